@@ -12,6 +12,12 @@ protocol FileImportControllerDelegate : AnyObject {
     func didSelect(tracks: [MP42Track], metadata: MP42Metadata?)
 }
 
+/// Raw H.264 and HEVC streams can lack timing info, their frame rate is chosen at import
+private func isRawVideo(_ url: URL?) -> Bool {
+    guard let pathExtension = url?.pathExtension.lowercased() else { return false }
+    return ["264", "h264", "265", "h265", "hevc"].contains(pathExtension)
+}
+
 final class FileImportController: ViewController, NSTableViewDataSource, NSTableViewDelegate, NSUserInterfaceValidations {
 
     private enum ItemType {
@@ -64,8 +70,7 @@ final class FileImportController: ViewController, NSTableViewDataSource, NSTable
                 }
 
             case is MP42VideoTrack:
-                if track.url?.pathExtension.caseInsensitiveCompare("264") == ComparisonResult.orderedSame ||
-                    track.url?.pathExtension.caseInsensitiveCompare("h264") == ComparisonResult.orderedSame  {
+                if isRawVideo(track.url) {
                     let formats = ["23.976", "24", "25", "29.97", "30", "50", "59.96", "60"]
                     let tags = [2398, 24, 25, 2997, 30, 50, 5994, 60]
                     
@@ -378,8 +383,7 @@ final class FileImportController: ViewController, NSTableViewDataSource, NSTable
 
             case let track as MP42VideoTrack:
 
-                if track.url?.pathExtension.caseInsensitiveCompare("264") == ComparisonResult.orderedSame ||
-                    track.url?.pathExtension.caseInsensitiveCompare("h264") == ComparisonResult.orderedSame  {
+                if isRawVideo(track.url) {
 
                     track.conversionSettings = MP42RawConversionSettings.rawConversion(withFrameRate: trackSettings.selectedActionTag)
                 }
@@ -0,0 +1,142 @@
+//
+//  annexb_scan.cpp
+//  MP42Foundation Benchmarks
+//
+//  Times the Annex B start code search and NAL reader of the raw H.264
+//  importer against the per-NAL code they replaced.
+//
+//  usage: annexb_scan [megabytes]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "annexb.h"
+
+#include "h264_find.inc"
+
+#include "h264_reference.h"
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* random payloads without 00 00 01, a start code every nalSize bytes or so */
+static uint8_t *makeStream(size_t size, size_t nalSize)
+{
+    uint8_t *data = (uint8_t *)malloc(size + 64);
+    uint64_t state = 88172645463325252ULL;
+
+    for (size_t i = 0; i < size + 64; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        data[i] = (uint8_t)(state >> 24);
+        if (data[i] == 1) {
+            data[i] = 2;
+        }
+    }
+
+    for (size_t i = 0; i + 4 < size; i += nalSize / 2 + (data[i + 4] * 257 + data[i + 5]) % nalSize) {
+        data[i] = 0;
+        data[i + 1] = 0;
+        data[i + 2] = 1;
+        data[i + 3] = 0x65;
+    }
+
+    return data;
+}
+
+static void benchmarkSearch(const uint8_t *data, size_t size)
+{
+    double start;
+    size_t previousCount = 0, currentCount = 0;
+    uint32_t offset;
+
+    start = now();
+    for (size_t pos = 0; (offset = reference::h264_find_next_start_code(data + pos, (uint32_t)(size - pos))); pos += offset) {
+        previousCount++;
+    }
+    double previous = now() - start;
+
+    start = now();
+    for (size_t pos = 0; (offset = h264_find_next_start_code(data + pos, (uint32_t)(size - pos))); pos += offset) {
+        currentCount++;
+    }
+    double current = now() - start;
+
+    size_t offsets[4096], found, total = 0, pos = 0;
+    start = now();
+    while ((found = annexb_find_start_codes(data + pos, size - pos, offsets, 4096))) {
+        total += found;
+        pos += offsets[found - 1] + 3;
+    }
+    double batched = now() - start;
+
+    printf("start code search, %zu start codes%s\n", total,
+           previousCount == currentCount ? "" : ", the searches disagree");
+    printf("  byte by byte              %8.0f MB/s\n", size / previous / 1e6);
+    printf("  h264_find_next_start_code %8.0f MB/s\n", size / current / 1e6);
+    printf("  annexb_find_start_codes   %8.0f MB/s\n", size / batched / 1e6);
+}
+
+static void benchmarkReader(const uint8_t *data, size_t size)
+{
+    FILE *file = tmpfile();
+    fwrite(data, 1, size, file);
+    fflush(file);
+
+    double start = now();
+    size_t count = 0;
+    reference::nal_reader_t nal;
+    memset(&nal, 0, sizeof(nal));
+    rewind(file);
+    nal.ifile = file;
+    while (reference::LoadNal(&nal) && nal.buffer_on) {
+        count++;
+    }
+    free(nal.buffer);
+    double previous = now() - start;
+
+    annexb_reader_t reader;
+    start = now();
+    size_t nals = 0;
+    rewind(file);
+    annexb_reader_open(&reader, file);
+    while (annexb_reader_next(&reader)) {
+        nals++;
+    }
+    annexb_reader_close(&reader);
+    double current = now() - start;
+
+    printf("NAL reader, %.0f MB with %zu NALs%s\n", size / 1e6, nals,
+           count == nals ? "" : ", the readers disagree");
+    printf("  LoadNal                   %8.3f s\n", previous);
+    printf("  annexb_reader_next        %8.3f s\n", current);
+
+    fclose(file);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+
+    // slices of a high bitrate stream
+    uint8_t *data = makeStream(size, 40000);
+    benchmarkSearch(data, size);
+    free(data);
+
+    // intra frames of a few MB, the old reader rescans them as they grow
+    size = size < (64 << 20) ? size : (64 << 20);
+    data = makeStream(size, 2 << 20);
+    benchmarkReader(data, size);
+    free(data);
+
+    return 0;
+}
@@ -0,0 +1,440 @@
+//
+//  bit_reader.cpp
+//  MP42Foundation Benchmarks
+//
+//  Times the bit reader of muxer/bitstream.h against the mpeg4ip readers
+//  the header parsers used before, kept in bitreader_reference.h: fixed
+//  width fields like the ones of the ADTS, AC-3 and sequence headers,
+//  and the Exp-Golomb codes of the H.264 parameter sets and slices.
+//  Then the header parsers built on them, the previous ones and the
+//  current ones, on the fixtures written by make_fixtures.py.
+//
+//  usage: bit_reader [megabytes] [fixtures]
+//
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// the Core Foundation and MacTypes names the parsers use
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef uint32_t FourCharCode;
+typedef int32_t ComponentResult;
+typedef const struct __CFData *CFDataRef;
+
+#define MIN(a, b)  (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)  (((a) > (b)) ? (a) : (b))
+
+#include "bitstream.h"
+#include "annexb.h"
+
+// the parsers of MP42FormatUtilites.mm and the sequence parameter set
+// parsers of the importers, extracted by the Makefile
+#include "format_types.inc"
+#include "format_parsers.inc"
+
+namespace h264 {
+#include "h264_sps.inc"
+}
+
+namespace hevc {
+#include "hevc_sps.inc"
+}
+
+#include "bitreader_reference.h"
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t state = 88172645463325252ULL;
+
+static uint32_t next(void)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (uint32_t)(state >> 16);
+}
+
+// field widths that repeat, from a single bit flag to a 24 bit size
+static const unsigned widths[16] = { 1, 3, 2, 8, 1, 1, 13, 4, 16, 2, 5, 1, 24, 7, 3, 11 };
+
+static void benchmarkFields(uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)next();
+    }
+
+    // stops a field short of the end, the old readers throw past it
+    size_t count = (size * 8 - 64) / 102 * 16;
+    uint64_t previousSum = 0, memorySum = 0, currentSum = 0;
+    double start;
+
+    start = now();
+    reference::CBitstream previous(data, (uint32_t)(size * 8));
+    for (size_t i = 0; i < count; i++) {
+        previousSum += previous.GetBits(widths[i % 16]);
+    }
+    double previousTime = now() - start;
+
+    start = now();
+    reference::CMemoryBitstream memory;
+    memory.SetBytes(data, (uint32_t)size);
+    for (size_t i = 0; i < count; i++) {
+        memorySum += memory.GetBits(widths[i % 16]);
+    }
+    double memoryTime = now() - start;
+
+    start = now();
+    bs_reader_t reader;
+    bs_reader_init(&reader, data, size);
+    for (size_t i = 0; i < count; i++) {
+        currentSum += bs_read(&reader, widths[i % 16]);
+    }
+    double currentTime = now() - start;
+
+    printf("fixed width fields, %zu reads%s\n", count,
+           previousSum == currentSum && memorySum == currentSum && !bs_error(&reader) ? "" : ", the readers disagree");
+    printf("  CBitstream::GetBits           %8.1f M/s\n", count / previousTime / 1e6);
+    printf("  CMemoryBitstream::GetBits     %8.1f M/s\n", count / memoryTime / 1e6);
+    printf("  bs_read                       %8.1f M/s\n", count / currentTime / 1e6);
+}
+
+// mostly small values, like the ones of the slice headers, some larger ones
+static uint32_t randomCode(void)
+{
+    uint32_t r = next();
+    switch (r % 8) {
+        case 0:  return (r >> 8) % 65536;
+        case 1:
+        case 2:  return (r >> 8) % 256;
+        default: return (r >> 8) % 8;
+    }
+}
+
+static size_t writeCodes(uint8_t *data, size_t size)
+{
+    bs_writer_t writer;
+    size_t count = 0;
+
+    memset(data, 0, size);
+    bs_writer_init(&writer, data, size);
+
+    // the longest code is 33 bits, leave room for it
+    while (bs_writer_tell(&writer) + 40 < (size - 8) * 8) {
+        uint32_t value = randomCode() + 1;
+        unsigned bits = 32 - __builtin_clz(value);
+        bs_write(&writer, 0, bits - 1);
+        bs_write(&writer, value, bits);
+        count++;
+    }
+    bs_writer_flush(&writer);
+
+    return count;
+}
+
+static void benchmarkExpGolomb(uint8_t *data, size_t size)
+{
+    size_t count = writeCodes(data, size);
+    uint64_t previousSum = 0, currentSum = 0;
+    int64_t previousSigned = 0, currentSigned = 0;
+    double start;
+
+    start = now();
+    reference::CBitstream previous(data, (uint32_t)(size * 8));
+    for (size_t i = 0; i < count; i++) {
+        previousSum += reference::h264_ue(&previous);
+    }
+    double previousTime = now() - start;
+
+    start = now();
+    bs_reader_t reader;
+    bs_reader_init(&reader, data, size);
+    for (size_t i = 0; i < count; i++) {
+        currentSum += bs_read_ue(&reader);
+    }
+    double currentTime = now() - start;
+
+    // the same codes as signed values
+    previous.init(data, (uint32_t)(size * 8));
+    for (size_t i = 0; i < count; i++) {
+        previousSigned += reference::h264_se(&previous);
+    }
+    bs_reader_init(&reader, data, size);
+    for (size_t i = 0; i < count; i++) {
+        currentSigned += bs_read_se(&reader);
+    }
+
+    printf("Exp-Golomb codes, %zu codes%s\n", count,
+           previousSum == currentSum && previousSigned == currentSigned && !bs_error(&reader) ? "" : ", the readers disagree");
+    printf("  h264_ue                       %8.1f M/s\n", count / previousTime / 1e6);
+    printf("  bs_read_ue                    %8.1f M/s\n", count / currentTime / 1e6);
+}
+
+typedef struct fixture_t {
+    char name[64];
+    uint8_t *data;
+    uint32_t size;
+} fixture_t;
+
+#define FIXTURES_MAX 16
+
+static size_t loadFixtures(const char *directory, const char *extension, fixture_t *fixtures)
+{
+    DIR *dir = opendir(directory);
+    struct dirent *entry;
+    size_t count = 0;
+
+    if (dir == NULL) {
+        return 0;
+    }
+
+    while ((entry = readdir(dir)) != NULL && count < FIXTURES_MAX) {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (dot == NULL || strcmp(dot + 1, extension) || strlen(entry->d_name) >= sizeof(fixtures->name)) {
+            continue;
+        }
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+            continue;
+        }
+
+        fixture_t *fixture = &fixtures[count];
+        fseek(file, 0, SEEK_END);
+        fixture->size = (uint32_t)ftell(file);
+        fseek(file, 0, SEEK_SET);
+        fixture->data = (uint8_t *)malloc(fixture->size);
+        if (fread(fixture->data, 1, fixture->size, file) == fixture->size) {
+            strcpy(fixture->name, entry->d_name);
+            count++;
+        } else {
+            free(fixture->data);
+        }
+        fclose(file);
+    }
+    closedir(dir);
+
+    return count;
+}
+
+// every parser runs this many times on the fixtures of its kind, the
+// best of the runs is kept
+static const size_t parses = 1 << 16;
+static const int runs = 5;
+
+template <typename Result, typename Parse>
+static double timeParser(const fixture_t *fixtures, size_t count, uint32_t divisor, Result *results, Parse parse)
+{
+    size_t passes = parses / count;
+    double best = 0;
+
+    for (int run = 0; run < runs; run++) {
+        double start = now();
+        for (size_t pass = 0; pass < passes; pass++) {
+            for (size_t i = 0; i < count; i++) {
+                memset(&results[i], 0, sizeof(Result));
+                parse(fixtures[i].data, fixtures[i].size / divisor, &results[i]);
+            }
+        }
+        best = MAX(best, passes * count / (now() - start) / 1e6);
+    }
+
+    return best;
+}
+
+// Runs both parsers on every fixture, the results must be the same, then
+// times them. The results are compared as bytes, the parsers fill
+// results cleared before. Then times them again on the fixtures cut in
+// half, where the previous parsers throw, their results differ there.
+template <typename Result, typename Previous, typename Current>
+static bool benchmarkParser(const char *title, const char *directory, const char *extension,
+                            const char *previousName, Previous previous,
+                            const char *currentName, Current current)
+{
+    fixture_t fixtures[FIXTURES_MAX];
+    size_t count = loadFixtures(directory, extension, fixtures);
+    bool same = true;
+
+    if (count == 0) {
+        printf("%s, no .%s fixtures in %s\n", title, extension, directory);
+        return false;
+    }
+
+    Result *expected = (Result *)calloc(count, sizeof(Result));
+    Result *results = (Result *)calloc(count, sizeof(Result));
+
+    for (size_t i = 0; i < count; i++) {
+        previous(fixtures[i].data, fixtures[i].size, &expected[i]);
+        current(fixtures[i].data, fixtures[i].size, &results[i]);
+        if (memcmp(&expected[i], &results[i], sizeof(Result))) {
+            printf("%s: the parsers disagree\n", fixtures[i].name);
+            same = false;
+        }
+    }
+
+    double previousRate = timeParser(fixtures, count, 1, results, previous);
+    same = same && !memcmp(expected, results, count * sizeof(Result));
+    double currentRate = timeParser(fixtures, count, 1, results, current);
+    same = same && !memcmp(expected, results, count * sizeof(Result));
+
+    double previousCutRate = timeParser(fixtures, count, 2, results, previous);
+    double currentCutRate = timeParser(fixtures, count, 2, results, current);
+
+    printf("%s, %zu fixtures%s\n", title, count, same ? "" : ", the parsers disagree");
+    printf("  %-30s %8.2f M/s\n", previousName, previousRate);
+    printf("  %-30s %8.2f M/s %6.1fx\n", currentName, currentRate, currentRate / previousRate);
+    printf("  cut in half, previous          %8.2f M/s\n", previousCutRate);
+    printf("  cut in half, current           %8.2f M/s %6.1fx\n", currentCutRate, currentCutRate / previousCutRate);
+
+    for (size_t i = 0; i < count; i++) {
+        free(fixtures[i].data);
+    }
+    free(expected);
+    free(results);
+
+    return same;
+}
+
+typedef struct eac3_result_t {
+    int result;
+    struct eac3_info info;
+} eac3_result_t;
+
+typedef struct esds_result_t {
+    int result;
+    MPEG4AudioConfig config;
+} esds_result_t;
+
+typedef struct hvcc_result_t {
+    int result;
+    bool complete;
+} hvcc_result_t;
+
+typedef struct h264_sps_result_t {
+    int result;
+    h264::h264_decode_t dec;
+} h264_sps_result_t;
+
+typedef struct hevc_sps_result_t {
+    int result;
+    uint32_t sps_id;
+    hevc::hevc_sps_t sps;
+} hevc_sps_result_t;
+
+static bool benchmarkParsers(const char *directory)
+{
+    bool same = true;
+
+    // a context of the importer, cleared for every frame so that the
+    // dependent substreams are parsed every time. The previous
+    // analyze_EAC3 throws on a frame shorter than its header.
+    same &= benchmarkParser<eac3_result_t>("AC-3 frames", directory, "ac3",
+        "reference::analyze_EAC3", [](const uint8_t *data, uint32_t size, eac3_result_t *r) {
+            void *context = &r->info;
+            try {
+                r->result = reference::analyze_EAC3(&context, (uint8_t *)data, size);
+            } catch (...) {
+                r->result = -1;
+            }
+        },
+        "analyze_EAC3", [](const uint8_t *data, uint32_t size, eac3_result_t *r) {
+            void *context = &r->info;
+            r->result = analyze_EAC3(&context, (uint8_t *)data, size);
+        });
+    same &= benchmarkParser<eac3_result_t>("E-AC-3 frames", directory, "ec3",
+        "reference::analyze_EAC3", [](const uint8_t *data, uint32_t size, eac3_result_t *r) {
+            void *context = &r->info;
+            try {
+                r->result = reference::analyze_EAC3(&context, (uint8_t *)data, size);
+            } catch (...) {
+                r->result = -1;
+            }
+        },
+        "analyze_EAC3", [](const uint8_t *data, uint32_t size, eac3_result_t *r) {
+            void *context = &r->info;
+            r->result = analyze_EAC3(&context, (uint8_t *)data, size);
+        });
+
+    same &= benchmarkParser<esds_result_t>("AudioSpecificConfigs", directory, "esds",
+        "reference::analyze_ESDS", [](const uint8_t *data, uint32_t size, esds_result_t *r) {
+            r->result = reference::analyze_ESDS(&r->config, data, size);
+        },
+        "analyze_ESDS", [](const uint8_t *data, uint32_t size, esds_result_t *r) {
+            r->result = analyze_ESDS(&r->config, data, size);
+        });
+
+    same &= benchmarkParser<int>("avcC boxes", directory, "avcC",
+        "reference::analyze_AVC", [](const uint8_t *data, uint32_t size, int *r) {
+            *r = reference::analyze_AVC(data, size);
+        },
+        "analyze_AVC", [](const uint8_t *data, uint32_t size, int *r) {
+            *r = analyze_AVC(data, size);
+        });
+
+    same &= benchmarkParser<hvcc_result_t>("hvcC boxes", directory, "hvcC",
+        "reference::parse_HEVC", [](const uint8_t *data, uint32_t size, hvcc_result_t *r) {
+            r->result = reference::parse_HEVC(data, size, &r->complete, false);
+        },
+        "parse_HEVC", [](const uint8_t *data, uint32_t size, hvcc_result_t *r) {
+            r->result = parse_HEVC(data, size, &r->complete, false);
+        });
+
+    // the H.264 fixtures start with a start code, the HEVC ones with the NAL header
+    same &= benchmarkParser<h264_sps_result_t>("H.264 sequence parameter sets", directory, "264",
+        "reference::h264_read_seq_info", [](const uint8_t *data, uint32_t size, h264_sps_result_t *r) {
+            r->result = reference::h264::h264_read_seq_info(data, size, &r->dec);
+        },
+        "h264_read_seq_info", [](const uint8_t *data, uint32_t size, h264_sps_result_t *r) {
+            r->result = h264::h264_read_seq_info(data, size, &r->dec);
+        });
+    same &= benchmarkParser<hevc_sps_result_t>("HEVC sequence parameter sets", directory, "265",
+        "reference::hevc_read_seq_info", [](const uint8_t *data, uint32_t size, hevc_sps_result_t *r) {
+            r->result = reference::hevc::hevc_read_seq_info(data, size, &r->sps, &r->sps_id);
+        },
+        "hevc_read_seq_info", [](const uint8_t *data, uint32_t size, hevc_sps_result_t *r) {
+            r->result = hevc::hevc_read_seq_info(data, size, &r->sps, &r->sps_id);
+        });
+
+    return same;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+    const char *fixtures = argc > 2 ? argv[2] : "fixtures";
+
+    // CBitstream counts bits in 32 bits
+    if (size == 0 || size > (256 << 20)) {
+        fprintf(stderr, "usage: %s [megabytes], up to 256, [fixtures]\n", argv[0]);
+        return 2;
+    }
+
+    uint8_t *data = (uint8_t *)malloc(size);
+
+    benchmarkFields(data, size);
+    benchmarkExpGolomb(data, size);
+
+    free(data);
+
+    return benchmarkParsers(fixtures) ? 0 : 1;
+}
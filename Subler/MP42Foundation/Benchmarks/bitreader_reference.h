@@ -0,0 +1,1762 @@
+/*
+ * The contents of this file are subject to the Mozilla Public
+ * License Version 1.1 (the "License"); you may not use this file
+ * except in compliance with the License. You may obtain a copy of
+ * the License at http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS
+ * IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * rights and limitations under the License.
+ * 
+ * The Original Code is MPEG4IP.
+ * 
+ * The Initial Developer of the Original Code is Cisco Systems Inc.
+ * Portions created by Cisco Systems Inc. are
+ * Copyright (C) Cisco Systems Inc. 2001-2005.  All Rights Reserved.
+ * 
+ * Contributor(s): 
+ *              Bill May        wmay@cisco.com
+ */
+
+/*
+ * The bit readers of mpeg4ip that MP42Foundation used before
+ * muxer/bitstream.h, and the header parsers built on them, kept for the
+ * bit reader benchmark: the E-AC-3, ESDS, avcC and hvcC parsers of
+ * MP42FormatUtilites.mm and the sequence parameter set parsers of the
+ * H.264 and HEVC importers. The code is unchanged, except for the mbs.cpp
+ * members made inline and the extern "C" of the H.264 VUI parsers.
+ *
+ * The parsers use the types and tables of the current sources, include
+ * this file after them, with the ones of the importers in the h264 and
+ * hevc namespaces.
+ */
+
+#ifndef BITREADER_REFERENCE_H
+#define BITREADER_REFERENCE_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace reference {
+
+#ifndef MIN
+#define MIN(a, b)  (((a) < (b)) ? (a) : (b))
+#endif
+
+typedef enum BitstreamErr_t {
+  BITSTREAM_TOO_MANY_BITS, 
+  BITSTREAM_PAST_END,
+} BitstreamErr_t;
+
+class CBitstream {
+ public:
+  CBitstream(void) { m_verbose = 0;};
+  CBitstream(const uint8_t *buffer, uint32_t bit_len) {
+    m_verbose = 0;
+    init(buffer, bit_len);
+  };
+  ~CBitstream (void) {};
+  void init(const uint8_t *buffer, uint32_t bit_len) {
+    m_chDecBuffer = buffer;
+    m_chDecBufferSize = bit_len;
+    m_bBookmarkOn = 0;
+    m_uNumOfBitsInBuffer = 0;
+
+  };
+  void init(const char *buffer, uint32_t bit_len) {
+    init((const uint8_t *)buffer, (uint32_t)bit_len);
+  };
+  void init(const char *buffer, int bit_len) {
+    init((const uint8_t *)buffer, (uint32_t)bit_len);
+  };
+  void init(const uint8_t *buffer, int bit_len) {
+    init(buffer, (uint32_t)bit_len);
+  };
+  void init(const char *buffer, unsigned short bit_len) {
+    init((const uint8_t *)buffer, (uint32_t)bit_len);
+  };
+  void init(const uint8_t *buffer, unsigned short bit_len) {
+    init(buffer, (uint32_t)bit_len);
+  };
+  uint32_t GetBits(uint32_t numBits) {
+    uint32_t retData;
+    static const uint32_t msk[33] = {
+      0x00000000, 0x00000001, 0x00000003, 0x00000007,
+      0x0000000f, 0x0000001f, 0x0000003f, 0x0000007f,
+      0x000000ff, 0x000001ff, 0x000003ff, 0x000007ff,
+      0x00000fff, 0x00001fff, 0x00003fff, 0x00007fff,
+      0x0000ffff, 0x0001ffff, 0x0003ffff, 0x0007ffff,
+      0x000fffff, 0x001fffff, 0x003fffff, 0x007fffff,
+      0x00ffffff, 0x01ffffff, 0x03ffffff, 0x07ffffff,
+      0x0fffffff, 0x1fffffff, 0x3fffffff, 0x7fffffff,
+      0xffffffff
+    };
+
+    if (numBits > 32) {
+      throw BITSTREAM_TOO_MANY_BITS;
+    }
+  
+    if (numBits == 0) {
+      return 0;
+    }
+	
+    if (m_uNumOfBitsInBuffer >= numBits) {  // don't need to read from FILE
+      m_uNumOfBitsInBuffer -= numBits;
+      retData = m_chDecData >> m_uNumOfBitsInBuffer;
+      // wmay - this gets done below...retData &= msk[numBits];
+    } else {
+      uint32_t nbits;
+      nbits = numBits - m_uNumOfBitsInBuffer;
+      if (nbits == 32)
+	retData = 0;
+      else
+	retData = m_chDecData << nbits;
+      switch ((nbits - 1) / 8) {
+      case 3:
+	nbits -= 8;
+	if (m_chDecBufferSize < 8) throw BITSTREAM_PAST_END;
+	retData |= *m_chDecBuffer++ << nbits;
+	m_chDecBufferSize -= 8;
+	// fall through
+      case 2:
+	nbits -= 8;
+	if (m_chDecBufferSize < 8) throw BITSTREAM_PAST_END;
+	retData |= *m_chDecBuffer++ << nbits;
+	m_chDecBufferSize -= 8;
+      case 1:
+	nbits -= 8;
+	if (m_chDecBufferSize < 8) throw BITSTREAM_PAST_END;
+	retData |= *m_chDecBuffer++ << nbits;
+	m_chDecBufferSize -= 8;
+      case 0:
+	break;
+      }
+      if (m_chDecBufferSize < nbits) {
+	throw BITSTREAM_PAST_END;
+      }
+      m_chDecData = *m_chDecBuffer++;
+      m_uNumOfBitsInBuffer = MIN(8, m_chDecBufferSize) - nbits;
+      m_chDecBufferSize -= MIN(8, m_chDecBufferSize);
+      retData |= (m_chDecData >> m_uNumOfBitsInBuffer) & msk[nbits];
+    }
+    if (m_verbose)
+      printf("bits %d value %x\n", numBits, retData&msk[numBits]);
+    return (retData & msk[numBits]);
+  };
+  int getbits(uint32_t bits, uint32_t *retvalue) {
+    try {
+      *retvalue = GetBits(bits);
+    } catch (...) {
+      return -1;
+    }
+    return 0;
+  }
+  int peekbits(uint32_t bits, uint32_t *retvalue) {
+    int ret;
+    bookmark(1);
+    ret = getbits(bits, retvalue);
+    bookmark(0);
+    return (ret);
+  }
+  uint32_t PeekBits(uint32_t bits) {
+    uint32_t ret;
+    bookmark(1);
+    ret = GetBits(bits);
+    bookmark(0);
+    return ret;
+  }
+  void bookmark(int bSet) {
+    if (m_verbose) {
+      printf("bookmark\n");
+    }
+    if (bSet) {
+      m_uNumOfBitsInBuffer_bookmark = m_uNumOfBitsInBuffer;
+      m_chDecBuffer_bookmark = m_chDecBuffer;
+      m_chDecBufferSize_bookmark = m_chDecBufferSize;
+      m_bBookmarkOn = 1;
+      m_chDecData_bookmark = m_chDecData;
+    } else {
+      m_uNumOfBitsInBuffer = m_uNumOfBitsInBuffer_bookmark;
+      m_chDecBuffer = m_chDecBuffer_bookmark;
+      m_chDecBufferSize = m_chDecBufferSize_bookmark;
+      m_chDecData = m_chDecData_bookmark;
+      m_bBookmarkOn = 0;
+    }
+  };
+  int bits_remain (void) {
+    return m_chDecBufferSize + m_uNumOfBitsInBuffer;
+  };
+  int byte_align(void) {
+    int temp = 0;
+    if (m_uNumOfBitsInBuffer != 0) {
+      temp = GetBits(m_uNumOfBitsInBuffer);
+#if 0
+      temp = m_uNumOfBitsInBuffer;
+      m_uNumOfBitsInBuffer = 0;
+      m_chDecBuffer++;
+      m_chDecBufferSize -= MIN(m_chDecBufferSize,8);
+#endif
+    } else {
+      // if we are byte aligned, check for 0x7f value - this will indicate
+      // we need to skip those bits
+      uint8_t readval;
+      readval = PeekBits(8);
+      if (readval == 0x7f) {
+	 GetBits(8);
+      }
+    }
+    return (temp);
+  };
+  void set_verbose(int verbose) { m_verbose = verbose; };
+ private:
+  uint32_t m_uNumOfBitsInBuffer;
+  const uint8_t *m_chDecBuffer;
+  uint8_t m_chDecData, m_chDecData_bookmark;
+  uint32_t m_chDecBufferSize;
+  int m_bBookmarkOn;
+  uint32_t m_uNumOfBitsInBuffer_bookmark;
+  const uint8_t *m_chDecBuffer_bookmark;
+  uint32_t m_chDecBufferSize_bookmark;
+  int m_verbose;
+};
+
+class CMemoryBitstream {
+public:
+	CMemoryBitstream() {
+		m_pBuf = NULL;
+		m_bitPos = 0;
+		m_numBits = 0;
+		m_alloced = false;
+	}
+	~CMemoryBitstream(void) {
+	  if (m_alloced) free(m_pBuf);
+	}
+	void AllocBytes(u_int32_t numBytes);
+
+	void SetBytes(u_int8_t* pBytes, u_int32_t numBytes);
+
+	void PutBytes(u_int8_t* pBytes, u_int32_t numBytes);
+
+	void PutBits(u_int32_t bits, u_int32_t numBits);
+
+    u_int32_t PeakBits(u_int32_t numBits);
+    u_int32_t GetBits(u_int32_t numBits);
+
+	void SkipBytes(u_int32_t numBytes) {
+		SkipBits(numBytes << 3);
+	}
+
+	void SkipBits(u_int32_t numBits) {
+		SetBitPosition(GetBitPosition() + numBits);
+	}
+
+	u_int32_t GetBitPosition() {
+		return m_bitPos;
+	}
+
+	void SetBitPosition(u_int32_t bitPos) {
+		if (bitPos > m_numBits) {
+			throw EIO;
+		}
+		m_bitPos = bitPos;
+	}
+
+	u_int8_t* GetBuffer() {
+	  m_alloced = false;
+		return m_pBuf;
+	}
+
+	u_int32_t GetNumberOfBytes() {
+		return (GetNumberOfBits() + 7) / 8;
+	}
+
+	u_int32_t GetNumberOfBits() {
+		return m_numBits;
+	}
+
+    u_int32_t GetRemainingBits() {
+        return m_numBits - m_bitPos;
+    }
+
+
+protected:
+	u_int8_t*	m_pBuf;
+	u_int32_t	m_bitPos;
+	u_int32_t	m_numBits;
+	bool m_alloced;
+};
+
+inline void CMemoryBitstream::AllocBytes(u_int32_t numBytes) 
+{
+	m_pBuf = (u_int8_t*)calloc(numBytes, 1);
+	if (!m_pBuf) {
+		throw ENOMEM;
+	}
+	m_alloced = true;
+	m_bitPos = 0;
+	m_numBits = numBytes << 3;
+}
+
+inline void CMemoryBitstream::SetBytes(u_int8_t* pBytes, u_int32_t numBytes) 
+{
+	m_pBuf = pBytes;
+	m_bitPos = 0;
+	m_numBits = numBytes << 3;
+}
+
+inline void CMemoryBitstream::PutBytes(u_int8_t* pBytes, u_int32_t numBytes)
+{
+	u_int32_t numBits = numBytes << 3;
+
+	if (numBits + m_bitPos > m_numBits) {
+		throw EIO;
+	}
+
+	if ((m_bitPos & 7) == 0) {
+		memcpy(&m_pBuf[m_bitPos >> 3], pBytes, numBytes);
+		m_bitPos += numBits;
+	} else {
+		for (u_int32_t i = 0; i < numBytes; i++) {
+			PutBits(pBytes[i], 8);
+		}
+	}
+}
+
+inline void CMemoryBitstream::PutBits(u_int32_t bits, u_int32_t numBits)
+{
+	if (numBits + m_bitPos > m_numBits) {
+		throw EIO;
+	}
+	if (numBits > 32) {
+		throw EIO;
+	}
+
+	for (int8_t i = numBits - 1; i >= 0; i--) {
+		m_pBuf[m_bitPos >> 3] |= ((bits >> i) & 1) << (7 - (m_bitPos & 7));
+		m_bitPos++;
+	}
+}
+
+inline u_int32_t CMemoryBitstream::PeakBits(u_int32_t numBits)
+{
+    if (numBits + m_bitPos > m_numBits) {
+        throw EIO;
+    }
+    if (numBits > 32) {
+        throw EIO;
+    }
+
+    u_int32_t bits = 0;
+    u_int32_t bitPos = m_bitPos;
+
+    for (u_int8_t i = 0; i < numBits; i++) {
+        bits <<= 1;
+        bits |= (m_pBuf[bitPos >> 3] >> (7 - (bitPos & 7))) & 1;
+        bitPos++;
+    }
+    
+    return bits;
+}
+
+inline u_int32_t CMemoryBitstream::GetBits(u_int32_t numBits)
+{
+	if (numBits + m_bitPos > m_numBits) {
+		throw EIO;
+	}
+	if (numBits > 32) {
+		throw EIO;
+	}
+
+	u_int32_t bits = 0;
+
+	for (u_int8_t i = 0; i < numBits; i++) {
+		bits <<= 1;
+		bits |= (m_pBuf[m_bitPos >> 3] >> (7 - (m_bitPos & 7))) & 1;
+		m_bitPos++;
+	}
+
+	return bits;
+}
+
+static uint8_t exp_golomb_bits[256] = {
+    8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4, 3, 
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+    0, 
+};
+
+static uint32_t h264_ue (CBitstream *bs)
+{
+    uint32_t bits, read;
+    int bits_left;
+    uint8_t coded;
+    bool done = false;
+    uint32_t temp;
+    bits = 0;
+    // we want to read 8 bits at a time - if we don't have 8 bits, 
+    // read what's left, and shift.  The exp_golomb_bits calc remains the
+    // same.
+    while (done == false) {
+        bits_left = bs->bits_remain();
+        if (bits_left < 8) {
+            read = bs->PeekBits(bits_left) << (8 - bits_left);
+            done = true;
+        } else {
+            read = bs->PeekBits(8);
+            if (read == 0) {
+                (void)bs->GetBits(8);
+                bits += 8;
+            } else {
+                done = true;
+            }
+        }
+    }
+    coded = exp_golomb_bits[read];
+    temp = bs->GetBits(coded);
+    bits += coded;
+    
+    //  printf("ue - bits %d\n", bits);
+    return bs->GetBits(bits + 1) - 1;
+}
+
+static int32_t h264_se (CBitstream *bs) 
+{
+    uint32_t ret;
+    ret = h264_ue(bs);
+    if ((ret & 0x1) == 0) {
+        ret >>= 1;
+        int32_t temp = 0 - ret;
+        return temp;
+    } 
+    return (ret + 1) >> 1;
+}
+
+void analyze_eac3_addbsi(CMemoryBitstream &b, AC3HeaderInfo *phdr);
+
+static int ac3_parse_header(CMemoryBitstream &b, AC3HeaderInfo **phdr)
+{
+    int frame_size_code;
+    AC3HeaderInfo *hdr;
+
+    if (!*phdr) {
+        *phdr = (AC3HeaderInfo *)malloc(sizeof(AC3HeaderInfo));
+    }
+    if (!*phdr) {
+        return 1;
+    }
+    hdr = *phdr;
+
+    memset(hdr, 0, sizeof(*hdr));
+
+    hdr->sync_word = b.GetBits(16);
+    if (hdr->sync_word != 0x0B77) {
+        return AAC_AC3_PARSE_ERROR_SYNC;
+    }
+
+    /* read ahead to bsid to distinguish between AC-3 and E-AC-3 */
+    b.SkipBits(24);
+	hdr->bitstream_id = b.GetBits(5);			// bsid
+	b.SetBitPosition(b.GetBitPosition() - 29);	// back to start of bsi
+    if (hdr->bitstream_id > 16) {
+        return AAC_AC3_PARSE_ERROR_BSID;
+    }
+
+    hdr->num_blocks = 6;
+
+    /* set default mix levels */
+    hdr->center_mix_level   = 5;  // -4.5dB
+    hdr->surround_mix_level = 6;  // -6.0dB
+
+    /* set default dolby surround mode */
+    hdr->dolby_surround_mode = AC3_DSURMOD_NOTINDICATED;
+
+    if (hdr->bitstream_id <= 10) {
+        /* Normal AC-3 */
+        hdr->crc1 = b.GetBits(16);
+        hdr->sr_code = b.GetBits(2);
+        if (hdr->sr_code == 3) {
+            return AAC_AC3_PARSE_ERROR_SAMPLE_RATE;
+        }
+
+        frame_size_code = b.GetBits(6);
+        if (frame_size_code > 37) {
+            return AAC_AC3_PARSE_ERROR_FRAME_SIZE;
+        }
+        //end syncinfo()
+        //bsi()
+        b.SkipBits(5); // skip bsid, already got it
+
+        hdr->bitstream_mode = b.GetBits(3);
+        hdr->channel_mode = b.GetBits(3);
+
+        if (hdr->channel_mode == AC3_CHMODE_STEREO) {
+            hdr->dolby_surround_mode = b.GetBits(2);
+        } else {
+            if((hdr->channel_mode & 1) && hdr->channel_mode != AC3_CHMODE_MONO) {
+                hdr->  center_mix_level =   center_levels[b.GetBits(2)];
+            }
+            if(hdr->channel_mode & 4) {
+                hdr->surround_mix_level = surround_levels[b.GetBits(2)];
+            }
+        }
+        hdr->lfe_on = b.GetBits(1);
+        //next unparsed field - dialnorm
+        hdr->sr_shift = MAX(hdr->bitstream_id, 8) - 8;
+        hdr->sample_rate = ff_ac3_sample_rate_tab[hdr->sr_code] >> hdr->sr_shift;
+        hdr->bit_rate = (ff_ac3_bitrate_tab[frame_size_code>>1] * 1000) >> hdr->sr_shift;
+        hdr->channels = ff_ac3_channels_tab[hdr->channel_mode] + hdr->lfe_on;
+        hdr->frame_size = ff_ac3_frame_size_tab[frame_size_code][hdr->sr_code] * 2;
+        hdr->frame_type = EAC3_FRAME_TYPE_AC3_CONVERT; //EAC3_FRAME_TYPE_INDEPENDENT;
+        hdr->substreamid = 0;
+    }
+    else {
+        /* Enhanced AC-3 */
+        hdr->crc1 = 0;
+        //bsi()
+        hdr->frame_type = b.GetBits(2);			//strmtyp
+        if (hdr->frame_type == EAC3_FRAME_TYPE_RESERVED) {
+            return AAC_AC3_PARSE_ERROR_FRAME_TYPE;
+        }
+
+        hdr->substreamid = b.GetBits(3);		//substreamid
+
+        hdr->frame_size = (b.GetBits(11) + 1) << 1;	//frmsiz
+        if (hdr->frame_size < AC3_HEADER_SIZE) {
+            return AAC_AC3_PARSE_ERROR_FRAME_SIZE;
+        }
+
+        hdr->sr_code = b.GetBits(2);			//fscod
+        if (hdr->sr_code == 3) {
+            int sr_code2 = b.GetBits(2);
+            if(sr_code2 == 3) {
+                return AAC_AC3_PARSE_ERROR_SAMPLE_RATE;
+            }
+            hdr->sample_rate = ff_ac3_sample_rate_tab[sr_code2] / 2;
+            hdr->sr_shift = 1;
+        } else {
+            hdr->num_blocks = eac3_blocks[b.GetBits(2)];	//numblkscod
+            hdr->sample_rate = ff_ac3_sample_rate_tab[hdr->sr_code];
+            hdr->sr_shift = 0;
+        }
+
+        hdr->channel_mode = b.GetBits(3);	//acmod
+        hdr->lfe_on = b.GetBits(1);			//lfeon
+		b.SkipBits(5);						//bsid already taken
+		//next unparsed field - dialnorm
+        hdr->bit_rate = 8LL * hdr->frame_size * hdr->sample_rate /
+        (hdr->num_blocks * 256);
+        hdr->channels = ff_ac3_channels_tab[hdr->channel_mode] + hdr->lfe_on;
+    }
+    hdr->channel_layout = avpriv_ac3_channel_layout_tab[hdr->channel_mode];
+    if (hdr->lfe_on) {
+        hdr->channel_layout |= AV_CH_LOW_FREQUENCY;
+    }
+	//location in stream - bsi().dialnorm(5), bitpos = 45
+    try {
+		analyze_eac3_addbsi(b, hdr);
+	}  catch (int e) {
+        return 1;
+    }
+
+	return 0;
+}
+
+void analyze_eac3_addbsi(CMemoryBitstream &b, AC3HeaderInfo *hdr)
+{
+	if(hdr->bitstream_id != 16)
+		return;
+	
+	//location in stream - bsi().dialnorm(5), savedbitpos = 63
+	uint32_t savedbitpos = b.GetBitPosition();	//calling routines assume bit pos in b after this fn returns!
+	
+	uint8_t addbsi[64] = {0};
+	
+#ifdef DEBUG_PARSER
+	printf("***parse_eac3_bsi start bit pos: %d remaining bits: %d\n", b.GetBitPosition(), b.GetRemainingBits());
+#endif
+	b.SetBitPosition(16);				//skip syncword
+	b.SkipBits(2+3+11+2+2+3+1+5+5);		//strmtyp,substreamid,frmsiz,fscod,numblkscod,acmod,lfeon,bsid,dialnorm
+	if(b.GetBits(1))					//compre ..................................................................................... 1
+		b.SkipBits(8);					//{compr} ......................................................................... 8
+	if(hdr->channel_mode == 0x0) 		/* if 1+1 mode (dual mono, so some items need a second value) */
+	{
+		b.SkipBits(5);					//dialnorm2 ............................................................................... 5
+		if(b.GetBits(1))				//compr2e ................................................................................. 1
+			b.SkipBits(8);				//{compr2} .................................................................... 8
+	}
+	if(hdr->frame_type == 0x1) 			/* if dependent stream */
+	{
+		if(b.GetBits(1))				//chanmape ................................................................................ 1
+			b.SkipBits(16);				//{chanmap} ................................................................. 16
+	}
+	/* mixing metadata */
+	if(b.GetBits(1))					//mixmdate ................................................................................... 1
+	{
+		if(hdr->channel_mode > 0x2) 	/* if more than 2 channels */
+			b.SkipBits(2);				//{dmixmod} ................................. 2
+		if((hdr->channel_mode & 0x1) && (hdr->channel_mode > 0x2)) /* if three front channels exist */
+			b.SkipBits(3+3);			//ltrtcmixlev,lorocmixlev .......................................................................... 3
+		if(hdr->channel_mode & 0x4) 	/* if a surround channel exists */
+			b.SkipBits(3+3);			//ltrtsurmixlev,lorosurmixlev
+		if(hdr->lfe_on) 				/* if the LFE channel exists */
+		{
+			if(b.GetBits(1)) 			//lfemixlevcode
+				b.SkipBits(5);			//lfemixlevcod
+		}
+		if(hdr->frame_type == 0x0) 		/* if independent stream */
+		{
+			if(b.GetBits(1)) 			//pgmscle
+				b.SkipBits(6);			//pgmscl
+			if(hdr->channel_mode == 0x0) /* if 1+1 mode (dual mono, so some items need a second value) */
+			{
+				if(b.GetBits(1)) 		//pgmscl2e
+					b.SkipBits(6);		//pgmscl2
+			}
+			if(b.GetBits(1)) 			//extpgmscle
+				b.SkipBits(6);			//extpgmscl
+			uint8_t mixdef = b.GetBits(2);
+			if(mixdef == 0x1) 			/* mixing option 2 */
+				b.SkipBits(1+1+3);		//premixcmpsel, drcsrc, premixcmpscl
+			else if(mixdef == 0x2) 		/* mixing option 3 */ {
+				b.SkipBits(12);
+			}
+			else if(mixdef == 0x3) 		/* mixing option 4 */
+			{
+				uint8_t mixdeflen = b.GetBits(5);	//mixdeflen
+				if (b.GetBits(1))		//mixdata2e
+				{
+					b.SkipBits(1+1+3);	//premixcmpsel,drcsrc,premixcmpscl
+					if(b.GetBits(1)) 	//extpgmlscle
+						b.SkipBits(4);	//extpgmlscl
+					if(b.GetBits(1)) 	//extpgmcscle
+						b.SkipBits(4);	//extpgmcscl
+					if(b.GetBits(1)) 	//extpgmrscle
+						b.SkipBits(4);	//extpgmrscl
+					if(b.GetBits(1)) 	//extpgmlsscle
+						b.SkipBits(4);	//extpgmlsscl
+					if(b.GetBits(1)) 	//extpgmrsscle
+						b.SkipBits(4);	//extpgmrsscl
+					if(b.GetBits(1)) 	//extpgmlfescle
+						b.SkipBits(4);	//extpgmlfescl
+					if(b.GetBits(1)) 	//dmixscle
+						b.SkipBits(4);	//dmixscl
+					if (b.GetBits(1))	//addche
+					{
+						if(b.GetBits(1))	//extpgmaux1scle
+							b.SkipBits(4);	//extpgmaux1scl
+						if(b.GetBits(1))	//extpgmaux2scle
+							b.SkipBits(4);	//extpgmaux2scl
+					}
+				}
+				if(b.GetBits(1))			//mixdata3e
+				{
+					b.SkipBits(5);			//spchdat
+					if(b.GetBits(1))		//addspchdate
+					{
+						b.SkipBits(5+2);	//spchdat1,spchan1att
+						if(b.GetBits(1))	//addspchdat1e
+							b.SkipBits(5+3);//spchdat2,spchan2att
+					}
+				}
+				//mixdata ........................................ (8*(mixdeflen+2)) - no. mixdata bits
+				b.SkipBytes(mixdeflen + 2);
+				if(b.GetBitPosition() & 0x7)
+					//mixdatafill ................................................................... 0 - 7
+					//used to round up the size of the mixdata field to the nearest byte
+					b.SkipBits(8 - (b.GetBitPosition() & 0x7));
+			}
+			if(hdr->channel_mode < 0x2) 	/* if mono or dual mono source */
+			{
+				if(b.GetBits(1))			//paninfoe
+					b.SkipBits(8+6);		//panmean,paninfo
+				if(hdr->channel_mode == 0x0) /* if 1+1 mode (dual mono - some items need a second value) */
+				{
+					if(b.GetBits(1))		//paninfo2e
+						b.SkipBits(8+6);	//panmean2,paninfo2
+				}
+			}
+			/* mixing configuration information */
+			if(b.GetBits(1))				//frmmixcfginfoe
+			{
+				if(hdr->num_blocks == 1) {	//if(numblkscod == 0x0)
+					b.SkipBits(5);			//blkmixcfginfo[0]
+				}
+				else
+				{
+					for(int blk = 0; blk < hdr->num_blocks; blk++)
+					{
+						if(b.GetBits(1))	//blkmixcfginfoe[blk]
+							b.SkipBits(5);	//blkmixcfginfo[blk]
+					}
+				}
+			}
+		}
+	}
+	/* informational metadata */
+	if(b.GetBits(1))						//infomdate
+	{
+		b.SkipBits(3+1+1);					//bsmod,copyrightb,origbs
+		if(hdr->channel_mode == 0x2) 		/* if in 2/0 mode */
+			b.SkipBits(2+2);				//dsurmod,dheadphonmod
+		if(hdr->channel_mode >= 0x6) 		/* if both surround channels exist */
+			b.SkipBits(2);					//dsurexmod
+		if(b.GetBits(1))					//audprodie
+			b.SkipBits(5+2+1);				//mixlevel,roomtyp,adconvtyp
+		if(hdr->channel_mode == 0x0)		/* if 1+1 mode (dual mono, so some items need a second value) */
+		{
+			if(b.GetBits(1))				//audprodi2e
+				b.SkipBits(5+2+1);			//mixlevel2,roomtyp2,adconvtyp2
+		}
+		if(hdr->sr_code < 0x3) 				/* if not half sample rate */
+			b.SkipBits(1);					//sourcefscod
+	}
+	if(hdr->frame_type == 0x0 && hdr->num_blocks != 6)	//(numblkscod != 0x3)
+		b.SkipBits(1);						//convsync
+	if(hdr->frame_type == 0x2) 				/* if bit stream converted from AC-3 */
+	{
+		uint8_t blkid = 0;
+		if(hdr->num_blocks == 6) 			/* 6 blocks per syncframe */
+			blkid = 1;
+		else
+			blkid = b.GetBits(1);
+		if(blkid)
+			b.SkipBits(6);					//frmsizecod
+	}
+	// JOC extension can be read in addbsi field. Everything prior was only necessary to get here.
+	if(b.GetBits(1))						//addbsie
+	{
+#ifdef DEBUG_PARSER
+		printf("***parse_eac3_bsi ADDBSIExists at bit pos: %d\n", b.GetBitPosition());
+#endif
+		uint8_t addbsil = b.GetBits(6) + 1;	//addbsil
+#ifdef DEBUG_PARSER
+		printf("***parse_eac3_bsi ADDBSILength: %d bytes\n", addbsil);
+#endif
+		for(int i = 0; i < addbsil; i++) {
+			addbsi[i] = b.GetBits(8);		//addbsi
+#ifdef DEBUG_PARSER
+			printf("***parse_eac3_bsi ADDBSI byte #%d: 0x%X (%d)\n", i, addbsi[i], addbsi[i]);
+#endif
+		}
+	}
+#ifdef DEBUG_PARSER
+	printf("***parse_eac3_bsi end bit pos: %d remaining bits: %d\n", b.GetBitPosition(), b.GetRemainingBits());
+#endif
+	b.SetBitPosition(savedbitpos);				//so that analyze_EAC3() does not raise exception
+
+	// Defined in 8.3 of ETSI TS 103 420
+	if(addbsi[0] & EC3Extension_JOC)
+	{
+		hdr->ec3_extension_type = EC3Extension_JOC;
+		hdr->complexity_index   = addbsi[1];
+	}
+}
+
+int analyze_EAC3(void **context, uint8_t *frame, uint32_t size)
+{
+    CMemoryBitstream b;
+    AC3HeaderInfo *hdr = NULL;
+    struct eac3_info *info = NULL;
+    int num_blocks;
+
+    if (!*context) {
+        *context = (struct eac3_info *)malloc(sizeof(*info));
+        memset(*context, 0, sizeof(*info));
+    }
+    if (!*context) {
+        return 1;
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+
+    info = (struct eac3_info *)*context;
+
+    b.SetBytes(frame, size);
+    if (ac3_parse_header(b, &hdr) < 0) {
+        free(hdr);
+        return -1;
+    }
+    info->data_rate = MAX(info->data_rate, hdr->bit_rate / 1000);
+    num_blocks = hdr->num_blocks;
+
+    /* fill the info needed for the "dec3" atom */
+    if (!info->ec3_done) {
+        /* AC-3 substream must be the first one */
+        if (hdr->bitstream_id <= 10 && hdr->substreamid != 0) {
+            free(hdr);
+            return -1;
+        }
+
+        /* this should always be the case, given that our AC-3 parser
+         * concatenates dependent frames to their independent parent */
+        if (hdr->frame_type == EAC3_FRAME_TYPE_INDEPENDENT) {
+            /* substream ids must be incremental */
+            if (hdr->substreamid > info->num_ind_sub + 1) {
+                free(hdr);
+                return -1;
+            }
+
+            if (hdr->substreamid == info->num_ind_sub + 1) {
+                //info->num_ind_sub++;
+                free(hdr);
+                return -1;
+            } else if (hdr->substreamid < info->num_ind_sub ||
+                       (hdr->substreamid == 0 && info->substream[0].bsid)) {
+                info->ec3_done = 1;
+                goto concatenate;
+            }
+        }
+
+        info->substream[hdr->substreamid].fscod = hdr->sr_code;
+        info->substream[hdr->substreamid].bsid  = hdr->bitstream_id;
+        info->substream[hdr->substreamid].bsmod = hdr->bitstream_mode;
+        info->substream[hdr->substreamid].acmod = hdr->channel_mode;
+        info->substream[hdr->substreamid].lfeon = hdr->lfe_on;
+		info->substream[hdr->substreamid].num_dep_sub = 0;		// to count num_dep_sub's only in this frame! Otherwise, if instantiated context passed in, num_dep_sub gets incremented cumulatively.
+		
+        /* Parse dependent substream(s), if any */
+        if (size != hdr->frame_size) {
+            int cumul_size = hdr->frame_size;
+            int parent = hdr->substreamid;
+
+            while (cumul_size != size) {
+                int i;
+                CMemoryBitstream gbc;
+                gbc.SetBytes(frame + cumul_size, (size - cumul_size));
+                if (ac3_parse_header(gbc, &hdr) < 0) {
+                    free(hdr);
+                    return -1;
+                }
+                if (hdr->frame_type != EAC3_FRAME_TYPE_DEPENDENT) {
+                    free(hdr);
+                    return -1;
+                }
+                cumul_size += hdr->frame_size;
+                info->substream[parent].num_dep_sub++;
+
+                /* header is parsed up to lfeon, but custom channel map may be needed */
+                /* skip bsid */
+				//gbc.SkipBits(5); // PV: ac3_parse_header() parses up to dialnorm!
+
+                /* skip volume control params */
+                for (i = 0; i < (hdr->channel_mode ? 1 : 2); i++) {
+                    gbc.SkipBits(5); // skip dialog normalization
+                    if (gbc.GetBits(1)) {
+                        gbc.SkipBits(8); // skip compression gain word
+                    }
+                }
+                /* get the dependent stream channel map, if exists */
+                if (gbc.GetBits(1)) {
+                    uint16_t value = gbc.GetBits(16);
+                    info->substream[parent].chan_loc = ac3_to_dec3_chan_map(value);
+                }
+                else {
+                    info->substream[parent].chan_loc |= hdr->channel_mode;
+                }
+            }
+        }
+    }
+
+concatenate:
+
+	info->ec3_extension_type |= hdr->ec3_extension_type;
+	info->complexity_index    = MAX(hdr->complexity_index, info->complexity_index);
+
+    free(hdr);
+
+    if (!info->num_blocks && num_blocks == 6) {
+        return size;
+    }
+    else if (info->num_blocks + num_blocks > 6) {
+        return -2;
+    }
+
+    if (!info->num_blocks) {
+        // Copy the frame
+        if (info->frame) {
+            free(info->frame);
+        }
+        info->frame = (uint8_t *)malloc(size);
+        if (info->frame == NULL) {
+            return -2;
+        }
+        memcpy(info->frame, frame, size);
+        info->size = size;
+        info->num_blocks = num_blocks;
+        return 0;
+    } else {
+        info->frame = (uint8_t *)realloc(info->frame, info->size + size);
+        if (info->frame == NULL) {
+            return -2;
+        }
+        memcpy(info->frame + info->size, frame, size);
+        info->size += size;
+        info->num_blocks += num_blocks;
+
+        if (info->num_blocks != 6) {
+            return 0;
+        }
+        info->num_blocks = 0;
+    }
+
+    return 0;
+}
+
+static int parse_config_ALS(CMemoryBitstream &b, MPEG4AudioConfig *c)
+{
+    if (b.GetRemainingBits() < 112)
+        return -1;
+
+    if (b.GetBits(32) != MKBETAG('A','L','S','\0'))
+        return -1;
+
+    // override AudioSpecificConfig channel configuration and sample rate
+    // which are buggy in old ALS conformance files
+    c->sample_rate = b.GetBits(32);
+
+    // skip number of samples
+    b.SkipBits(32);
+
+    // read number of channels
+    c->chan_config = 0;
+    c->channels    = b.GetBits(16) + 1;
+
+    return 0;
+}
+
+static inline int get_object_type(CMemoryBitstream &b)
+{
+    int object_type = b.GetBits(5);
+    if (object_type == AOT_ESCAPE)
+        object_type = 32 + b.GetBits(6);
+    return object_type;
+}
+
+static inline int get_sample_rate(CMemoryBitstream &b, int *index)
+{
+    *index = b.GetBits(4);
+    return *index == 0x0f ? b.GetBits(24) :
+    mpeg4audio_sample_rates[*index];
+}
+
+static inline int get_program_config_element(CMemoryBitstream &b, int *channels)
+{
+    b.SkipBits(4); // element_instance_tag
+    b.SkipBits(2); // object_type
+    b.SkipBits(4); // sampling_frequency_index
+    int num_front_channel_elements  = b.GetBits(4);
+    int num_side_channel_elements   = b.GetBits(4);
+    int num_back_channel_elements   = b.GetBits(4);
+    int num_lfe_channel_elements    = b.GetBits(2);
+
+    *channels = num_front_channel_elements + num_side_channel_elements + num_back_channel_elements + num_lfe_channel_elements;
+    return 0;
+}
+
+int analyze_ESDS(MPEG4AudioConfig *c, const uint8_t *cookie, uint32_t cookieLen)
+{
+    int specific_config_bitindex;
+    int sync_extension = 1;
+
+    if (cookieLen <= 0) {
+        return 1;
+    }
+
+    bzero(c, sizeof(MPEG4AudioConfig));
+
+    CMemoryBitstream b;
+    b.SetBytes((uint8_t *)cookie, cookieLen);
+
+    try {
+        c->object_type = get_object_type(b);
+        c->sample_rate = get_sample_rate(b, &c->sampling_index);
+        c->chan_config = b.GetBits(4);
+        if (c->chan_config < ARRAY_ELEMS(mpeg4audio_channels)) {
+            c->channels = mpeg4audio_channels[c->chan_config];
+        }
+        c->sbr = -1;
+        c->ps  = -1;
+        if (c->object_type == AOT_SBR || (c->object_type == AOT_PS &&
+                                          // check for W6132 Annex YYYY draft MP3onMP4
+                                          !(b.PeakBits(3) & 0x03 && !(b.PeakBits(9) & 0x3F)))) {
+            if (c->object_type == AOT_PS) {
+                c->ps = 1;
+            }
+            c->ext_object_type = AOT_SBR;
+            c->sbr = 1;
+            c->ext_sample_rate = get_sample_rate(b, &c->ext_sampling_index);
+            c->object_type = get_object_type(b);
+            if (c->object_type == AOT_ER_BSAC) {
+                c->ext_chan_config = b.GetBits(4);
+            }
+        } else {
+            c->ext_object_type = AOT_NULL;
+            c->ext_sample_rate = 0;
+        }
+        specific_config_bitindex = b.GetBitPosition();
+
+        switch (c->object_type) {
+            case 1:
+            case 2:
+            case 3:
+            case 4:
+            case 6:
+            case 7:
+            case 17:
+            case 19:
+            case 20:
+            case 21:
+            case 22:
+            case 23:
+            {
+                b.SkipBits(1); // frameLengthFlag
+
+                int dependsOnCoreCoder = b.GetBits(1);
+                if (dependsOnCoreCoder) {
+                    b.SkipBits(14); // coreCoderDelay
+                }
+
+                int extensionFlag = b.GetBits(1);
+
+                if (!c->chan_config) {
+                    get_program_config_element(b, &c->channels);
+                }
+
+                if ((c->object_type == 6) || (c->object_type == 20)) {
+                    b.SkipBits(3);
+                }
+
+                if (extensionFlag) {
+                    if (c->object_type == 22) {
+                        b.SkipBits(5);
+                        b.SkipBits(11);
+                    }
+                    if ((c->object_type == 17)
+                        || (c->object_type == 19)
+                        || (c->object_type == 20)
+                        || (c->object_type == 23)
+                        ) {
+                        b.SkipBits(1);
+                        b.SkipBits(1);
+                        b.SkipBits(1);
+                    }
+                    /*ext_flag = */b.SkipBits(1);
+                }
+            }
+        }
+
+        if (c->object_type == AOT_ALS) {
+            b.SkipBits(5);
+            if (b.PeakBits(24) != MKBETAG('\0','A','L','S')) {
+                b.SkipBits(24);
+            }
+
+            specific_config_bitindex = b.GetBitPosition();
+
+            if (parse_config_ALS(b, c)) {
+                return -1;
+            }
+        }
+
+        if (c->ext_object_type != AOT_SBR && sync_extension) {
+            while (b.GetRemainingBits() > 15) {
+                if (b.PeakBits(11) == 0x2b7) { // sync extension
+                    b.GetBits(11);
+                    c->ext_object_type = get_object_type(b);
+                    if (c->ext_object_type == AOT_SBR && (c->sbr = b.GetBits(1)) == 1) {
+                        c->ext_sample_rate = get_sample_rate(b, &c->ext_sampling_index);
+                        if (c->ext_sample_rate == c->sample_rate) {
+                            c->sbr = -1;
+                        }
+                    }
+                    if (b.GetRemainingBits() > 11 && b.GetBits(11) == 0x548) {
+                        c->ps = b.GetBits(1);
+                    }
+                    break;
+                } else {
+                    b.SkipBits(1); // skip 1 bit
+                }
+            }
+        }
+
+        //PS requires SBR
+        if (!c->sbr) {
+            c->ps = 0;
+        }
+        //Limit implicit PS to the HE-AACv2 Profile
+        if ((c->ps == -1 && c->object_type != AOT_AAC_LC) || c->channels & ~0x01) {
+            c->ps = 0;
+        }
+
+    } catch (int e) {
+        return -1;
+    }
+
+    return specific_config_bitindex;
+}
+
+int analyze_AVC(const uint8_t *cookie, uint32_t cookieLen)
+{
+    int result = 0;
+
+    AVCConfig *info = (AVCConfig *)malloc (sizeof(AVCConfig));
+    bzero(info, sizeof(AVCConfig));
+
+    CMemoryBitstream b;
+    b.SetBytes((uint8_t *)cookie, cookieLen);
+
+    try {
+        info->configurationVersion = b.GetBits(8);
+        info->AVCProfileIndication = b.GetBits(8);
+        info->profile_compatibility = b.GetBits(8);
+        info->AVCLevelIndication = b.GetBits(8);
+
+        b.SkipBits(6);
+        info->lengthSizeMinusOne = b.GetBits(2);
+        b.SkipBits(3);
+
+        info->numOfSequenceParameterSets = b.GetBits(5);
+
+        for (int i = 0; i < info->numOfSequenceParameterSets; i++) {
+            UInt16 sequenceParameterSetLength = b.GetBits(16);
+            b.SkipBits(8 * sequenceParameterSetLength);
+        }
+
+        info->numOfPictureParameterSets = b.GetBits(8);
+
+        for (int i = 0; i < info->numOfPictureParameterSets; i++) {
+            UInt16 pictureParameterSetLength = b.GetBits(16);
+            b.SkipBits(8 * pictureParameterSetLength);
+        }
+    }
+    catch (int e) {
+        result = 1;
+    }
+
+    free(info);
+
+
+    return result;
+}
+
+int parse_HEVC(const uint8_t *cookie, uint32_t cookieLen, bool *completeness, bool forceCompleteness)
+{
+    int result = 0;
+    bool complete = true;
+
+    HEVCConfig *info = (HEVCConfig *)malloc (sizeof(HEVCConfig));
+    bzero(info, sizeof(HEVCConfig));
+
+    CMemoryBitstream b;
+    b.SetBytes((uint8_t *)cookie, cookieLen);
+
+    try {
+        if (forceCompleteness) {
+            b.PutBits(1, 8);
+        } else {
+            info->configurationVersion = b.GetBits(8);
+        }
+        info->general_profile_space = b.GetBits(2);
+        info->general_tier_flag = b.GetBits(1);
+        info->general_profile_idc = b.GetBits(5);
+        info->general_profile_compatibility_flags = b.GetBits(32);
+
+        info->general_constraint_indicator_flags = b.GetBits(32) << 16;
+        info->general_constraint_indicator_flags += b.GetBits(16);
+        info->general_level_idc = b.GetBits(8);
+
+        b.SkipBits(4); // reserved 1111b
+        info->min_spatial_segmentation_idc = b.GetBits(12);
+        b.SkipBits(6); // reserved 111111b
+        info->parallelismType = b.GetBits(2);
+        b.SkipBits(6); // reserved 111111b
+        info->chromaFormat = b.GetBits(2);
+        b.SkipBits(5); // reserved 11111b
+        info->bitDepthLumaMinus8 = b.GetBits(3);
+        b.SkipBits(5); // reserved 11111b
+        info->bitDepthChromaMinus8 = b.GetBits(3);
+
+        info->avgFrameRate = b.GetBits(16);
+        info->constantFrameRate = b.GetBits(2);
+
+        info->numTemporalLayers = b.GetBits(3);
+        info->temporalIdNested = b.GetBits(1);
+
+        info->lengthSizeMinusOne = b.GetBits(2);
+        info->numOfArrays = b.GetBits(8);
+
+        info->NAL_units = (struct NAL_units *)malloc(sizeof(struct NAL_units) * info->numOfArrays);
+
+        for (UInt8 j = 0; j < info->numOfArrays; j++) {
+            bool unitIsComplete = true;
+            u_int32_t completenessPos = b.GetBitPosition();
+
+            info->NAL_units[j].array_completeness = b.GetBits(1);
+
+            if (info->NAL_units[j].array_completeness == 0) {
+                unitIsComplete = false;
+            }
+
+            b.SkipBits(1); // reserved 0
+
+            info->NAL_units[j].NAL_unit_type = b.GetBits(6);
+            info->NAL_units[j].numNalus = b.GetBits(16);
+
+            if (info->NAL_units[j].NAL_unit_type == NAL_UNIT_VPS ||
+                info->NAL_units[j].NAL_unit_type == NAL_UNIT_SPS ||
+                info->NAL_units[j].NAL_unit_type == NAL_UNIT_PPS) {
+                if (forceCompleteness && info->NAL_units[j].numNalus > 0) {
+                    u_int32_t currentPos = b.GetBitPosition();
+                    b.SetBitPosition(completenessPos);
+                    b.PutBits(1, 1);
+                    b.SetBitPosition(currentPos);
+                } else {
+                    complete = unitIsComplete;
+                }
+            }
+
+            for (UInt8 i = 0; i < info->NAL_units[j].numNalus; i++) {
+                UInt16 nalUnitLength = b.GetBits(16);
+                b.SkipBits(8 * nalUnitLength);
+            }
+        }
+    }
+    catch (int e) {
+        result = 1;
+    }
+
+    free(info->NAL_units);
+    free(info);
+
+    *completeness = complete;
+
+    return 0;
+}
+
+namespace h264 {
+
+using namespace ::h264;
+
+static void h264_decode_annexb( uint8_t *dst, int *dstlen,
+                               const uint8_t *src, const int srclen )
+{
+    uint8_t *dst_sav = dst;
+    const uint8_t *end = &src[srclen];
+    
+    while (src < end)
+    {
+        if (src < end - 3 && src[0] == 0x00 && src[1] == 0x00 &&
+            src[2] == 0x03)
+        {
+            *dst++ = 0x00;
+            *dst++ = 0x00;
+            
+            src += 3;
+            continue;
+        }
+        *dst++ = *src++;
+    }
+    
+    *dstlen = dst - dst_sav;
+}
+
+static void scaling_list (uint sizeOfScalingList, CBitstream *bs)
+{
+    uint lastScale = 8, nextScale = 8;
+    uint j;
+    
+    for (j = 0; j < sizeOfScalingList; j++) {
+        if (nextScale != 0) {
+            int deltaScale = h264_se(bs);
+            nextScale = (lastScale + deltaScale + 256) % 256;
+        }
+        if (nextScale == 0) {
+            lastScale = lastScale;
+        } else {
+            lastScale = nextScale;
+        }
+    }
+}
+
+void h264_hrd_parameters (h264_decode_t *dec, CBitstream *bs)
+{
+    uint32_t cpb_cnt;
+    dec->cpb_cnt_minus1 = cpb_cnt = h264_ue(bs);
+    uint32_t temp;
+    printf("     cpb_cnt_minus1: %u\n", cpb_cnt);
+    printf("     bit_rate_scale: %u\n", bs->GetBits(4));
+    printf("     cpb_size_scale: %u\n", bs->GetBits(4));
+    for (uint32_t ix = 0; ix <= cpb_cnt; ix++) {
+        printf("      bit_rate_value_minus1[%u]: %u\n", ix, h264_ue(bs));
+        printf("      cpb_size_value_minus1[%u]: %u\n", ix, h264_ue(bs));
+        printf("      cbr_flag[%u]: %u\n", ix, bs->GetBits(1));
+    }
+    temp = dec->initial_cpb_removal_delay_length_minus1 = bs->GetBits(5);
+    printf("     initial_cpb_removal_delay_length_minus1: %u\n", temp);
+    
+    dec->cpb_removal_delay_length_minus1 = temp = bs->GetBits(5);
+    printf("     cpb_removal_delay_length_minus1: %u\n", temp);
+    dec->dpb_output_delay_length_minus1 = temp = bs->GetBits(5);
+    printf("     dpb_output_delay_length_minus1: %u\n", temp);
+    dec->time_offset_length = temp = bs->GetBits(5);  
+    printf("     time_offset_length: %u\n", temp);
+}
+
+void h264_vui_parameters (h264_decode_t *dec, CBitstream *bs)
+{
+    //uint32_t temp;
+    dec->aspect_ratio_info_present_flag = bs->GetBits(1);
+    if (dec->aspect_ratio_info_present_flag) {
+        dec->aspect_ratio_idc = bs->GetBits(8);
+        if (dec->aspect_ratio_idc == 0xff) { // extended_SAR
+            dec->sar_width = bs->GetBits(16);
+            dec->sar_height = bs->GetBits(16);
+        }
+    }
+    
+#if 0
+    temp = bs->GetBits(1);
+    printf("    overscan_info_present_flag: %u\n", temp);
+    if (temp) {
+        printf("     overscan_appropriate_flag: %u\n", bs->GetBits(1));
+    }
+    temp = bs->GetBits(1);
+    printf("    video_signal_info_present_flag: %u\n", temp);
+    if (temp) {
+        printf("     video_format: %u\n", bs->GetBits(3));
+        printf("     video_full_range_flag: %u\n", bs->GetBits(1));
+        temp = bs->GetBits(1);
+        printf("     colour_description_present_flag: %u\n", temp);
+        if (temp) {
+            printf("      colour_primaries: %u\n", bs->GetBits(8));
+            printf("      transfer_characteristics: %u\n", bs->GetBits(8));
+            printf("      matrix_coefficients: %u\n", bs->GetBits(8));
+        }
+    }
+    
+    temp = bs->GetBits(1);
+    printf("    chroma_loc_info_present_flag: %u\n", temp);
+    if (temp) {
+        printf("     chroma_sample_loc_type_top_field: %u\n", h264_ue(bs));
+        printf("     chroma_sample_loc_type_bottom_field: %u\n", h264_ue(bs));
+    }
+    temp = bs->GetBits(1);
+    printf("    timing_info_present_flag: %u\n", temp);
+    if (temp) {
+        printf("     num_units_in_tick: %u\n", bs->GetBits(32));
+        printf("     time_scale: %u\n", bs->GetBits(32));
+        printf("     fixed_frame_scale: %u\n", bs->GetBits(1));
+    }
+    temp = bs->GetBits(1);
+    printf("    nal_hrd_parameters_present_flag: %u\n", temp);
+    if (temp) {
+        dec->NalHrdBpPresentFlag = 1;
+        dec->CpbDpbDelaysPresentFlag = 1;
+        h264_hrd_parameters(dec, bs);
+    }
+    uint32_t temp2;
+    
+    temp2 = bs->GetBits(1);
+    printf("    vcl_hrd_parameters_present_flag: %u\n", temp2);
+    if (temp2) {
+        dec->VclHrdBpPresentFlag = 1;
+        dec->CpbDpbDelaysPresentFlag = 1;
+        h264_hrd_parameters(dec, bs);
+    }
+    if (temp || temp2) {
+        printf("    low_delay_hrd_flag: %u\n", bs->GetBits(1));
+    }
+    dec->pic_struct_present_flag = temp = bs->GetBits(1);
+    printf("    pic_struct_present_flag: %u\n", temp);
+    temp = bs->GetBits(1);
+    if (temp) {
+        printf("    motion_vectors_over_pic_boundaries_flag: %u\n", bs->GetBits(1));
+        printf("    max_bytes_per_pic_denom: %u\n", h264_ue(bs));
+        printf("    max_bits_per_mb_denom: %u\n", h264_ue(bs));
+        printf("    log2_max_mv_length_horizontal: %u\n", h264_ue(bs));
+        printf("    log2_max_mv_length_vertical: %u\n", h264_ue(bs));
+        printf("    num_reorder_frames: %u\n", h264_ue(bs));
+        printf("     max_dec_frame_buffering: %u\n", h264_ue(bs));
+    }
+#endif
+}
+
+int h264_read_seq_info (const uint8_t *buffer, 
+                        uint32_t buflen, 
+                        h264_decode_t *dec)
+{
+    CBitstream bs;
+    uint32_t header;
+    uint8_t tmp[2048]; /* Should be enough for all SPS (we have at worst 13 bytes and 496 se/ue in frext) */
+    int tmp_len;
+    uint32_t dummy;
+    
+    if (buffer[2] == 1) header = 4;
+    else header = 5;
+    
+    h264_decode_annexb( tmp, &tmp_len, buffer + header, MIN(buflen-header,2048) );
+    bs.init(tmp, tmp_len * 8);
+    
+    //bs.set_verbose(true);
+    try {
+        dec->profile = bs.GetBits(8);
+        dummy = bs.GetBits(1 + 1 + 1 + 1 + 4);
+        dec->level = bs.GetBits(8);
+        (void)h264_ue(&bs); // seq_parameter_set_id
+        if (dec->profile == 100 || dec->profile == 110 ||
+            dec->profile == 122 || dec->profile == 144) {
+            dec->chroma_format_idc = h264_ue(&bs);
+            if (dec->chroma_format_idc == 3) {
+                dec->residual_colour_transform_flag = bs.GetBits(1);
+            }
+            dec->bit_depth_luma_minus8 = h264_ue(&bs);
+            dec->bit_depth_chroma_minus8 = h264_ue(&bs);
+            dec->qpprime_y_zero_transform_bypass_flag = bs.GetBits(1);
+            dec->seq_scaling_matrix_present_flag = bs.GetBits(1);
+            if (dec->seq_scaling_matrix_present_flag) {
+                for (uint ix = 0; ix < 8; ix++) {
+                    if (bs.GetBits(1)) {
+                        scaling_list(ix < 6 ? 16 : 64, &bs);
+                    }
+                }
+            }
+        }
+        dec->log2_max_frame_num_minus4 = h264_ue(&bs);
+        dec->pic_order_cnt_type = h264_ue(&bs);
+        if (dec->pic_order_cnt_type == 0) {
+            dec->log2_max_pic_order_cnt_lsb_minus4 = h264_ue(&bs);
+        } else if (dec->pic_order_cnt_type == 1) {
+            dec->delta_pic_order_always_zero_flag = bs.GetBits(1);
+            dec->offset_for_non_ref_pic = h264_se(&bs); // offset_for_non_ref_pic
+            dec->offset_for_top_to_bottom_field = h264_se(&bs); // offset_for_top_to_bottom_field
+            dec->pic_order_cnt_cycle_length = h264_ue(&bs); // poc_cycle_length
+            for (uint32_t ix = 0; ix < dec->pic_order_cnt_cycle_length; ix++) {
+                dec->offset_for_ref_frame[MIN(ix,255)] = h264_se(&bs); // offset for ref fram -
+            }
+        }
+        dummy = h264_ue(&bs); // num_ref_frames
+        dummy = bs.GetBits(1); // gaps_in_frame_num_value_allowed_flag
+        uint32_t PicWidthInMbs = h264_ue(&bs) + 1;
+        dec->pic_width = PicWidthInMbs * 16;
+        uint32_t PicHeightInMapUnits = h264_ue(&bs) + 1;
+        
+        dec->frame_mbs_only_flag = bs.GetBits(1);
+        dec->pic_height = 
+        (2 - dec->frame_mbs_only_flag) * PicHeightInMapUnits * 16;
+        
+        if (!dec->frame_mbs_only_flag) {
+            dec->mb_adaptive_frame_field_flag = bs.GetBits(1);
+        }
+        dec->direct_8x8_inference_flag = bs.GetBits(1);
+        dummy = bs.GetBits(1);
+        if (dummy) {
+            dec->frame_crop_left_offset = h264_ue(&bs);
+            dec->frame_crop_right_offset = h264_ue(&bs);
+            dec->frame_crop_top_offset = h264_ue(&bs);
+            dec->frame_crop_bottom_offset = h264_ue(&bs);
+            
+            dec->pic_width -= 2*dec->frame_crop_right_offset;
+            if (dec->frame_mbs_only_flag)
+                dec->pic_height -= 2*dec->frame_crop_bottom_offset;
+            else
+                dec->pic_height -= 4*dec->frame_crop_bottom_offset;
+        }
+        dummy = bs.GetBits(1);
+        if (dummy) {
+            h264_vui_parameters(dec, &bs);
+        }
+        
+    } catch (...) {
+        return -1;
+    }
+    return 0;
+}
+
+}
+
+namespace hevc {
+
+using namespace ::hevc;
+
+static uint32_t hevc_ue (CBitstream *bs)
+{
+    uint32_t zeros = 0;
+
+    while (bs->GetBits(1) == 0) {
+        if (++zeros > 31) {
+            throw BITSTREAM_TOO_MANY_BITS;
+        }
+    }
+
+    return zeros ? (1u << zeros) - 1 + bs->GetBits(zeros) : 0;
+}
+
+static int32_t hevc_se (CBitstream *bs)
+{
+    uint32_t value = hevc_ue(bs);
+    return value & 1 ? (int32_t)((value + 1) >> 1) : -(int32_t)(value >> 1);
+}
+
+static void hevc_sub_layers_profile_tier_level (CBitstream *bs, uint32_t max_sub_layers_minus1)
+{
+    uint8_t profile_present[8], level_present[8];
+
+    for (uint32_t ix = 0; ix < max_sub_layers_minus1; ix++) {
+        profile_present[ix] = bs->GetBits(1);
+        level_present[ix] = bs->GetBits(1);
+    }
+    if (max_sub_layers_minus1 > 0) {
+        for (uint32_t ix = max_sub_layers_minus1; ix < 8; ix++) {
+            bs->GetBits(2); // reserved_zero_2bits
+        }
+    }
+    for (uint32_t ix = 0; ix < max_sub_layers_minus1; ix++) {
+        if (profile_present[ix]) {
+            bs->GetBits(32);
+            bs->GetBits(32);
+            bs->GetBits(24);
+        }
+        if (level_present[ix]) {
+            bs->GetBits(8);
+        }
+    }
+}
+
+static void hevc_scaling_list_data (CBitstream *bs)
+{
+    for (uint32_t sizeId = 0; sizeId < 4; sizeId++) {
+        for (uint32_t matrixId = 0; matrixId < 6; matrixId += (sizeId == 3) ? 3 : 1) {
+            if (bs->GetBits(1) == 0) {
+                hevc_ue(bs); // scaling_list_pred_matrix_id_delta
+            } else {
+                uint32_t coefNum = MIN(64, 1 << (4 + (sizeId << 1)));
+                if (sizeId > 1) {
+                    hevc_se(bs); // scaling_list_dc_coef_minus8
+                }
+                for (uint32_t ix = 0; ix < coefNum; ix++) {
+                    hevc_se(bs); // scaling_list_delta_coef
+                }
+            }
+        }
+    }
+}
+
+static void hevc_st_ref_pic_set (CBitstream *bs, uint32_t idx, uint32_t *num_delta_pocs)
+{
+    if (idx != 0 && bs->GetBits(1)) {
+        // inter_ref_pic_set_prediction_flag
+        bs->GetBits(1); // delta_rps_sign
+        hevc_ue(bs); // abs_delta_rps_minus1
+
+        uint32_t count = 0;
+        for (uint32_t ix = 0; ix <= num_delta_pocs[idx - 1]; ix++) {
+            uint32_t used_by_curr_pic_flag = bs->GetBits(1);
+            uint32_t use_delta_flag = used_by_curr_pic_flag ? 1 : bs->GetBits(1);
+            if (used_by_curr_pic_flag || use_delta_flag) {
+                count++;
+            }
+        }
+        num_delta_pocs[idx] = count;
+    } else {
+        uint32_t num_negative_pics = hevc_ue(bs);
+        uint32_t num_positive_pics = hevc_ue(bs);
+        if (num_negative_pics > 16 || num_positive_pics > 16) {
+            throw BITSTREAM_TOO_MANY_BITS;
+        }
+        for (uint32_t ix = 0; ix < num_negative_pics + num_positive_pics; ix++) {
+            hevc_ue(bs); // delta_poc_minus1
+            bs->GetBits(1); // used_by_curr_pic_flag
+        }
+        num_delta_pocs[idx] = num_negative_pics + num_positive_pics;
+    }
+}
+
+static void hevc_vui_parameters (CBitstream *bs, hevc_sps_t *sps)
+{
+    if (bs->GetBits(1)) {
+        // aspect_ratio_info_present_flag
+        uint32_t aspect_ratio_idc = bs->GetBits(8);
+        if (aspect_ratio_idc == 255) {
+            sps->sar_width = bs->GetBits(16);
+            sps->sar_height = bs->GetBits(16);
+        } else if (aspect_ratio_idc < 17) {
+            sps->sar_width = hevc_sar[aspect_ratio_idc][0];
+            sps->sar_height = hevc_sar[aspect_ratio_idc][1];
+        }
+    }
+    if (bs->GetBits(1)) {
+        bs->GetBits(1); // overscan_appropriate_flag
+    }
+    if (bs->GetBits(1)) {
+        // video_signal_type_present_flag
+        bs->GetBits(3); // video_format
+        sps->video_full_range_flag = bs->GetBits(1);
+        sps->colour_description_present_flag = bs->GetBits(1);
+        if (sps->colour_description_present_flag) {
+            sps->colour_primaries = bs->GetBits(8);
+            sps->transfer_characteristics = bs->GetBits(8);
+            sps->matrix_coeffs = bs->GetBits(8);
+        }
+    }
+    if (bs->GetBits(1)) {
+        // chroma_loc_info_present_flag
+        hevc_ue(bs);
+        hevc_ue(bs);
+    }
+    bs->GetBits(1); // neutral_chroma_indication_flag
+    bs->GetBits(1); // field_seq_flag
+    bs->GetBits(1); // frame_field_info_present_flag
+    if (bs->GetBits(1)) {
+        // default_display_window_flag
+        hevc_ue(bs);
+        hevc_ue(bs);
+        hevc_ue(bs);
+        hevc_ue(bs);
+    }
+    if (bs->GetBits(1)) {
+        // vui_timing_info_present_flag
+        sps->num_units_in_tick = bs->GetBits(32);
+        sps->time_scale = bs->GetBits(32);
+    }
+}
+
+static int hevc_read_seq_info (const uint8_t *nal, uint32_t len, hevc_sps_t *sps, uint32_t *sps_id)
+{
+    uint8_t *rbsp = (uint8_t *)malloc(len);
+    uint32_t size = hevc_nal_to_rbsp(rbsp, nal, len);
+    CBitstream bs(rbsp, size * 8);
+    int result = 0;
+
+    memset(sps, 0, sizeof(hevc_sps_t));
+
+    try {
+        bs.GetBits(16); // nal_unit_header
+        bs.GetBits(4); // sps_video_parameter_set_id
+        uint32_t max_sub_layers_minus1 = bs.GetBits(3);
+        if (max_sub_layers_minus1 > 6) {
+            throw BITSTREAM_TOO_MANY_BITS;
+        }
+        sps->max_sub_layers = max_sub_layers_minus1 + 1;
+        sps->temporal_id_nesting_flag = bs.GetBits(1);
+
+        // the general profile_tier_level is byte aligned,
+        // hvcC stores it as it is
+        if (size < 15) {
+            throw BITSTREAM_PAST_END;
+        }
+        memcpy(sps->general_profile_tier_level, rbsp + 3, 12);
+        bs.GetBits(32);
+        bs.GetBits(32);
+        bs.GetBits(32);
+        hevc_sub_layers_profile_tier_level(&bs, max_sub_layers_minus1);
+
+        *sps_id = hevc_ue(&bs);
+        if (*sps_id >= HEVC_MAX_SPS) {
+            throw BITSTREAM_TOO_MANY_BITS;
+        }
+        sps->chroma_format_idc = hevc_ue(&bs);
+        if (sps->chroma_format_idc == 3) {
+            sps->separate_colour_plane_flag = bs.GetBits(1);
+        }
+        sps->pic_width = hevc_ue(&bs);
+        sps->pic_height = hevc_ue(&bs);
+        if (bs.GetBits(1)) {
+            // conformance_window_flag
+            uint32_t left = hevc_ue(&bs);
+            uint32_t right = hevc_ue(&bs);
+            uint32_t top = hevc_ue(&bs);
+            uint32_t bottom = hevc_ue(&bs);
+            uint32_t sub_width = (sps->chroma_format_idc == 1 || sps->chroma_format_idc == 2) && !sps->separate_colour_plane_flag ? 2 : 1;
+            uint32_t sub_height = sps->chroma_format_idc == 1 && !sps->separate_colour_plane_flag ? 2 : 1;
+            sps->pic_width -= MIN(sps->pic_width, sub_width * (left + right));
+            sps->pic_height -= MIN(sps->pic_height, sub_height * (top + bottom));
+        }
+        sps->bit_depth_luma_minus8 = hevc_ue(&bs);
+        sps->bit_depth_chroma_minus8 = hevc_ue(&bs);
+        sps->log2_max_pic_order_cnt_lsb = hevc_ue(&bs) + 4;
+        if (sps->log2_max_pic_order_cnt_lsb > 16) {
+            throw BITSTREAM_TOO_MANY_BITS;
+        }
+        // everything needed to read the slice headers is here
+        sps->valid = true;
+
+        uint32_t sub_layer_ordering_info_present_flag = bs.GetBits(1);
+        for (uint32_t ix = sub_layer_ordering_info_present_flag ? 0 : max_sub_layers_minus1; ix <= max_sub_layers_minus1; ix++) {
+            hevc_ue(&bs); // sps_max_dec_pic_buffering_minus1
+            hevc_ue(&bs); // sps_max_num_reorder_pics
+            hevc_ue(&bs); // sps_max_latency_increase_plus1
+        }
+        hevc_ue(&bs); // log2_min_luma_coding_block_size_minus3
+        hevc_ue(&bs); // log2_diff_max_min_luma_coding_block_size
+        hevc_ue(&bs); // log2_min_luma_transform_block_size_minus2
+        hevc_ue(&bs); // log2_diff_max_min_luma_transform_block_size
+        hevc_ue(&bs); // max_transform_hierarchy_depth_inter
+        hevc_ue(&bs); // max_transform_hierarchy_depth_intra
+        if (bs.GetBits(1) && bs.GetBits(1)) {
+            // scaling_list_enabled_flag and sps_scaling_list_data_present_flag
+            hevc_scaling_list_data(&bs);
+        }
+        bs.GetBits(1); // amp_enabled_flag
+        bs.GetBits(1); // sample_adaptive_offset_enabled_flag
+        if (bs.GetBits(1)) {
+            // pcm_enabled_flag
+            bs.GetBits(4);
+            bs.GetBits(4);
+            hevc_ue(&bs);
+            hevc_ue(&bs);
+            bs.GetBits(1);
+        }
+        uint32_t num_short_term_ref_pic_sets = hevc_ue(&bs);
+        if (num_short_term_ref_pic_sets > 64) {
+            throw BITSTREAM_TOO_MANY_BITS;
+        }
+        uint32_t num_delta_pocs[64];
+        for (uint32_t ix = 0; ix < num_short_term_ref_pic_sets; ix++) {
+            hevc_st_ref_pic_set(&bs, ix, num_delta_pocs);
+        }
+        if (bs.GetBits(1)) {
+            // long_term_ref_pics_present_flag
+            uint32_t num_long_term_ref_pics_sps = hevc_ue(&bs);
+            for (uint32_t ix = 0; ix < num_long_term_ref_pics_sps; ix++) {
+                bs.GetBits(sps->log2_max_pic_order_cnt_lsb);
+                bs.GetBits(1);
+            }
+        }
+        bs.GetBits(1); // sps_temporal_mvp_enabled_flag
+        bs.GetBits(1); // strong_intra_smoothing_enabled_flag
+        if (bs.GetBits(1)) {
+            hevc_vui_parameters(&bs, sps);
+        }
+    } catch (...) {
+        // a broken VUI doesn't matter
+        result = sps->valid ? 0 : -1;
+    }
+
+    free(rbsp);
+    return result;
+}
+
+}
+
+}
+
+#endif
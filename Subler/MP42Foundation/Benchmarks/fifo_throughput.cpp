@@ -0,0 +1,395 @@
+//
+//  fifo_throughput.cpp
+//  MP42Foundation Benchmarks
+//
+//  Passes items from a producer thread to a consumer thread through the
+//  fifo that sits between the demuxers and the muxer, and reports how
+//  many items per second go through. MP42Fifo is Objective-C, its
+//  algorithms are mirrored here on plain values: the single producer,
+//  single consumer ring of MP42Fifo.m, the semaphore and serial queue
+//  fifo it replaced, and a mutex and condition variables one for
+//  comparison. The retain and release of the items aren't counted.
+//
+//  usage: fifo_throughput [million items]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <atomic>
+
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
+#define FIFO_CAPACITY 300
+#define FIFO_CACHE_LINE 128
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+class Semaphore {
+public:
+#ifdef __APPLE__
+    Semaphore(long value) { _semaphore = dispatch_semaphore_create(value); }
+    ~Semaphore() { dispatch_release(_semaphore); }
+    void wait() { dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER); }
+    void signal() { dispatch_semaphore_signal(_semaphore); }
+private:
+    dispatch_semaphore_t _semaphore;
+#else
+    Semaphore(long value) { sem_init(&_semaphore, 0, (unsigned)value); }
+    ~Semaphore() { sem_destroy(&_semaphore); }
+    void wait() { while (sem_wait(&_semaphore) != 0) {} }
+    void signal() { sem_post(&_semaphore); }
+private:
+    sem_t _semaphore;
+#endif
+};
+
+// a serial dispatch queue, or a mutex where there's no libdispatch
+class SerialQueue {
+public:
+#ifdef __APPLE__
+    SerialQueue() { _queue = dispatch_queue_create("org.subler.FifoQueue", DISPATCH_QUEUE_SERIAL); }
+    ~SerialQueue() { dispatch_release(_queue); }
+    void sync(void *context, void (*work)(void *)) { dispatch_sync_f(_queue, context, work); }
+private:
+    dispatch_queue_t _queue;
+#else
+    SerialQueue() { pthread_mutex_init(&_mutex, NULL); }
+    ~SerialQueue() { pthread_mutex_destroy(&_mutex); }
+    void sync(void *context, void (*work)(void *)) {
+        pthread_mutex_lock(&_mutex);
+        work(context);
+        pthread_mutex_unlock(&_mutex);
+    }
+private:
+    pthread_mutex_t _mutex;
+#endif
+};
+
+#pragma mark Semaphore and serial queue
+
+// the previous MP42Fifo, one semaphore wait and signal per item
+class QueueFifo {
+public:
+    QueueFifo(int32_t capacity) : _size(capacity), _full(capacity - 1), _empty(0) {
+        _array = (uint64_t *)malloc(sizeof(uint64_t) * _size);
+    }
+    ~QueueFifo() { free(_array); }
+
+    void enqueue(uint64_t item) {
+        _full.wait();
+
+        struct Context { QueueFifo *fifo; uint64_t item; } context = { this, item };
+        _queue.sync(&context, [](void *c) {
+            Context *context = (Context *)c;
+            context->fifo->_array[context->fifo->_tail++] = context->item;
+        });
+
+        if (_tail == _size) {
+            _tail = 0;
+        }
+
+        _count++;
+        _empty.signal();
+    }
+
+    bool dequeue(uint64_t *item) {
+        if (!_count) return false;
+
+        struct Context { QueueFifo *fifo; uint64_t *item; } context = { this, item };
+        _queue.sync(&context, [](void *c) {
+            Context *context = (Context *)c;
+            *context->item = context->fifo->_array[context->fifo->_head++];
+        });
+
+        if (_head == _size) {
+            _head = 0;
+        }
+
+        _count--;
+        _full.signal();
+
+        return true;
+    }
+
+    // there were no batches, one item at a time
+    void enqueueObjects(const uint64_t *items, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            enqueue(items[i]);
+        }
+    }
+
+    size_t dequeueObjectsAndWait(uint64_t *items, size_t) {
+        while (!dequeue(items)) {
+            _empty.wait();
+        }
+        return 1;
+    }
+
+private:
+    uint64_t *_array;
+    int32_t _head = 0;
+    int32_t _tail = 0;
+    int32_t _size;
+    std::atomic<int32_t> _count{0};
+
+    Semaphore _full;
+    Semaphore _empty;
+    SerialQueue _queue;
+};
+
+#pragma mark Mutex and condition variables
+
+class MutexFifo {
+public:
+    MutexFifo(size_t capacity) : _size(capacity) {
+        _array = (uint64_t *)malloc(sizeof(uint64_t) * _size);
+        pthread_mutex_init(&_mutex, NULL);
+        pthread_cond_init(&_space, NULL);
+        pthread_cond_init(&_items, NULL);
+    }
+    ~MutexFifo() {
+        free(_array);
+        pthread_mutex_destroy(&_mutex);
+        pthread_cond_destroy(&_space);
+        pthread_cond_destroy(&_items);
+    }
+
+    void enqueueObjects(const uint64_t *items, size_t count) {
+        size_t done = 0;
+
+        pthread_mutex_lock(&_mutex);
+        while (done < count) {
+            if (_count == _size) {
+                pthread_cond_wait(&_space, &_mutex);
+                continue;
+            }
+            for (; _count < _size && done < count; done++, _count++) {
+                _array[(_head + _count) % _size] = items[done];
+            }
+            pthread_cond_signal(&_items);
+        }
+        pthread_mutex_unlock(&_mutex);
+    }
+
+    size_t dequeueObjectsAndWait(uint64_t *items, size_t count) {
+        size_t done = 0;
+
+        pthread_mutex_lock(&_mutex);
+        while (_count == 0) {
+            pthread_cond_wait(&_items, &_mutex);
+        }
+        for (; _count && done < count; done++, _count--) {
+            items[done] = _array[_head++];
+            if (_head == _size) {
+                _head = 0;
+            }
+        }
+        pthread_cond_signal(&_space);
+        pthread_mutex_unlock(&_mutex);
+
+        return done;
+    }
+
+private:
+    uint64_t *_array;
+    size_t _head = 0;
+    size_t _count = 0;
+    size_t _size;
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _space;
+    pthread_cond_t _items;
+};
+
+#pragma mark Single producer, single consumer ring
+
+// MP42Fifo.m, enqueueObjects:count:, dequeueObjects:count: and the
+// wait of dequeueAndWait, with the same orderings
+class RingFifo {
+public:
+    RingFifo(uint64_t capacity) : _size(capacity), _space(0), _items(0) {
+        _array = (uint64_t *)malloc(sizeof(uint64_t) * _size);
+    }
+    ~RingFifo() { free(_array); }
+
+    void enqueueObjects(const uint64_t *items, size_t count) {
+        size_t done = 0;
+
+        while (done < count) {
+            uint64_t tail = _tail.load(std::memory_order_relaxed);
+            uint64_t head = _head.load();
+            uint64_t space = _size - (tail - head);
+
+            if (space == 0) {
+                waitUnless(_producerWaiting, _space, [&] { return _head.load() != head; });
+                continue;
+            }
+
+            uint64_t n = space < count - done ? space : count - done;
+            uint64_t i = tail % _size;
+
+            for (uint64_t end = done + n; done < end; done++) {
+                _array[i++] = items[done];
+
+                if (i == _size) {
+                    i = 0;
+                }
+            }
+
+            _tail.store(tail + n);
+            wake(_consumerWaiting, _items);
+        }
+    }
+
+    size_t dequeueObjects(uint64_t *items, size_t count) {
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        uint64_t tail = _tail.load();
+        uint64_t n = tail - head < count ? tail - head : count;
+
+        if (n == 0) return 0;
+
+        uint64_t i = head % _size;
+
+        for (uint64_t done = 0; done < n; done++) {
+            items[done] = _array[i++];
+
+            if (i == _size) {
+                i = 0;
+            }
+        }
+
+        _head.store(head + n);
+        wake(_producerWaiting, _space);
+
+        return n;
+    }
+
+    size_t dequeueObjectsAndWait(uint64_t *items, size_t count) {
+        size_t n;
+
+        while (!(n = dequeueObjects(items, count))) {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+
+            waitUnless(_consumerWaiting, _items, [&] { return _tail.load() != head; });
+        }
+
+        return n;
+    }
+
+private:
+    template <typename Ready>
+    static void waitUnless(std::atomic<int32_t> &waiting, Semaphore &semaphore, Ready ready) {
+        waiting.store(1);
+
+        if (!ready()) {
+            semaphore.wait();
+        } else if (!waiting.exchange(0)) {
+            // the other side saw the flag and is signalling
+            semaphore.wait();
+        }
+    }
+
+    static void wake(std::atomic<int32_t> &waiting, Semaphore &semaphore) {
+        if (waiting.load() && waiting.exchange(0)) {
+            semaphore.signal();
+        }
+    }
+
+    alignas(FIFO_CACHE_LINE) std::atomic<uint64_t> _tail{0};
+    std::atomic<int32_t> _producerWaiting{0};
+
+    alignas(FIFO_CACHE_LINE) std::atomic<uint64_t> _head{0};
+    std::atomic<int32_t> _consumerWaiting{0};
+
+    alignas(FIFO_CACHE_LINE) uint64_t *_array;
+    uint64_t _size;
+
+    Semaphore _space;
+    Semaphore _items;
+};
+
+#pragma mark Benchmark
+
+template <typename Fifo>
+struct Producer {
+    Fifo *fifo;
+    uint64_t total;
+    size_t batch;
+
+    static void *run(void *p) {
+        Producer *producer = (Producer *)p;
+        uint64_t items[64];
+
+        for (uint64_t v = 0; v < producer->total; v += producer->batch) {
+            for (size_t i = 0; i < producer->batch; i++) {
+                items[i] = v + i;
+            }
+            producer->fifo->enqueueObjects(items, producer->batch);
+        }
+
+        return NULL;
+    }
+};
+
+template <typename Fifo>
+static bool run(const char *name, size_t batch, uint64_t total)
+{
+    Fifo *fifo = new Fifo(FIFO_CAPACITY);
+    Producer<Fifo> producer = { fifo, total, batch };
+    uint64_t items[64], received = 0, sum = 0;
+    pthread_t thread;
+
+    double start = now();
+    pthread_create(&thread, NULL, Producer<Fifo>::run, &producer);
+
+    while (received < total) {
+        size_t n = fifo->dequeueObjectsAndWait(items, batch);
+        for (size_t i = 0; i < n; i++) {
+            sum += items[i];
+        }
+        received += n;
+    }
+
+    pthread_join(thread, NULL);
+    double seconds = now() - start;
+    delete fifo;
+
+    bool valid = sum == total * (total - 1) / 2;
+    printf("  %-26s batch %2zu %8.1f M/s%s\n", name, batch, total / seconds / 1e6,
+           valid ? "" : ", items were lost");
+
+    return valid;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t total = (argc > 1 ? strtoull(argv[1], NULL, 10) : 10) * 1000000;
+    bool valid = true;
+
+    // whole batches, the items are summed to check that none is lost
+    total -= total % 64;
+
+    printf("%llu items through a fifo of %d\n", (unsigned long long)total, FIFO_CAPACITY);
+
+    for (size_t batch = 1; batch <= 64; batch *= 64) {
+        valid &= run<QueueFifo>("semaphore and serial queue", batch, total);
+        valid &= run<MutexFifo>("mutex", batch, total);
+        valid &= run<RingFifo>("ring", batch, total);
+    }
+
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,429 @@
+#!/usr/bin/env python3
+#
+# Writes the header fixtures of the bit_reader benchmark: avcC and hvcC
+# boxes, H.264 and HEVC sequence parameter sets, AC-3 and E-AC-3 frames
+# and AudioSpecificConfigs, with the fields and options the usual
+# encoders (x264, x265, Dolby and Apple encoders) write. The payloads of
+# the audio frames are random, only their headers are parsed.
+#
+# The fixtures are checked in, run it again only to change them.
+#
+# usage: make_fixtures.py [fixtures] [--seed 1]
+
+import argparse
+import os
+import random
+
+
+class BitWriter:
+    def __init__(self):
+        self.bits = []
+
+    def u(self, value, count):
+        for i in reversed(range(count)):
+            self.bits.append((value >> i) & 1)
+        return self
+
+    def ue(self, value):
+        value += 1
+        count = value.bit_length()
+        return self.u(0, count - 1).u(value, count)
+
+    def se(self, value):
+        return self.ue(2 * value - 1 if value > 0 else -2 * value)
+
+    def trailing(self):
+        self.u(1, 1)
+        return self.align()
+
+    def align(self):
+        while len(self.bits) % 8:
+            self.bits.append(0)
+        return self
+
+    def bytes(self):
+        self.align()
+        return bytes(int(''.join(map(str, self.bits[i:i + 8])), 2)
+                     for i in range(0, len(self.bits), 8))
+
+
+def escape(rbsp):
+    """Inserts the emulation prevention bytes of a NAL unit."""
+    out = bytearray()
+    zeros = 0
+    for byte in rbsp:
+        if zeros >= 2 and byte <= 3:
+            out.append(3)
+            zeros = 0
+        out.append(byte)
+        zeros = zeros + 1 if byte == 0 else 0
+    return bytes(out)
+
+
+# H.264
+
+def h264_sps(profile, level, width, height, interlaced=False, scaling=False,
+             poc_type=0, vui=True):
+    w = BitWriter()
+    w.u(profile, 8).u(0, 8).u(level, 8).ue(0)
+    if profile in (100, 110, 122, 144):
+        w.ue(1).ue(0).ue(0).u(0, 1)
+        w.u(1 if scaling else 0, 1)
+        if scaling:
+            for ix in range(8):
+                w.u(1, 1)
+                # a flat matrix, a delta of 8 then zeros
+                w.se(8)
+                for _ in range(1, 16 if ix < 6 else 64):
+                    w.se(0)
+    w.ue(0).ue(poc_type)
+    if poc_type == 0:
+        w.ue(2)
+    elif poc_type == 1:
+        w.u(0, 1).se(-2).se(0).ue(2).se(2).se(2)
+    w.ue(4).u(0, 1)
+    mbs_width = (width + 15) // 16
+    map_units = (height + (31 if interlaced else 15)) // (32 if interlaced else 16)
+    w.ue(mbs_width - 1).ue(map_units - 1)
+    w.u(0 if interlaced else 1, 1)
+    if interlaced:
+        w.u(1, 1)
+    w.u(1, 1)
+    crop = map_units * (32 if interlaced else 16) - height
+    w.u(1 if crop else 0, 1)
+    if crop:
+        w.ue(0).ue(0).ue(0).ue(crop // (4 if interlaced else 2))
+    w.u(1 if vui else 0, 1)
+    if vui:
+        w.u(1, 1).u(1, 8)                   # aspect_ratio_idc 1:1
+        w.u(0, 1)                           # overscan_info_present_flag
+        w.u(1, 1).u(5, 3).u(0, 1).u(1, 1)   # video_signal_type, colour
+        w.u(1, 8).u(1, 8).u(1, 8)
+        w.u(0, 1)                           # chroma_loc_info_present_flag
+        w.u(1, 1).u(1001, 32).u(60000, 32).u(0, 1)
+        w.u(1 if interlaced else 0, 1)      # nal_hrd_parameters_present_flag
+        if interlaced:
+            w.ue(0).u(4, 4).u(6, 4)
+            w.ue(24999).ue(29999).u(0, 1)
+            w.u(23, 5).u(23, 5).u(23, 5).u(24, 5)
+        w.u(0, 1)                           # vcl_hrd_parameters_present_flag
+        if interlaced:
+            w.u(0, 1)                       # low_delay_hrd_flag
+        w.u(1 if interlaced else 0, 1)      # pic_struct_present_flag
+        w.u(1, 1).u(1, 1).ue(0).ue(0).ue(11).ue(11).ue(2).ue(4)
+    w.trailing()
+    return bytes([0x67]) + escape(w.bytes())
+
+
+def h264_pps():
+    w = BitWriter()
+    w.ue(0).ue(0).u(1, 1).u(0, 1).ue(0).ue(2).ue(0).u(1, 1).u(2, 2)
+    w.se(-3).se(0).se(-2).u(1, 1).u(0, 1).u(0, 1)
+    w.u(1, 1).u(0, 1).se(-2)
+    w.trailing()
+    return bytes([0x68]) + escape(w.bytes())
+
+
+def avcC(sps, pps):
+    box = bytes([1, sps[1], sps[2], sps[3], 0xFF, 0xE1])
+    box += len(sps).to_bytes(2, 'big') + sps
+    box += bytes([1]) + len(pps).to_bytes(2, 'big') + pps
+    if sps[1] in (100, 110, 122, 144):
+        box += bytes([0xFD, 0xF8, 0xF8, 0])
+    return box
+
+
+# HEVC
+
+def hevc_profile_tier_level(w, profile, level):
+    w.u(0, 2).u(0, 1).u(profile, 5)
+    w.u(1 << (31 - profile) | (1 << 29 if profile == 1 else 0), 32)
+    w.u(1, 1).u(0, 1).u(0, 1).u(1, 1).u(0, 44)
+    w.u(level, 8)
+
+
+def hevc_vps(profile, level):
+    w = BitWriter()
+    w.u(0x4001, 16).u(0, 4).u(1, 1).u(1, 1).u(0, 6).u(0, 3).u(1, 1).u(0xFFFF, 16)
+    hevc_profile_tier_level(w, profile, level)
+    w.u(1, 1).ue(4).ue(2).ue(0)
+    w.u(0, 6).ue(0).u(0, 1).u(0, 1)
+    w.trailing()
+    return escape(w.bytes())
+
+
+def hevc_sps(profile, level, width, height, bit_depth, hdr, scaling=False):
+    w = BitWriter()
+    w.u(0x4201, 16).u(0, 4).u(0, 3).u(1, 1)
+    hevc_profile_tier_level(w, profile, level)
+    coded_height = (height + 7) // 8 * 8
+    w.ue(0).ue(1).ue(width).ue(coded_height)
+    w.u(1 if coded_height != height else 0, 1)
+    if coded_height != height:
+        w.ue(0).ue(0).ue(0).ue((coded_height - height) // 2)
+    w.ue(bit_depth - 8).ue(bit_depth - 8).ue(4)
+    w.u(1, 1).ue(4).ue(2).ue(0)
+    w.ue(0).ue(3).ue(0).ue(3).ue(3).ue(3)
+    w.u(1 if scaling else 0, 1)
+    if scaling:
+        w.u(1, 1)
+        for size in range(4):
+            for matrix in range(0, 6, 3 if size == 3 else 1):
+                if matrix and size < 3:
+                    w.u(0, 1).ue(1)     # copies the previous matrix
+                    continue
+                w.u(1, 1)
+                if size > 1:
+                    w.se(8)
+                w.se(8)
+                for _ in range(1, min(64, 1 << (4 + (size << 1)))):
+                    w.se(0)
+    w.u(0, 1).u(1, 1).u(0, 1)
+    # x265 writes the reference picture sets of its GOP in the SPS
+    sets = [(1, 0), (2, 0), (3, 0), (1, 1), (2, 1)]
+    w.ue(len(sets))
+    for ix, (negative, positive) in enumerate(sets):
+        if ix:
+            w.u(0, 1)
+        w.ue(negative).ue(positive)
+        for _ in range(negative + positive):
+            w.ue(0).u(1, 1)
+    w.u(0, 1).u(1, 1).u(1, 1)
+    w.u(1, 1)                               # vui_parameters_present_flag
+    w.u(1, 1).u(1, 8)
+    w.u(0, 1)
+    w.u(1, 1).u(5, 3).u(0, 1).u(1, 1)
+    if hdr:
+        w.u(9, 8).u(16, 8).u(9, 8)
+    else:
+        w.u(1, 8).u(1, 8).u(1, 8)
+    w.u(1, 1).ue(2).ue(2)
+    w.u(0, 1).u(0, 1).u(0, 1).u(0, 1)
+    w.u(1, 1).u(1001, 32).u(24000, 32).u(0, 1).u(0, 1)
+    w.u(1, 1).u(0, 1).u(1, 1).u(1, 1).ue(0).ue(2).ue(1).ue(15).ue(15)
+    w.u(0, 1)                               # sps_extension_present_flag
+    w.trailing()
+    return escape(w.bytes())
+
+
+def hevc_pps():
+    w = BitWriter()
+    w.u(0x4401, 16).ue(0).ue(0).u(0, 1).u(0, 1).u(0, 3).u(1, 1).u(0, 1)
+    w.ue(0).ue(0).se(0).u(0, 1).u(0, 1).u(1, 1).ue(1).se(0).se(0)
+    w.u(0, 1).u(1, 1).u(0, 1).u(0, 1).u(0, 1).u(1, 1).u(0, 1)
+    w.u(1, 1).u(0, 1).u(0, 1).se(0).se(0)
+    w.u(0, 1).u(0, 1).ue(0).u(0, 1).u(0, 1)
+    w.trailing()
+    return escape(w.bytes())
+
+
+X265_OPTIONS = (
+    'x265 (build 199) - 3.5+1-f0c1022b6:[Mac OS X][clang 14.0.0][64 bit] '
+    '{depth}bit - H.265/HEVC codec - Copyright 2013-2018 (c) Multicoreware, '
+    'Inc - http://x265.org - options: cpuid=1111039 frame-threads=4 '
+    'numa-pools=10 wpp no-pmode no-pme no-psnr no-ssim log-level=2 '
+    'input-csp=1 input-res={width}x{height} interlace=0 total-frames=0 '
+    'level-idc=0 high-tier=1 uhd-bd=0 ref=4 no-allow-non-conformance '
+    'no-repeat-headers annexb no-aud no-eob no-eos no-hrd info hash=0 '
+    'temporal-layers=0 open-gop min-keyint=23 keyint=240 gop-lookahead=0 '
+    'bframes=4 b-adapt=2 b-pyramid bframe-bias=0 rc-lookahead=25 '
+    'lookahead-slices=4 scenecut=40 no-hist-scenecut radl=0 no-splice '
+    'no-intra-refresh ctu=64 min-cu-size=8 rect no-amp max-tu-size=32 '
+    'tu-inter-depth=1 tu-intra-depth=1 limit-tu=0 rdoq-level=2 '
+    'dynamic-rd=0.00 no-ssim-rd signhide no-tskip nr-intra=0 nr-inter=0 '
+    'no-constrained-intra strong-intra-smoothing max-merge=3 '
+    'limit-refs=3 limit-modes me=3 subme=3 merange=57 temporal-mvp '
+    'no-frame-dup no-hme weightp no-weightb no-analyze-src-pics '
+    'deblock=0:0 sao no-sao-non-deblock rd=4 selective-sao=4 '
+    'no-early-skip rskip=1 no-fast-intra no-tskip-fast no-cu-lossless '
+    'b-intra no-splitrd-skip rdpenalty=0 psy-rd=2.00 psy-rdoq=1.00 '
+    'no-rd-refine no-lossless cbqpoffs=0 crqpoffs=0 rc=crf crf=18.0 '
+    'qcomp=0.60 qpstep=4 stats-write=0 stats-read=0 ipratio=1.40 '
+    'pbratio=1.30 aq-mode=2 aq-strength=1.00 cutree zone-count=0 '
+    'no-strict-cbr qg-size=32 no-rc-grain qpmax=69 qpmin=0 '
+    'no-const-vbv sar=1 overscan=0 videoformat=5 range=0 colorprim={prim} '
+    'transfer={transfer} colormatrix={matrix} chromaloc=1 '
+    'chromaloc-top=2 chromaloc-bottom=2 display-window=0 cll=0,0 '
+    'min-luma=0 max-luma={max_luma} log2-max-poc-lsb=8 vui-timing-info '
+    'vui-hrd-info slices=1 no-opt-qp-pps no-opt-ref-list-length-pps '
+    'no-multi-pass-opt-rps scenecut-bias=0.05 hist-threshold=0.03 '
+    'no-opt-cu-delta-qp no-aq-motion no-hdr10 no-hdr10-opt '
+    'no-dhdr10-opt no-idr-recovery-sei analysis-reuse-level=0 '
+    'analysis-save-reuse-level=0 analysis-load-reuse-level=0 '
+    'scale-factor=0 refine-intra=0 refine-inter=0 refine-mv=1 '
+    'refine-ctu-distortion=0 no-limit-sao ctu-info=0 no-lowpass-dct '
+    'refine-analysis-type=0 copy-pic=1 max-ausize-factor=1.0 '
+    'no-dynamic-refine no-single-sei no-hevc-aq no-svt no-field '
+    'qp-adaptation-range=1.00 scenecut-aware-qp=0conformance-window-offsets '
+    'right=0 bottom=0 decoder-max-rate=0 no-vbv-live-multi-pass')
+
+
+def hevc_sei(depth, width, height, hdr):
+    options = X265_OPTIONS.format(
+        depth=depth, width=width, height=height,
+        prim=9 if hdr else 1, transfer=16 if hdr else 1,
+        matrix=9 if hdr else 1, max_luma=(1 << depth) - 1)
+    # user_data_unregistered, with the UUID of x265
+    payload = bytes.fromhex('2ca2de09b51747dbbb55a4fe7fc2fc4e')
+    payload += options.encode() + b'\0'
+    size = len(payload)
+    sei = bytes([0x4E, 0x01, 5])
+    sei += b'\xff' * (size // 255) + bytes([size % 255])
+    return sei + escape(payload) + b'\x80'
+
+
+def hvcC(vps, sps, pps, sei, profile, level, bit_depth):
+    box = bytes([1, profile])
+    box += (1 << (31 - profile) | (1 << 29 if profile == 1 else 0)).to_bytes(4, 'big')
+    box += bytes([0x90, 0, 0, 0, 0, 0, level])
+    box += bytes([0xF0, 0, 0xFC, 0xFD, 0xF8 | (bit_depth - 8), 0xF8 | (bit_depth - 8)])
+    box += bytes([0, 0, 0x0F])
+    arrays = [(32, vps), (33, sps), (34, pps), (39, sei)]
+    box += bytes([len(arrays)])
+    for nal_type, nal in arrays:
+        box += bytes([0x80 | nal_type]) + (1).to_bytes(2, 'big')
+        box += len(nal).to_bytes(2, 'big') + nal
+    return box
+
+
+# AC-3 and E-AC-3
+
+AC3_BITRATES = [32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+                320, 384, 448, 512, 576, 640]
+
+
+def ac3_frame(rng, acmod, lfeon, bitrate):
+    # at 48 kHz, a frame of 1536 samples is 4 bytes per kbit/s
+    w = BitWriter()
+    size = bitrate * 4
+    w.u(0x0B77, 16).u(rng.getrandbits(16), 16).u(0, 2).u(AC3_BITRATES.index(bitrate) * 2, 6)
+    w.u(8, 5).u(0, 3).u(acmod, 3)
+    if acmod & 1 and acmod != 1:
+        w.u(0, 2)
+    if acmod & 4:
+        w.u(0, 2)
+    if acmod == 2:
+        w.u(0, 2)
+    w.u(lfeon, 1).u(27, 5).u(0, 1).u(0, 1).u(1, 1).u(22, 5).u(0, 2)
+    w.u(0, 1).u(1, 1).u(0, 1).u(0, 1).u(0, 1)
+    header = w.bytes()
+    return header + rng.randbytes(size - len(header))
+
+
+def eac3_frame(rng, strmtyp, substreamid, size, acmod, lfeon,
+               chanmap=None, joc=None):
+    w = BitWriter()
+    w.u(0x0B77, 16).u(strmtyp, 2).u(substreamid, 3).u(size // 2 - 1, 11)
+    w.u(0, 2).u(3, 2).u(acmod, 3).u(lfeon, 1).u(16, 5)
+    w.u(27, 5).u(0, 1)                      # dialnorm, compre
+    if acmod == 0:
+        w.u(27, 5).u(0, 1)
+    if strmtyp == 1:
+        w.u(1 if chanmap else 0, 1)
+        if chanmap:
+            w.u(chanmap, 16)
+    w.u(1, 1)                               # mixmdate
+    if acmod > 2:
+        w.u(1, 2)
+    if acmod & 1 and acmod > 2:
+        w.u(4, 3).u(4, 3)
+    if acmod & 4:
+        w.u(4, 3).u(4, 3)
+    if lfeon:
+        w.u(1, 1).u(10, 5)
+    if strmtyp == 0:
+        w.u(0, 1)                           # pgmscle
+        if acmod == 0:
+            w.u(0, 1)
+        w.u(0, 1)                           # extpgmscle
+        w.u(0, 2)                           # mixdef
+        if acmod < 2:
+            w.u(0, 1)
+            if acmod == 0:
+                w.u(0, 1)
+        w.u(0, 1)                           # frmmixcfginfoe
+    w.u(1, 1)                               # infomdate
+    w.u(0, 3).u(1, 1).u(1, 1)
+    if acmod == 2:
+        w.u(0, 2).u(0, 2)
+    if acmod >= 6:
+        w.u(0, 2)
+    w.u(1, 1).u(25, 5).u(1, 2).u(0, 1)
+    if acmod == 0:
+        w.u(0, 1)
+    w.u(0, 1)                               # sourcefscod
+    w.u(1 if joc is not None else 0, 1)     # addbsie
+    if joc is not None:
+        # flag_ec3_extension_type_a and complexity_index_type_a
+        w.u(1, 6).u(1, 8).u(joc, 8)
+    header = w.bytes()
+    return header + rng.randbytes(size - len(header))
+
+
+# AudioSpecificConfig
+
+def asc(object_type, rate_index, channels, sbr=None, sync=None):
+    w = BitWriter()
+    w.u(object_type, 5).u(rate_index, 4).u(channels, 4)
+    if object_type in (5, 29):
+        w.u(sbr, 4).u(2, 5)
+    w.u(0, 1).u(0, 1).u(0, 1)               # GASpecificConfig
+    if sync is not None:
+        # backward compatible signalling of SBR, with the sync extension
+        w.u(0x2B7, 11).u(5, 5).u(1 if sync else 0, 1)
+        if sync:
+            w.u(sync, 4)
+    return w.bytes()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('directory', nargs='?', default='fixtures')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    rng = random.Random(args.seed)
+
+    fixtures = {}
+
+    for name, sps in (
+            ('h264-high-1080p', h264_sps(100, 40, 1920, 1080)),
+            ('h264-high-1080i', h264_sps(100, 40, 1920, 1080, interlaced=True)),
+            ('h264-high-cqm-720p', h264_sps(100, 31, 1280, 720, scaling=True, poc_type=1)),
+            ('h264-main-576p', h264_sps(77, 30, 720, 576, poc_type=2, vui=False))):
+        fixtures[name + '.264'] = b'\0\0\0\1' + sps
+        fixtures[name + '.avcC'] = avcC(sps, h264_pps())
+
+    for name, profile, level, width, height, depth, hdr, scaling in (
+            ('hevc-main10-2160p-hdr', 2, 153, 3840, 2160, 10, True, False),
+            ('hevc-main-1080p', 1, 120, 1920, 1080, 8, False, False),
+            ('hevc-main-720p-cqm', 1, 93, 1280, 720, 8, False, True)):
+        sps = hevc_sps(profile, level, width, height, depth, hdr, scaling)
+        fixtures[name + '.265'] = sps
+        fixtures[name + '.hvcC'] = hvcC(hevc_vps(profile, level), sps, hevc_pps(),
+                                        hevc_sei(depth, width, height, hdr),
+                                        profile, level, depth)
+
+    fixtures['ac3-5.1-448k.ac3'] = ac3_frame(rng, 7, 1, 448)
+    fixtures['ac3-2.0-640k.ac3'] = ac3_frame(rng, 2, 0, 640)
+    fixtures['eac3-2.0-224k.ec3'] = eac3_frame(rng, 0, 0, 896, 2, 0)
+    fixtures['eac3-5.1-640k.ec3'] = eac3_frame(rng, 0, 0, 2560, 7, 1)
+    # 7.1, the back surrounds in a dependent substream
+    fixtures['eac3-7.1-1024k.ec3'] = (eac3_frame(rng, 0, 0, 2560, 7, 1) +
+                                     eac3_frame(rng, 1, 0, 1536, 6, 0, chanmap=0x1A00))
+    fixtures['eac3-5.1-joc-768k.ec3'] = eac3_frame(rng, 0, 0, 3072, 7, 1, joc=16)
+
+    fixtures['aac-lc-2.0-48k.esds'] = asc(2, 3, 2)
+    fixtures['aac-lc-5.1-48k.esds'] = asc(2, 3, 6)
+    fixtures['aac-lc-2.0-44k-sync.esds'] = asc(2, 4, 2, sync=0)
+    fixtures['he-aac-2.0-48k-sync.esds'] = asc(2, 6, 2, sync=3)
+    fixtures['he-aac-2.0-48k.esds'] = asc(5, 6, 2, sbr=3)
+    fixtures['he-aacv2-2.0-48k.esds'] = asc(29, 6, 1, sbr=3)
+
+    os.makedirs(args.directory, exist_ok=True)
+    for name, data in sorted(fixtures.items()):
+        with open(os.path.join(args.directory, name), 'wb') as f:
+            f.write(data)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+#
+# Writes a synthetic Matroska file for the benchmarks: an H.264 like video
+# track in SimpleBlocks, a laced AAC like audio track in BlockGroups and a
+# text track, one cluster per second, with or without Cues.
+#
+# usage: make_mkv.py out.mkv [--mb 200] [--no-cues] [--seed 1]
+
+import argparse
+import random
+import struct
+
+
+def vint(n, length=None):
+    if length is None:
+        length = 1
+        while n >= (1 << (7 * length)) - 1:
+            length += 1
+    return ((1 << (7 * length)) | n).to_bytes(length, 'big')
+
+
+def element(id_, data):
+    return id_.to_bytes((id_.bit_length() + 7) // 8, 'big') + vint(len(data)) + data
+
+
+def uint(id_, value):
+    return element(id_, value.to_bytes(max(1, (value.bit_length() + 7) // 8), 'big'))
+
+
+def double(id_, value):
+    return element(id_, struct.pack('>d', value))
+
+
+def string(id_, value):
+    return element(id_, value.encode())
+
+
+def track(number, kind, codec, extra=b''):
+    return element(0xAE, uint(0xD7, number) + uint(0x73C5, number) +
+                   uint(0x83, kind) + string(0x86, codec) + extra)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('out')
+    parser.add_argument('--mb', type=float, default=200)
+    parser.add_argument('--no-cues', action='store_true')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    rnd = random.Random(args.seed)
+
+    header = element(0x1A45DFA3, uint(0x4286, 1) + uint(0x42F7, 1) + uint(0x42F2, 4) +
+                     uint(0x42F3, 8) + string(0x4282, 'matroska') +
+                     uint(0x4287, 4) + uint(0x4285, 2))
+
+    tracks = element(0x1654AE6B,
+                     track(1, 1, 'V_MPEG4/ISO/AVC', element(0xE0, uint(0xB0, 1920) + uint(0xBA, 1080))) +
+                     track(2, 2, 'A_AAC', element(0xE1, double(0xB5, 48000.0) + uint(0x9F, 2))) +
+                     track(3, 17, 'S_TEXT/UTF8'))
+
+    # 24 video frames per cluster, a keyframe first, and
+    # four laced audio frames every other video frame
+    clusters = []
+    size, time = 0, 0
+    while size < args.mb * 1024 * 1024:
+        body = uint(0xE7, time)
+        for k in range(24):
+            frame = rnd.randbytes(80000 if k == 0 else rnd.randint(5000, 20000))
+            body += element(0xA3, vint(1) + struct.pack('>h', k * 42) +
+                            bytes([0x80 if k == 0 else 0]) + frame)
+            if k % 2 == 0:
+                frames = [rnd.randbytes(rnd.randint(200, 700)) for _ in range(4)]
+                lacing = bytes([len(frames) - 1])
+                for f in frames[:-1]:
+                    lacing += b'\xff' * (len(f) // 255) + bytes([len(f) % 255])
+                body += element(0xA0, element(0xA1, vint(2) + struct.pack('>h', k * 42) +
+                                              bytes([0x02]) + lacing + b''.join(frames)))
+            if k == 12:
+                body += element(0xA0, element(0xA1, vint(3) + struct.pack('>h', k * 42) +
+                                              bytes([0x80]) + b'subtitle') + uint(0x9B, 1500))
+        clusters.append((time, element(0x1F43B675, body)))
+        size += len(clusters[-1][1])
+        time += 24 * 42
+
+    info = element(0x1549A966, uint(0x2AD7B1, 1000000) + double(0x4489, float(time)) +
+                   string(0x4D80, 'make_mkv') + string(0x5741, 'make_mkv') +
+                   element(0x73A4, bytes(range(16))))
+
+    # the SeekHead points to the Cues after the clusters,
+    # its size doesn't depend on the offset
+    def seek_head(position):
+        return element(0x114D9B74, element(0x4DBB, element(0x53AB, (0x1C53BB6B).to_bytes(4, 'big')) +
+                                           element(0x53AC, position.to_bytes(8, 'big'))))
+
+    head = info + tracks
+    cues = b''
+    if not args.no_cues:
+        position = len(seek_head(0)) + len(head)
+        points = b''
+        for time, cluster in clusters:
+            points += element(0xBB, uint(0xB3, time) + element(0xB7, uint(0xF7, 1) + uint(0xF1, position)))
+            position += len(cluster)
+        head = seek_head(position) + head
+        cues = element(0x1C53BB6B, points)
+
+    segment = head + b''.join(cluster for _, cluster in clusters) + cues
+
+    with open(args.out, 'wb') as out:
+        out.write(header + (0x18538067).to_bytes(4, 'big') + vint(len(segment), 8) + segment)
+
+
+if __name__ == '__main__':
+    main()
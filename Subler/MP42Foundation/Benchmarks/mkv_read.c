@@ -0,0 +1,140 @@
+/*
+ *  mkv_read.c
+ *  MP42Foundation Benchmarks
+ *
+ *  Demuxes every frame of Matroska files through the stdio InputStream
+ *  and through the memory-mapped one, and reports the best time of each.
+ *  Both must return the same frames.
+ *
+ *  usage: mkv_read [-r runs] file.mkv...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "MatroskaParser.h"
+#include "MatroskaFile.h"
+
+typedef struct ReadResult {
+	double          seconds;
+	unsigned long   frames;
+	uint64_t        bytes;
+	uint64_t        hash;
+} ReadResult;
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t hash(uint64_t h, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	size_t              i;
+
+	for (i = 0; i < size; i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+static int readFile(const char *path, int mapped, ReadResult *result)
+{
+	StdIoStream     *ioStream = calloc(1, sizeof(StdIoStream));
+	MatroskaFile    *mf;
+	unsigned        track, size, flags, additionalSize, additionalId;
+	ulonglong       startTime, endTime, filePos;
+	longlong        discardPadding;
+	char            *data, *additional;
+	double          start = now();
+
+	memset(result, 0, sizeof(*result));
+	result->hash = 1469598103934665603ULL;
+
+	mf = mapped ? openMatroskaFileMapped(path, ioStream) : openMatroskaFile(path, ioStream);
+	if (mf == NULL) {
+		closeMatroskaFile(NULL, ioStream);
+		return 0;
+	}
+
+	while (mkv_ReadFrame(mf, 0, &track, &startTime, &endTime, &filePos, &size, &data,
+	                     &flags, &discardPadding, &additionalSize, &additional, &additionalId) == 0) {
+		/* only the first bytes, the benchmark is about reading */
+		result->hash = hash(result->hash, &track, sizeof(track));
+		result->hash = hash(result->hash, &startTime, sizeof(startTime));
+		result->hash = hash(result->hash, &size, sizeof(size));
+		result->hash = hash(result->hash, data, size < 16 ? size : 16);
+		result->frames++;
+		result->bytes += size;
+
+		ioStream->base.memfree(&ioStream->base, data);
+		ioStream->base.memfree(&ioStream->base, additional);
+	}
+
+	closeMatroskaFile(mf, ioStream);
+	result->seconds = now() - start;
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char   *names[] = { "stdio", "mapped" };
+	int                 runs = 5, option, i, mapped, run, failed = 0;
+
+	while ((option = getopt(argc, argv, "r:")) != -1) {
+		if (option == 'r')
+			runs = atoi(optarg);
+		else {
+			fprintf(stderr, "usage: %s [-r runs] file.mkv...\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for (i = optind; i < argc; i++) {
+		struct stat st;
+		ReadResult  best[2];
+
+		if (stat(argv[i], &st) != 0) {
+			perror(argv[i]);
+			failed = 1;
+			continue;
+		}
+
+		printf("%s, %.1f MB\n", argv[i], st.st_size / 1e6);
+
+		for (mapped = 0; mapped < 2; mapped++) {
+			ReadResult  result;
+
+			/* the first read warms up the page cache */
+			if (!readFile(argv[i], mapped, &best[mapped])) {
+				fprintf(stderr, "%s: can't open\n", argv[i]);
+				failed = 1;
+				break;
+			}
+
+			for (run = 0; run < runs; run++) {
+				readFile(argv[i], mapped, &result);
+				if (result.seconds < best[mapped].seconds)
+					best[mapped] = result;
+			}
+
+			printf("  %-6s %8lu frames %8.3f s %8.1f MB/s\n", names[mapped], best[mapped].frames,
+			       best[mapped].seconds, st.st_size / best[mapped].seconds / 1e6);
+		}
+
+		if (mapped == 2 && (best[0].hash != best[1].hash || best[0].frames != best[1].frames)) {
+			printf("  the two streams returned different frames\n");
+			failed = 1;
+		}
+	}
+
+	return failed;
+}
@@ -15,20 +15,29 @@
 #import "MP42SampleBuffer.h"
 #import "MP42Track+Private.h"
 
+#include "syncframe.h"
+
+#define ADTS_HEADER_MAX_SIZE 10 /* bytes */
+
+/* ADTS parser state, one for each importer */
+typedef struct adts_parser_t {
+	int useOldFile;
+	int profileLevel;
+	u_int8_t firstHeader[ADTS_HEADER_MAX_SIZE];
+} adts_parser_t;
+
 MP42_OBJC_DIRECT_MEMBERS
 @implementation MP42AACImporter {
 @private
     FILE *inFile;
     int64_t size;
 
+    adts_parser_t parser;
+
     NSMutableData *aacInfo;
     u_int32_t samplesPerSecond;
 }
 
-
-static int aacUseOldFile = 0;
-static int aacProfileLevel = 4;
-
 #define MP4AV_AAC_MAIN_PROFILE	0
 #define MP4AV_AAC_LC_PROFILE	1
 #define MP4AV_AAC_SSR_PROFILE	2
@@ -42,7 +51,7 @@ static int aacProfileLevel = 4;
 #include <string.h>
 #include <inttypes.h>
 #include <sys/types.h>
-#include "mbs.h"
+#include "bitstream.h"
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -267,39 +276,43 @@ bool MP4AV_AdtsMakeFrame(
 {
 	*pAdtsDataLength = 7 + dataLength; // 56 bits only
     
-	CMemoryBitstream adts;
-    
-	try {
-		adts.AllocBytes(*pAdtsDataLength);
-		*ppAdtsData = adts.GetBuffer();
-        
-		// build adts header
-		adts.PutBits(0xFFF, 12);		// syncword
-		adts.PutBits(isMpeg2, 1);		// id
-		adts.PutBits(0, 2);				// layer
-		adts.PutBits(1, 1);				// protection_absent
-		adts.PutBits(profile, 2);		// profile
-		adts.PutBits(
-                     MP4AV_AdtsFindSamplingRateIndex(samplingFrequency),
-                     4);							// sampling_frequency_index
-		adts.PutBits(0, 1);				// private
-		adts.PutBits(channels, 3);		// channel_configuration
-		adts.PutBits(0, 1);				// original
-		adts.PutBits(0, 1);				// home
-        
-		adts.PutBits(0, 1);				// copyright_id
-		adts.PutBits(0, 1);				// copyright_id_start
-		adts.PutBits(*pAdtsDataLength, 13);	// aac_frame_length
-		adts.PutBits(0x7FF, 11);		// adts_buffer_fullness
-		adts.PutBits(0, 2);				// num_raw_data_blocks
-        
-		// copy audio frame data
-		adts.PutBytes(pData, dataLength);
+	uint8_t *buffer = (uint8_t *)calloc(*pAdtsDataLength, 1);
+	if (buffer == NULL) {
+		return false;
 	}
-	catch (...) {
+
+	bs_writer_t adts;
+	bs_writer_init(&adts, buffer, *pAdtsDataLength);
+
+	// build adts header
+	bs_write(&adts, 0xFFF, 12);		// syncword
+	bs_write(&adts, isMpeg2, 1);		// id
+	bs_write(&adts, 0, 2);				// layer
+	bs_write(&adts, 1, 1);				// protection_absent
+	bs_write(&adts, profile, 2);		// profile
+	bs_write(&adts,
+             MP4AV_AdtsFindSamplingRateIndex(samplingFrequency),
+             4);							// sampling_frequency_index
+	bs_write(&adts, 0, 1);				// private
+	bs_write(&adts, channels, 3);		// channel_configuration
+	bs_write(&adts, 0, 1);				// original
+	bs_write(&adts, 0, 1);				// home
+
+	bs_write(&adts, 0, 1);				// copyright_id
+	bs_write(&adts, 0, 1);				// copyright_id_start
+	bs_write(&adts, *pAdtsDataLength, 13);	// aac_frame_length
+	bs_write(&adts, 0x7FF, 11);		// adts_buffer_fullness
+	bs_write(&adts, 0, 2);				// num_raw_data_blocks
+
+	// copy audio frame data
+	bs_write_bytes(&adts, pData, dataLength);
+
+	if (bs_writer_error(&adts)) {
+		free(buffer);
 		return false;
 	}
-    
+
+	*ppAdtsData = buffer;
 	return true;
 }
 
@@ -520,9 +533,6 @@ extern "C" bool MP4AV_AacGetConfiguration_LATM (
 }
 
 
-#define ADTS_HEADER_MAX_SIZE 10 /* bytes */
-
-static u_int8_t firstHeader[ADTS_HEADER_MAX_SIZE];
 static u_int16_t OLD_MP4AV_AdtsGetFrameSize(u_int8_t* pHdr)
 {
 	/* extract the necessary fields from the header */
@@ -563,161 +573,174 @@ static u_int16_t OLD_MP4AV_AdtsGetHeaderByteSize(u_int8_t* pHdr)
 /* 
  * hdr must point to at least ADTS_HEADER_MAX_SIZE bytes of memory 
  */
-static bool LoadNextAdtsHeader(FILE* inFile, u_int8_t* hdr)
+static bool LoadNextAdtsHeader(const adts_parser_t* parser, syncframe_reader_t* reader, u_int8_t* hdr)
 {
-	u_int state = 0;
-	u_int dropped = 0;
-	u_int hdrByteSize = ADTS_HEADER_MAX_SIZE;
+	const u_int8_t* p;
+	u_int hdrByteSize, frameSize;
     
-	while (1) {
-		/* read a byte */
-		u_int8_t b;
-        
-		if (fread(&b, 1, 1, inFile) == 0) {
+	for (;;) {
+		/* look for 11111111 1111X00X */
+		if (!syncframe_reader_sync(reader, 0xFF, 0xF6, 0xF0)) {
 			return false;
 		}
+		p = syncframe_reader_peek(reader, 2);
         
-		/* header is complete, return it */
-		if (state == hdrByteSize - 1) {
-			hdr[state] = b;
-			if (dropped > 0) {
-#ifdef DEBUG
-                fprintf(stderr, "Warning: dropped %u input bytes at offset %ld\n", dropped,
-                        ftell(inFile) - dropped - state - 1);
-#endif
-			}
-			return true;
+		/* compute desired header size */
+		if (parser->useOldFile) {
+			hdrByteSize = OLD_MP4AV_AdtsGetHeaderByteSize((u_int8_t*)p);
+		} else {
+			hdrByteSize = MP4AV_AdtsGetHeaderByteSize((u_int8_t*)p);
 		}
         
-		/* collect requisite number of bytes, no constraints on data */
-		if (state >= 2) {
-			hdr[state++] = b;
+		p = syncframe_reader_peek(reader, hdrByteSize);
+		if (p == NULL) {
+			return false;
+		}
+        
+		if (parser->useOldFile) {
+			frameSize = OLD_MP4AV_AdtsGetFrameSize((u_int8_t*)p);
 		} else {
-			/* have first byte, check if we have 1111X00X */
-			if (state == 1) {
-				if ((b & 0xF6) == 0xF0) {
-					hdr[state] = b;
-					state = 2;
-					/* compute desired header size */
-					if (aacUseOldFile) {
-                        hdrByteSize = OLD_MP4AV_AdtsGetHeaderByteSize(hdr);
-					} else {
-                        hdrByteSize = MP4AV_AdtsGetHeaderByteSize(hdr);
-					}
-				} else {
-					state = 0;
-					dropped ++;
-				}
-			}
-			/* initial state, looking for 11111111 */
-			if (state == 0) {
-				if (b == 0xFF) {
-					hdr[state] = b;
-					state = 1;
-				} else {
-                    /* else drop it */ 
-					dropped++;
-					//					printf("%02x ", b);
-				}
-			}
+			frameSize = MP4AV_AdtsGetFrameSize((u_int8_t*)p);
+		}
+        
+		/* a frame shorter than its header comes from a false sync word,
+		 * a real one may start inside it */
+		if (frameSize < hdrByteSize) {
+			syncframe_reader_skip(reader, 1);
+			continue;
 		}
+        
+		memcpy(hdr, p, hdrByteSize);
+		syncframe_reader_skip(reader, hdrByteSize);
+        
+		return true;
 	}
 }
 
 /*
- * Load the next frame from the file
- * into the supplied buffer, which better be large enough!
- *
- * Note: Frames are padded to byte boundaries
+ * An ADTS frame found by ReadNextAacFrame, the payload points in the
+ * reader buffer and stays valid until the reader moves again
  */
-static bool LoadNextAacFrame(FILE* inFile, u_int8_t* pBuf, u_int32_t* pBufSize, bool stripAdts)
+typedef struct aac_frame_t {
+	u_int8_t hdr[ADTS_HEADER_MAX_SIZE];
+	u_int16_t hdrBitSize, hdrByteSize;
+	u_int16_t payloadSize;
+	const u_int8_t* payload;
+} aac_frame_t;
+
+static bool ReadNextAacFrame(const adts_parser_t* parser, syncframe_reader_t* reader, aac_frame_t* frame)
 {
 	u_int16_t frameSize;
-	u_int16_t hdrBitSize, hdrByteSize;
-	u_int8_t hdrBuf[ADTS_HEADER_MAX_SIZE];
     
-	/* get the next AAC frame header, more or less */
-	if (!LoadNextAdtsHeader(inFile, hdrBuf)) {
+	/* get the next AAC frame header */
+	if (!LoadNextAdtsHeader(parser, reader, frame->hdr)) {
 		return false;
 	}
-	
+    
 	/* get frame size from header */
-	if (aacUseOldFile) {
-        frameSize = OLD_MP4AV_AdtsGetFrameSize(hdrBuf);
-        /* get header size in bits and bytes from header */
-        hdrBitSize = OLD_MP4AV_AdtsGetHeaderBitSize(hdrBuf);
-        hdrByteSize = OLD_MP4AV_AdtsGetHeaderByteSize(hdrBuf);
+	if (parser->useOldFile) {
+		frameSize = OLD_MP4AV_AdtsGetFrameSize(frame->hdr);
+		/* get header size in bits and bytes from header */
+		frame->hdrBitSize = OLD_MP4AV_AdtsGetHeaderBitSize(frame->hdr);
+		frame->hdrByteSize = OLD_MP4AV_AdtsGetHeaderByteSize(frame->hdr);
 	} else {
-        frameSize = MP4AV_AdtsGetFrameSize(hdrBuf);
-        /* get header size in bits and bytes from header */
-        hdrBitSize = MP4AV_AdtsGetHeaderBitSize(hdrBuf);
-        hdrByteSize = MP4AV_AdtsGetHeaderByteSize(hdrBuf);
+		frameSize = MP4AV_AdtsGetFrameSize(frame->hdr);
+		/* get header size in bits and bytes from header */
+		frame->hdrBitSize = MP4AV_AdtsGetHeaderBitSize(frame->hdr);
+		frame->hdrByteSize = MP4AV_AdtsGetHeaderByteSize(frame->hdr);
 	}
     
-	
 	/* adjust the frame size to what remains to be read */
-	frameSize -= hdrByteSize;
+	frame->payloadSize = frameSize - frame->hdrByteSize;
+    
+	frame->payload = syncframe_reader_peek(reader, frame->payloadSize);
+	if (frame->payload == NULL) {
+		return false;
+	}
+	syncframe_reader_skip(reader, frame->payloadSize);
+    
+	return true;
+}
+
+/*
+ * Size of the sample CopyAacFrame writes
+ */
+static u_int32_t AacSampleSize(const aac_frame_t* frame, bool stripAdts)
+{
+	if (!stripAdts) {
+		return frame->hdrByteSize + frame->payloadSize;
+	}
+	/* a MPEG-4 ADTS header isn't byte aligned, its last bits start the sample */
+	return frame->payloadSize + ((frame->hdrBitSize % 8) != 0);
+}
+
+static void CopyAacFrame(const aac_frame_t* frame, bool stripAdts, u_int8_t* pBuf)
+{
+	u_int16_t frameSize = frame->payloadSize;
+	const u_int8_t* pFrame = frame->payload;
     
 	if (stripAdts) {
-		if ((hdrBitSize % 8) == 0) {
+		if ((frame->hdrBitSize % 8) == 0) {
 			/* header is byte aligned, i.e. MPEG-2 ADTS */
-			/* read the frame data into the buffer */
-			if (fread(pBuf, 1, frameSize, inFile) != frameSize) {
-				return false;
-			}
-			(*pBufSize) = frameSize;
+			memcpy(pBuf, pFrame, frameSize);
 		} else {
 			/* header is not byte aligned, i.e. MPEG-4 ADTS */
 			int i;
-			u_int8_t newByte;
-			int upShift = hdrBitSize % 8;
+			int upShift = frame->hdrBitSize % 8;
 			int downShift = 8 - upShift;
             
-			pBuf[0] = hdrBuf[hdrBitSize / 8] << upShift;
+			pBuf[0] = frame->hdr[frame->hdrBitSize / 8] << upShift;
             
 			for (i = 0; i < frameSize; i++) {
-				if (fread(&newByte, 1, 1, inFile) != 1) {
-					return false;
-				}
-				pBuf[i] |= (newByte >> downShift);
-				pBuf[i+1] = (newByte << upShift);
+				pBuf[i] |= (pFrame[i] >> downShift);
+				pBuf[i+1] = (pFrame[i] << upShift);
 			}
-			(*pBufSize) = frameSize + 1;
 		}
 	} else { /* don't strip ADTS headers */
-		memcpy(pBuf, hdrBuf, hdrByteSize);
-		if (fread(&pBuf[hdrByteSize], 1, frameSize, inFile) != frameSize) {
-			return false;
-		}
+		memcpy(pBuf, frame->hdr, frame->hdrByteSize);
+		memcpy(&pBuf[frame->hdrByteSize], pFrame, frameSize);
 	}
+}
+
+/*
+ * Load the next frame from the file into a new buffer
+ *
+ * Note: Frames are padded to byte boundaries
+ */
+static u_int8_t* LoadNextAacFrame(const adts_parser_t* parser, syncframe_reader_t* reader, u_int32_t* pBufSize, bool stripAdts)
+{
+	aac_frame_t frame;
+	u_int8_t* pBuf;
     
-	return true;
+	if (!ReadNextAacFrame(parser, reader, &frame)) {
+		return NULL;
+	}
+    
+	(*pBufSize) = AacSampleSize(&frame, stripAdts);
+	pBuf = (u_int8_t*)malloc(*pBufSize);
+	CopyAacFrame(&frame, stripAdts, pBuf);
+    
+	return pBuf;
 }
 
-static bool GetFirstHeader(FILE* inFile)
+static bool GetFirstHeader(adts_parser_t* parser, FILE* inFile)
 {
 	/* read file until we find an audio frame */
-	fpos_t curPos;
+	syncframe_reader_t reader;
+	bool found;
     
 	/* already read first header */
-	if (firstHeader[0] == 0xff) {
+	if (parser->firstHeader[0] == 0xff) {
 		return true;
 	}
     
-	/* remember where we are */
-	fgetpos(inFile, &curPos);
-	
-	/* go back to start of file */
-	rewind(inFile);
-    
-	if (!LoadNextAdtsHeader(inFile, firstHeader)) {
+	if (inFile == NULL || !syncframe_reader_open(&reader, inFile)) {
 		return false;
 	}
+	found = LoadNextAdtsHeader(parser, &reader, parser->firstHeader);
+	syncframe_reader_close(&reader);
     
-	/* reposition the file to where we were */
-	fsetpos(inFile, &curPos);
-    
-	return true;
+	return found;
 }
 
 + (NSArray<NSString *> *)supportedFileFormats {
@@ -733,20 +756,23 @@ static bool GetFirstHeader(FILE* inFile)
         newTrack.format = kMP42AudioCodecType_MPEG4AAC;
         newTrack.URL = self.fileURL;
 
+        parser.useOldFile = 0;
+        parser.profileLevel = 4;
+
         if (!inFile) {
             inFile = fopen(self.fileURL.fileSystemRepresentation, "rb");
         }
 
         struct stat st;
         stat(self.fileURL.fileSystemRepresentation, &st);
-        size = st.st_size * 8;
+        size = st.st_size;
 
         // collect all the necessary meta information
         u_int8_t mpegVersion;
         u_int8_t profile;
         u_int8_t channelConfig;
 
-        if (!GetFirstHeader(inFile)) {
+        if (!GetFirstHeader(&parser, inFile)) {
             if (outError) {
                 *outError = MP42Error(MP42LocalizedString(@"The audio could not be opened.", @"error message"),
                                       MP42LocalizedString(@"Data in file doesn't appear to be valid audio.", @"error message"), 100);
@@ -754,10 +780,10 @@ static bool GetFirstHeader(FILE* inFile)
             return nil;
         }
 
-        samplesPerSecond = MP4AV_AdtsGetSamplingRate(firstHeader);
-        mpegVersion = MP4AV_AdtsGetVersion(firstHeader);
-        profile = MP4AV_AdtsGetProfile(firstHeader);
-        if (aacProfileLevel == 2) {
+        samplesPerSecond = MP4AV_AdtsGetSamplingRate(parser.firstHeader);
+        mpegVersion = MP4AV_AdtsGetVersion(parser.firstHeader);
+        profile = MP4AV_AdtsGetProfile(parser.firstHeader);
+        if (parser.profileLevel == 2) {
             if (profile > MP4_MPEG4_AAC_SSR_AUDIO_TYPE) {
                 if (outError) {
                     *outError = MP42Error(MP42LocalizedString(@"The audio could not be opened.", @"error message"),
@@ -766,10 +792,10 @@ static bool GetFirstHeader(FILE* inFile)
                 return nil;
             }
             mpegVersion = 1;
-        } else if (aacProfileLevel == 4) {
+        } else if (parser.profileLevel == 4) {
             mpegVersion = 0;
         }
-        channelConfig = MP4AV_AdtsGetChannels(firstHeader);
+        channelConfig = MP4AV_AdtsGetChannels(parser.firstHeader);
         
         //u_int8_t audioType = MP4_INVALID_AUDIO_TYPE;
         switch (mpegVersion) {
@@ -844,34 +870,45 @@ static bool GetFirstHeader(FILE* inFile)
         MP4TrackId trackId = self.inputTracks.lastObject.sourceId;
 
         // parse the ADTS frames, and write the MP4 samples
-        u_int8_t sampleBuffer[8 * 1024];
-        u_int32_t sampleSize = sizeof(sampleBuffer);
+        syncframe_reader_t reader;
+        MP42SampleBuffer *samples[64];
+        NSUInteger count = 0;
+        aac_frame_t frame;
         MP4SampleId sampleId = 1;
 
-        int64_t currentSize = 0;
-
-        while (LoadNextAacFrame(inFile, sampleBuffer, &sampleSize, true) && !self.isCancelled) {
-            MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
+        if (inFile == NULL || !syncframe_reader_open(&reader, inFile)) {
+            [self setDone];
+            return;
+        }
 
-            void * sampleDataBuffer = malloc(sampleSize);
-            memcpy(sampleDataBuffer, sampleBuffer, sampleSize);
+        while (!self.isCancelled && ReadNextAacFrame(&parser, &reader, &frame)) {
+            MP42SampleBuffer *sample = [self newSampleWithSize:AacSampleSize(&frame, true)];
 
-            sample->data = sampleDataBuffer;
-            sample->size = sampleSize;
+            CopyAacFrame(&frame, true, (u_int8_t *)sample->data);
             sample->duration = MP4_INVALID_DURATION;
             sample->offset = 0;
             sample->flags |= MP42SampleBufferFlagIsSync;
             sample->trackId = trackId;
 
-            [self enqueue:sample];
+            samples[count++] = sample;
+            if (count == 64) {
+                [self enqueueSamples:samples count:count];
+                // the muxer could recycle them, don't keep them alive
+                for (NSUInteger i = 0; i < count; i++) {
+                    samples[i] = nil;
+                }
+                count = 0;
+            }
 
             sampleId++;
-            sampleSize = sizeof(sampleBuffer);
-            
-            currentSize += sampleSize;
-            self.progress = (currentSize / (CGFloat) size) * 100;
+
+            self.progress = (reader.pos / (CGFloat) size) * 100;
         }
-        
+
+        [self enqueueSamples:samples count:count];
+
+        syncframe_reader_close(&reader);
+
         [self setDone];
     }
 }
@@ -18,6 +18,8 @@
 
 #include <sys/stat.h>
 
+#include "syncframe.h"
+
 #define AC3_HEADER_MAX_SIZE 10 /* bytes */
 #define NUM_AC3_SAMPLING_RATES 4
 #define NUM_AC3_FRAMECODE_SIZES 19 * 2
@@ -28,6 +30,8 @@ MP42_OBJC_DIRECT_MEMBERS
     FILE *inFile;
     int64_t size;
 
+    u_int8_t firstHeader[AC3_HEADER_MAX_SIZE];
+
     NSMutableData *ac3Info;
     u_int32_t samplesPerSecond;
 }
@@ -79,13 +83,6 @@ u_int32_t Ac3FrameSize[NUM_AC3_FRAMECODE_SIZES][4] = {
     {640, 1920, 1394, 1280},
 };
 
-static u_int8_t firstHeader[AC3_HEADER_MAX_SIZE];
-
-static u_int16_t MP4AV_Ac3GetHeaderBitSize(u_int8_t* pHdr)
-{
-	return AC3_HEADER_MAX_SIZE * 8;
-}
-
 static u_int16_t MP4AV_Ac3GetHeaderByteSize(u_int8_t* pHdr)
 {
 	return AC3_HEADER_MAX_SIZE;
@@ -117,154 +114,127 @@ static u_int16_t MP4AV_Ac3GetFrameSize(u_int8_t* pHdr)
 /* 
  * hdr must point to at least Ac3_HEADER_MAX_SIZE bytes of memory 
  */
-static bool LoadNextAc3Header(FILE* inFile, u_int8_t* hdr)
+static bool LoadNextAc3Header(syncframe_reader_t* reader, u_int8_t* hdr)
 {
-	u_int state = 0;
-	u_int dropped = 0;
+	const u_int8_t* p;
 	u_int hdrByteSize = AC3_HEADER_MAX_SIZE;
     
-	while (1) {
-		/* read a byte */
-		u_int8_t b;
-        
-		if (fread(&b, 1, 1, inFile) == 0) {
+	for (;;) {
+		/* look for 0000 1011 0111 0111 */
+		if (!syncframe_reader_sync(reader, 0x0B, 0xFF, 0x77)) {
 			return false;
 		}
         
-		/* header is complete, return it */
-		if (state == hdrByteSize - 1) {
-			hdr[state] = b;
-			if (dropped > 0) {
-#ifdef DEBUG
-                fprintf(stderr, "Warning: dropped %u input bytes at offset %ld\n", dropped,
-                        ftell(inFile) - dropped - state - 1);
-#endif
-			}
-			return true;
+		p = syncframe_reader_peek(reader, hdrByteSize);
+		if (p == NULL) {
+			return false;
 		}
         
-		/* collect requisite number of bytes, no constraints on data */
-		if (state >= 2) {
-			hdr[state++] = b;
-		} else {
-			/* have first byte, check if we have 0111 0111 */
-			if (state == 1) {
-				if (b == 0x77) {
-					hdr[state] = b;
-					state = 2;
-					/* compute desired header size */
-					hdrByteSize = MP4AV_Ac3GetHeaderByteSize(hdr);
-				} else {
-					state = 0;
-					dropped ++;
-				}
-			}
-			/* initial state, looking for 0000 1011 */
-			if (state == 0) {
-				if (b == 0x0B) {
-					hdr[state] = b;
-					state = 1;
-				} else {
-                    /* else drop it */ 
-					dropped++;
-					//					printf("%02x ", b);
-				}
-			}
+		/* a reserved sampling rate or a frame size code past the table
+		 * comes from a false sync word, a real one may start inside it */
+		if (MP4AV_Ac3GetSamplingRateIndex((u_int8_t*)p) == 3 ||
+		    MP4AV_Ac3GetFrameSizeCode((u_int8_t*)p) >= NUM_AC3_FRAMECODE_SIZES) {
+			syncframe_reader_skip(reader, 1);
+			continue;
 		}
+        
+		memcpy(hdr, p, hdrByteSize);
+		syncframe_reader_skip(reader, hdrByteSize);
+        
+		return true;
 	}
 }
 
 /*
- * Load the next frame from the file
- * into the supplied buffer, which better be large enough!
- *
- * Note: Frames are padded to byte boundaries
+ * An AC-3 frame found by ReadNextAc3Frame, the payload points in the
+ * reader buffer and stays valid until the reader moves again
  */
-static bool LoadNextAc3Frame(FILE* inFile, u_int8_t** pBuf, size_t* pBufSize, bool stripAc3)
+typedef struct ac3_frame_t {
+	u_int8_t hdr[AC3_HEADER_MAX_SIZE];
+	u_int16_t hdrByteSize;
+	u_int16_t payloadSize;
+	const u_int8_t* payload;
+} ac3_frame_t;
+
+static bool ReadNextAc3Frame(syncframe_reader_t* reader, ac3_frame_t* frame)
 {
-	u_int16_t frameSize;
-	u_int16_t hdrBitSize, hdrByteSize;
-	u_int8_t hdrBuf[AC3_HEADER_MAX_SIZE];
-    
-	/* get the next Ac3 frame header, more or less */
-	if (!LoadNextAc3Header(inFile, hdrBuf)) {
+	/* get the next Ac3 frame header */
+	if (!LoadNextAc3Header(reader, frame->hdr)) {
 		return false;
 	}
 	
-	/* get frame size from header */
-	frameSize = MP4AV_Ac3GetFrameSize(hdrBuf);
-	/* get header size in bits and bytes from header */
-	hdrBitSize = MP4AV_Ac3GetHeaderBitSize(hdrBuf);
-	hdrByteSize = MP4AV_Ac3GetHeaderByteSize(hdrBuf);
+	/* get header size in bytes from header, it's always byte aligned */
+	frame->hdrByteSize = MP4AV_Ac3GetHeaderByteSize(frame->hdr);
 	
 	/* adjust the frame size to what remains to be read */
-	frameSize -= hdrByteSize;
-
-    if (frameSize && frameSize > *pBufSize) {
-        *pBuf = realloc(*pBuf, frameSize + 1024);
-    }
-    *pBufSize = frameSize + hdrByteSize;
+	frame->payloadSize = MP4AV_Ac3GetFrameSize(frame->hdr) - frame->hdrByteSize;
     
+	frame->payload = syncframe_reader_peek(reader, frame->payloadSize);
+	if (frame->payload == NULL) {
+		return false;
+	}
+	syncframe_reader_skip(reader, frame->payloadSize);
+    
+	return true;
+}
+
+/*
+ * Size of the sample CopyAc3Frame writes
+ */
+static size_t Ac3SampleSize(const ac3_frame_t* frame, bool stripAc3)
+{
+	return stripAc3 ? frame->payloadSize : frame->hdrByteSize + frame->payloadSize;
+}
+
+static void CopyAc3Frame(const ac3_frame_t* frame, bool stripAc3, u_int8_t* pBuf)
+{
 	if (stripAc3) {
-		if ((hdrBitSize % 8) == 0) {
-			/* header is byte aligned, i.e. MPEG-2 Ac3 */
-			/* read the frame data into the buffer */
-			if (fread(*pBuf, 1, frameSize, inFile) != frameSize) {
-				return false;
-			}
-			(*pBufSize) = frameSize;
-		} else {
-			/* header is not byte aligned, i.e. MPEG-4 Ac3 */
-			int i;
-			u_int8_t newByte;
-			int upShift = hdrBitSize % 8;
-			int downShift = 8 - upShift;
-            
-			*pBuf[0] = hdrBuf[hdrBitSize / 8] << upShift;
-            
-			for (i = 0; i < frameSize; i++) {
-				if (fread(&newByte, 1, 1, inFile) != 1) {
-					return false;
-				}
-				*pBuf[i] |= (newByte >> downShift);
-				*pBuf[i+1] = (newByte << upShift);
-			}
-			(*pBufSize) = frameSize + 1;
-		}
+		memcpy(pBuf, frame->payload, frame->payloadSize);
 	} else { /* don't strip Ac3 headers */
-		memcpy(*pBuf, hdrBuf, hdrByteSize);
-		if (fread(*pBuf + hdrByteSize, 1, frameSize, inFile) != frameSize) {
-			return false;
-		}
+		memcpy(pBuf, frame->hdr, frame->hdrByteSize);
+		memcpy(pBuf + frame->hdrByteSize, frame->payload, frame->payloadSize);
 	}
+}
+
+/*
+ * Load the next frame from the file into a new buffer
+ *
+ * Note: Frames are padded to byte boundaries
+ */
+static u_int8_t* LoadNextAc3Frame(syncframe_reader_t* reader, size_t* pBufSize, bool stripAc3)
+{
+	ac3_frame_t frame;
+	u_int8_t* pBuf;
     
-	return true;
+	if (!ReadNextAc3Frame(reader, &frame)) {
+		return NULL;
+	}
+    
+	(*pBufSize) = Ac3SampleSize(&frame, stripAc3);
+	pBuf = malloc(*pBufSize);
+	CopyAc3Frame(&frame, stripAc3, pBuf);
+    
+	return pBuf;
 }
 
-static bool GetFirstHeader(FILE* inFile)
+static bool GetFirstHeader(FILE* inFile, u_int8_t* firstHeader)
 {
 	/* read file until we find an audio frame */
-	fpos_t curPos;
+	syncframe_reader_t reader;
+	bool found;
     
 	/* already read first header */
 	/*if (firstHeader[0] == 0x0b) {
 		return true;
 	}*/
     
-	/* remember where we are */
-	fgetpos(inFile, &curPos);
-	
-	/* go back to start of file */
-	rewind(inFile);
-    
-	if (!LoadNextAc3Header(inFile, firstHeader)) {
+	if (inFile == NULL || !syncframe_reader_open(&reader, inFile)) {
 		return false;
 	}
+	found = LoadNextAc3Header(&reader, firstHeader);
+	syncframe_reader_close(&reader);
     
-	/* reposition the file to where we were */
-	fsetpos(inFile, &curPos);
-    
-	return true;
+	return found;
 }
 
 + (NSArray<NSString *> *)supportedFileFormats {
@@ -286,14 +256,14 @@ static bool GetFirstHeader(FILE* inFile)
 
         struct stat st;
         stat(self.fileURL.fileSystemRepresentation, &st);
-        size = st.st_size * 8;
+        size = st.st_size;
 
         // collect all the necessary meta information
         UInt32 channels = 0, channelLayoutTag = 0;
         uint64_t fscod, frmsizecod, bsid, bsmod, acmod, lfeon;
         uint64_t lfe_offset = 4;
 
-        if (!GetFirstHeader(inFile)) {
+        if (!GetFirstHeader(inFile, firstHeader)) {
             fprintf(stderr,	
                     "Subler: data in file doesn't appear to be valid ac3 audio\n");
         }
@@ -352,36 +322,43 @@ static bool GetFirstHeader(FILE* inFile)
         MP4TrackId trackId = self.inputTracks.lastObject.sourceId;
 
         // parse the Ac3 frames, and write the MP4 samples
-        u_int8_t *pBuf = malloc(sizeof(u_int8_t) * 1024);
-        size_t pBufSize = 0;
+        syncframe_reader_t reader;
+        MP42SampleBuffer *samples[64];
+        NSUInteger count = 0;
+        ac3_frame_t frame;
         MP4SampleId sampleId = 1;
 
-        int64_t currentSize = 0;
-
-        while (LoadNextAc3Frame(inFile, &pBuf, &pBufSize, false) && !self.isCancelled) {
-
-            if (pBufSize < UINT32_MAX) {
-                MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
-
-                void *sampleDataBuffer = malloc(pBufSize);
-                memcpy(sampleDataBuffer, pBuf, pBufSize);
-
-                sample->data = sampleDataBuffer;
-                sample->size = (uint32_t)pBufSize;
-                sample->duration = MP4_INVALID_DURATION;
-                sample->flags |= MP42SampleBufferFlagIsSync;
-                sample->trackId = trackId;
+        if (inFile == NULL || !syncframe_reader_open(&reader, inFile)) {
+            [self setDone];
+            return;
+        }
 
-                [self enqueue:sample];
+        while (!self.isCancelled && ReadNextAc3Frame(&reader, &frame)) {
+            MP42SampleBuffer *sample = [self newSampleWithSize:(uint32_t)Ac3SampleSize(&frame, false)];
+
+            CopyAc3Frame(&frame, false, (u_int8_t *)sample->data);
+            sample->duration = MP4_INVALID_DURATION;
+            sample->flags |= MP42SampleBufferFlagIsSync;
+            sample->trackId = trackId;
+
+            samples[count++] = sample;
+            if (count == 64) {
+                [self enqueueSamples:samples count:count];
+                // the muxer could recycle them, don't keep them alive
+                for (NSUInteger i = 0; i < count; i++) {
+                    samples[i] = nil;
+                }
+                count = 0;
             }
 
             sampleId++;
 
-            currentSize += pBufSize;
-            self.progress = (currentSize / (CGFloat) size) * 100;
+            self.progress = (reader.pos / (CGFloat) size) * 100;
         }
 
-        free(pBuf);
+        [self enqueueSamples:samples count:count];
+
+        syncframe_reader_close(&reader);
         
         [self setDone];
     }
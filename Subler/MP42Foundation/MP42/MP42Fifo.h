@@ -11,6 +11,11 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+/**
+ *  A bounded single producer, single consumer queue, lock free
+ *  unless one side has to wait for the other.
+ *  Only one thread at a time can enqueue, and one dequeue.
+ */
 MP42_OBJC_DIRECT_MEMBERS
 @interface MP42Fifo<__covariant ObjectType> : NSObject
 
@@ -20,6 +25,27 @@ MP42_OBJC_DIRECT_MEMBERS
 - (nullable ObjectType)dequeue NS_RETURNS_RETAINED;
 - (nullable ObjectType)dequeueAndWait NS_RETURNS_RETAINED;
 
+/**
+ *  Enqueues count items at once, waiting for free space
+ *  only when the fifo is full.
+ */
+- (void)enqueueObjects:(ObjectType const _Nonnull * _Nonnull)items count:(NSUInteger)count;
+
+/**
+ *  Dequeues up to count items into the items array without waiting,
+ *  the items are returned retained.
+ *
+ *  @return the number of dequeued items.
+ */
+- (NSUInteger)dequeueObjects:(ObjectType _Nullable __strong * _Nonnull)items count:(NSUInteger)count;
+
+/**
+ *  Sets a semaphore that is signalled each time the fifo
+ *  goes from empty to not empty, so a consumer can wait on it
+ *  instead of polling. Must be set before the fifo is used.
+ */
+- (void)setReadySignal:(nullable dispatch_semaphore_t)readySignal;
+
 - (BOOL)isFull;
 - (BOOL)isEmpty;
 
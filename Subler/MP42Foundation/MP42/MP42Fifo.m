@@ -7,24 +7,41 @@
 //
 
 #import "MP42Fifo.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define FIFO_CACHE_LINE 128
+
+/**
+ *  The positions only grow, the producer owns the tail
+ *  and the consumer the head, each on its own cache line.
+ *  Their stores and the loads of the other side's position are
+ *  sequentially consistent, so a side that goes to sleep
+ *  and the other side that checks whether it must wake it
+ *  can't miss each other.
+ */
+typedef struct fifo_ring_t {
+    _Alignas(FIFO_CACHE_LINE) _Atomic uint64_t tail;
+    _Atomic int32_t producerWaiting;
+
+    _Alignas(FIFO_CACHE_LINE) _Atomic uint64_t head;
+    _Atomic int32_t consumerWaiting;
+} fifo_ring_t;
 
 MP42_OBJC_DIRECT_MEMBERS
 @implementation MP42Fifo {
 @private
     id *_array;
+    uint64_t    _size;
 
-    int32_t     _head;
-    int32_t     _tail;
-
-    int32_t     _size;
-    _Atomic int32_t     _count;
+    fifo_ring_t *_ring;
 
     _Atomic int32_t     _cancelled;
 
-    dispatch_semaphore_t _full;
-    dispatch_semaphore_t _empty;
+    dispatch_semaphore_t _space;
+    dispatch_semaphore_t _items;
 
-    dispatch_queue_t _queue;
+    dispatch_semaphore_t _readySignal;
 }
 
 - (instancetype)init {
@@ -35,95 +52,187 @@ MP42_OBJC_DIRECT_MEMBERS
 - (instancetype)initWithCapacity:(NSUInteger)capacity {
     self = [super init];
     if (self) {
-        _size = (int32_t)capacity;
+        _size = capacity;
         _array = (id *) malloc(sizeof(id) * _size);
-        _full = dispatch_semaphore_create(_size - 1);
-        _empty = dispatch_semaphore_create(0);
-        _queue = dispatch_queue_create("org.subler.FifoQueue", DISPATCH_QUEUE_SERIAL);
+        posix_memalign((void **)&_ring, FIFO_CACHE_LINE, sizeof(fifo_ring_t));
+        memset(_ring, 0, sizeof(fifo_ring_t));
+        _space = dispatch_semaphore_create(0);
+        _items = dispatch_semaphore_create(0);
     }
     return self;
 }
 
+- (void)setReadySignal:(nullable dispatch_semaphore_t)readySignal {
+    if (readySignal) {
+        dispatch_retain(readySignal);
+    }
+    if (_readySignal) {
+        dispatch_release(_readySignal);
+    }
+    _readySignal = readySignal;
+}
+
+/**
+ *  Sleeps on semaphore until the other side clears the waiting flag,
+ *  unless ready() turns true once the flag is set.
+ */
+static void wait_unless(_Atomic int32_t *waiting, dispatch_semaphore_t semaphore, BOOL (^ready)(void))
+{
+    atomic_store(waiting, 1);
+
+    if (!ready()) {
+        dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+    } else if (!atomic_exchange(waiting, 0)) {
+        // the other side saw the flag and is signalling
+        dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+    }
+}
+
+static void wake(_Atomic int32_t *waiting, dispatch_semaphore_t semaphore)
+{
+    if (atomic_load(waiting) && atomic_exchange(waiting, 0)) {
+        dispatch_semaphore_signal(semaphore);
+    }
+}
+
 - (void)enqueue:(id)item {
-    if (_cancelled) return;
+    [self enqueueObjects:&item count:1];
+}
 
-    [item retain];
+- (void)enqueueObjects:(id const *)items count:(NSUInteger)count {
+    fifo_ring_t *ring = _ring;
+    NSUInteger done = 0;
 
-    dispatch_semaphore_wait(_full, DISPATCH_TIME_FOREVER);
+    while (done < count && !_cancelled) {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load(&ring->head);
+        uint64_t space = _size - (tail - head);
 
-    dispatch_sync(_queue, ^{
-        _array[_tail++] = item;
-    });
+        if (space == 0) {
+            wait_unless(&ring->producerWaiting, _space, ^{
+                return (BOOL)(atomic_load(&ring->head) != head || _cancelled);
+            });
+            continue;
+        }
 
-    if (_tail == _size) {
-        _tail = 0;
-    }
+        uint64_t n = MIN(space, count - done);
+        uint64_t i = tail % _size;
+
+        for (uint64_t end = done + n; done < end; done++) {
+            _array[i++] = [items[done] retain];
 
-    _count++;
-    dispatch_semaphore_signal(_empty);
+            if (i == _size) {
+                i = 0;
+            }
+        }
+
+        atomic_store(&ring->tail, tail + n);
+
+        // the consumer had taken everything, it could be asleep
+        if (atomic_load(&ring->head) == tail && _readySignal) {
+            dispatch_semaphore_signal(_readySignal);
+        }
+        wake(&ring->consumerWaiting, _items);
+    }
 }
 
-- (nullable id)dequeue NS_RETURNS_RETAINED {
-    if (!_count) return nil;
+- (NSUInteger)dequeueObjects:(id *)items count:(NSUInteger)count {
+    if (_cancelled) return 0;
 
-    __block id item = nil;
+    fifo_ring_t *ring = _ring;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load(&ring->tail);
+    uint64_t n = MIN(tail - head, count);
 
-    dispatch_sync(_queue, ^{
-        item = _array[_head++];
-    });
+    if (n == 0) return 0;
 
-    if (_head == _size) {
-        _head = 0;
+    uint64_t i = head % _size;
+
+    for (uint64_t done = 0; done < n; done++) {
+        items[done] = _array[i++];
+
+        if (i == _size) {
+            i = 0;
+        }
     }
 
-    _count--;
-    dispatch_semaphore_signal(_full);
+    atomic_store(&ring->head, head + n);
+    wake(&ring->producerWaiting, _space);
+
+    return n;
+}
 
+- (nullable id)dequeue NS_RETURNS_RETAINED {
+    id item = nil;
+    [self dequeueObjects:&item count:1];
     return item;
 }
 
 - (nullable id)dequeueAndWait NS_RETURNS_RETAINED {
-    id item = [self dequeue];
+    fifo_ring_t *ring = _ring;
+    id item = nil;
 
-    while (!item) {
-        dispatch_semaphore_wait(_empty, DISPATCH_TIME_FOREVER);
-        item = [self dequeue];
+    while (!_cancelled && ![self dequeueObjects:&item count:1]) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+        wait_unless(&ring->consumerWaiting, _items, ^{
+            return (BOOL)(atomic_load(&ring->tail) != head || _cancelled);
+        });
     }
 
     return item;
 }
 
 - (NSUInteger)count {
-    return _count;
+    return (NSUInteger)(atomic_load(&_ring->tail) - atomic_load(&_ring->head));
 }
 
 - (BOOL)isFull {
-    return (_count >= _size);
+    return [self count] >= _size;
 }
 
 - (BOOL)isEmpty {
-    return !_count;
+    return [self count] == 0;
 }
 
+/**
+ *  Releases the queued items, from the consumer thread.
+ */
 - (void)drain {
-    id item;
-    while ((item = [self dequeue])) {
-        [item release];
+    fifo_ring_t *ring = _ring;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load(&ring->tail);
+
+    for (; head != tail; head++) {
+        [_array[head % _size] release];
     }
+
+    atomic_store(&ring->head, head);
+    wake(&ring->producerWaiting, _space);
 }
 
+/**
+ *  Stops the fifo, a waiting producer returns, a waiting consumer
+ *  gets nil and the queued items aren't dequeued anymore.
+ *  They are released with the fifo, because cancel
+ *  can be called from a third thread.
+ */
 - (void)cancel {
     _cancelled = 1;
-    [self drain];
+    wake(&_ring->producerWaiting, _space);
+    wake(&_ring->consumerWaiting, _items);
 }
 
 - (void)dealloc {
     [self drain];
 
 	free(_array);
-    dispatch_release(_full);
-    dispatch_release(_empty);
-    dispatch_release(_queue);
+    free(_ring);
+    dispatch_release(_space);
+    dispatch_release(_items);
+    if (_readySignal) {
+        dispatch_release(_readySignal);
+    }
 
     [super dealloc];
 }
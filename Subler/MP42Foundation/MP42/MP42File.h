@@ -29,6 +29,10 @@ extern NSString * const MP42GenerateChaptersPreviewTrack;
 extern NSString * const MP42ChaptersPreviewPosition;
 extern NSString * const MP42CustomChaptersPreviewTrack;
 extern NSString * const MP42ForceHvc1;
+extern NSString * const MP42ChunkDuration;
+extern NSString * const MP42MemoryBudget;
+extern NSString * const MP42TrackByteBudget;
+extern NSString * const MP42TrackDurationBudget;
 
 typedef void (^MP42FileProgressHandler)(double progress);
 
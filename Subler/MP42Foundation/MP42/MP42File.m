@@ -24,6 +24,10 @@ NSString * const MP42GenerateChaptersPreviewTrack = @"MP42ChaptersPreview";
 NSString * const MP42ChaptersPreviewPosition = @"MP42ChaptersPreviewPosition";
 NSString * const MP42CustomChaptersPreviewTrack = @"MP42CustomChaptersPreview";
 NSString * const MP42ForceHvc1 = @"MP42ForceHvc1";
+NSString * const MP42ChunkDuration = @"MP42ChunkDuration";
+NSString * const MP42MemoryBudget = @"MP42MemoryBudget";
+NSString * const MP42TrackByteBudget = @"MP42TrackByteBudget";
+NSString * const MP42TrackDurationBudget = @"MP42TrackDurationBudget";
 
 /**
  *  MP42Status
@@ -14,6 +14,8 @@
 NS_ASSUME_NONNULL_BEGIN
 
 @class MP42SampleBuffer;
+@class MP42SampleBufferPool;
+@class MP42MemoryGovernor;
 @class MP42AudioTrack;
 @class MP42VideoTrack;
 
@@ -29,6 +31,9 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)setActiveTrack:(MP42Track *)track;
 
+@property (nonatomic, nullable) MP42SampleBufferPool *samplePool;
+@property (nonatomic, nullable) MP42MemoryGovernor *memoryGovernor;
+
 - (void)startReading;
 - (void)cancelReading;
 
@@ -46,6 +46,27 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)enqueue:(MP42SampleBuffer * NS_RELEASES_ARGUMENT)sample MP42_OBJC_DIRECT;
 
+/**
+ *  Hands a batch of samples to the output tracks,
+ *  with a single fifo synchronization for each track.
+ */
+- (void)enqueueSamples:(MP42SampleBuffer * const _Nonnull * _Nonnull)samples count:(NSUInteger)count MP42_OBJC_DIRECT;
+
+/**
+ *  Adds a sample to the batch of the demuxer thread, the batch is
+ *  enqueued once full, by flushSamples and by setDone. Don't mix it
+ *  with enqueue: for the same track, the samples would be reordered.
+ */
+- (void)batchSample:(MP42SampleBuffer * NS_RELEASES_ARGUMENT)sample MP42_OBJC_DIRECT;
+- (void)flushSamples MP42_OBJC_DIRECT;
+
+/**
+ *  Returns a sample with a data buffer of at least size bytes,
+ *  from the muxer pool if there is one. Don't touch
+ *  the sample anymore once enqueued, it could be reused.
+ */
+- (MP42SampleBuffer *)newSampleWithSize:(uint32_t)size MP42_OBJC_DIRECT;
+
 @property (nonatomic, readwrite MP42_DIRECT) double progress;
 @property (nonatomic, readonly, getter=isCancelled MP42_DIRECT) BOOL cancelled;
 
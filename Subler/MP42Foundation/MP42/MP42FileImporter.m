@@ -16,6 +16,7 @@
 #import "MP42AC3Importer.h"
 #import "MP42AACImporter.h"
 #import "MP42H264Importer.h"
+#import "MP42HEVCImporter.h"
 #import "MP42VobSubImporter.h"
 #import "MP42AVFImporter.h"
 
@@ -24,12 +25,16 @@
 #import "MP42AudioTrack.h"
 #import "MP42Track+Private.h"
 #import "MP42SampleBuffer.h"
+#import "MP42SampleBufferPool.h"
 #import "MP42Metadata.h"
 
 #import "mp4v2.h"
 
 #import <CoreAudio/CoreAudio.h>
 
+/// The samples enqueued at once by batchSample:
+#define SAMPLE_BATCH_SIZE 64
+
 /// The available subclasses
 static NSArray<Class> *_fileImporters;
 
@@ -46,6 +51,12 @@ static NSArray<NSString *> *_supportedFileFormats;
 
     dispatch_semaphore_t _doneSem;
 
+    MP42SampleBufferPool *_samplePool;
+    MP42MemoryGovernor *_memoryGovernor;
+
+    MP42SampleBuffer *_batch[SAMPLE_BATCH_SIZE];
+    NSUInteger _batchCount;
+
     _Atomic double _progress;
     _Atomic BOOL _cancelled;
 }
@@ -58,6 +69,7 @@ static NSArray<NSString *> *_supportedFileFormats;
                            [MP42CCImporter class],
                            [MP42AACImporter class],
                            [MP42H264Importer class],
+                           [MP42HEVCImporter class],
                            [MP42VobSubImporter class],
                            [MP42AVFImporter class],
                            [MP42AC3Importer class],
@@ -135,6 +147,26 @@ static NSArray<NSString *> *_supportedFileFormats;
     return [_outputsTracks copy];
 }
 
+- (nullable MP42SampleBufferPool *)samplePool
+{
+    return _samplePool;
+}
+
+- (void)setSamplePool:(nullable MP42SampleBufferPool *)samplePool
+{
+    _samplePool = samplePool;
+}
+
+- (nullable MP42MemoryGovernor *)memoryGovernor
+{
+    return _memoryGovernor;
+}
+
+- (void)setMemoryGovernor:(nullable MP42MemoryGovernor *)memoryGovernor
+{
+    _memoryGovernor = memoryGovernor;
+}
+
 - (void)setMetadata:(MP42Metadata * _Nonnull)metadata
 {
     _metadata = metadata;
@@ -185,8 +217,27 @@ static NSArray<NSString *> *_supportedFileFormats;
     dispatch_semaphore_wait(_doneSem, DISPATCH_TIME_FOREVER);
 }
 
+/**
+ * Counts the output tracks a pooled sample goes to,
+ * it's recycled only once all of them are done with it.
+ */
+static inline void setSampleOwners(NSArray<MP42Track *> *tracks, MP42SampleBuffer *sample)
+{
+    if (sample->capacity) {
+        uint32_t owners = 0;
+        for (MP42Track *track in tracks) {
+            if (track.sourceId == sample->trackId) {
+                owners++;
+            }
+        }
+        sample->owners = owners;
+    }
+}
+
 - (void)enqueue:(MP42SampleBuffer * NS_RELEASES_ARGUMENT)sample
 {
+    setSampleOwners(_outputsTracks, sample);
+
     for (MP42Track *track in _outputsTracks) {
         if (track.sourceId == sample->trackId) {
             [track enqueue:sample];
@@ -194,6 +245,69 @@ static NSArray<NSString *> *_supportedFileFormats;
     }
 }
 
+- (void)enqueueSamples:(MP42SampleBuffer * const *)samples count:(NSUInteger)count
+{
+    if (!count) {
+        return;
+    }
+
+    MP42SampleBuffer * __unsafe_unretained trackSamples[count];
+
+    for (NSUInteger i = 0; i < count; i++) {
+        setSampleOwners(_outputsTracks, samples[i]);
+    }
+
+    for (MP42Track *track in _outputsTracks) {
+        MP42TrackId trackId = track.sourceId;
+        NSUInteger trackCount = 0;
+
+        for (NSUInteger i = 0; i < count; i++) {
+            if (samples[i]->trackId == trackId) {
+                trackSamples[trackCount++] = samples[i];
+            }
+        }
+
+        if (trackCount) {
+            [track enqueueSamples:trackSamples count:trackCount];
+        }
+    }
+}
+
+- (void)batchSample:(MP42SampleBuffer * NS_RELEASES_ARGUMENT)sample
+{
+    _batch[_batchCount++] = sample;
+
+    if (_batchCount == SAMPLE_BATCH_SIZE) {
+        [self flushSamples];
+    }
+}
+
+- (void)flushSamples
+{
+    [self enqueueSamples:_batch count:_batchCount];
+
+    // the muxer could recycle them, don't keep them alive
+    for (NSUInteger i = 0; i < _batchCount; i++) {
+        _batch[i] = nil;
+    }
+    _batchCount = 0;
+}
+
+/**
+ * Takes a sample from the muxer pool, or allocates one.
+ */
+- (MP42SampleBuffer *)newSampleWithSize:(uint32_t)size
+{
+    if (_samplePool) {
+        return [_samplePool newSampleWithSize:size];
+    }
+
+    MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
+    sample->data = malloc(MAX(size, 1));
+    sample->size = size;
+    return sample;
+}
+
 /**
  * Sends the EOF flag down the muxer chain.
  */
@@ -209,6 +323,7 @@ static NSArray<NSString *> *_supportedFileFormats;
 
 - (void)setDone
 {
+    [self flushSamples];
     [self enqueueEndOfFileSamples];
     dispatch_semaphore_signal(_doneSem);
 }
@@ -6,7 +6,7 @@
 //  Copyright © 2022 Damiano Galassi. All rights reserved.
 //
 
-#include "mbs.h"
+#include "bitstream.h"
 #include "MP42FormatUtilites.h"
 #include "MP42MediaFormat.h"
 
@@ -275,11 +275,11 @@ int readEAC3Config(const uint8_t *cookie, uint32_t cookieLen, UInt32 *channelsCo
         return 0;
     }
 
-    CMemoryBitstream b;
-    b.SetBytes((uint8_t *)cookie, cookieLen);
+    bs_reader_t b;
+    bs_reader_init(&b, cookie, cookieLen);
 
-    b.GetBits(13); // data_rate
-    b.GetBits(3);  // num_ind_sub
+    bs_read(&b, 13); // data_rate
+    bs_read(&b, 3);  // num_ind_sub
 	// end bytes #0 and #1
     // we support only one independent substream
     for (int i = 0; i < 1; i++)
@@ -287,28 +287,28 @@ int readEAC3Config(const uint8_t *cookie, uint32_t cookieLen, UInt32 *channelsCo
         //uint32_t fscod, bsid, asvc, bsmod;
         uint8_t acmod, lfeon, bsid;
 
-        b.GetBits(2); // fscod
-        bsid = b.GetBits(5); // bsid
-        b.SkipBits(1); // reserved
+        bs_read(&b, 2); // fscod
+        bsid = bs_read(&b, 5); // bsid
+        bs_skip(&b, 1); // reserved
 		// end byte #2
-        b.GetBits(1); // asvc
-        b.GetBits(3); // bsmod
+        bs_read(&b, 1); // asvc
+        bs_read(&b, 3); // bsmod
 
-        acmod = b.GetBits(3);
-        lfeon = b.GetBits(1);
+        acmod = bs_read(&b, 3);
+        lfeon = bs_read(&b, 1);
 		// end byte #3
-        b.SkipBits(3); // reserved
+        bs_skip(&b, 3); // reserved
 
         uint8_t num_dep_sub = 0;
         uint16_t chan_loc = 0;
 
-        num_dep_sub = b.GetBits(4);
+        num_dep_sub = bs_read(&b, 4);
 
         if (num_dep_sub > 0 && cookieLen > 5) {
-            chan_loc = b.GetBits(9);	//chan_loc
+            chan_loc = bs_read(&b, 9);	//chan_loc
 			// end byts #4 and #5
 		} else {
-			b.GetBits(1); //reserved
+			bs_read(&b, 1); //reserved
 			// end byte #4
 		}
 
@@ -316,10 +316,10 @@ int readEAC3Config(const uint8_t *cookie, uint32_t cookieLen, UInt32 *channelsCo
 		*ec3ExtensionType = EC3Extension_None;
 		*complexityIndex = 0;
 		if (bsid >= 16 && cookieLen >= 7) {
-			b.SkipBits(7); 						// reserved
-			*ec3ExtensionType = b.GetBits(1);	//MP42EC3Extension_JOC
+			bs_skip(&b, 7); 						// reserved
+			*ec3ExtensionType = bs_read(&b, 1);	//MP42EC3Extension_JOC
 			if (*ec3ExtensionType)
-				*complexityIndex = b.GetBits(8);
+				*complexityIndex = bs_read(&b, 8);
 		}
 		
         if (acmod == 7 && lfeon && chan_loc != 0) {
@@ -685,9 +685,9 @@ typedef struct AC3HeaderInfo {
 	/** @} */
 } AC3HeaderInfo;
 
-void analyze_eac3_addbsi(CMemoryBitstream &b, AC3HeaderInfo *phdr);
+void analyze_eac3_addbsi(bs_reader_t *b, AC3HeaderInfo *phdr);
 
-static int ac3_parse_header(CMemoryBitstream &b, AC3HeaderInfo **phdr)
+static int ac3_parse_header(bs_reader_t *b, AC3HeaderInfo **phdr)
 {
     int frame_size_code;
     AC3HeaderInfo *hdr;
@@ -702,15 +702,13 @@ static int ac3_parse_header(CMemoryBitstream &b, AC3HeaderInfo **phdr)
 
     memset(hdr, 0, sizeof(*hdr));
 
-    hdr->sync_word = b.GetBits(16);
+    hdr->sync_word = bs_read(b, 16);
     if (hdr->sync_word != 0x0B77) {
         return AAC_AC3_PARSE_ERROR_SYNC;
     }
 
     /* read ahead to bsid to distinguish between AC-3 and E-AC-3 */
-    b.SkipBits(24);
-	hdr->bitstream_id = b.GetBits(5);			// bsid
-	b.SetBitPosition(b.GetBitPosition() - 29);	// back to start of bsi
+	hdr->bitstream_id = bs_peek(b, 29) & 0x1f;	// bsid
     if (hdr->bitstream_id > 16) {
         return AAC_AC3_PARSE_ERROR_BSID;
     }
@@ -726,34 +724,34 @@ static int ac3_parse_header(CMemoryBitstream &b, AC3HeaderInfo **phdr)
 
     if (hdr->bitstream_id <= 10) {
         /* Normal AC-3 */
-        hdr->crc1 = b.GetBits(16);
-        hdr->sr_code = b.GetBits(2);
+        hdr->crc1 = bs_read(b, 16);
+        hdr->sr_code = bs_read(b, 2);
         if (hdr->sr_code == 3) {
             return AAC_AC3_PARSE_ERROR_SAMPLE_RATE;
         }
 
-        frame_size_code = b.GetBits(6);
+        frame_size_code = bs_read(b, 6);
         if (frame_size_code > 37) {
             return AAC_AC3_PARSE_ERROR_FRAME_SIZE;
         }
         //end syncinfo()
         //bsi()
-        b.SkipBits(5); // skip bsid, already got it
+        bs_skip(b, 5); // skip bsid, already got it
 
-        hdr->bitstream_mode = b.GetBits(3);
-        hdr->channel_mode = b.GetBits(3);
+        hdr->bitstream_mode = bs_read(b, 3);
+        hdr->channel_mode = bs_read(b, 3);
 
         if (hdr->channel_mode == AC3_CHMODE_STEREO) {
-            hdr->dolby_surround_mode = b.GetBits(2);
+            hdr->dolby_surround_mode = bs_read(b, 2);
         } else {
             if((hdr->channel_mode & 1) && hdr->channel_mode != AC3_CHMODE_MONO) {
-                hdr->  center_mix_level =   center_levels[b.GetBits(2)];
+                hdr->  center_mix_level =   center_levels[bs_read(b, 2)];
             }
             if(hdr->channel_mode & 4) {
-                hdr->surround_mix_level = surround_levels[b.GetBits(2)];
+                hdr->surround_mix_level = surround_levels[bs_read(b, 2)];
             }
         }
-        hdr->lfe_on = b.GetBits(1);
+        hdr->lfe_on = bs_read(b, 1);
         //next unparsed field - dialnorm
         hdr->sr_shift = MAX(hdr->bitstream_id, 8) - 8;
         hdr->sample_rate = ff_ac3_sample_rate_tab[hdr->sr_code] >> hdr->sr_shift;
@@ -767,50 +765,49 @@ static int ac3_parse_header(CMemoryBitstream &b, AC3HeaderInfo **phdr)
         /* Enhanced AC-3 */
         hdr->crc1 = 0;
         //bsi()
-        hdr->frame_type = b.GetBits(2);			//strmtyp
+        hdr->frame_type = bs_read(b, 2);			//strmtyp
         if (hdr->frame_type == EAC3_FRAME_TYPE_RESERVED) {
             return AAC_AC3_PARSE_ERROR_FRAME_TYPE;
         }
 
-        hdr->substreamid = b.GetBits(3);		//substreamid
+        hdr->substreamid = bs_read(b, 3);		//substreamid
 
-        hdr->frame_size = (b.GetBits(11) + 1) << 1;	//frmsiz
+        hdr->frame_size = (bs_read(b, 11) + 1) << 1;	//frmsiz
         if (hdr->frame_size < AC3_HEADER_SIZE) {
             return AAC_AC3_PARSE_ERROR_FRAME_SIZE;
         }
 
-        hdr->sr_code = b.GetBits(2);			//fscod
+        hdr->sr_code = bs_read(b, 2);			//fscod
         if (hdr->sr_code == 3) {
-            int sr_code2 = b.GetBits(2);
+            int sr_code2 = bs_read(b, 2);
             if(sr_code2 == 3) {
                 return AAC_AC3_PARSE_ERROR_SAMPLE_RATE;
             }
             hdr->sample_rate = ff_ac3_sample_rate_tab[sr_code2] / 2;
             hdr->sr_shift = 1;
         } else {
-            hdr->num_blocks = eac3_blocks[b.GetBits(2)];	//numblkscod
+            hdr->num_blocks = eac3_blocks[bs_read(b, 2)];	//numblkscod
             hdr->sample_rate = ff_ac3_sample_rate_tab[hdr->sr_code];
             hdr->sr_shift = 0;
         }
 
-        hdr->channel_mode = b.GetBits(3);	//acmod
-        hdr->lfe_on = b.GetBits(1);			//lfeon
-		b.SkipBits(5);						//bsid already taken
+        hdr->channel_mode = bs_read(b, 3);	//acmod
+        hdr->lfe_on = bs_read(b, 1);			//lfeon
+		bs_skip(b, 5);						//bsid already taken
 		//next unparsed field - dialnorm
         hdr->bit_rate = 8LL * hdr->frame_size * hdr->sample_rate /
         (hdr->num_blocks * 256);
         hdr->channels = ff_ac3_channels_tab[hdr->channel_mode] + hdr->lfe_on;
     }
+    if (bs_error(b)) {
+        return AAC_AC3_PARSE_ERROR_FRAME_SIZE;
+    }
     hdr->channel_layout = avpriv_ac3_channel_layout_tab[hdr->channel_mode];
     if (hdr->lfe_on) {
         hdr->channel_layout |= AV_CH_LOW_FREQUENCY;
     }
 	//location in stream - bsi().dialnorm(5), bitpos = 45
-    try {
-		analyze_eac3_addbsi(b, hdr);
-	}  catch (int e) {
-        return 1;
-    }
+	analyze_eac3_addbsi(b, hdr);
 
 	return 0;
 }
@@ -821,191 +818,192 @@ static int ac3_parse_header(CMemoryBitstream &b, AC3HeaderInfo **phdr)
  */
 //---------------------------------------------------------------------------
 //E.1.2.2 bsi - Bit stream information
-void analyze_eac3_addbsi(CMemoryBitstream &b, AC3HeaderInfo *hdr)
+void analyze_eac3_addbsi(bs_reader_t *b, AC3HeaderInfo *hdr)
 {
 	if(hdr->bitstream_id != 16)
 		return;
 	
 	//location in stream - bsi().dialnorm(5), savedbitpos = 63
-	uint32_t savedbitpos = b.GetBitPosition();	//calling routines assume bit pos in b after this fn returns!
+	uint64_t savedbitpos = bs_tell(b);	//calling routines assume bit pos in b after this fn returns!
 	
 	uint8_t addbsi[64] = {0};
 	
 #ifdef DEBUG_PARSER
-	printf("***parse_eac3_bsi start bit pos: %d remaining bits: %d\n", b.GetBitPosition(), b.GetRemainingBits());
+	printf("***parse_eac3_bsi start bit pos: %d remaining bits: %d\n", (int)bs_tell(b), (int)bs_left(b));
 #endif
-	b.SetBitPosition(16);				//skip syncword
-	b.SkipBits(2+3+11+2+2+3+1+5+5);		//strmtyp,substreamid,frmsiz,fscod,numblkscod,acmod,lfeon,bsid,dialnorm
-	if(b.GetBits(1))					//compre ..................................................................................... 1
-		b.SkipBits(8);					//{compr} ......................................................................... 8
+	bs_seek(b, 16);				//skip syncword
+	bs_skip(b, 2+3+11+2+2+3+1+5+5);		//strmtyp,substreamid,frmsiz,fscod,numblkscod,acmod,lfeon,bsid,dialnorm
+	if(bs_read(b, 1))					//compre ..................................................................................... 1
+		bs_skip(b, 8);					//{compr} ......................................................................... 8
 	if(hdr->channel_mode == 0x0) 		/* if 1+1 mode (dual mono, so some items need a second value) */
 	{
-		b.SkipBits(5);					//dialnorm2 ............................................................................... 5
-		if(b.GetBits(1))				//compr2e ................................................................................. 1
-			b.SkipBits(8);				//{compr2} .................................................................... 8
+		bs_skip(b, 5);					//dialnorm2 ............................................................................... 5
+		if(bs_read(b, 1))				//compr2e ................................................................................. 1
+			bs_skip(b, 8);				//{compr2} .................................................................... 8
 	}
 	if(hdr->frame_type == 0x1) 			/* if dependent stream */
 	{
-		if(b.GetBits(1))				//chanmape ................................................................................ 1
-			b.SkipBits(16);				//{chanmap} ................................................................. 16
+		if(bs_read(b, 1))				//chanmape ................................................................................ 1
+			bs_skip(b, 16);				//{chanmap} ................................................................. 16
 	}
 	/* mixing metadata */
-	if(b.GetBits(1))					//mixmdate ................................................................................... 1
+	if(bs_read(b, 1))					//mixmdate ................................................................................... 1
 	{
 		if(hdr->channel_mode > 0x2) 	/* if more than 2 channels */
-			b.SkipBits(2);				//{dmixmod} ................................. 2
+			bs_skip(b, 2);				//{dmixmod} ................................. 2
 		if((hdr->channel_mode & 0x1) && (hdr->channel_mode > 0x2)) /* if three front channels exist */
-			b.SkipBits(3+3);			//ltrtcmixlev,lorocmixlev .......................................................................... 3
+			bs_skip(b, 3+3);			//ltrtcmixlev,lorocmixlev .......................................................................... 3
 		if(hdr->channel_mode & 0x4) 	/* if a surround channel exists */
-			b.SkipBits(3+3);			//ltrtsurmixlev,lorosurmixlev
+			bs_skip(b, 3+3);			//ltrtsurmixlev,lorosurmixlev
 		if(hdr->lfe_on) 				/* if the LFE channel exists */
 		{
-			if(b.GetBits(1)) 			//lfemixlevcode
-				b.SkipBits(5);			//lfemixlevcod
+			if(bs_read(b, 1)) 			//lfemixlevcode
+				bs_skip(b, 5);			//lfemixlevcod
 		}
 		if(hdr->frame_type == 0x0) 		/* if independent stream */
 		{
-			if(b.GetBits(1)) 			//pgmscle
-				b.SkipBits(6);			//pgmscl
+			if(bs_read(b, 1)) 			//pgmscle
+				bs_skip(b, 6);			//pgmscl
 			if(hdr->channel_mode == 0x0) /* if 1+1 mode (dual mono, so some items need a second value) */
 			{
-				if(b.GetBits(1)) 		//pgmscl2e
-					b.SkipBits(6);		//pgmscl2
+				if(bs_read(b, 1)) 		//pgmscl2e
+					bs_skip(b, 6);		//pgmscl2
 			}
-			if(b.GetBits(1)) 			//extpgmscle
-				b.SkipBits(6);			//extpgmscl
-			uint8_t mixdef = b.GetBits(2);
+			if(bs_read(b, 1)) 			//extpgmscle
+				bs_skip(b, 6);			//extpgmscl
+			uint8_t mixdef = bs_read(b, 2);
 			if(mixdef == 0x1) 			/* mixing option 2 */
-				b.SkipBits(1+1+3);		//premixcmpsel, drcsrc, premixcmpscl
+				bs_skip(b, 1+1+3);		//premixcmpsel, drcsrc, premixcmpscl
 			else if(mixdef == 0x2) 		/* mixing option 3 */ {
-				b.SkipBits(12);
+				bs_skip(b, 12);
 			}
 			else if(mixdef == 0x3) 		/* mixing option 4 */
 			{
-				uint8_t mixdeflen = b.GetBits(5);	//mixdeflen
-				if (b.GetBits(1))		//mixdata2e
+				uint8_t mixdeflen = bs_read(b, 5);	//mixdeflen
+				if (bs_read(b, 1))		//mixdata2e
 				{
-					b.SkipBits(1+1+3);	//premixcmpsel,drcsrc,premixcmpscl
-					if(b.GetBits(1)) 	//extpgmlscle
-						b.SkipBits(4);	//extpgmlscl
-					if(b.GetBits(1)) 	//extpgmcscle
-						b.SkipBits(4);	//extpgmcscl
-					if(b.GetBits(1)) 	//extpgmrscle
-						b.SkipBits(4);	//extpgmrscl
-					if(b.GetBits(1)) 	//extpgmlsscle
-						b.SkipBits(4);	//extpgmlsscl
-					if(b.GetBits(1)) 	//extpgmrsscle
-						b.SkipBits(4);	//extpgmrsscl
-					if(b.GetBits(1)) 	//extpgmlfescle
-						b.SkipBits(4);	//extpgmlfescl
-					if(b.GetBits(1)) 	//dmixscle
-						b.SkipBits(4);	//dmixscl
-					if (b.GetBits(1))	//addche
+					bs_skip(b, 1+1+3);	//premixcmpsel,drcsrc,premixcmpscl
+					if(bs_read(b, 1)) 	//extpgmlscle
+						bs_skip(b, 4);	//extpgmlscl
+					if(bs_read(b, 1)) 	//extpgmcscle
+						bs_skip(b, 4);	//extpgmcscl
+					if(bs_read(b, 1)) 	//extpgmrscle
+						bs_skip(b, 4);	//extpgmrscl
+					if(bs_read(b, 1)) 	//extpgmlsscle
+						bs_skip(b, 4);	//extpgmlsscl
+					if(bs_read(b, 1)) 	//extpgmrsscle
+						bs_skip(b, 4);	//extpgmrsscl
+					if(bs_read(b, 1)) 	//extpgmlfescle
+						bs_skip(b, 4);	//extpgmlfescl
+					if(bs_read(b, 1)) 	//dmixscle
+						bs_skip(b, 4);	//dmixscl
+					if (bs_read(b, 1))	//addche
 					{
-						if(b.GetBits(1))	//extpgmaux1scle
-							b.SkipBits(4);	//extpgmaux1scl
-						if(b.GetBits(1))	//extpgmaux2scle
-							b.SkipBits(4);	//extpgmaux2scl
+						if(bs_read(b, 1))	//extpgmaux1scle
+							bs_skip(b, 4);	//extpgmaux1scl
+						if(bs_read(b, 1))	//extpgmaux2scle
+							bs_skip(b, 4);	//extpgmaux2scl
 					}
 				}
-				if(b.GetBits(1))			//mixdata3e
+				if(bs_read(b, 1))			//mixdata3e
 				{
-					b.SkipBits(5);			//spchdat
-					if(b.GetBits(1))		//addspchdate
+					bs_skip(b, 5);			//spchdat
+					if(bs_read(b, 1))		//addspchdate
 					{
-						b.SkipBits(5+2);	//spchdat1,spchan1att
-						if(b.GetBits(1))	//addspchdat1e
-							b.SkipBits(5+3);//spchdat2,spchan2att
+						bs_skip(b, 5+2);	//spchdat1,spchan1att
+						if(bs_read(b, 1))	//addspchdat1e
+							bs_skip(b, 5+3);//spchdat2,spchan2att
 					}
 				}
 				//mixdata ........................................ (8*(mixdeflen+2)) - no. mixdata bits
-				b.SkipBytes(mixdeflen + 2);
-				if(b.GetBitPosition() & 0x7)
+				bs_skip(b, 8 * (mixdeflen + 2));
+				if(bs_tell(b) & 0x7)
 					//mixdatafill ................................................................... 0 - 7
 					//used to round up the size of the mixdata field to the nearest byte
-					b.SkipBits(8 - (b.GetBitPosition() & 0x7));
+					bs_skip(b, 8 - (bs_tell(b) & 0x7));
 			}
 			if(hdr->channel_mode < 0x2) 	/* if mono or dual mono source */
 			{
-				if(b.GetBits(1))			//paninfoe
-					b.SkipBits(8+6);		//panmean,paninfo
+				if(bs_read(b, 1))			//paninfoe
+					bs_skip(b, 8+6);		//panmean,paninfo
 				if(hdr->channel_mode == 0x0) /* if 1+1 mode (dual mono - some items need a second value) */
 				{
-					if(b.GetBits(1))		//paninfo2e
-						b.SkipBits(8+6);	//panmean2,paninfo2
+					if(bs_read(b, 1))		//paninfo2e
+						bs_skip(b, 8+6);	//panmean2,paninfo2
 				}
 			}
 			/* mixing configuration information */
-			if(b.GetBits(1))				//frmmixcfginfoe
+			if(bs_read(b, 1))				//frmmixcfginfoe
 			{
 				if(hdr->num_blocks == 1) {	//if(numblkscod == 0x0)
-					b.SkipBits(5);			//blkmixcfginfo[0]
+					bs_skip(b, 5);			//blkmixcfginfo[0]
 				}
 				else
 				{
 					for(int blk = 0; blk < hdr->num_blocks; blk++)
 					{
-						if(b.GetBits(1))	//blkmixcfginfoe[blk]
-							b.SkipBits(5);	//blkmixcfginfo[blk]
+						if(bs_read(b, 1))	//blkmixcfginfoe[blk]
+							bs_skip(b, 5);	//blkmixcfginfo[blk]
 					}
 				}
 			}
 		}
 	}
 	/* informational metadata */
-	if(b.GetBits(1))						//infomdate
+	if(bs_read(b, 1))						//infomdate
 	{
-		b.SkipBits(3+1+1);					//bsmod,copyrightb,origbs
+		bs_skip(b, 3+1+1);					//bsmod,copyrightb,origbs
 		if(hdr->channel_mode == 0x2) 		/* if in 2/0 mode */
-			b.SkipBits(2+2);				//dsurmod,dheadphonmod
+			bs_skip(b, 2+2);				//dsurmod,dheadphonmod
 		if(hdr->channel_mode >= 0x6) 		/* if both surround channels exist */
-			b.SkipBits(2);					//dsurexmod
-		if(b.GetBits(1))					//audprodie
-			b.SkipBits(5+2+1);				//mixlevel,roomtyp,adconvtyp
+			bs_skip(b, 2);					//dsurexmod
+		if(bs_read(b, 1))					//audprodie
+			bs_skip(b, 5+2+1);				//mixlevel,roomtyp,adconvtyp
 		if(hdr->channel_mode == 0x0)		/* if 1+1 mode (dual mono, so some items need a second value) */
 		{
-			if(b.GetBits(1))				//audprodi2e
-				b.SkipBits(5+2+1);			//mixlevel2,roomtyp2,adconvtyp2
+			if(bs_read(b, 1))				//audprodi2e
+				bs_skip(b, 5+2+1);			//mixlevel2,roomtyp2,adconvtyp2
 		}
 		if(hdr->sr_code < 0x3) 				/* if not half sample rate */
-			b.SkipBits(1);					//sourcefscod
+			bs_skip(b, 1);					//sourcefscod
 	}
 	if(hdr->frame_type == 0x0 && hdr->num_blocks != 6)	//(numblkscod != 0x3)
-		b.SkipBits(1);						//convsync
+		bs_skip(b, 1);						//convsync
 	if(hdr->frame_type == 0x2) 				/* if bit stream converted from AC-3 */
 	{
 		uint8_t blkid = 0;
 		if(hdr->num_blocks == 6) 			/* 6 blocks per syncframe */
 			blkid = 1;
 		else
-			blkid = b.GetBits(1);
+			blkid = bs_read(b, 1);
 		if(blkid)
-			b.SkipBits(6);					//frmsizecod
+			bs_skip(b, 6);					//frmsizecod
 	}
 	// JOC extension can be read in addbsi field. Everything prior was only necessary to get here.
-	if(b.GetBits(1))						//addbsie
+	if(bs_read(b, 1))						//addbsie
 	{
 #ifdef DEBUG_PARSER
-		printf("***parse_eac3_bsi ADDBSIExists at bit pos: %d\n", b.GetBitPosition());
+		printf("***parse_eac3_bsi ADDBSIExists at bit pos: %d\n", (int)bs_tell(b));
 #endif
-		uint8_t addbsil = b.GetBits(6) + 1;	//addbsil
+		uint8_t addbsil = bs_read(b, 6) + 1;	//addbsil
 #ifdef DEBUG_PARSER
 		printf("***parse_eac3_bsi ADDBSILength: %d bytes\n", addbsil);
 #endif
 		for(int i = 0; i < addbsil; i++) {
-			addbsi[i] = b.GetBits(8);		//addbsi
+			addbsi[i] = bs_read(b, 8);		//addbsi
 #ifdef DEBUG_PARSER
 			printf("***parse_eac3_bsi ADDBSI byte #%d: 0x%X (%d)\n", i, addbsi[i], addbsi[i]);
 #endif
 		}
 	}
 #ifdef DEBUG_PARSER
-	printf("***parse_eac3_bsi end bit pos: %d remaining bits: %d\n", b.GetBitPosition(), b.GetRemainingBits());
+	printf("***parse_eac3_bsi end bit pos: %d remaining bits: %d\n", (int)bs_tell(b), (int)bs_left(b));
 #endif
-	b.SetBitPosition(savedbitpos);				//so that analyze_EAC3() does not raise exception
+	int truncated = bs_error(b);
+	bs_seek(b, savedbitpos);				//so that analyze_EAC3() can go on reading after the header
 
 	// Defined in 8.3 of ETSI TS 103 420
-	if(addbsi[0] & EC3Extension_JOC)
+	if(!truncated && (addbsi[0] & EC3Extension_JOC))
 	{
 		hdr->ec3_extension_type = EC3Extension_JOC;
 		hdr->complexity_index   = addbsi[1];
@@ -1014,7 +1012,7 @@ void analyze_eac3_addbsi(CMemoryBitstream &b, AC3HeaderInfo *hdr)
 
 int analyze_EAC3(void **context, uint8_t *frame, uint32_t size)
 {
-    CMemoryBitstream b;
+    bs_reader_t b;
     AC3HeaderInfo *hdr = NULL;
     struct eac3_info *info = NULL;
     int num_blocks;
@@ -1033,8 +1031,8 @@ int analyze_EAC3(void **context, uint8_t *frame, uint32_t size)
 
     info = (struct eac3_info *)*context;
 
-    b.SetBytes(frame, size);
-    if (ac3_parse_header(b, &hdr) < 0) {
+    bs_reader_init(&b, frame, size);
+    if (ac3_parse_header(&b, &hdr) < 0) {
         free(hdr);
         return -1;
     }
@@ -1076,16 +1074,22 @@ int analyze_EAC3(void **context, uint8_t *frame, uint32_t size)
         info->substream[hdr->substreamid].lfeon = hdr->lfe_on;
 		info->substream[hdr->substreamid].num_dep_sub = 0;		// to count num_dep_sub's only in this frame! Otherwise, if instantiated context passed in, num_dep_sub gets incremented cumulatively.
 		
+        /* the frame is truncated */
+        if (size < hdr->frame_size) {
+            free(hdr);
+            return -1;
+        }
+
         /* Parse dependent substream(s), if any */
         if (size != hdr->frame_size) {
             int cumul_size = hdr->frame_size;
             int parent = hdr->substreamid;
 
-            while (cumul_size != size) {
+            while (cumul_size < size) {
                 int i;
-                CMemoryBitstream gbc;
-                gbc.SetBytes(frame + cumul_size, (size - cumul_size));
-                if (ac3_parse_header(gbc, &hdr) < 0) {
+                bs_reader_t gbc;
+                bs_reader_init(&gbc, frame + cumul_size, (size - cumul_size));
+                if (ac3_parse_header(&gbc, &hdr) < 0) {
                     free(hdr);
                     return -1;
                 }
@@ -1098,23 +1102,27 @@ int analyze_EAC3(void **context, uint8_t *frame, uint32_t size)
 
                 /* header is parsed up to lfeon, but custom channel map may be needed */
                 /* skip bsid */
-				//gbc.SkipBits(5); // PV: ac3_parse_header() parses up to dialnorm!
+				//bs_skip(&gbc, 5); // PV: ac3_parse_header() parses up to dialnorm!
 
                 /* skip volume control params */
                 for (i = 0; i < (hdr->channel_mode ? 1 : 2); i++) {
-                    gbc.SkipBits(5); // skip dialog normalization
-                    if (gbc.GetBits(1)) {
-                        gbc.SkipBits(8); // skip compression gain word
+                    bs_skip(&gbc, 5); // skip dialog normalization
+                    if (bs_read(&gbc, 1)) {
+                        bs_skip(&gbc, 8); // skip compression gain word
                     }
                 }
                 /* get the dependent stream channel map, if exists */
-                if (gbc.GetBits(1)) {
-                    uint16_t value = gbc.GetBits(16);
+                if (bs_read(&gbc, 1)) {
+                    uint16_t value = bs_read(&gbc, 16);
                     info->substream[parent].chan_loc = ac3_to_dec3_chan_map(value);
                 }
                 else {
                     info->substream[parent].chan_loc |= hdr->channel_mode;
                 }
+                if (bs_error(&gbc)) {
+                    free(hdr);
+                    return -1;
+                }
             }
         }
     }
@@ -1169,49 +1177,48 @@ CFDataRef createCookie_EAC3(void *context)
     struct eac3_info *info = (struct eac3_info *) context;
 
     // Recreate the dec3 atom
-    CMemoryBitstream cookie;
-    cookie.AllocBytes(32);
-    cookie.PutBits(info->data_rate, 13);    // data_rate
-    cookie.PutBits(info->num_ind_sub, 3);   // num_ind_sub
+    uint8_t buffer[32] = {0};
+    bs_writer_t cookie;
+    bs_writer_init(&cookie, buffer, sizeof(buffer));
+    bs_write(&cookie, info->data_rate, 13);    // data_rate
+    bs_write(&cookie, info->num_ind_sub, 3);   // num_ind_sub
 	//end byte #0 & #1
     for (int i = 0; i <= info->num_ind_sub; i++) {
-        cookie.PutBits(info->substream[i].fscod, 2);
-        cookie.PutBits(16, 5); // eac3 should be always 16.
+        bs_write(&cookie, info->substream[i].fscod, 2);
+        bs_write(&cookie, 16, 5); // eac3 should be always 16.
 
-        cookie.PutBits(0, 1); // reserved
+        bs_write(&cookie, 0, 1); // reserved
 		//end byte #2
-        cookie.PutBits(0, 1); // asvc
+        bs_write(&cookie, 0, 1); // asvc
 
-        cookie.PutBits(info->substream[i].bsmod, 3);
-        cookie.PutBits(info->substream[i].acmod, 3);
-        cookie.PutBits(info->substream[i].lfeon, 1);
+        bs_write(&cookie, info->substream[i].bsmod, 3);
+        bs_write(&cookie, info->substream[i].acmod, 3);
+        bs_write(&cookie, info->substream[i].lfeon, 1);
 		//end byte #3
-        cookie.PutBits(0, 3); // reserved
+        bs_write(&cookie, 0, 3); // reserved
 
-        cookie.PutBits(info->substream[i].num_dep_sub, 4);
+        bs_write(&cookie, info->substream[i].num_dep_sub, 4);
 
         if (!info->substream[i].num_dep_sub) {
-            cookie.PutBits(0, 1); // reserved
+            bs_write(&cookie, 0, 1); // reserved
 			//end byte #4
         } else {
-            cookie.PutBits(info->substream[i].chan_loc, 9); // chan_loc
+            bs_write(&cookie, info->substream[i].chan_loc, 9); // chan_loc
 			//end byte #4 & #5
         }
 		if (info->ec3_extension_type) {						// See ETSI TS 103 420 V1.2.1 (2018-10) - C.3 EX3SpecificBox for details
-			cookie.PutBits(0, 7); 							// reserved
-			cookie.PutBits(info->ec3_extension_type, 1); 	// E-AC3 Extension type
+			bs_write(&cookie, 0, 7); 							// reserved
+			bs_write(&cookie, info->ec3_extension_type, 1); 	// E-AC3 Extension type
 			//end byte #5 or #6 (if num_dep_sub > 0)
-			cookie.PutBits(info->complexity_index, 8);		// Stream complexity Index
+			bs_write(&cookie, info->complexity_index, 8);		// Stream complexity Index
 			//end byte #6 or #7 (if num_dep_sub > 0)
 		}
     }
 
     free(info->frame);
     info->frame = NULL;
-    uint8_t *buffer = cookie.GetBuffer();
-    size_t size = cookie.GetBitPosition() / 8;
+    size_t size = bs_writer_tell(&cookie) / 8;
 	CFDataRef cookieData = CFDataCreate(kCFAllocatorDefault, buffer, size);
-	free (buffer);
 
     return cookieData;
 }
@@ -1316,42 +1323,37 @@ UInt32 readWaveChannelLayout(waveformatextensible_t *ex)
 
 int analyze_WAVEFORMATEX(const uint8_t *cookie, uint32_t cookieLen, waveformatextensible_t *ex)
 {
-    CMemoryBitstream b;
-    b.SetBytes((u_int8_t *)cookie, cookieLen);
+    bs_reader_t b;
+    bs_reader_init(&b, cookie, cookieLen);
     bzero(ex, sizeof(waveformatextensible_t));
 
-    try {
-        ex->Format.wFormatTag = EndianU16_BtoN(b.GetBits(16));
-        ex->Format.nChannels = EndianU16_BtoN(b.GetBits(16));
-        ex->Format.nSamplesPerSec = EndianU32_BtoN(b.GetBits(32));
-        ex->Format.nAvgBytesPerSec = EndianU32_BtoN(b.GetBits(32));
-        ex->Format.nBlockAlign = EndianU16_BtoN(b.GetBits(16));
-        ex->Format.wBitsPerSample = EndianU16_BtoN(b.GetBits(16));
-        ex->Format.cbSize = EndianU16_BtoN(b.GetBits(16));
-
-        if (ex->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
-            ex->Samples.wValidBitsPerSample = EndianU16_BtoN(b.GetBits(16));
-            ex->dwChannelMask = EndianU32_BtoN(b.GetBits(32));
-
-            ex->SubFormat.Data1 = EndianU32_BtoN(b.GetBits(32));
-            ex->SubFormat.Data2 = EndianU16_BtoN(b.GetBits(16));
-            ex->SubFormat.Data3 = EndianU16_BtoN(b.GetBits(16));
-
-            ex->SubFormat.Data4[0] = b.GetBits(8);
-            ex->SubFormat.Data4[1] = b.GetBits(8);
-            ex->SubFormat.Data4[2] = b.GetBits(8);
-            ex->SubFormat.Data4[3] = b.GetBits(8);
-            ex->SubFormat.Data4[4] = b.GetBits(8);
-            ex->SubFormat.Data4[5] = b.GetBits(8);
-            ex->SubFormat.Data4[6] = b.GetBits(8);
-            ex->SubFormat.Data4[7] = b.GetBits(8);
-        }
-    }
-    catch (int e) {
-        return 1;
+    ex->Format.wFormatTag = EndianU16_BtoN(bs_read(&b, 16));
+    ex->Format.nChannels = EndianU16_BtoN(bs_read(&b, 16));
+    ex->Format.nSamplesPerSec = EndianU32_BtoN(bs_read(&b, 32));
+    ex->Format.nAvgBytesPerSec = EndianU32_BtoN(bs_read(&b, 32));
+    ex->Format.nBlockAlign = EndianU16_BtoN(bs_read(&b, 16));
+    ex->Format.wBitsPerSample = EndianU16_BtoN(bs_read(&b, 16));
+    ex->Format.cbSize = EndianU16_BtoN(bs_read(&b, 16));
+
+    if (ex->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+        ex->Samples.wValidBitsPerSample = EndianU16_BtoN(bs_read(&b, 16));
+        ex->dwChannelMask = EndianU32_BtoN(bs_read(&b, 32));
+
+        ex->SubFormat.Data1 = EndianU32_BtoN(bs_read(&b, 32));
+        ex->SubFormat.Data2 = EndianU16_BtoN(bs_read(&b, 16));
+        ex->SubFormat.Data3 = EndianU16_BtoN(bs_read(&b, 16));
+
+        ex->SubFormat.Data4[0] = bs_read(&b, 8);
+        ex->SubFormat.Data4[1] = bs_read(&b, 8);
+        ex->SubFormat.Data4[2] = bs_read(&b, 8);
+        ex->SubFormat.Data4[3] = bs_read(&b, 8);
+        ex->SubFormat.Data4[4] = bs_read(&b, 8);
+        ex->SubFormat.Data4[5] = bs_read(&b, 8);
+        ex->SubFormat.Data4[6] = bs_read(&b, 8);
+        ex->SubFormat.Data4[7] = bs_read(&b, 8);
     }
 
-    return 0;
+    return bs_error(&b) ? 1 : 0;
 }
 
 #pragma mark - MPEG 4 Audio
@@ -1415,52 +1417,52 @@ const uint8_t  mpeg4audio_channels[] = {
     0, 1, 2, 3, 4, 5, 6, 8, 2, 3, 4, 7, 8, 24, 8, 12, 10, 12, 14
 };
 
-static int parse_config_ALS(CMemoryBitstream &b, MPEG4AudioConfig *c)
+static int parse_config_ALS(bs_reader_t *b, MPEG4AudioConfig *c)
 {
-    if (b.GetRemainingBits() < 112)
+    if (bs_left(b) < 112)
         return -1;
 
-    if (b.GetBits(32) != MKBETAG('A','L','S','\0'))
+    if (bs_read(b, 32) != MKBETAG('A','L','S','\0'))
         return -1;
 
     // override AudioSpecificConfig channel configuration and sample rate
     // which are buggy in old ALS conformance files
-    c->sample_rate = b.GetBits(32);
+    c->sample_rate = bs_read(b, 32);
 
     // skip number of samples
-    b.SkipBits(32);
+    bs_skip(b, 32);
 
     // read number of channels
     c->chan_config = 0;
-    c->channels    = b.GetBits(16) + 1;
+    c->channels    = bs_read(b, 16) + 1;
 
     return 0;
 }
 
-static inline int get_object_type(CMemoryBitstream &b)
+static inline int get_object_type(bs_reader_t *b)
 {
-    int object_type = b.GetBits(5);
+    int object_type = bs_read(b, 5);
     if (object_type == AOT_ESCAPE)
-        object_type = 32 + b.GetBits(6);
+        object_type = 32 + bs_read(b, 6);
     return object_type;
 }
 
-static inline int get_sample_rate(CMemoryBitstream &b, int *index)
+static inline int get_sample_rate(bs_reader_t *b, int *index)
 {
-    *index = b.GetBits(4);
-    return *index == 0x0f ? b.GetBits(24) :
+    *index = bs_read(b, 4);
+    return *index == 0x0f ? bs_read(b, 24) :
     mpeg4audio_sample_rates[*index];
 }
 
-static inline int get_program_config_element(CMemoryBitstream &b, int *channels)
+static inline int get_program_config_element(bs_reader_t *b, int *channels)
 {
-    b.SkipBits(4); // element_instance_tag
-    b.SkipBits(2); // object_type
-    b.SkipBits(4); // sampling_frequency_index
-    int num_front_channel_elements  = b.GetBits(4);
-    int num_side_channel_elements   = b.GetBits(4);
-    int num_back_channel_elements   = b.GetBits(4);
-    int num_lfe_channel_elements    = b.GetBits(2);
+    bs_skip(b, 4); // element_instance_tag
+    bs_skip(b, 2); // object_type
+    bs_skip(b, 4); // sampling_frequency_index
+    int num_front_channel_elements  = bs_read(b, 4);
+    int num_side_channel_elements   = bs_read(b, 4);
+    int num_back_channel_elements   = bs_read(b, 4);
+    int num_lfe_channel_elements    = bs_read(b, 2);
 
     *channels = num_front_channel_elements + num_side_channel_elements + num_back_channel_elements + num_lfe_channel_elements;
     return 0;
@@ -1477,131 +1479,129 @@ int analyze_ESDS(MPEG4AudioConfig *c, const uint8_t *cookie, uint32_t cookieLen)
 
     bzero(c, sizeof(MPEG4AudioConfig));
 
-    CMemoryBitstream b;
-    b.SetBytes((uint8_t *)cookie, cookieLen);
+    bs_reader_t b;
+    bs_reader_init(&b, cookie, cookieLen);
 
-    try {
-        c->object_type = get_object_type(b);
-        c->sample_rate = get_sample_rate(b, &c->sampling_index);
-        c->chan_config = b.GetBits(4);
-        if (c->chan_config < ARRAY_ELEMS(mpeg4audio_channels)) {
-            c->channels = mpeg4audio_channels[c->chan_config];
+    c->object_type = get_object_type(&b);
+    c->sample_rate = get_sample_rate(&b, &c->sampling_index);
+    c->chan_config = bs_read(&b, 4);
+    if (c->chan_config < ARRAY_ELEMS(mpeg4audio_channels)) {
+        c->channels = mpeg4audio_channels[c->chan_config];
+    }
+    c->sbr = -1;
+    c->ps  = -1;
+    if (c->object_type == AOT_SBR || (c->object_type == AOT_PS &&
+                                      // check for W6132 Annex YYYY draft MP3onMP4
+                                      !(bs_peek(&b, 3) & 0x03 && !(bs_peek(&b, 9) & 0x3F)))) {
+        if (c->object_type == AOT_PS) {
+            c->ps = 1;
         }
-        c->sbr = -1;
-        c->ps  = -1;
-        if (c->object_type == AOT_SBR || (c->object_type == AOT_PS &&
-                                          // check for W6132 Annex YYYY draft MP3onMP4
-                                          !(b.PeakBits(3) & 0x03 && !(b.PeakBits(9) & 0x3F)))) {
-            if (c->object_type == AOT_PS) {
-                c->ps = 1;
-            }
-            c->ext_object_type = AOT_SBR;
-            c->sbr = 1;
-            c->ext_sample_rate = get_sample_rate(b, &c->ext_sampling_index);
-            c->object_type = get_object_type(b);
-            if (c->object_type == AOT_ER_BSAC) {
-                c->ext_chan_config = b.GetBits(4);
-            }
-        } else {
-            c->ext_object_type = AOT_NULL;
-            c->ext_sample_rate = 0;
+        c->ext_object_type = AOT_SBR;
+        c->sbr = 1;
+        c->ext_sample_rate = get_sample_rate(&b, &c->ext_sampling_index);
+        c->object_type = get_object_type(&b);
+        if (c->object_type == AOT_ER_BSAC) {
+            c->ext_chan_config = bs_read(&b, 4);
         }
-        specific_config_bitindex = b.GetBitPosition();
-
-        switch (c->object_type) {
-            case 1:
-            case 2:
-            case 3:
-            case 4:
-            case 6:
-            case 7:
-            case 17:
-            case 19:
-            case 20:
-            case 21:
-            case 22:
-            case 23:
-            {
-                b.SkipBits(1); // frameLengthFlag
-
-                int dependsOnCoreCoder = b.GetBits(1);
-                if (dependsOnCoreCoder) {
-                    b.SkipBits(14); // coreCoderDelay
-                }
+    } else {
+        c->ext_object_type = AOT_NULL;
+        c->ext_sample_rate = 0;
+    }
+    specific_config_bitindex = (int)bs_tell(&b);
 
-                int extensionFlag = b.GetBits(1);
+    switch (c->object_type) {
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 6:
+        case 7:
+        case 17:
+        case 19:
+        case 20:
+        case 21:
+        case 22:
+        case 23:
+        {
+            bs_skip(&b, 1); // frameLengthFlag
+
+            int dependsOnCoreCoder = bs_read(&b, 1);
+            if (dependsOnCoreCoder) {
+                bs_skip(&b, 14); // coreCoderDelay
+            }
 
-                if (!c->chan_config) {
-                    get_program_config_element(b, &c->channels);
-                }
+            int extensionFlag = bs_read(&b, 1);
 
-                if ((c->object_type == 6) || (c->object_type == 20)) {
-                    b.SkipBits(3);
-                }
+            if (!c->chan_config) {
+                get_program_config_element(&b, &c->channels);
+            }
 
-                if (extensionFlag) {
-                    if (c->object_type == 22) {
-                        b.SkipBits(5);
-                        b.SkipBits(11);
-                    }
-                    if ((c->object_type == 17)
-                        || (c->object_type == 19)
-                        || (c->object_type == 20)
-                        || (c->object_type == 23)
-                        ) {
-                        b.SkipBits(1);
-                        b.SkipBits(1);
-                        b.SkipBits(1);
-                    }
-                    /*ext_flag = */b.SkipBits(1);
+            if ((c->object_type == 6) || (c->object_type == 20)) {
+                bs_skip(&b, 3);
+            }
+
+            if (extensionFlag) {
+                if (c->object_type == 22) {
+                    bs_skip(&b, 5);
+                    bs_skip(&b, 11);
                 }
+                if ((c->object_type == 17)
+                    || (c->object_type == 19)
+                    || (c->object_type == 20)
+                    || (c->object_type == 23)
+                    ) {
+                    bs_skip(&b, 1);
+                    bs_skip(&b, 1);
+                    bs_skip(&b, 1);
+                }
+                /*ext_flag = */bs_skip(&b, 1);
             }
         }
+    }
 
-        if (c->object_type == AOT_ALS) {
-            b.SkipBits(5);
-            if (b.PeakBits(24) != MKBETAG('\0','A','L','S')) {
-                b.SkipBits(24);
-            }
+    if (c->object_type == AOT_ALS) {
+        bs_skip(&b, 5);
+        if (bs_peek(&b, 24) != MKBETAG('\0','A','L','S')) {
+            bs_skip(&b, 24);
+        }
 
-            specific_config_bitindex = b.GetBitPosition();
+        specific_config_bitindex = (int)bs_tell(&b);
 
-            if (parse_config_ALS(b, c)) {
-                return -1;
-            }
+        if (parse_config_ALS(&b, c)) {
+            return -1;
         }
+    }
 
-        if (c->ext_object_type != AOT_SBR && sync_extension) {
-            while (b.GetRemainingBits() > 15) {
-                if (b.PeakBits(11) == 0x2b7) { // sync extension
-                    b.GetBits(11);
-                    c->ext_object_type = get_object_type(b);
-                    if (c->ext_object_type == AOT_SBR && (c->sbr = b.GetBits(1)) == 1) {
-                        c->ext_sample_rate = get_sample_rate(b, &c->ext_sampling_index);
-                        if (c->ext_sample_rate == c->sample_rate) {
-                            c->sbr = -1;
-                        }
+    if (c->ext_object_type != AOT_SBR && sync_extension) {
+        while (bs_left(&b) > 15) {
+            if (bs_peek(&b, 11) == 0x2b7) { // sync extension
+                bs_read(&b, 11);
+                c->ext_object_type = get_object_type(&b);
+                if (c->ext_object_type == AOT_SBR && (c->sbr = bs_read(&b, 1)) == 1) {
+                    c->ext_sample_rate = get_sample_rate(&b, &c->ext_sampling_index);
+                    if (c->ext_sample_rate == c->sample_rate) {
+                        c->sbr = -1;
                     }
-                    if (b.GetRemainingBits() > 11 && b.GetBits(11) == 0x548) {
-                        c->ps = b.GetBits(1);
-                    }
-                    break;
-                } else {
-                    b.SkipBits(1); // skip 1 bit
                 }
+                if (bs_left(&b) > 11 && bs_read(&b, 11) == 0x548) {
+                    c->ps = bs_read(&b, 1);
+                }
+                break;
+            } else {
+                bs_skip(&b, 1); // skip 1 bit
             }
         }
+    }
 
-        //PS requires SBR
-        if (!c->sbr) {
-            c->ps = 0;
-        }
-        //Limit implicit PS to the HE-AACv2 Profile
-        if ((c->ps == -1 && c->object_type != AOT_AAC_LC) || c->channels & ~0x01) {
-            c->ps = 0;
-        }
-
-    } catch (int e) {
+    //PS requires SBR
+    if (!c->sbr) {
+        c->ps = 0;
+    }
+    //Limit implicit PS to the HE-AACv2 Profile
+    if ((c->ps == -1 && c->object_type != AOT_AAC_LC) || c->channels & ~0x01) {
+        c->ps = 0;
+    }
+    if (bs_error(&b)) {
         return -1;
     }
 
@@ -1633,34 +1633,32 @@ int analyze_AVC(const uint8_t *cookie, uint32_t cookieLen)
     AVCConfig *info = (AVCConfig *)malloc (sizeof(AVCConfig));
     bzero(info, sizeof(AVCConfig));
 
-    CMemoryBitstream b;
-    b.SetBytes((uint8_t *)cookie, cookieLen);
+    bs_reader_t b;
+    bs_reader_init(&b, cookie, cookieLen);
 
-    try {
-        info->configurationVersion = b.GetBits(8);
-        info->AVCProfileIndication = b.GetBits(8);
-        info->profile_compatibility = b.GetBits(8);
-        info->AVCLevelIndication = b.GetBits(8);
+    info->configurationVersion = bs_read(&b, 8);
+    info->AVCProfileIndication = bs_read(&b, 8);
+    info->profile_compatibility = bs_read(&b, 8);
+    info->AVCLevelIndication = bs_read(&b, 8);
 
-        b.SkipBits(6);
-        info->lengthSizeMinusOne = b.GetBits(2);
-        b.SkipBits(3);
+    bs_skip(&b, 6);
+    info->lengthSizeMinusOne = bs_read(&b, 2);
+    bs_skip(&b, 3);
 
-        info->numOfSequenceParameterSets = b.GetBits(5);
+    info->numOfSequenceParameterSets = bs_read(&b, 5);
 
-        for (int i = 0; i < info->numOfSequenceParameterSets; i++) {
-            UInt16 sequenceParameterSetLength = b.GetBits(16);
-            b.SkipBits(8 * sequenceParameterSetLength);
-        }
+    for (int i = 0; i < info->numOfSequenceParameterSets; i++) {
+        UInt16 sequenceParameterSetLength = bs_read(&b, 16);
+        bs_skip(&b, 8 * sequenceParameterSetLength);
+    }
 
-        info->numOfPictureParameterSets = b.GetBits(8);
+    info->numOfPictureParameterSets = bs_read(&b, 8);
 
-        for (int i = 0; i < info->numOfPictureParameterSets; i++) {
-            UInt16 pictureParameterSetLength = b.GetBits(16);
-            b.SkipBits(8 * pictureParameterSetLength);
-        }
+    for (int i = 0; i < info->numOfPictureParameterSets; i++) {
+        UInt16 pictureParameterSetLength = bs_read(&b, 16);
+        bs_skip(&b, 8 * pictureParameterSetLength);
     }
-    catch (int e) {
+    if (bs_error(&b)) {
         result = 1;
     }
 
@@ -1720,81 +1718,78 @@ int parse_HEVC(const uint8_t *cookie, uint32_t cookieLen, bool *completeness, bo
     HEVCConfig *info = (HEVCConfig *)malloc (sizeof(HEVCConfig));
     bzero(info, sizeof(HEVCConfig));
 
-    CMemoryBitstream b;
-    b.SetBytes((uint8_t *)cookie, cookieLen);
+    bs_reader_t b;
+    bs_reader_init(&b, cookie, cookieLen);
 
-    try {
-        if (forceCompleteness) {
-            b.PutBits(1, 8);
-        } else {
-            info->configurationVersion = b.GetBits(8);
-        }
-        info->general_profile_space = b.GetBits(2);
-        info->general_tier_flag = b.GetBits(1);
-        info->general_profile_idc = b.GetBits(5);
-        info->general_profile_compatibility_flags = b.GetBits(32);
+    info->configurationVersion = bs_read(&b, 8);
+    if (forceCompleteness && cookieLen > 0) {
+        ((uint8_t *)cookie)[0] |= 1;
+    }
+    info->general_profile_space = bs_read(&b, 2);
+    info->general_tier_flag = bs_read(&b, 1);
+    info->general_profile_idc = bs_read(&b, 5);
+    info->general_profile_compatibility_flags = bs_read(&b, 32);
 
-        info->general_constraint_indicator_flags = b.GetBits(32) << 16;
-        info->general_constraint_indicator_flags += b.GetBits(16);
-        info->general_level_idc = b.GetBits(8);
+    info->general_constraint_indicator_flags = bs_read(&b, 32) << 16;
+    info->general_constraint_indicator_flags += bs_read(&b, 16);
+    info->general_level_idc = bs_read(&b, 8);
 
-        b.SkipBits(4); // reserved 1111b
-        info->min_spatial_segmentation_idc = b.GetBits(12);
-        b.SkipBits(6); // reserved 111111b
-        info->parallelismType = b.GetBits(2);
-        b.SkipBits(6); // reserved 111111b
-        info->chromaFormat = b.GetBits(2);
-        b.SkipBits(5); // reserved 11111b
-        info->bitDepthLumaMinus8 = b.GetBits(3);
-        b.SkipBits(5); // reserved 11111b
-        info->bitDepthChromaMinus8 = b.GetBits(3);
+    bs_skip(&b, 4); // reserved 1111b
+    info->min_spatial_segmentation_idc = bs_read(&b, 12);
+    bs_skip(&b, 6); // reserved 111111b
+    info->parallelismType = bs_read(&b, 2);
+    bs_skip(&b, 6); // reserved 111111b
+    info->chromaFormat = bs_read(&b, 2);
+    bs_skip(&b, 5); // reserved 11111b
+    info->bitDepthLumaMinus8 = bs_read(&b, 3);
+    bs_skip(&b, 5); // reserved 11111b
+    info->bitDepthChromaMinus8 = bs_read(&b, 3);
 
-        info->avgFrameRate = b.GetBits(16);
-        info->constantFrameRate = b.GetBits(2);
+    info->avgFrameRate = bs_read(&b, 16);
+    info->constantFrameRate = bs_read(&b, 2);
 
-        info->numTemporalLayers = b.GetBits(3);
-        info->temporalIdNested = b.GetBits(1);
+    info->numTemporalLayers = bs_read(&b, 3);
+    info->temporalIdNested = bs_read(&b, 1);
 
-        info->lengthSizeMinusOne = b.GetBits(2);
-        info->numOfArrays = b.GetBits(8);
+    info->lengthSizeMinusOne = bs_read(&b, 2);
+    info->numOfArrays = bs_read(&b, 8);
 
-        info->NAL_units = (struct NAL_units *)malloc(sizeof(struct NAL_units) * info->numOfArrays);
+    info->NAL_units = (struct NAL_units *)malloc(sizeof(struct NAL_units) * info->numOfArrays);
 
-        for (UInt8 j = 0; j < info->numOfArrays; j++) {
-            bool unitIsComplete = true;
-            u_int32_t completenessPos = b.GetBitPosition();
+    for (UInt8 j = 0; j < info->numOfArrays && !bs_error(&b); j++) {
+        bool unitIsComplete = true;
+        uint64_t completenessPos = bs_tell(&b);
 
-            info->NAL_units[j].array_completeness = b.GetBits(1);
+        info->NAL_units[j].array_completeness = bs_read(&b, 1);
 
-            if (info->NAL_units[j].array_completeness == 0) {
-                unitIsComplete = false;
-            }
+        if (info->NAL_units[j].array_completeness == 0) {
+            unitIsComplete = false;
+        }
 
-            b.SkipBits(1); // reserved 0
-
-            info->NAL_units[j].NAL_unit_type = b.GetBits(6);
-            info->NAL_units[j].numNalus = b.GetBits(16);
-
-            if (info->NAL_units[j].NAL_unit_type == NAL_UNIT_VPS ||
-                info->NAL_units[j].NAL_unit_type == NAL_UNIT_SPS ||
-                info->NAL_units[j].NAL_unit_type == NAL_UNIT_PPS) {
-                if (forceCompleteness && info->NAL_units[j].numNalus > 0) {
-                    u_int32_t currentPos = b.GetBitPosition();
-                    b.SetBitPosition(completenessPos);
-                    b.PutBits(1, 1);
-                    b.SetBitPosition(currentPos);
-                } else {
-                    complete = unitIsComplete;
-                }
-            }
+        bs_skip(&b, 1); // reserved 0
+
+        info->NAL_units[j].NAL_unit_type = bs_read(&b, 6);
+        info->NAL_units[j].numNalus = bs_read(&b, 16);
+        if (bs_error(&b)) {
+            break;
+        }
 
-            for (UInt8 i = 0; i < info->NAL_units[j].numNalus; i++) {
-                UInt16 nalUnitLength = b.GetBits(16);
-                b.SkipBits(8 * nalUnitLength);
+        if (info->NAL_units[j].NAL_unit_type == NAL_UNIT_VPS ||
+            info->NAL_units[j].NAL_unit_type == NAL_UNIT_SPS ||
+            info->NAL_units[j].NAL_unit_type == NAL_UNIT_PPS) {
+            if (forceCompleteness && info->NAL_units[j].numNalus > 0) {
+                ((uint8_t *)cookie)[completenessPos >> 3] |= 0x80 >> (completenessPos & 7);
+            } else {
+                complete = unitIsComplete;
             }
         }
+
+        for (UInt8 i = 0; i < info->NAL_units[j].numNalus && !bs_error(&b); i++) {
+            UInt16 nalUnitLength = bs_read(&b, 16);
+            bs_skip(&b, 8 * nalUnitLength);
+        }
     }
-    catch (int e) {
+    if (bs_error(&b)) {
         result = 1;
     }
 
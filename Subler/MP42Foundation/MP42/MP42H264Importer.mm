@@ -24,20 +24,33 @@ typedef struct framerate_t {
     uint32_t duration;
 } framerate_t;
 
+#define H264_DPB_SIZE 16
+
+/* a frame that waits longer than this for output has a broken poc */
+#define H264_DPB_MAX_WAITING 256
+
 typedef struct
 {
+    /* the frames waiting for output, a min-heap on the poc
+     * and then on the decode order */
     struct
     {
-        int size_min;
-        int next;
-        int cnt;
-        int idx[17];
-        int poc[17];
-    } dpb;
-
+        int poc;
+        int idx;
+    } heap[H264_DPB_SIZE + 1];
     int cnt;
-    int cnt_max;
-    int *frame;
+    int next;       /* decode index of the next frame */
+    int out;        /* output index of the next frame out of the heap */
+
+    /* output index minus decode index of the frames that weren't taken
+     * yet, a ring indexed by decode index whose size is a power of two */
+    int *delta;
+    int delta_size;
+    int taken;
+
+    /* the largest number of frames that precede a frame in decode order
+     * and follow it in output order */
+    int max_num_reorder_frames;
 } h264_dpb_t;
 
 //#define DEBUG_H264
@@ -128,16 +141,6 @@ typedef struct h264_decode_t {
     uint8_t initial_cpb_removal_delay_length_minus1;
 } h264_decode_t;
 
-typedef struct nal_reader_t {
-    FILE *ifile;
-	int pipeFD;
-	int usePipe;
-    uint8_t *buffer;
-    uint32_t buffer_on;
-    uint32_t buffer_size;
-    uint32_t buffer_size_max;
-} nal_reader_t;
-
 #define H264_START_CODE 0x000001
 #define H264_PREVENT_3_BYTE 0x000003
 
@@ -184,25 +187,6 @@ typedef struct nal_reader_t {
 #define HAVE_ALL_SLICES 0x1f
 #define HAVE_ALL_BUT_B_SLICES 0x1b
 
-static uint8_t exp_golomb_bits[256] = {
-    8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4, 3, 
-    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 
-    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 
-    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 
-};
-
 static const char *ProgName = "Subler";
 static int Verbosity = 0;
 
@@ -214,76 +198,8 @@ static int Verbosity = 0;
 #include <string.h>
 #include <inttypes.h>
 #include <sys/types.h>
-#include "mpeg4ip_bitstream.h"
-
-uint32_t h264_ue (CBitstream *bs)
-{
-    uint32_t bits, read;
-    int bits_left;
-    uint8_t coded;
-    bool done = false;
-    uint32_t temp;
-    bits = 0;
-    // we want to read 8 bits at a time - if we don't have 8 bits, 
-    // read what's left, and shift.  The exp_golomb_bits calc remains the
-    // same.
-    while (done == false) {
-        bits_left = bs->bits_remain();
-        if (bits_left < 8) {
-            read = bs->PeekBits(bits_left) << (8 - bits_left);
-            done = true;
-        } else {
-            read = bs->PeekBits(8);
-            if (read == 0) {
-                (void)bs->GetBits(8);
-                bits += 8;
-            } else {
-                done = true;
-            }
-        }
-    }
-    coded = exp_golomb_bits[read];
-    temp = bs->GetBits(coded);
-    bits += coded;
-    
-    //  printf("ue - bits %d\n", bits);
-    return bs->GetBits(bits + 1) - 1;
-}
-
-int32_t h264_se (CBitstream *bs) 
-{
-    uint32_t ret;
-    ret = h264_ue(bs);
-    if ((ret & 0x1) == 0) {
-        ret >>= 1;
-        int32_t temp = 0 - ret;
-        return temp;
-    } 
-    return (ret + 1) >> 1;
-}
-
-static void h264_decode_annexb( uint8_t *dst, int *dstlen,
-                               const uint8_t *src, const int srclen )
-{
-    uint8_t *dst_sav = dst;
-    const uint8_t *end = &src[srclen];
-    
-    while (src < end)
-    {
-        if (src < end - 3 && src[0] == 0x00 && src[1] == 0x00 &&
-            src[2] == 0x03)
-        {
-            *dst++ = 0x00;
-            *dst++ = 0x00;
-            
-            src += 3;
-            continue;
-        }
-        *dst++ = *src++;
-    }
-    
-    *dstlen = dst - dst_sav;
-}
+#include "bitstream.h"
+#include "annexb.h"
 
 extern "C" bool h264_is_start_code (const uint8_t *pBuf) 
 {
@@ -296,33 +212,21 @@ extern "C" bool h264_is_start_code (const uint8_t *pBuf)
     return false;
 }
 
+// offset of the start code following the one at pBuf, if any,
+// including its leading zero byte when it has one, 0 if there is none
+// in the first bufLen - 3 bytes
 extern "C" uint32_t h264_find_next_start_code (const uint8_t *pBuf, 
                                                uint32_t bufLen)
 {
-    uint32_t val, temp;
-    uint32_t offset;
-    
-    offset = 0;
-    if (pBuf[0] == 0 && 
-        pBuf[1] == 0 && 
-        ((pBuf[2] == 1) ||
-         ((pBuf[2] == 0) && pBuf[3] == 1))) {
-            pBuf += 3;
-            offset = 3;
-        }
-    val = 0xffffffff;
-    while (offset < bufLen - 3) {
-        val <<= 8;
-        temp = val & 0xff000000;
-        val &= 0x00ffffff;
-        val |= *pBuf++;
-        offset++;
-        if (val == H264_START_CODE) {
-            if (temp == 0) return offset - 4;
-            return offset - 3;
-        }
-    }
-    return 0;
+    uint32_t first, offset;
+
+    first = h264_is_start_code(pBuf) ? 3 : 0;
+    if (bufLen < first + 3) return 0;
+
+    offset = first + (uint32_t)annexb_find_start_code(pBuf + first, bufLen - 3 - first);
+    if (offset == bufLen - 3) return 0;
+    if (offset > first && pBuf[offset - 1] == 0) return offset - 1;
+    return offset;
 }
 
 extern "C" uint8_t h264_nal_unit_type (const uint8_t *buffer)
@@ -362,14 +266,14 @@ extern "C" uint8_t h264_nal_ref_idc (const uint8_t *buffer)
     return (buffer[offset] >> 5) & 0x3;
 }
 
-static void scaling_list (uint sizeOfScalingList, CBitstream *bs)
+static void scaling_list (uint sizeOfScalingList, bs_reader_t *bs)
 {
     uint lastScale = 8, nextScale = 8;
     uint j;
     
     for (j = 0; j < sizeOfScalingList; j++) {
         if (nextScale != 0) {
-            int deltaScale = h264_se(bs);
+            int deltaScale = bs_read_se(bs);
             nextScale = (lastScale + deltaScale + 256) % 256;
         }
         if (nextScale == 0) {
@@ -380,76 +284,76 @@ static void scaling_list (uint sizeOfScalingList, CBitstream *bs)
     }
 }
 
-extern "C" void h264_hrd_parameters (h264_decode_t *dec, CBitstream *bs)
+extern "C" void h264_hrd_parameters (h264_decode_t *dec, bs_reader_t *bs)
 {
     uint32_t cpb_cnt;
-    dec->cpb_cnt_minus1 = cpb_cnt = h264_ue(bs);
+    dec->cpb_cnt_minus1 = cpb_cnt = bs_read_ue(bs);
     uint32_t temp;
     printf("     cpb_cnt_minus1: %u\n", cpb_cnt);
-    printf("     bit_rate_scale: %u\n", bs->GetBits(4));
-    printf("     cpb_size_scale: %u\n", bs->GetBits(4));
+    printf("     bit_rate_scale: %u\n", bs_read(bs, 4));
+    printf("     cpb_size_scale: %u\n", bs_read(bs, 4));
     for (uint32_t ix = 0; ix <= cpb_cnt; ix++) {
-        printf("      bit_rate_value_minus1[%u]: %u\n", ix, h264_ue(bs));
-        printf("      cpb_size_value_minus1[%u]: %u\n", ix, h264_ue(bs));
-        printf("      cbr_flag[%u]: %u\n", ix, bs->GetBits(1));
+        printf("      bit_rate_value_minus1[%u]: %u\n", ix, bs_read_ue(bs));
+        printf("      cpb_size_value_minus1[%u]: %u\n", ix, bs_read_ue(bs));
+        printf("      cbr_flag[%u]: %u\n", ix, bs_read(bs, 1));
     }
-    temp = dec->initial_cpb_removal_delay_length_minus1 = bs->GetBits(5);
+    temp = dec->initial_cpb_removal_delay_length_minus1 = bs_read(bs, 5);
     printf("     initial_cpb_removal_delay_length_minus1: %u\n", temp);
     
-    dec->cpb_removal_delay_length_minus1 = temp = bs->GetBits(5);
+    dec->cpb_removal_delay_length_minus1 = temp = bs_read(bs, 5);
     printf("     cpb_removal_delay_length_minus1: %u\n", temp);
-    dec->dpb_output_delay_length_minus1 = temp = bs->GetBits(5);
+    dec->dpb_output_delay_length_minus1 = temp = bs_read(bs, 5);
     printf("     dpb_output_delay_length_minus1: %u\n", temp);
-    dec->time_offset_length = temp = bs->GetBits(5);  
+    dec->time_offset_length = temp = bs_read(bs, 5);  
     printf("     time_offset_length: %u\n", temp);
 }
 
-extern "C" void h264_vui_parameters (h264_decode_t *dec, CBitstream *bs)
+extern "C" void h264_vui_parameters (h264_decode_t *dec, bs_reader_t *bs)
 {
     //uint32_t temp;
-    dec->aspect_ratio_info_present_flag = bs->GetBits(1);
+    dec->aspect_ratio_info_present_flag = bs_read(bs, 1);
     if (dec->aspect_ratio_info_present_flag) {
-        dec->aspect_ratio_idc = bs->GetBits(8);
+        dec->aspect_ratio_idc = bs_read(bs, 8);
         if (dec->aspect_ratio_idc == 0xff) { // extended_SAR
-            dec->sar_width = bs->GetBits(16);
-            dec->sar_height = bs->GetBits(16);
+            dec->sar_width = bs_read(bs, 16);
+            dec->sar_height = bs_read(bs, 16);
         }
     }
     
 #if 0
-    temp = bs->GetBits(1);
+    temp = bs_read(bs, 1);
     printf("    overscan_info_present_flag: %u\n", temp);
     if (temp) {
-        printf("     overscan_appropriate_flag: %u\n", bs->GetBits(1));
+        printf("     overscan_appropriate_flag: %u\n", bs_read(bs, 1));
     }
-    temp = bs->GetBits(1);
+    temp = bs_read(bs, 1);
     printf("    video_signal_info_present_flag: %u\n", temp);
     if (temp) {
-        printf("     video_format: %u\n", bs->GetBits(3));
-        printf("     video_full_range_flag: %u\n", bs->GetBits(1));
-        temp = bs->GetBits(1);
+        printf("     video_format: %u\n", bs_read(bs, 3));
+        printf("     video_full_range_flag: %u\n", bs_read(bs, 1));
+        temp = bs_read(bs, 1);
         printf("     colour_description_present_flag: %u\n", temp);
         if (temp) {
-            printf("      colour_primaries: %u\n", bs->GetBits(8));
-            printf("      transfer_characteristics: %u\n", bs->GetBits(8));
-            printf("      matrix_coefficients: %u\n", bs->GetBits(8));
+            printf("      colour_primaries: %u\n", bs_read(bs, 8));
+            printf("      transfer_characteristics: %u\n", bs_read(bs, 8));
+            printf("      matrix_coefficients: %u\n", bs_read(bs, 8));
         }
     }
     
-    temp = bs->GetBits(1);
+    temp = bs_read(bs, 1);
     printf("    chroma_loc_info_present_flag: %u\n", temp);
     if (temp) {
-        printf("     chroma_sample_loc_type_top_field: %u\n", h264_ue(bs));
-        printf("     chroma_sample_loc_type_bottom_field: %u\n", h264_ue(bs));
+        printf("     chroma_sample_loc_type_top_field: %u\n", bs_read_ue(bs));
+        printf("     chroma_sample_loc_type_bottom_field: %u\n", bs_read_ue(bs));
     }
-    temp = bs->GetBits(1);
+    temp = bs_read(bs, 1);
     printf("    timing_info_present_flag: %u\n", temp);
     if (temp) {
-        printf("     num_units_in_tick: %u\n", bs->GetBits(32));
-        printf("     time_scale: %u\n", bs->GetBits(32));
-        printf("     fixed_frame_scale: %u\n", bs->GetBits(1));
+        printf("     num_units_in_tick: %u\n", bs_read(bs, 32));
+        printf("     time_scale: %u\n", bs_read(bs, 32));
+        printf("     fixed_frame_scale: %u\n", bs_read(bs, 1));
     }
-    temp = bs->GetBits(1);
+    temp = bs_read(bs, 1);
     printf("    nal_hrd_parameters_present_flag: %u\n", temp);
     if (temp) {
         dec->NalHrdBpPresentFlag = 1;
@@ -458,7 +362,7 @@ extern "C" void h264_vui_parameters (h264_decode_t *dec, CBitstream *bs)
     }
     uint32_t temp2;
     
-    temp2 = bs->GetBits(1);
+    temp2 = bs_read(bs, 1);
     printf("    vcl_hrd_parameters_present_flag: %u\n", temp2);
     if (temp2) {
         dec->VclHrdBpPresentFlag = 1;
@@ -466,19 +370,19 @@ extern "C" void h264_vui_parameters (h264_decode_t *dec, CBitstream *bs)
         h264_hrd_parameters(dec, bs);
     }
     if (temp || temp2) {
-        printf("    low_delay_hrd_flag: %u\n", bs->GetBits(1));
+        printf("    low_delay_hrd_flag: %u\n", bs_read(bs, 1));
     }
-    dec->pic_struct_present_flag = temp = bs->GetBits(1);
+    dec->pic_struct_present_flag = temp = bs_read(bs, 1);
     printf("    pic_struct_present_flag: %u\n", temp);
-    temp = bs->GetBits(1);
+    temp = bs_read(bs, 1);
     if (temp) {
-        printf("    motion_vectors_over_pic_boundaries_flag: %u\n", bs->GetBits(1));
-        printf("    max_bytes_per_pic_denom: %u\n", h264_ue(bs));
-        printf("    max_bits_per_mb_denom: %u\n", h264_ue(bs));
-        printf("    log2_max_mv_length_horizontal: %u\n", h264_ue(bs));
-        printf("    log2_max_mv_length_vertical: %u\n", h264_ue(bs));
-        printf("    num_reorder_frames: %u\n", h264_ue(bs));
-        printf("     max_dec_frame_buffering: %u\n", h264_ue(bs));
+        printf("    motion_vectors_over_pic_boundaries_flag: %u\n", bs_read(bs, 1));
+        printf("    max_bytes_per_pic_denom: %u\n", bs_read_ue(bs));
+        printf("    max_bits_per_mb_denom: %u\n", bs_read_ue(bs));
+        printf("    log2_max_mv_length_horizontal: %u\n", bs_read_ue(bs));
+        printf("    log2_max_mv_length_vertical: %u\n", bs_read_ue(bs));
+        printf("    num_reorder_frames: %u\n", bs_read_ue(bs));
+        printf("     max_dec_frame_buffering: %u\n", bs_read_ue(bs));
     }
 #endif
 }
@@ -487,91 +391,82 @@ int h264_read_seq_info (const uint8_t *buffer,
                         uint32_t buflen, 
                         h264_decode_t *dec)
 {
-    CBitstream bs;
+    bs_reader_t bs;
     uint32_t header;
-    uint8_t tmp[2048]; /* Should be enough for all SPS (we have at worst 13 bytes and 496 se/ue in frext) */
-    int tmp_len;
     uint32_t dummy;
     
     if (buffer[2] == 1) header = 4;
     else header = 5;
     
-    h264_decode_annexb( tmp, &tmp_len, buffer + header, MIN(buflen-header,2048) );
-    bs.init(tmp, tmp_len * 8);
+    bs_reader_init_nal(&bs, buffer + header, buflen - header);
     
-    //bs.set_verbose(true);
-    try {
-        dec->profile = bs.GetBits(8);
-        dummy = bs.GetBits(1 + 1 + 1 + 1 + 4);
-        dec->level = bs.GetBits(8);
-        (void)h264_ue(&bs); // seq_parameter_set_id
-        if (dec->profile == 100 || dec->profile == 110 ||
-            dec->profile == 122 || dec->profile == 144) {
-            dec->chroma_format_idc = h264_ue(&bs);
-            if (dec->chroma_format_idc == 3) {
-                dec->residual_colour_transform_flag = bs.GetBits(1);
-            }
-            dec->bit_depth_luma_minus8 = h264_ue(&bs);
-            dec->bit_depth_chroma_minus8 = h264_ue(&bs);
-            dec->qpprime_y_zero_transform_bypass_flag = bs.GetBits(1);
-            dec->seq_scaling_matrix_present_flag = bs.GetBits(1);
-            if (dec->seq_scaling_matrix_present_flag) {
-                for (uint ix = 0; ix < 8; ix++) {
-                    if (bs.GetBits(1)) {
-                        scaling_list(ix < 6 ? 16 : 64, &bs);
-                    }
-                }
-            }
+    dec->profile = bs_read(&bs, 8);
+    dummy = bs_read(&bs, 1 + 1 + 1 + 1 + 4);
+    dec->level = bs_read(&bs, 8);
+    (void)bs_read_ue(&bs); // seq_parameter_set_id
+    if (dec->profile == 100 || dec->profile == 110 ||
+        dec->profile == 122 || dec->profile == 144) {
+        dec->chroma_format_idc = bs_read_ue(&bs);
+        if (dec->chroma_format_idc == 3) {
+            dec->residual_colour_transform_flag = bs_read(&bs, 1);
         }
-        dec->log2_max_frame_num_minus4 = h264_ue(&bs);
-        dec->pic_order_cnt_type = h264_ue(&bs);
-        if (dec->pic_order_cnt_type == 0) {
-            dec->log2_max_pic_order_cnt_lsb_minus4 = h264_ue(&bs);
-        } else if (dec->pic_order_cnt_type == 1) {
-            dec->delta_pic_order_always_zero_flag = bs.GetBits(1);
-            dec->offset_for_non_ref_pic = h264_se(&bs); // offset_for_non_ref_pic
-            dec->offset_for_top_to_bottom_field = h264_se(&bs); // offset_for_top_to_bottom_field
-            dec->pic_order_cnt_cycle_length = h264_ue(&bs); // poc_cycle_length
-            for (uint32_t ix = 0; ix < dec->pic_order_cnt_cycle_length; ix++) {
-                dec->offset_for_ref_frame[MIN(ix,255)] = h264_se(&bs); // offset for ref fram -
+        dec->bit_depth_luma_minus8 = bs_read_ue(&bs);
+        dec->bit_depth_chroma_minus8 = bs_read_ue(&bs);
+        dec->qpprime_y_zero_transform_bypass_flag = bs_read(&bs, 1);
+        dec->seq_scaling_matrix_present_flag = bs_read(&bs, 1);
+        if (dec->seq_scaling_matrix_present_flag) {
+            for (uint ix = 0; ix < 8; ix++) {
+                if (bs_read(&bs, 1)) {
+                    scaling_list(ix < 6 ? 16 : 64, &bs);
+                }
             }
         }
-        dummy = h264_ue(&bs); // num_ref_frames
-        dummy = bs.GetBits(1); // gaps_in_frame_num_value_allowed_flag
-        uint32_t PicWidthInMbs = h264_ue(&bs) + 1;
-        dec->pic_width = PicWidthInMbs * 16;
-        uint32_t PicHeightInMapUnits = h264_ue(&bs) + 1;
-        
-        dec->frame_mbs_only_flag = bs.GetBits(1);
-        dec->pic_height = 
-        (2 - dec->frame_mbs_only_flag) * PicHeightInMapUnits * 16;
-        
-        if (!dec->frame_mbs_only_flag) {
-            dec->mb_adaptive_frame_field_flag = bs.GetBits(1);
-        }
-        dec->direct_8x8_inference_flag = bs.GetBits(1);
-        dummy = bs.GetBits(1);
-        if (dummy) {
-            dec->frame_crop_left_offset = h264_ue(&bs);
-            dec->frame_crop_right_offset = h264_ue(&bs);
-            dec->frame_crop_top_offset = h264_ue(&bs);
-            dec->frame_crop_bottom_offset = h264_ue(&bs);
-            
-            dec->pic_width -= 2*dec->frame_crop_right_offset;
-            if (dec->frame_mbs_only_flag)
-                dec->pic_height -= 2*dec->frame_crop_bottom_offset;
-            else
-                dec->pic_height -= 4*dec->frame_crop_bottom_offset;
-        }
-        dummy = bs.GetBits(1);
-        if (dummy) {
-            h264_vui_parameters(dec, &bs);
+    }
+    dec->log2_max_frame_num_minus4 = bs_read_ue(&bs);
+    dec->pic_order_cnt_type = bs_read_ue(&bs);
+    if (dec->pic_order_cnt_type == 0) {
+        dec->log2_max_pic_order_cnt_lsb_minus4 = bs_read_ue(&bs);
+    } else if (dec->pic_order_cnt_type == 1) {
+        dec->delta_pic_order_always_zero_flag = bs_read(&bs, 1);
+        dec->offset_for_non_ref_pic = bs_read_se(&bs); // offset_for_non_ref_pic
+        dec->offset_for_top_to_bottom_field = bs_read_se(&bs); // offset_for_top_to_bottom_field
+        dec->pic_order_cnt_cycle_length = bs_read_ue(&bs); // poc_cycle_length
+        for (uint32_t ix = 0; ix < dec->pic_order_cnt_cycle_length && !bs_error(&bs); ix++) {
+            dec->offset_for_ref_frame[MIN(ix,255)] = bs_read_se(&bs); // offset for ref fram -
         }
+    }
+    dummy = bs_read_ue(&bs); // num_ref_frames
+    dummy = bs_read(&bs, 1); // gaps_in_frame_num_value_allowed_flag
+    uint32_t PicWidthInMbs = bs_read_ue(&bs) + 1;
+    dec->pic_width = PicWidthInMbs * 16;
+    uint32_t PicHeightInMapUnits = bs_read_ue(&bs) + 1;
+    
+    dec->frame_mbs_only_flag = bs_read(&bs, 1);
+    dec->pic_height = 
+    (2 - dec->frame_mbs_only_flag) * PicHeightInMapUnits * 16;
+    
+    if (!dec->frame_mbs_only_flag) {
+        dec->mb_adaptive_frame_field_flag = bs_read(&bs, 1);
+    }
+    dec->direct_8x8_inference_flag = bs_read(&bs, 1);
+    dummy = bs_read(&bs, 1);
+    if (dummy) {
+        dec->frame_crop_left_offset = bs_read_ue(&bs);
+        dec->frame_crop_right_offset = bs_read_ue(&bs);
+        dec->frame_crop_top_offset = bs_read_ue(&bs);
+        dec->frame_crop_bottom_offset = bs_read_ue(&bs);
         
-    } catch (...) {
-        return -1;
+        dec->pic_width -= 2*dec->frame_crop_right_offset;
+        if (dec->frame_mbs_only_flag)
+            dec->pic_height -= 2*dec->frame_crop_bottom_offset;
+        else
+            dec->pic_height -= 4*dec->frame_crop_bottom_offset;
     }
-    return 0;
+    dummy = bs_read(&bs, 1);
+    if (dummy) {
+        h264_vui_parameters(dec, &bs);
+    }
+    return bs_error(&bs) ? -1 : 0;
 }
 extern "C" int h264_find_slice_type (const uint8_t *buffer, 
                                      uint32_t buflen,
@@ -585,70 +480,106 @@ extern "C" int h264_find_slice_type (const uint8_t *buffer,
         if (buffer[2] == 1) header = 4;
         else header = 5;
     }
-    CBitstream bs;
-    bs.init(buffer + header, (buflen - header) * 8);
-    try {
-        dummy = h264_ue(&bs); // first_mb_in_slice
-        *slice_type = h264_ue(&bs); // slice type
-    } catch (...) {
-        return -1;
-    }
-    return 0;
+    bs_reader_t bs;
+    bs_reader_init_nal(&bs, buffer + header, buflen - header);
+    dummy = bs_read_ue(&bs); // first_mb_in_slice
+    *slice_type = bs_read_ue(&bs); // slice type
+    return bs_error(&bs) ? -1 : 0;
 }
 
-extern "C" int h264_read_slice_info (const uint8_t *buffer, 
-                                     uint32_t buflen, 
-                                     h264_decode_t *dec)
+/* the slice header fields the access unit boundary detection compares,
+ * they are read apart from the decode state so that the slice headers
+ * can be read ahead of the demux, on other threads.
+ */
+typedef struct h264_slice_header_t {
+    int result;
+    uint32_t slice_type;
+    uint32_t frame_num;
+    uint8_t field_pic_flag;
+    uint8_t bottom_field_flag;
+    uint32_t idr_pic_id;
+    uint32_t pic_order_cnt_lsb;
+    int32_t delta_pic_order_cnt_bottom;
+    int32_t delta_pic_order_cnt[2];
+} h264_slice_header_t;
+
+static int h264_read_slice_header (const uint8_t *buffer,
+                                   uint32_t buflen,
+                                   const h264_decode_t *dec,
+                                   h264_slice_header_t *slice)
 {
     uint32_t header;
-    uint8_t tmp[512]; /* Enough for the begining of the slice header */
-    int tmp_len;
     uint32_t temp;
     
     if (buffer[2] == 1) header = 4;
     else header = 5;
-    CBitstream bs;
+    bs_reader_t bs;
     
-    h264_decode_annexb( tmp, &tmp_len, buffer + header, MIN(buflen-header,512) );
-    bs.init(tmp, tmp_len * 8);
-    try {
-        dec->field_pic_flag = 0;
-        dec->bottom_field_flag = 0;
-        dec->delta_pic_order_cnt[0] = 0;
-        dec->delta_pic_order_cnt[1] = 0;
-        temp = h264_ue(&bs); // first_mb_in_slice
-        dec->slice_type = h264_ue(&bs); // slice type
-        temp = h264_ue(&bs); // pic_parameter_set
-        dec->frame_num = bs.GetBits(dec->log2_max_frame_num_minus4 + 4);
-        if (!dec->frame_mbs_only_flag) {
-            dec->field_pic_flag = bs.GetBits(1);
-            if (dec->field_pic_flag) {
-                dec->bottom_field_flag = bs.GetBits(1);
-            }
-        }
-        if (dec->nal_unit_type == H264_NAL_TYPE_IDR_SLICE) {
-            dec->idr_pic_id = h264_ue(&bs);
+    bs_reader_init_nal(&bs, buffer + header, buflen - header);
+    memset(slice, 0, sizeof(*slice));
+    temp = bs_read_ue(&bs); // first_mb_in_slice
+    slice->slice_type = bs_read_ue(&bs); // slice type
+    temp = bs_read_ue(&bs); // pic_parameter_set
+    slice->frame_num = bs_read(&bs, dec->log2_max_frame_num_minus4 + 4);
+    if (!dec->frame_mbs_only_flag) {
+        slice->field_pic_flag = bs_read(&bs, 1);
+        if (slice->field_pic_flag) {
+            slice->bottom_field_flag = bs_read(&bs, 1);
         }
-        switch (dec->pic_order_cnt_type) {
-            case 0:
-                dec->pic_order_cnt_lsb = bs.GetBits(dec->log2_max_pic_order_cnt_lsb_minus4 + 4);
-                if (dec->pic_order_present_flag && !dec->field_pic_flag) {
-                    dec->delta_pic_order_cnt_bottom = h264_se(&bs);
-                }
-                break;
-            case 1:
-                if (!dec->delta_pic_order_always_zero_flag) {
-                    dec->delta_pic_order_cnt[0] = h264_se(&bs);
-                }
-                if (dec->pic_order_present_flag && !dec->field_pic_flag) {
-                    dec->delta_pic_order_cnt[1] = h264_se(&bs);
-                }
-                break;
+    }
+    if (dec->nal_unit_type == H264_NAL_TYPE_IDR_SLICE) {
+        slice->idr_pic_id = bs_read_ue(&bs);
+    }
+    switch (dec->pic_order_cnt_type) {
+        case 0:
+            slice->pic_order_cnt_lsb = bs_read(&bs, dec->log2_max_pic_order_cnt_lsb_minus4 + 4);
+            if (dec->pic_order_present_flag && !slice->field_pic_flag) {
+                slice->delta_pic_order_cnt_bottom = bs_read_se(&bs);
+            }
+            break;
+        case 1:
+            if (!dec->delta_pic_order_always_zero_flag) {
+                slice->delta_pic_order_cnt[0] = bs_read_se(&bs);
+            }
+            if (dec->pic_order_present_flag && !slice->field_pic_flag) {
+                slice->delta_pic_order_cnt[1] = bs_read_se(&bs);
+            }
+            break;
+    }
+    slice->result = bs_error(&bs) ? -1 : 0;
+    return slice->result;
+}
+
+/* the fields that weren't in the slice header keep their previous value */
+static void h264_set_slice_header (h264_decode_t *dec, const h264_slice_header_t *slice)
+{
+    dec->slice_type = slice->slice_type;
+    dec->frame_num = slice->frame_num;
+    dec->field_pic_flag = slice->field_pic_flag;
+    dec->bottom_field_flag = slice->bottom_field_flag;
+    if (dec->nal_unit_type == H264_NAL_TYPE_IDR_SLICE) {
+        dec->idr_pic_id = slice->idr_pic_id;
+    }
+    if (dec->pic_order_cnt_type == 0) {
+        dec->pic_order_cnt_lsb = slice->pic_order_cnt_lsb;
+        if (dec->pic_order_present_flag && !slice->field_pic_flag) {
+            dec->delta_pic_order_cnt_bottom = slice->delta_pic_order_cnt_bottom;
         }
-        
-    } catch (...) {
+    }
+    dec->delta_pic_order_cnt[0] = slice->delta_pic_order_cnt[0];
+    dec->delta_pic_order_cnt[1] = slice->delta_pic_order_cnt[1];
+}
+
+extern "C" int h264_read_slice_info (const uint8_t *buffer, 
+                                     uint32_t buflen, 
+                                     h264_decode_t *dec)
+{
+    h264_slice_header_t slice;
+    
+    if (h264_read_slice_header(buffer, buflen, dec, &slice) < 0) {
         return -1;
     }
+    h264_set_slice_header(dec, &slice);
     return 0;
 }
 
@@ -762,9 +693,11 @@ static void h264_compute_poc( h264_decode_t *dec ) {
 }
 
 
-extern "C" int h264_detect_boundary (const uint8_t *buffer, 
-                                     uint32_t buflen, 
-                                     h264_decode_t *decode)
+/* slice_header, when it isn't NULL, was read ahead from the slice in buffer */
+static int h264_detect_boundary_with_slice_header (const uint8_t *buffer,
+                                                   uint32_t buflen,
+                                                   h264_decode_t *decode,
+                                                   const h264_slice_header_t *slice_header)
 {
     uint8_t temp;
     h264_decode_t new_decode;
@@ -791,9 +724,16 @@ extern "C" int h264_detect_boundary (const uint8_t *buffer,
         case H264_NAL_TYPE_IDR_SLICE:
             slice = 1;
             // slice buffer - read the info into the new_decode, and compare.
-            if (h264_read_slice_info(buffer, buflen, &new_decode) < 0) {
-                // need more memory
-                return -1;
+            if (slice_header == NULL) {
+                if (h264_read_slice_info(buffer, buflen, &new_decode) < 0) {
+                    // need more memory
+                    return -1;
+                }
+            } else {
+                if (slice_header->result < 0) {
+                    return -1;
+                }
+                h264_set_slice_header(&new_decode, slice_header);
             }
             if (decode->nal_unit_type > H264_NAL_TYPE_IDR_SLICE || 
                 decode->nal_unit_type < H264_NAL_TYPE_NON_IDR_SLICE) {
@@ -909,6 +849,13 @@ extern "C" int h264_detect_boundary (const uint8_t *buffer,
     return ret;
 }
 
+extern "C" int h264_detect_boundary (const uint8_t *buffer, 
+                                     uint32_t buflen, 
+                                     h264_decode_t *decode)
+{
+    return h264_detect_boundary_with_slice_header(buffer, buflen, decode, NULL);
+}
+
 uint32_t h264_read_sei_value (const uint8_t *buffer, uint32_t *size) 
 {
     uint32_t ret = 0;
@@ -1045,229 +992,246 @@ extern "C" char *h264_get_profile_level_string (const uint8_t profile,
 }
 
 
+#define H264_DPB_WAITING INT_MIN
+
 void DpbInit( h264_dpb_t *p )
 {
-    p->dpb.cnt = 0;
-    p->dpb.next = 0;
-    p->dpb.size_min = 0;
-    
     p->cnt = 0;
-    p->cnt_max = 0;
-    p->frame = NULL;
+    p->next = 0;
+    p->out = 0;
+    
+    p->delta = NULL;
+    p->delta_size = 0;
+    p->taken = 0;
+    
+    p->max_num_reorder_frames = 0;
 }
 void DpbClean( h264_dpb_t *p )
 {
-    free( p->frame );
+    free( p->delta );
+}
+static int DpbLess( h264_dpb_t *p, int a, int b )
+{
+    if (p->heap[a].poc != p->heap[b].poc)
+        return p->heap[a].poc < p->heap[b].poc;
+    return p->heap[a].idx < p->heap[b].idx;
+}
+static void DpbSwap( h264_dpb_t *p, int a, int b )
+{
+    int poc = p->heap[a].poc;
+    int idx = p->heap[a].idx;
+    
+    p->heap[a] = p->heap[b];
+    p->heap[b].poc = poc;
+    p->heap[b].idx = idx;
 }
 static void DpbUpdate( h264_dpb_t *p, int is_forced )
 {
     int i;
-    int pos;
+    int reorder;
+    int idx;
     
-    if (!is_forced && p->dpb.cnt < 16)
+    if (!is_forced && p->cnt < H264_DPB_SIZE)
         return;
     
-    /* find the lowest poc */
-    pos = 0;
-    for (i = 1; i < p->dpb.cnt; i++)
-    {
-        if (p->dpb.poc[i] < p->dpb.poc[pos])
-            pos = i;
-    }
-    //fprintf( stderr, "lowest=%d\n", pos );
+    /* the lowest poc is at the top, the frames decoded before it that
+     * are still waiting will be output after it */
+    idx = p->heap[0].idx;
+    reorder = 0;
+    for (i = 1; i < p->cnt; i++)
+        reorder += p->heap[i].idx < idx;
     
-    /* save the idx */
-    if (p->dpb.idx[pos] >= p->cnt_max)
-    {
-        int inc = 1000 + (p->dpb.idx[pos]-p->cnt_max);
-        p->cnt_max += inc;
-        p->frame = (int*)realloc( p->frame, sizeof(int)*p->cnt_max );
-        for (i=0;i<inc;i++)
-            p->frame[p->cnt_max-inc+i] = -1; /* To detect errors latter */
-    }
-    p->frame[p->dpb.idx[pos]] = p->cnt++;
+    if (reorder > p->max_num_reorder_frames)
+        p->max_num_reorder_frames = reorder;
     
-    /* Update the dpb minimal size */
-    if (pos > p->dpb.size_min)
-        p->dpb.size_min = pos;
+    p->delta[idx & (p->delta_size - 1)] = p->out++ - idx;
     
-    /* update dpb */
-    for (i = pos; i < p->dpb.cnt-1; i++)
+    /* remove the top */
+    p->cnt--;
+    p->heap[0] = p->heap[p->cnt];
+    for (i = 0;;)
     {
-        p->dpb.idx[i] = p->dpb.idx[i+1];
-        p->dpb.poc[i] = p->dpb.poc[i+1];
+        int child = 2 * i + 1;
+        
+        if (child >= p->cnt)
+            break;
+        if (child + 1 < p->cnt && DpbLess( p, child + 1, child ))
+            child++;
+        if (!DpbLess( p, child, i ))
+            break;
+        DpbSwap( p, i, child );
+        i = child;
     }
-    p->dpb.cnt--;
 }
 
 void DpbFlush( h264_dpb_t *p )
 {
-    while (p->dpb.cnt > 0)
+    while (p->cnt > 0)
         DpbUpdate( p, true );
 }
 
+/* the ring holds every frame from the oldest one that wasn't taken */
+static void DpbGrow( h264_dpb_t *p )
+{
+    int size = p->delta_size ? 2 * p->delta_size : 2 * H264_DPB_SIZE;
+    int *delta = (int *)malloc( sizeof(int) * size );
+    
+    for (int idx = p->taken; idx < p->next; idx++)
+        delta[idx & (size - 1)] = p->delta[idx & (p->delta_size - 1)];
+    
+    free( p->delta );
+    p->delta = delta;
+    p->delta_size = size;
+}
+
 void DpbAdd( h264_dpb_t *p, int poc, int is_idr )
 {
+    int i;
+    
     if (is_idr)
         DpbFlush( p );
     
-    p->dpb.idx[p->dpb.cnt] = p->dpb.next;
-    p->dpb.poc[p->dpb.cnt] = poc;
-    p->dpb.cnt++;
-    p->dpb.next++;
+    if (p->next - p->taken == p->delta_size)
+        DpbGrow( p );
+    p->delta[p->next & (p->delta_size - 1)] = H264_DPB_WAITING;
+    
+    i = p->cnt++;
+    p->heap[i].poc = poc;
+    p->heap[i].idx = p->next++;
+    while (i > 0 && DpbLess( p, i, (i - 1) / 2 ))
+    {
+        DpbSwap( p, i, (i - 1) / 2 );
+        i = (i - 1) / 2;
+    }
     
     DpbUpdate( p, false );
 }
 
-int DpbFrameOffset( h264_dpb_t *p, int idx )
+/* takes the output index minus the decode index of the frames in decode
+ * order, returns 0 while the next one is still waiting in the dpb */
+int DpbTake( h264_dpb_t *p, int *delta )
 {
-    if (idx >= p->cnt)
+    if (p->taken == p->next)
+        return 0;
+    
+    *delta = p->delta[p->taken & (p->delta_size - 1)];
+    if (*delta == H264_DPB_WAITING)
         return 0;
-    if (p->frame[idx] < 0)
-        return p->dpb.size_min; /* We have an error (probably broken/truncated bitstream) */
     
-    return p->dpb.size_min + p->frame[idx] - idx;
+    p->taken++;
+    return 1;
 }
 
 
-static bool remove_unused_sei_messages (nal_reader_t *nal,
-                                        uint32_t header_size)
+/* The demux builds an index of the next NALs with the start code scan,
+ * reads the slice headers of the index on several threads, and then
+ * detects the access units and computes the POCs in a single ordered pass
+ * over the index. Pipes and files that can't be mapped are read a NAL at
+ * a time, and their slice headers are read by the ordered pass.
+ */
+typedef struct h264_nal_t {
+    uint64_t offset;
+    uint32_t size;
+    uint8_t type;
+    h264_slice_header_t slice;
+} h264_nal_t;
+
+#define H264_INDEX_MAX_NALS 8192
+#define H264_INDEX_MAX_BYTES (64 * 1024 * 1024)
+#define H264_INDEX_MIN_CHUNK 512
+#define H264_INDEX_MAX_WORKERS 8
+
+static void h264_read_seq_info_if_valid (const uint8_t *buffer,
+                                         uint32_t buflen,
+                                         h264_decode_t *dec)
 {
-    uint32_t buffer_on = header_size;
-    buffer_on++; // increment past SEI message header
+    h264_decode_t new_dec;
     
-    while (buffer_on < nal->buffer_on) {
-        uint32_t payload_type, payload_size, start, size;
-        if (nal->buffer[buffer_on] == 0x80) {
-            // rbsp_trailing_bits
-            return true;
-        }
-        if (nal->buffer_on - buffer_on <= 2) {
-            //fprintf(stderr, "extra bytes after SEI message\n");
-#if 0
-            memset(nal->buffer + buffer_on, 0,
-                   nal->buffer_on - buffer_on); 
-            nal->buffer_on = buffer_on;
-#endif
-            
-            return true;
-        }
-        start = buffer_on;
-        payload_type = h264_read_sei_value(nal->buffer + buffer_on,
-                                           &size);
-#ifdef DEBUG_H264
-        printf("sei type %d size %d on %d\n", payload_type, 
-               size, buffer_on);
-#endif
-        buffer_on += size;
-        payload_size = h264_read_sei_value(nal->buffer + buffer_on,
-                                           &size);
-        buffer_on += size + payload_size;
-#ifdef DEBUG_H264
-        printf("sei size %d size %d on %d nal %d\n",
-               payload_size, size, buffer_on, nal->buffer_on);
-#endif
-        if (buffer_on > nal->buffer_on) {
-            fprintf(stderr, "Error decoding sei message\n");
-            return false;
-        }
-        switch (payload_type) {
-            case 3:
-            case 10:
-            case 11:
-            case 12:
-                memmove(nal->buffer + start,
-                        nal->buffer + buffer_on, 
-                        nal->buffer_size - buffer_on);
-                nal->buffer_size -= buffer_on - start;
-                nal->buffer_on -= buffer_on - start;
-                buffer_on = start;
-                break;
-        }
+    memcpy(&new_dec, dec, sizeof(new_dec));
+    if (h264_read_seq_info(buffer, buflen, &new_dec) >= 0) {
+        memcpy(dec, &new_dec, sizeof(*dec));
     }
-    if (nal->buffer_on == header_size) return false;
-    return true;
 }
 
-static bool RefreshReader (nal_reader_t *nal,
-                           uint32_t nal_start)
+/* dec holds the sequence parameters in use before the first NAL,
+ * and is updated by the ones found along the way
+ */
+static void h264_read_slice_headers (const uint8_t *data,
+                                     h264_nal_t *nals,
+                                     uint32_t count,
+                                     h264_decode_t *dec)
 {
-    uint32_t bytes_left;
-    uint32_t bytes_read;
-#ifdef DEBUG_H264_READER
-    printf("refresh - start %u buffer on %u size %u\n", 
-           nal_start, nal->buffer_on, nal->buffer_size);
-#endif
-    if (nal_start != 0) {
-        if (nal_start > nal->buffer_size) {
-#ifdef DEBUG_H264
-            printf("nal start is greater than buffer size\n");
-#endif
-            nal->buffer_on = 0;
-        } else {
-            bytes_left = nal->buffer_size - nal_start;
-            if (bytes_left > 0) {
-                memmove(nal->buffer, 
-                        nal->buffer + nal_start,
-                        bytes_left);
-                nal->buffer_on -= nal_start;
-#ifdef DEBUG_H264_READER
-                printf("move %u new on is %u\n", bytes_left, nal->buffer_on);
-#endif
-            } else {
-                nal->buffer_on = 0;
-            }
-            nal->buffer_size = bytes_left;
-        }
-    } else {
-        if (feof(nal->ifile)) {
-            return false;
+    for (uint32_t i = 0; i < count; i++) {
+        h264_nal_t *nal = &nals[i];
+        
+        if (nal->type == H264_NAL_TYPE_SEQ_PARAM) {
+            h264_read_seq_info_if_valid(data + nal->offset, nal->size, dec);
+        } else if (h264_nal_unit_type_is_slice(nal->type)) {
+            dec->nal_unit_type = nal->type;
+            h264_read_slice_header(data + nal->offset, nal->size, dec, &nal->slice);
         }
-        nal->buffer_size_max += 4096 * 4;
-        nal->buffer = (uint8_t *)realloc(nal->buffer, nal->buffer_size_max);
     }
-    bytes_read = fread(nal->buffer + nal->buffer_size,
-                       1,
-                       nal->buffer_size_max - nal->buffer_size,
-                       nal->ifile);
-    if (bytes_read == 0) return false;
-#ifdef DEBUG_H264_READER
-    printf("read %u of %u\n", bytes_read, 
-           nal->buffer_size_max - nal->buffer_size);
-#endif
-    nal->buffer_size += bytes_read;
-    return true;
 }
 
-static bool LoadNal (nal_reader_t *nal)
+/* loads the next NALs into nals, returns 0 at the end of the file.
+ * dec holds the sequence parameters of the previous calls.
+ */
+static uint32_t h264_index_next (annexb_reader_t *reader,
+                                 h264_nal_t *nals,
+                                 h264_decode_t *dec)
 {
-    if (nal->buffer_on != 0 || nal->buffer_size == 0) {
-        if (RefreshReader(nal, nal->buffer_on) == false) {
-#ifdef DEBUG_H264
-            printf("refresh returned 0 - buffer on is %u, size %u\n",
-                   nal->buffer_on, nal->buffer_size);
-#endif
-            if (nal->buffer_on >= nal->buffer_size) return false;
-            // continue
+    uint32_t count = 0;
+    uint64_t size = 0;
+    
+    if (!reader->mapped) {
+        if (annexb_reader_next(reader) == 0) {
+            return 0;
         }
+        nals[0].offset = reader->nal_offset;
+        nals[0].size = reader->nal_size;
+        nals[0].type = h264_nal_unit_type(reader->nal);
+        return 1;
     }
-    // find start code
-    uint32_t start;
-    if (h264_is_start_code(nal->buffer) == false) {
-        start = h264_find_next_start_code(nal->buffer,
-                                          nal->buffer_size);
-        RefreshReader(nal, start);
+    
+    while (count < H264_INDEX_MAX_NALS && size < H264_INDEX_MAX_BYTES &&
+           annexb_reader_next(reader)) {
+        nals[count].offset = reader->nal_offset;
+        nals[count].size = reader->nal_size;
+        nals[count].type = h264_nal_unit_type(reader->nal);
+        size += reader->nal_size;
+        count++;
     }
-    while ((start = h264_find_next_start_code(nal->buffer + 4,
-                                              nal->buffer_size - 4)) == 0) {
-        if (RefreshReader(nal, 0) == false) {
-            // end of file - use the last NAL
-            nal->buffer_on = nal->buffer_size;
-            return true;
+    
+    // the whole file is mapped, the NALs stay readable
+    const uint8_t *data = reader->data;
+    NSUInteger workersCount = MIN(NSProcessInfo.processInfo.activeProcessorCount, H264_INDEX_MAX_WORKERS);
+    uint32_t chunksCount = (uint32_t)MAX(1, MIN(workersCount, count / H264_INDEX_MIN_CHUNK));
+    uint32_t chunkSize = (count + chunksCount - 1) / chunksCount;
+    
+    if (chunksCount == 1) {
+        h264_read_slice_headers(data, nals, count, dec);
+        return count;
+    }
+    
+    // each chunk starts with the sequence parameters of the previous ones
+    h264_decode_t *decs = (h264_decode_t *)malloc(chunksCount * sizeof(h264_decode_t));
+    for (uint32_t i = 0; i < chunksCount; i++) {
+        memcpy(&decs[i], dec, sizeof(*dec));
+        for (uint32_t j = i * chunkSize; j < MIN(count, (i + 1) * chunkSize); j++) {
+            if (nals[j].type == H264_NAL_TYPE_SEQ_PARAM) {
+                h264_read_seq_info_if_valid(data + nals[j].offset, nals[j].size, dec);
+            }
         }
     }
-    nal->buffer_on = start + 4;
-    return true;
+    
+    dispatch_apply(chunksCount, dispatch_get_global_queue(0, 0), ^(size_t index) {
+        uint32_t start = (uint32_t)index * chunkSize;
+        uint32_t end = MIN(count, start + chunkSize);
+        h264_read_slice_headers(data, nals + start, end - start, &decs[index]);
+    });
+    
+    free(decs);
+    return count;
 }
 
 NSData* H264Info(const char *filePath, uint32_t *pic_width, uint32_t *pic_height, uint8_t *profile, uint8_t *level)
@@ -1283,7 +1247,7 @@ NSData* H264Info(const char *filePath, uint32_t *pic_width, uint32_t *pic_height
     bool have_seq = false;
     bool have_pic = false;
     uint8_t nal_type;
-    nal_reader_t nal;
+    annexb_reader_t reader;
     h264_decode_t h264_dec;
     FILE *inFile;
     
@@ -1292,27 +1256,30 @@ NSData* H264Info(const char *filePath, uint32_t *pic_width, uint32_t *pic_height
         return 0;
     }
     
-    memset(&nal, 0, sizeof(nal));
-    nal.ifile = inFile;
-    
+    if (annexb_reader_open(&reader, inFile) == 0) {
+        fclose(inFile);
+        return nil;
+    }
+
     while (have_seq == false || have_pic == false) {
-        if (LoadNal(&nal) == false) {
+        if (annexb_reader_next(&reader) == 0) {
             // fprintf(stderr, "%s: Could not find sequence header\n", ProgName);
+            annexb_reader_close(&reader);
             fclose(inFile);
             return nil;
         }
-        uint32_t header_size = nal.buffer[2] == 1 ? 3 : 4;
+        uint32_t header_size = reader.nal[2] == 1 ? 3 : 4;
 
-        nal_type = h264_nal_unit_type(nal.buffer);
+        nal_type = h264_nal_unit_type(reader.nal);
         if (nal_type == H264_NAL_TYPE_SEQ_PARAM && !have_seq) {
             have_seq = true;
             uint32_t offset;
-            if (nal.buffer[2] == 1) offset = 3;
+            if (reader.nal[2] == 1) offset = 3;
             else offset = 4;
 
-            AVCProfileIndication = nal.buffer[offset + 1];
-            profile_compat = nal.buffer[offset + 2];
-            AVCLevelIndication = nal.buffer[offset + 3];
+            AVCProfileIndication = reader.nal[offset + 1];
+            profile_compat = reader.nal[offset + 2];
+            AVCLevelIndication = reader.nal[offset + 3];
 
             [avcCData appendBytes:&configurationVersion length:sizeof(uint8_t)];
             [avcCData appendBytes:&AVCProfileIndication length:sizeof(uint8_t)];
@@ -1320,8 +1287,8 @@ NSData* H264Info(const char *filePath, uint32_t *pic_width, uint32_t *pic_height
             [avcCData appendBytes:&AVCLevelIndication length:sizeof(uint8_t)];
             [avcCData appendBytes:&sampleLenFieldSizeMinusOne length:sizeof(uint8_t)];
 
-            uint8_t *buffer = nal.buffer + header_size;
-            uint32_t buffersize = nal.buffer_on - header_size;
+            const uint8_t *buffer = reader.nal + header_size;
+            uint32_t buffersize = reader.nal_size - header_size;
             uint32_t iy = 0;
 
             NSMutableData *seqData = [[NSMutableData alloc] init];
@@ -1334,9 +1301,10 @@ NSData* H264Info(const char *filePath, uint32_t *pic_width, uint32_t *pic_height
             [avcCData appendData:seqData];
 
             // skip the nal type byte
-            if (h264_read_seq_info(nal.buffer, nal.buffer_on, &h264_dec) == -1)
+            if (h264_read_seq_info(reader.nal, reader.nal_size, &h264_dec) == -1)
             {
                 // fprintf(stderr, "%s: Could not decode Sequence header\n", ProgName);
+                annexb_reader_close(&reader);
                 fclose(inFile);
                 return nil;
             }
@@ -1348,8 +1316,8 @@ NSData* H264Info(const char *filePath, uint32_t *pic_width, uint32_t *pic_height
         else if (nal_type == H264_NAL_TYPE_PIC_PARAM && !have_pic) {
             have_pic = true;
             
-            uint8_t *buffer = nal.buffer + header_size;
-            uint32_t buffersize = nal.buffer_on - header_size;
+            const uint8_t *buffer = reader.nal + header_size;
+            uint32_t buffersize = reader.nal_size - header_size;
 
             uint32_t iy = 0;
 
@@ -1365,7 +1333,7 @@ NSData* H264Info(const char *filePath, uint32_t *pic_width, uint32_t *pic_height
         }
     }
 
-    free(nal.buffer);
+    annexb_reader_close(&reader);
     fclose(inFile);
     return avcCData;
 }
@@ -1380,6 +1348,13 @@ MP42_OBJC_DIRECT_MEMBERS
     uint32_t mp4FrameDuration;
     MP4SampleId samplesWritten;
     h264_dpb_t h264_dpb;
+
+    // the samples wait for the dpb to know their composition offset,
+    // which is written with the reorder delay known at that time
+    NSMutableArray<MP42SampleBuffer *> *reorderedSamples;
+    MP4SampleId samplesEnqueued;
+    int reorderDelay;
+    MP4SampleId reorderDelayStart[H264_DPB_SIZE + 1];
 }
 
 
@@ -1473,12 +1448,9 @@ MP42_OBJC_DIRECT_MEMBERS
         MP4SampleId sampleId = 1;
 
         // track configuration info
-        nal_reader_t nal;
+        annexb_reader_t reader;
         h264_decode_t h264_dec;
 
-        memset(&nal, 0, sizeof(nal));
-        nal.ifile = inFile;
-
         if (timescale == 0) {
             fprintf(stderr, "%s: Must specify a timescale when reading H.264 files",
                     ProgName);
@@ -1486,66 +1458,80 @@ MP42_OBJC_DIRECT_MEMBERS
             mp4FrameDuration = 1001;
         }
 
-        rewind(nal.ifile);
-        nal.buffer_size = 0;
-        nal.buffer_on = 0;
-        nal.buffer_size_max = 0;
-        free(nal.buffer);
-        nal.buffer = NULL;
-
-        uint8_t *nal_buffer;
-        uint32_t nal_buffer_size, nal_buffer_size_max;
-        nal_buffer = NULL;
-        nal_buffer_size = 0;
-        nal_buffer_size_max = 0;
+        if (inFile == NULL || annexb_reader_open(&reader, inFile) == 0) {
+            [self setDone];
+            return;
+        }
+
+        // the NALs of the access unit being read, they are copied
+        // only once into the sample when the access unit is complete
+        annexb_span_t *spans = NULL;
+        uint32_t spans_count = 0, spans_count_max = 0;
+        uint32_t sample_size = 0;
         bool first = true;
         bool nal_is_sync = false;
         bool slice_is_idr = false;
         int32_t poc = 0;
         uint32_t dflags = 0;
 
+        // the NALs read ahead, and the sequence parameters they were read with
+        h264_nal_t *nals = (h264_nal_t *)malloc(H264_INDEX_MAX_NALS * sizeof(h264_nal_t));
+        uint32_t nals_count = 0, nals_pos = 0;
+        h264_decode_t index_dec;
+
         // now process the rest of the video stream
         memset(&h264_dec, 0, sizeof(h264_dec));
+        memset(&index_dec, 0, sizeof(index_dec));
         DpbInit(&h264_dpb);
+        reorderedSamples = [NSMutableArray array];
 
-        while ( (LoadNal(&nal) != false) && !self.isCancelled) {
+        while (!self.isCancelled) {
+            if (nals_pos == nals_count) {
+                nals_count = h264_index_next(&reader, nals, &index_dec);
+                nals_pos = 0;
+                if (nals_count == 0) {
+                    break;
+                }
+            }
+            const h264_nal_t *nal = &nals[nals_pos++];
+            const uint8_t *nal_data = reader.mapped ? reader.data + nal->offset : reader.nal;
             uint32_t header_size;
-            header_size = nal.buffer[2] == 1 ? 3 : 4;
-            bool boundary = h264_detect_boundary(nal.buffer,
-                                                 nal.buffer_on,
-                                                 &h264_dec);
+            header_size = nal_data[2] == 1 ? 3 : 4;
+            bool boundary = h264_detect_boundary_with_slice_header(nal_data,
+                                                                   nal->size,
+                                                                   &h264_dec,
+                                                                   reader.mapped ? &nal->slice : NULL);
 
             if (boundary && first == false) {
                 // write the previous sample
-                if (nal_buffer_size != 0) {
+                if (sample_size != 0) {
                     samplesWritten++;
 
-                    void* sampleData = malloc(nal_buffer_size);
-                    memcpy(sampleData, nal_buffer, nal_buffer_size);
-
-                    MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
-                    sample->data = sampleData;
-                    sample->size = nal_buffer_size;
+                    MP42SampleBuffer *sample = [self newSampleWithSize:sample_size];
+                    annexb_reader_write_spans(&reader, spans, spans_count, (uint8_t *)sample->data);
                     sample->duration = mp4FrameDuration;
                     sample->flags = nal_is_sync ? MP42SampleBufferFlagIsSync : 0;
                     sample->dependecyFlags = dflags;
                     sample->trackId = trackId;
 
-                    [self enqueue:sample];
+                    [reorderedSamples addObject:sample];
 
-                    currentSize += nal_buffer_size;
+                    currentSize += sample_size;
                     self.progress = (currentSize / (CGFloat) _size) * 100;
 
                     sampleId++;
                     DpbAdd( &h264_dpb, poc, slice_is_idr );
+                    [self enqueueReorderedSamples];
                     nal_is_sync = false;
-                    nal_buffer_size = 0;
+                    spans_count = 0;
+                    sample_size = 0;
+                    reader.hold = ANNEXB_NO_HOLD;
                 }
             }
             bool copy_nal_to_buffer = false;
             if (Verbosity) {
                 printf("H264 type %x size %u\n",
-                       h264_dec.nal_unit_type, nal.buffer_on);
+                       h264_dec.nal_unit_type, nal->size);
             }
             if (h264_nal_unit_type_is_slice(h264_dec.nal_unit_type)) {
                 // copy all seis, etc before indicating first
@@ -1563,20 +1549,19 @@ MP42_OBJC_DIRECT_MEMBERS
                         // doesn't get added to sample buffer
                         // remove header
                         //MP4AddH264SequenceParameterSet(mp4File, trackId,
-                        //                               nal.buffer + header_size,
-                        //                               nal.buffer_on - header_size);
+                        //                               nal_data + header_size,
+                        //                               nal->size - header_size);
                         //break;
                     case H264_NAL_TYPE_PIC_PARAM:
                         // doesn't get added to sample buffer
                         //MP4AddH264PictureParameterSet(mp4File, trackId,
-                        //                              nal.buffer + header_size,
-                        //                              nal.buffer_on - header_size);
+                        //                              nal_data + header_size,
+                        //                              nal->size - header_size);
                         //break;
                     case H264_NAL_TYPE_FILLER_DATA:
                         // doesn't get copied
                         //break;
                     case H264_NAL_TYPE_SEI:
-                        //copy_nal_to_buffer = remove_unused_sei_messages(&nal, header_size);
                         //break;
                     case H264_NAL_TYPE_ACCESS_UNIT:
                         // note - may not want to copy this - not needed
@@ -1587,71 +1572,98 @@ MP42_OBJC_DIRECT_MEMBERS
             }
             if (copy_nal_to_buffer) {
                 uint32_t to_write;
-                to_write = nal.buffer_on - header_size;
-                if (to_write + 4 + nal_buffer_size > nal_buffer_size_max) {
-                    nal_buffer_size_max += nal.buffer_on + 4;
-                    nal_buffer = (uint8_t *)realloc(nal_buffer, nal_buffer_size_max);
+                to_write = nal->size - header_size;
+                if (spans_count == spans_count_max) {
+                    spans_count_max += 16;
+                    spans = (annexb_span_t *)realloc(spans, spans_count_max * sizeof(annexb_span_t));
                 }
-                nal_buffer[nal_buffer_size] = (to_write >> 24) & 0xff;
-                nal_buffer[nal_buffer_size + 1] = (to_write >> 16) & 0xff;
-                nal_buffer[nal_buffer_size + 2] = (to_write >> 8) & 0xff;
-                nal_buffer[nal_buffer_size + 3] = to_write & 0xff;
-                memcpy(nal_buffer + nal_buffer_size + 4,
-                       nal.buffer + header_size,
-                       to_write);
-
-                nal_buffer_size += to_write + 4;
+                if (spans_count == 0) {
+                    // keep the access unit in the reader until it's written
+                    reader.hold = nal->offset;
+                }
+                spans[spans_count].offset = nal->offset + header_size;
+                spans[spans_count].length = to_write;
+                spans_count++;
+
+                sample_size += to_write + 4;
             }
         }
 
-        if (nal_buffer_size != 0) {
+        if (sample_size != 0) {
             samplesWritten++;
 
-            void *sampleData = malloc(nal_buffer_size);
-            memcpy(sampleData, nal_buffer, nal_buffer_size);
-            
-            MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
-            sample->data = sampleData;
-            sample->size = nal_buffer_size;
+            MP42SampleBuffer *sample = [self newSampleWithSize:sample_size];
+            annexb_reader_write_spans(&reader, spans, spans_count, (uint8_t *)sample->data);
             sample->duration = mp4FrameDuration;
             sample->flags = nal_is_sync ? MP42SampleBufferFlagIsSync : 0;
             sample->dependecyFlags = dflags;
             sample->trackId = trackId;
             
-            [self enqueue:sample];
+            [reorderedSamples addObject:sample];
 
-            currentSize += nal_buffer_size;
+            currentSize += sample_size;
             self.progress = (currentSize / (CGFloat) _size) * 100;
             
             DpbAdd(&h264_dpb, h264_dec.pic_order_cnt, slice_is_idr);
         }
         
         DpbFlush(&h264_dpb);
-        free(nal.buffer);
-        free(nal_buffer);
+        [self enqueueReorderedSamples];
+        annexb_reader_close(&reader);
+        free(nals);
+        free(spans);
         
         [self setDone];
     }
 }
 
+- (void)enqueueReorderedSamples
+{
+    int delta;
+
+    // a frame stuck in the dpb is output as an IDR would do, instead
+    // of keeping every sample decoded after it
+    if (reorderedSamples.count > H264_DPB_MAX_WAITING) {
+        DpbFlush(&h264_dpb);
+    }
+
+    while (reorderedSamples.count && DpbTake(&h264_dpb, &delta)) {
+        MP42SampleBuffer *sample = reorderedSamples.firstObject;
+
+        samplesEnqueued++;
+        while (reorderDelay < h264_dpb.max_num_reorder_frames) {
+            reorderDelayStart[reorderDelay++] = samplesEnqueued;
+        }
+
+        sample->offset = (int64_t)(reorderDelay + delta) * mp4FrameDuration;
+        [self batchSample:sample];
+        [reorderedSamples removeObjectAtIndex:0];
+    }
+}
+
 - (void)cleanUp:(MP42Track *)track fileHandle:(MP4FileHandle)fileHandle
 {
     MP4TrackId trackId = track.trackId;
 
-    if (h264_dpb.dpb.size_min > 0) {
-        unsigned int ix;
+    if (reorderDelay > 0) {
+        MP4SampleId ix = 1;
+
+        // the samples enqueued before the reorder delay reached its final
+        // value are shifted by the difference
+        for (int delay = 0; delay < reorderDelay; delay++) {
+            const MP4Duration shift = (MP4Duration)(reorderDelay - delay) * mp4FrameDuration;
 
-        for (ix = 0; ix < samplesWritten; ix++) {
-            const int offset = DpbFrameOffset(&h264_dpb, ix);
-            MP4SetSampleRenderingOffset(fileHandle, trackId, 1 + ix, 
-                                        offset * mp4FrameDuration);
+            for (; ix < reorderDelayStart[delay] && ix <= samplesWritten; ix++) {
+                MP4SetSampleRenderingOffset(fileHandle, trackId, ix,
+                                            MP4GetSampleRenderingOffset(fileHandle, trackId, ix) + shift);
+            }
         }
         MP4Duration editDuration = MP4ConvertFromTrackDuration(fileHandle,
                                                                trackId,
                                                                MP4GetTrackDuration(fileHandle, trackId),
                                                                MP4GetTimeScale(fileHandle));
 
-        MP4AddTrackEdit(fileHandle, trackId, MP4_INVALID_EDIT_ID, DpbFrameOffset(&h264_dpb, 0) * mp4FrameDuration,
+        MP4AddTrackEdit(fileHandle, trackId, MP4_INVALID_EDIT_ID, MP4GetSampleRenderingOffset(fileHandle, trackId, 1),
                         editDuration, 0);
     }
 
@@ -0,0 +1,12 @@
+//
+//  MP42HEVCImporter.h
+//  Subler
+//
+//  Copyright © 2022 Damiano Galassi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "MP42FileImporter.h"
+
+@interface MP42HEVCImporter : MP42FileImporter
+@end
@@ -0,0 +1,1034 @@
+//
+//  MP42HEVCImporter.mm
+//  Subler
+//
+//  Copyright © 2022 Damiano Galassi. All rights reserved.
+//
+
+#import "MP42HEVCImporter.h"
+#import "MP42FileImporter+Private.h"
+#import "MP42SampleBuffer.h"
+
+#import "MP42File.h"
+#import "MP42PrivateUtilities.h"
+#import "MP42Track+Private.h"
+
+#include <sys/stat.h>
+
+#include "bitstream.h"
+#include "annexb.h"
+
+#import "mp4v2.h"
+
+typedef struct framerate_t {
+    uint32_t code;
+    uint32_t timescale;
+    uint32_t duration;
+} framerate_t;
+
+static const framerate_t framerates[] =
+{ { 2398, 24000, 1001 },
+    { 24, 600, 25 },
+    { 25, 600, 24 },
+    { 2997, 30000, 1001 },
+    { 30, 600, 20 },
+    { 50, 600, 12 },
+    { 5994, 60000, 1001 },
+    { 60, 600, 10 },
+    { 0, 24000, 1001 } };
+
+#define HEVC_NAL_TYPE_RADL_N        6
+#define HEVC_NAL_TYPE_RASL_N        8
+#define HEVC_NAL_TYPE_RASL_R        9
+#define HEVC_NAL_TYPE_BLA_W_LP      16
+#define HEVC_NAL_TYPE_IDR_W_RADL    19
+#define HEVC_NAL_TYPE_IDR_N_LP      20
+#define HEVC_NAL_TYPE_CRA           21
+#define HEVC_NAL_TYPE_RSV_IRAP_23   23
+#define HEVC_NAL_TYPE_VPS           32
+#define HEVC_NAL_TYPE_SPS           33
+#define HEVC_NAL_TYPE_PPS           34
+#define HEVC_NAL_TYPE_AUD           35
+#define HEVC_NAL_TYPE_EOS           36
+#define HEVC_NAL_TYPE_SEI_PREFIX    39
+
+#define HEVC_MAX_SPS 16
+#define HEVC_MAX_PPS 64
+
+typedef struct hevc_sps_t {
+    bool valid;
+    uint8_t general_profile_tier_level[12];
+    uint8_t max_sub_layers;
+    uint8_t temporal_id_nesting_flag;
+    uint32_t chroma_format_idc;
+    uint8_t separate_colour_plane_flag;
+    uint32_t pic_width, pic_height;
+    uint32_t bit_depth_luma_minus8;
+    uint32_t bit_depth_chroma_minus8;
+    uint32_t log2_max_pic_order_cnt_lsb;
+
+    uint32_t sar_width, sar_height;
+    uint8_t video_full_range_flag;
+    uint8_t colour_description_present_flag;
+    uint8_t colour_primaries;
+    uint8_t transfer_characteristics;
+    uint8_t matrix_coeffs;
+    uint32_t num_units_in_tick;
+    uint32_t time_scale;
+} hevc_sps_t;
+
+typedef struct hevc_pps_t {
+    bool valid;
+    uint32_t sps_id;
+    uint8_t output_flag_present_flag;
+    uint8_t num_extra_slice_header_bits;
+} hevc_pps_t;
+
+typedef struct hevc_decode_t {
+    hevc_sps_t sps[HEVC_MAX_SPS];
+    hevc_pps_t pps[HEVC_MAX_PPS];
+
+    /* POC state */
+    int32_t prev_tid0_poc;
+    bool seen_irap;
+    bool after_eos;
+    bool skip_rasl;
+} hevc_decode_t;
+
+// The access unit being read, its NALs are copied only once
+// into the sample when the access unit is complete
+typedef struct hevc_access_unit_t {
+    annexb_span_t *spans;
+    uint32_t spans_count;
+    uint32_t spans_count_max;
+    uint32_t size;
+
+    bool has_picture;
+    bool is_irap;
+    bool new_sequence;
+    bool skip;
+    int32_t poc;
+    uint32_t dflags;
+} hevc_access_unit_t;
+
+// What is needed of every written sample to compute the composition offsets
+typedef struct hevc_picture_t {
+    int32_t poc;
+    bool new_sequence;
+} hevc_picture_t;
+
+static const uint32_t hevc_sar[17][2] = {
+    {  0,  0 }, {  1,  1 }, { 12, 11 }, { 10, 11 }, { 16, 11 },
+    { 40, 33 }, { 24, 11 }, { 20, 11 }, { 32, 11 }, { 80, 33 },
+    { 18, 11 }, { 15, 11 }, { 64, 33 }, { 160, 99 }, {  4,  3 },
+    {  3,  2 }, {  2,  1 }
+};
+
+static inline uint8_t hevc_nal_unit_type (const uint8_t *nal)
+{
+    return (nal[0] >> 1) & 0x3f;
+}
+
+static inline uint8_t hevc_nuh_layer_id (const uint8_t *nal)
+{
+    return ((nal[0] & 0x01) << 5) | (nal[1] >> 3);
+}
+
+static inline uint8_t hevc_temporal_id (const uint8_t *nal)
+{
+    return (nal[1] & 0x07) ? (nal[1] & 0x07) - 1 : 0;
+}
+
+static inline bool hevc_nal_unit_type_is_irap (uint8_t type)
+{
+    return type >= HEVC_NAL_TYPE_BLA_W_LP && type <= HEVC_NAL_TYPE_RSV_IRAP_23;
+}
+
+// RADL and RASL pictures
+static inline bool hevc_nal_unit_type_is_leading (uint8_t type)
+{
+    return type >= HEVC_NAL_TYPE_RADL_N && type <= HEVC_NAL_TYPE_RASL_R;
+}
+
+static inline bool hevc_nal_unit_type_is_rasl (uint8_t type)
+{
+    return type == HEVC_NAL_TYPE_RASL_N || type == HEVC_NAL_TYPE_RASL_R;
+}
+
+// Sub-layer non-reference pictures
+static inline bool hevc_nal_unit_type_is_slnr (uint8_t type)
+{
+    return type <= 14 && (type & 1) == 0;
+}
+
+// Non-VCL NALs that can only appear before the first VCL NAL of an access unit
+static inline bool hevc_nal_unit_type_starts_access_unit (uint8_t type)
+{
+    return (type >= HEVC_NAL_TYPE_VPS && type <= HEVC_NAL_TYPE_AUD) ||
+            type == HEVC_NAL_TYPE_SEI_PREFIX ||
+            (type >= 41 && type <= 44) ||
+            (type >= 48 && type <= 55);
+}
+
+// Copies a NAL without its emulation prevention bytes, returns the new size
+static uint32_t hevc_nal_to_rbsp (uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+    uint32_t size = 0, zeros = 0;
+
+    for (uint32_t ix = 0; ix < len; ix++) {
+        if (zeros >= 2 && src[ix] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        dst[size++] = src[ix];
+        zeros = src[ix] ? 0 : zeros + 1;
+    }
+
+    return size;
+}
+
+static void hevc_sub_layers_profile_tier_level (bs_reader_t *bs, uint32_t max_sub_layers_minus1)
+{
+    uint8_t profile_present[8], level_present[8];
+
+    for (uint32_t ix = 0; ix < max_sub_layers_minus1; ix++) {
+        profile_present[ix] = bs_read(bs, 1);
+        level_present[ix] = bs_read(bs, 1);
+    }
+    if (max_sub_layers_minus1 > 0) {
+        bs_skip(bs, 2 * (8 - max_sub_layers_minus1)); // reserved_zero_2bits
+    }
+    for (uint32_t ix = 0; ix < max_sub_layers_minus1; ix++) {
+        if (profile_present[ix]) {
+            bs_skip(bs, 88);
+        }
+        if (level_present[ix]) {
+            bs_skip(bs, 8);
+        }
+    }
+}
+
+static void hevc_scaling_list_data (bs_reader_t *bs)
+{
+    for (uint32_t sizeId = 0; sizeId < 4; sizeId++) {
+        for (uint32_t matrixId = 0; matrixId < 6; matrixId += (sizeId == 3) ? 3 : 1) {
+            if (bs_read(bs, 1) == 0) {
+                bs_read_ue(bs); // scaling_list_pred_matrix_id_delta
+            } else {
+                uint32_t coefNum = MIN(64, 1 << (4 + (sizeId << 1)));
+                if (sizeId > 1) {
+                    bs_read_se(bs); // scaling_list_dc_coef_minus8
+                }
+                for (uint32_t ix = 0; ix < coefNum; ix++) {
+                    bs_read_se(bs); // scaling_list_delta_coef
+                }
+            }
+        }
+    }
+}
+
+static int hevc_st_ref_pic_set (bs_reader_t *bs, uint32_t idx, uint32_t *num_delta_pocs)
+{
+    if (idx != 0 && bs_read(bs, 1)) {
+        // inter_ref_pic_set_prediction_flag
+        bs_read(bs, 1); // delta_rps_sign
+        bs_read_ue(bs); // abs_delta_rps_minus1
+
+        uint32_t count = 0;
+        for (uint32_t ix = 0; ix <= num_delta_pocs[idx - 1]; ix++) {
+            uint32_t used_by_curr_pic_flag = bs_read(bs, 1);
+            uint32_t use_delta_flag = used_by_curr_pic_flag ? 1 : bs_read(bs, 1);
+            if (used_by_curr_pic_flag || use_delta_flag) {
+                count++;
+            }
+        }
+        num_delta_pocs[idx] = count;
+    } else {
+        uint32_t num_negative_pics = bs_read_ue(bs);
+        uint32_t num_positive_pics = bs_read_ue(bs);
+        if (num_negative_pics > 16 || num_positive_pics > 16) {
+            return -1;
+        }
+        for (uint32_t ix = 0; ix < num_negative_pics + num_positive_pics; ix++) {
+            bs_read_ue(bs); // delta_poc_minus1
+            bs_read(bs, 1); // used_by_curr_pic_flag
+        }
+        num_delta_pocs[idx] = num_negative_pics + num_positive_pics;
+    }
+    return bs_error(bs) ? -1 : 0;
+}
+
+// Only up to the timing info, the rest isn't needed.
+// Each group of fields is kept only if it could be read whole.
+static void hevc_vui_parameters (bs_reader_t *bs, hevc_sps_t *sps)
+{
+    if (bs_read(bs, 1)) {
+        // aspect_ratio_info_present_flag
+        uint32_t aspect_ratio_idc = bs_read(bs, 8);
+        if (aspect_ratio_idc == 255) {
+            uint32_t sar_width = bs_read(bs, 16);
+            uint32_t sar_height = bs_read(bs, 16);
+            if (bs_error(bs)) {
+                return;
+            }
+            sps->sar_width = sar_width;
+            sps->sar_height = sar_height;
+        } else if (aspect_ratio_idc < 17 && !bs_error(bs)) {
+            sps->sar_width = hevc_sar[aspect_ratio_idc][0];
+            sps->sar_height = hevc_sar[aspect_ratio_idc][1];
+        }
+    }
+    if (bs_read(bs, 1)) {
+        bs_read(bs, 1); // overscan_appropriate_flag
+    }
+    if (bs_read(bs, 1)) {
+        // video_signal_type_present_flag
+        bs_read(bs, 3); // video_format
+        uint32_t video_full_range_flag = bs_read(bs, 1);
+        uint32_t colour_description_present_flag = bs_read(bs, 1);
+        if (bs_error(bs)) {
+            return;
+        }
+        sps->video_full_range_flag = video_full_range_flag;
+        sps->colour_description_present_flag = colour_description_present_flag;
+        if (colour_description_present_flag) {
+            uint32_t colour_primaries = bs_read(bs, 8);
+            uint32_t transfer_characteristics = bs_read(bs, 8);
+            uint32_t matrix_coeffs = bs_read(bs, 8);
+            if (bs_error(bs)) {
+                return;
+            }
+            sps->colour_primaries = colour_primaries;
+            sps->transfer_characteristics = transfer_characteristics;
+            sps->matrix_coeffs = matrix_coeffs;
+        }
+    }
+    if (bs_read(bs, 1)) {
+        // chroma_loc_info_present_flag
+        bs_read_ue(bs);
+        bs_read_ue(bs);
+    }
+    bs_read(bs, 1); // neutral_chroma_indication_flag
+    bs_read(bs, 1); // field_seq_flag
+    bs_read(bs, 1); // frame_field_info_present_flag
+    if (bs_read(bs, 1)) {
+        // default_display_window_flag
+        bs_read_ue(bs);
+        bs_read_ue(bs);
+        bs_read_ue(bs);
+        bs_read_ue(bs);
+    }
+    if (bs_read(bs, 1)) {
+        // vui_timing_info_present_flag
+        uint32_t num_units_in_tick = bs_read(bs, 32);
+        uint32_t time_scale = bs_read(bs, 32);
+        if (bs_error(bs)) {
+            return;
+        }
+        sps->num_units_in_tick = num_units_in_tick;
+        sps->time_scale = time_scale;
+    }
+}
+
+static int hevc_parse_seq_info (bs_reader_t *bs, const uint8_t *rbsp, uint32_t size, hevc_sps_t *sps, uint32_t *sps_id)
+{
+    bs_skip(bs, 16); // nal_unit_header
+    bs_skip(bs, 4); // sps_video_parameter_set_id
+    uint32_t max_sub_layers_minus1 = bs_read(bs, 3);
+    if (max_sub_layers_minus1 > 6) {
+        return -1;
+    }
+    sps->max_sub_layers = max_sub_layers_minus1 + 1;
+    sps->temporal_id_nesting_flag = bs_read(bs, 1);
+
+    // the general profile_tier_level is byte aligned,
+    // hvcC stores it as it is
+    if (size < 15) {
+        return -1;
+    }
+    memcpy(sps->general_profile_tier_level, rbsp + 3, 12);
+    bs_skip(bs, 96);
+    hevc_sub_layers_profile_tier_level(bs, max_sub_layers_minus1);
+
+    *sps_id = bs_read_ue(bs);
+    if (*sps_id >= HEVC_MAX_SPS) {
+        return -1;
+    }
+    sps->chroma_format_idc = bs_read_ue(bs);
+    if (sps->chroma_format_idc == 3) {
+        sps->separate_colour_plane_flag = bs_read(bs, 1);
+    }
+    sps->pic_width = bs_read_ue(bs);
+    sps->pic_height = bs_read_ue(bs);
+    if (bs_read(bs, 1)) {
+        // conformance_window_flag
+        uint32_t left = bs_read_ue(bs);
+        uint32_t right = bs_read_ue(bs);
+        uint32_t top = bs_read_ue(bs);
+        uint32_t bottom = bs_read_ue(bs);
+        uint32_t sub_width = (sps->chroma_format_idc == 1 || sps->chroma_format_idc == 2) && !sps->separate_colour_plane_flag ? 2 : 1;
+        uint32_t sub_height = sps->chroma_format_idc == 1 && !sps->separate_colour_plane_flag ? 2 : 1;
+        sps->pic_width -= MIN(sps->pic_width, sub_width * (left + right));
+        sps->pic_height -= MIN(sps->pic_height, sub_height * (top + bottom));
+    }
+    sps->bit_depth_luma_minus8 = bs_read_ue(bs);
+    sps->bit_depth_chroma_minus8 = bs_read_ue(bs);
+    sps->log2_max_pic_order_cnt_lsb = bs_read_ue(bs) + 4;
+    if (sps->log2_max_pic_order_cnt_lsb > 16 || bs_error(bs)) {
+        return -1;
+    }
+    // everything needed to read the slice headers is here,
+    // a broken VUI doesn't matter
+    sps->valid = true;
+
+    uint32_t sub_layer_ordering_info_present_flag = bs_read(bs, 1);
+    for (uint32_t ix = sub_layer_ordering_info_present_flag ? 0 : max_sub_layers_minus1; ix <= max_sub_layers_minus1; ix++) {
+        bs_read_ue(bs); // sps_max_dec_pic_buffering_minus1
+        bs_read_ue(bs); // sps_max_num_reorder_pics
+        bs_read_ue(bs); // sps_max_latency_increase_plus1
+    }
+    bs_read_ue(bs); // log2_min_luma_coding_block_size_minus3
+    bs_read_ue(bs); // log2_diff_max_min_luma_coding_block_size
+    bs_read_ue(bs); // log2_min_luma_transform_block_size_minus2
+    bs_read_ue(bs); // log2_diff_max_min_luma_transform_block_size
+    bs_read_ue(bs); // max_transform_hierarchy_depth_inter
+    bs_read_ue(bs); // max_transform_hierarchy_depth_intra
+    if (bs_read(bs, 1) && bs_read(bs, 1)) {
+        // scaling_list_enabled_flag and sps_scaling_list_data_present_flag
+        hevc_scaling_list_data(bs);
+    }
+    bs_read(bs, 1); // amp_enabled_flag
+    bs_read(bs, 1); // sample_adaptive_offset_enabled_flag
+    if (bs_read(bs, 1)) {
+        // pcm_enabled_flag
+        bs_skip(bs, 8);
+        bs_read_ue(bs);
+        bs_read_ue(bs);
+        bs_read(bs, 1);
+    }
+    uint32_t num_short_term_ref_pic_sets = bs_read_ue(bs);
+    if (num_short_term_ref_pic_sets > 64) {
+        return 0;
+    }
+    uint32_t num_delta_pocs[64];
+    for (uint32_t ix = 0; ix < num_short_term_ref_pic_sets; ix++) {
+        if (hevc_st_ref_pic_set(bs, ix, num_delta_pocs) < 0) {
+            return 0;
+        }
+    }
+    if (bs_read(bs, 1)) {
+        // long_term_ref_pics_present_flag
+        uint32_t num_long_term_ref_pics_sps = bs_read_ue(bs);
+        for (uint32_t ix = 0; ix < num_long_term_ref_pics_sps && !bs_error(bs); ix++) {
+            bs_skip(bs, sps->log2_max_pic_order_cnt_lsb + 1);
+        }
+    }
+    bs_read(bs, 1); // sps_temporal_mvp_enabled_flag
+    bs_read(bs, 1); // strong_intra_smoothing_enabled_flag
+    if (bs_read(bs, 1) && !bs_error(bs)) {
+        hevc_vui_parameters(bs, sps);
+    }
+    return 0;
+}
+
+// nal starts with the NAL unit header
+static int hevc_read_seq_info (const uint8_t *nal, uint32_t len, hevc_sps_t *sps, uint32_t *sps_id)
+{
+    uint8_t *rbsp = (uint8_t *)malloc(len);
+    uint32_t size = hevc_nal_to_rbsp(rbsp, nal, len);
+    bs_reader_t bs;
+    int result;
+
+    memset(sps, 0, sizeof(hevc_sps_t));
+
+    bs_reader_init(&bs, rbsp, size);
+    result = hevc_parse_seq_info(&bs, rbsp, size, sps, sps_id);
+
+    free(rbsp);
+    return result;
+}
+
+static int hevc_read_pic_info (const uint8_t *nal, uint32_t len, hevc_pps_t *pps, uint32_t *pps_id)
+{
+    bs_reader_t bs;
+
+    memset(pps, 0, sizeof(hevc_pps_t));
+
+    bs_reader_init_nal(&bs, nal, len);
+    bs_skip(&bs, 16); // nal_unit_header
+    *pps_id = bs_read_ue(&bs);
+    pps->sps_id = bs_read_ue(&bs);
+    if (*pps_id >= HEVC_MAX_PPS || pps->sps_id >= HEVC_MAX_SPS) {
+        return -1;
+    }
+    bs_read(&bs, 1); // dependent_slice_segments_enabled_flag
+    pps->output_flag_present_flag = bs_read(&bs, 1);
+    pps->num_extra_slice_header_bits = bs_read(&bs, 3);
+    if (bs_error(&bs)) {
+        return -1;
+    }
+    pps->valid = true;
+    return 0;
+}
+
+// Reads the header of the first slice segment of a picture up to its POC lsb
+static const hevc_sps_t * hevc_read_slice_info (const uint8_t *nal, uint32_t len,
+                                                const hevc_decode_t *dec, uint32_t *poc_lsb)
+{
+    uint8_t type = hevc_nal_unit_type(nal);
+    bs_reader_t bs;
+
+    bs_reader_init_nal(&bs, nal, len);
+    bs_skip(&bs, 16); // nal_unit_header
+    bs_read(&bs, 1); // first_slice_segment_in_pic_flag
+    if (hevc_nal_unit_type_is_irap(type)) {
+        bs_read(&bs, 1); // no_output_of_prior_pics_flag
+    }
+    uint32_t pps_id = bs_read_ue(&bs);
+    if (pps_id >= HEVC_MAX_PPS || dec->pps[pps_id].valid == false || bs_error(&bs)) {
+        return NULL;
+    }
+    const hevc_pps_t *pps = &dec->pps[pps_id];
+    const hevc_sps_t *sps = &dec->sps[pps->sps_id];
+    if (sps->valid == false) {
+        return NULL;
+    }
+    bs_skip(&bs, pps->num_extra_slice_header_bits); // slice_reserved_flag
+    bs_read_ue(&bs); // slice_type
+    if (pps->output_flag_present_flag) {
+        bs_read(&bs, 1); // pic_output_flag
+    }
+    if (sps->separate_colour_plane_flag) {
+        bs_read(&bs, 2); // colour_plane_id
+    }
+    if (type != HEVC_NAL_TYPE_IDR_W_RADL && type != HEVC_NAL_TYPE_IDR_N_LP) {
+        *poc_lsb = bs_read(&bs, sps->log2_max_pic_order_cnt_lsb);
+    } else {
+        *poc_lsb = 0;
+    }
+    return bs_error(&bs) ? NULL : sps;
+}
+
+static int32_t hevc_compute_poc (hevc_decode_t *dec, uint8_t type, uint8_t temporal_id,
+                                 uint32_t poc_lsb, uint32_t log2_max_poc_lsb, bool no_rasl_output)
+{
+    int32_t max_poc_lsb = 1 << log2_max_poc_lsb;
+    int32_t lsb = (int32_t)poc_lsb;
+    int32_t msb;
+
+    if (hevc_nal_unit_type_is_irap(type) && no_rasl_output) {
+        msb = 0;
+    } else {
+        int32_t prev_lsb = dec->prev_tid0_poc & (max_poc_lsb - 1);
+        int32_t prev_msb = dec->prev_tid0_poc - prev_lsb;
+
+        if (lsb < prev_lsb && prev_lsb - lsb >= max_poc_lsb / 2) {
+            msb = prev_msb + max_poc_lsb;
+        } else if (lsb > prev_lsb && lsb - prev_lsb > max_poc_lsb / 2) {
+            msb = prev_msb - max_poc_lsb;
+        } else {
+            msb = prev_msb;
+        }
+    }
+
+    int32_t poc = msb + lsb;
+    if (temporal_id == 0 && !hevc_nal_unit_type_is_leading(type) && !hevc_nal_unit_type_is_slnr(type)) {
+        dec->prev_tid0_poc = poc;
+    }
+    return poc;
+}
+
+typedef struct hevc_order_t {
+    int32_t poc;
+    uint32_t index;
+} hevc_order_t;
+
+static int hevc_order_compare (const void *a, const void *b)
+{
+    const hevc_order_t *x = (const hevc_order_t *)a;
+    const hevc_order_t *y = (const hevc_order_t *)b;
+    if (x->poc != y->poc) {
+        return x->poc < y->poc ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Composition offsets in frames, from the display order of the pictures
+// of each coded video sequence. Returns the delay added to all of them
+// so that none is negative.
+static uint32_t hevc_composition_offsets (const hevc_picture_t *pictures, uint32_t count, int32_t *offsets)
+{
+    hevc_order_t *order = (hevc_order_t *)malloc(count * sizeof(hevc_order_t));
+    int32_t delay = 0;
+
+    for (uint32_t start = 0, end; start < count; start = end) {
+        for (end = start + 1; end < count && pictures[end].new_sequence == false; end++);
+
+        for (uint32_t ix = start; ix < end; ix++) {
+            order[ix].poc = pictures[ix].poc;
+            order[ix].index = ix;
+        }
+        qsort(order + start, end - start, sizeof(hevc_order_t), hevc_order_compare);
+
+        for (uint32_t ix = start; ix < end; ix++) {
+            offsets[order[ix].index] = (int32_t)ix - (int32_t)order[ix].index;
+            delay = MAX(delay, (int32_t)order[ix].index - (int32_t)ix);
+        }
+    }
+
+    for (uint32_t ix = 0; ix < count; ix++) {
+        offsets[ix] += delay;
+    }
+
+    free(order);
+    return delay;
+}
+
+static NSData * HEVCConfigurationRecord (const hevc_sps_t *sps, bool complete,
+                                         NSArray<NSData *> *vps, NSArray<NSData *> *spss, NSArray<NSData *> *pps)
+{
+    NSMutableData *hvcC = [[NSMutableData alloc] init];
+    uint8_t header[23];
+
+    header[0] = 1; // configurationVersion
+    memcpy(header + 1, sps->general_profile_tier_level, 12);
+    header[13] = 0xf0; // min_spatial_segmentation_idc
+    header[14] = 0x00;
+    header[15] = 0xfc; // parallelismType
+    header[16] = 0xfc | (sps->chroma_format_idc & 0x03);
+    header[17] = 0xf8 | (sps->bit_depth_luma_minus8 & 0x07);
+    header[18] = 0xf8 | (sps->bit_depth_chroma_minus8 & 0x07);
+    header[19] = 0; // avgFrameRate
+    header[20] = 0;
+    header[21] = ((sps->max_sub_layers & 0x07) << 3) | (sps->temporal_id_nesting_flag << 2) | 0x03;
+    header[22] = 3; // numOfArrays
+    [hvcC appendBytes:header length:sizeof(header)];
+
+    const struct { uint8_t type; NSArray<NSData *> *units; } arrays[3] = {
+        { HEVC_NAL_TYPE_VPS, vps }, { HEVC_NAL_TYPE_SPS, spss }, { HEVC_NAL_TYPE_PPS, pps }
+    };
+
+    for (int ix = 0; ix < 3; ix++) {
+        // array_completeness, set only if the samples don't carry other parameter sets
+        uint8_t array[3] = { (uint8_t)((complete ? 0x80 : 0) | arrays[ix].type),
+                             (uint8_t)(arrays[ix].units.count >> 8),
+                             (uint8_t)(arrays[ix].units.count & 0xff) };
+        [hvcC appendBytes:array length:sizeof(array)];
+
+        for (NSData *unit in arrays[ix].units) {
+            uint8_t length[2] = { (uint8_t)(unit.length >> 8), (uint8_t)(unit.length & 0xff) };
+            [hvcC appendBytes:length length:sizeof(length)];
+            [hvcC appendData:unit];
+        }
+    }
+
+    return hvcC;
+}
+
+static bool HEVCContainsUnit (NSArray<NSData *> *units, const uint8_t *nal, uint32_t size)
+{
+    for (NSData *unit in units) {
+        if (unit.length == size && memcmp(unit.bytes, nal, size) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Collects the parameter sets that come before the first picture,
+// and looks for different ones later in the stream, those stay in the samples
+static NSData * HEVCInfo (FILE *file, hevc_sps_t *sps, NSMutableArray<NSData *> *parameterSets, bool *complete)
+{
+    NSMutableArray<NSData *> *vps = [NSMutableArray array];
+    NSMutableArray<NSData *> *spss = [NSMutableArray array];
+    NSMutableArray<NSData *> *pps = [NSMutableArray array];
+    bool seen_picture = false;
+    annexb_reader_t reader;
+
+    *complete = true;
+
+    if (annexb_reader_open(&reader, file) == 0) {
+        return nil;
+    }
+
+    while (annexb_reader_next(&reader)) {
+        uint32_t header_size = reader.nal[2] == 1 ? 3 : 4;
+        const uint8_t *nal = reader.nal + header_size;
+        uint32_t size = reader.nal_size - header_size;
+
+        // trailing_zero_8bits aren't part of the NAL
+        while (size > 2 && nal[size - 1] == 0) {
+            size--;
+        }
+        if (size < 3 || hevc_nuh_layer_id(nal) != 0) {
+            continue;
+        }
+
+        uint8_t type = hevc_nal_unit_type(nal);
+        if (type < HEVC_NAL_TYPE_VPS) {
+            seen_picture |= vps.count && spss.count && pps.count;
+            continue;
+        }
+        if (type != HEVC_NAL_TYPE_VPS && type != HEVC_NAL_TYPE_SPS && type != HEVC_NAL_TYPE_PPS) {
+            continue;
+        }
+
+        if (seen_picture) {
+            NSArray<NSData *> *units = type == HEVC_NAL_TYPE_VPS ? vps : type == HEVC_NAL_TYPE_SPS ? spss : pps;
+            if (!HEVCContainsUnit(units, nal, size)) {
+                *complete = false;
+                break;
+            }
+            continue;
+        }
+
+        NSData *unit = [NSData dataWithBytes:nal length:size];
+        if (type == HEVC_NAL_TYPE_VPS && ![vps containsObject:unit]) {
+            [vps addObject:unit];
+        } else if (type == HEVC_NAL_TYPE_SPS && ![spss containsObject:unit]) {
+            uint32_t sps_id;
+            if (spss.count == 0 && hevc_read_seq_info(nal, size, sps, &sps_id) == -1) {
+                continue;
+            }
+            [spss addObject:unit];
+        } else if (type == HEVC_NAL_TYPE_PPS && ![pps containsObject:unit]) {
+            [pps addObject:unit];
+        }
+    }
+
+    annexb_reader_close(&reader);
+
+    if (vps.count == 0 || spss.count == 0 || pps.count == 0) {
+        return nil;
+    }
+
+    [parameterSets addObjectsFromArray:vps];
+    [parameterSets addObjectsFromArray:spss];
+    [parameterSets addObjectsFromArray:pps];
+
+    return HEVCConfigurationRecord(sps, *complete, vps, spss, pps);
+}
+
+MP42_OBJC_DIRECT_MEMBERS
+@implementation MP42HEVCImporter {
+    FILE *inFile;
+    int64_t _size;
+
+    NSData *hvcC;
+    NSArray<NSData *> *parameterSets;
+    uint32_t timescale;
+    uint32_t mp4FrameDuration;
+
+    hevc_picture_t *pictures;
+    uint32_t picturesCountMax;
+    MP4SampleId samplesWritten;
+}
+
++ (NSArray<NSString *> *)supportedFileFormats {
+    return @[@"265", @"h265", @"hevc"];
+}
+
+- (instancetype)initWithURL:(NSURL *)fileURL error:(NSError * __autoreleasing *)outError
+{
+    if ((self = [super initWithURL:fileURL])) {
+
+        MP42VideoTrack *newTrack = [[MP42VideoTrack alloc] init];
+
+        newTrack.format = kMP42VideoCodecType_HEVC;
+        newTrack.URL = self.fileURL;
+
+        if (!inFile) {
+            inFile = fopen(self.fileURL.fileSystemRepresentation, "rb");
+        }
+
+        struct stat st;
+        stat(self.fileURL.fileSystemRepresentation, &st);
+        _size = st.st_size;
+
+        hevc_sps_t sps;
+        bool complete;
+        NSMutableArray<NSData *> *units = [NSMutableArray array];
+        if (inFile == NULL || (hvcC = HEVCInfo(inFile, &sps, units, &complete)) == nil) {
+            if (outError) {
+                *outError = MP42Error(MP42LocalizedString(@"The video could not be opened.", @"error message"),
+                                      MP42LocalizedString(@"Data in file doesn't appear to be valid HEVC video.", @"error message"), 100);
+            }
+            return nil;
+        }
+        parameterSets = units;
+
+        // the samples carry parameter sets outside the configuration, write hev1
+        if (!complete) {
+            newTrack.format = kMP42VideoCodecType_HEVC_PSinBitstream;
+        }
+
+        newTrack.width = sps.pic_width;
+        newTrack.height = sps.pic_height;
+        newTrack.trackHeight = sps.pic_height;
+
+        if (sps.sar_width && sps.sar_height) {
+            newTrack.hSpacing = sps.sar_width;
+            newTrack.vSpacing = sps.sar_height;
+            newTrack.trackWidth = (float)sps.pic_width * sps.sar_width / sps.sar_height;
+        } else {
+            newTrack.hSpacing = newTrack.vSpacing = 1;
+            newTrack.trackWidth = sps.pic_width;
+        }
+
+        if (sps.colour_description_present_flag) {
+            newTrack.colorPrimaries = sps.colour_primaries;
+            newTrack.transferCharacteristics = sps.transfer_characteristics;
+            newTrack.matrixCoefficients = sps.matrix_coeffs;
+            newTrack.colorRange = sps.video_full_range_flag;
+        }
+
+        if (sps.num_units_in_tick && sps.time_scale) {
+            timescale = sps.time_scale;
+            mp4FrameDuration = sps.num_units_in_tick;
+        } else {
+            timescale = framerates[8].timescale;
+            mp4FrameDuration = framerates[8].duration;
+        }
+        newTrack.timescale = timescale;
+
+        newTrack.dataLength = _size;
+
+        [self addTrack:newTrack];
+    }
+
+    return self;
+}
+
+- (void)setup
+{
+    MP42Track *track = self.tracks.firstObject;
+
+    // a frame rate chosen at import time wins over the stream timing info
+    if ([track.conversionSettings isKindOfClass:[MP42RawConversionSettings class]]) {
+        NSUInteger frameRate = [(MP42RawConversionSettings *)track.conversionSettings frameRate];
+
+        for (const framerate_t *framerate = framerates; framerate->code; framerate++) {
+            if (frameRate == framerate->code) {
+                timescale = framerate->timescale;
+                mp4FrameDuration = framerate->duration;
+                break;
+            }
+        }
+    }
+
+    track.timescale = timescale;
+}
+
+- (NSData *)magicCookieForTrack:(MP42Track *)track
+{
+    return hvcC;
+}
+
+- (BOOL)isParameterSetInConfiguration:(const uint8_t *)nal size:(uint32_t)size
+{
+    while (size > 2 && nal[size - 1] == 0) {
+        size--;
+    }
+    return HEVCContainsUnit(parameterSets, nal, size);
+}
+
+- (uint32_t)enqueueAccessUnit:(hevc_access_unit_t *)au reader:(const annexb_reader_t *)reader trackId:(MP4TrackId)trackId
+{
+    uint32_t size = au->size;
+
+    if (au->skip == false && au->size) {
+        if (samplesWritten == picturesCountMax) {
+            picturesCountMax += 1024;
+            pictures = (hevc_picture_t *)realloc(pictures, picturesCountMax * sizeof(hevc_picture_t));
+        }
+        pictures[samplesWritten].poc = au->poc;
+        pictures[samplesWritten].new_sequence = au->new_sequence;
+        samplesWritten++;
+
+        MP42SampleBuffer *sample = [self newSampleWithSize:au->size];
+        annexb_reader_write_spans(reader, au->spans, au->spans_count, (uint8_t *)sample->data);
+        sample->duration = mp4FrameDuration;
+        sample->flags = au->is_irap ? MP42SampleBufferFlagIsSync : 0;
+        sample->dependecyFlags = au->dflags;
+        sample->trackId = trackId;
+
+        [self batchSample:sample];
+    }
+
+    au->spans_count = 0;
+    au->size = 0;
+    au->has_picture = false;
+    au->skip = false;
+
+    return size;
+}
+
+- (void)demux
+{
+    @autoreleasepool {
+        if (!inFile) {
+            inFile = fopen(self.fileURL.fileSystemRepresentation, "rb");
+        }
+
+        MP42Track *track = self.inputTracks.lastObject;
+        MP4TrackId trackId = track.sourceId;
+        int64_t currentSize = 0;
+
+        annexb_reader_t reader;
+        if (inFile == NULL || annexb_reader_open(&reader, inFile) == 0) {
+            [self setDone];
+            return;
+        }
+
+        hevc_decode_t *dec = (hevc_decode_t *)calloc(1, sizeof(hevc_decode_t));
+        hevc_access_unit_t au;
+        memset(&au, 0, sizeof(au));
+
+        while (annexb_reader_next(&reader) && !self.isCancelled) {
+            uint32_t header_size = reader.nal[2] == 1 ? 3 : 4;
+            const uint8_t *nal = reader.nal + header_size;
+            uint32_t size = reader.nal_size - header_size;
+
+            if (size < 2) {
+                continue;
+            }
+
+            uint8_t type = hevc_nal_unit_type(nal);
+            uint8_t layer_id = hevc_nuh_layer_id(nal);
+            bool first_slice = type < HEVC_NAL_TYPE_VPS && size > 2 && (nal[2] & 0x80);
+
+            if (au.has_picture && layer_id == 0 &&
+                (first_slice || hevc_nal_unit_type_starts_access_unit(type))) {
+                currentSize += [self enqueueAccessUnit:&au reader:&reader trackId:trackId];
+                self.progress = (currentSize / (CGFloat) _size) * 100;
+                reader.hold = ANNEXB_NO_HOLD;
+            }
+
+            bool copy_nal_to_buffer = true;
+
+            if (type == HEVC_NAL_TYPE_SPS) {
+                hevc_sps_t sps;
+                uint32_t sps_id;
+                if (hevc_read_seq_info(nal, size, &sps, &sps_id) == 0) {
+                    dec->sps[sps_id] = sps;
+                }
+                copy_nal_to_buffer = ![self isParameterSetInConfiguration:nal size:size];
+            } else if (type == HEVC_NAL_TYPE_PPS) {
+                hevc_pps_t pps;
+                uint32_t pps_id;
+                if (hevc_read_pic_info(nal, size, &pps, &pps_id) == 0) {
+                    dec->pps[pps_id] = pps;
+                }
+                copy_nal_to_buffer = ![self isParameterSetInConfiguration:nal size:size];
+            } else if (type == HEVC_NAL_TYPE_VPS) {
+                copy_nal_to_buffer = ![self isParameterSetInConfiguration:nal size:size];
+            } else if (type == HEVC_NAL_TYPE_EOS) {
+                dec->after_eos = true;
+            } else if (type < HEVC_NAL_TYPE_VPS) {
+                if (first_slice && layer_id == 0) {
+                    bool irap = hevc_nal_unit_type_is_irap(type);
+                    bool no_rasl_output = false;
+                    uint8_t temporal_id = hevc_temporal_id(nal);
+
+                    if (irap) {
+                        no_rasl_output = type != HEVC_NAL_TYPE_CRA || dec->seen_irap == false || dec->after_eos;
+                        dec->skip_rasl = no_rasl_output;
+                        dec->seen_irap = true;
+                    }
+                    dec->after_eos = false;
+
+                    uint32_t poc_lsb = 0;
+                    const hevc_sps_t *sps = hevc_read_slice_info(nal, size, dec, &poc_lsb);
+
+                    // pictures that can't be decoded, before the first IRAP
+                    // or RASL of an IRAP that starts a new sequence
+                    au.skip = dec->seen_irap == false ||
+                              (hevc_nal_unit_type_is_rasl(type) && dec->skip_rasl);
+                    au.is_irap = irap;
+                    au.new_sequence = irap && no_rasl_output;
+                    au.poc = sps ? hevc_compute_poc(dec, type, temporal_id, poc_lsb, sps->log2_max_pic_order_cnt_lsb, no_rasl_output) : au.poc + 1;
+
+                    au.dflags = 0;
+                    if (hevc_nal_unit_type_is_slnr(type) && sps && temporal_id + 1 >= sps->max_sub_layers) {
+                        au.dflags |= MP4_SDT_HAS_NO_DEPENDENTS; /* disposable */
+                    } else {
+                        au.dflags |= MP4_SDT_HAS_DEPENDENTS;
+                    }
+                    if (irap) {
+                        au.dflags |= MP4_SDT_IS_INDEPENDENT;
+                    }
+                }
+                au.has_picture = true;
+            }
+
+            if (copy_nal_to_buffer) {
+                if (au.spans_count == au.spans_count_max) {
+                    au.spans_count_max += 16;
+                    au.spans = (annexb_span_t *)realloc(au.spans, au.spans_count_max * sizeof(annexb_span_t));
+                }
+                if (au.spans_count == 0) {
+                    // keep the access unit in the reader until it's written
+                    reader.hold = reader.nal_offset;
+                }
+                au.spans[au.spans_count].offset = reader.nal_offset + header_size;
+                au.spans[au.spans_count].length = size;
+                au.spans_count++;
+
+                au.size += size + 4;
+            }
+        }
+
+        if (au.has_picture) {
+            currentSize += [self enqueueAccessUnit:&au reader:&reader trackId:trackId];
+            self.progress = (currentSize / (CGFloat) _size) * 100;
+        }
+
+        annexb_reader_close(&reader);
+        free(au.spans);
+        free(dec);
+
+        [self setDone];
+    }
+}
+
+- (void)cleanUp:(MP42Track *)track fileHandle:(MP4FileHandle)fileHandle
+{
+    MP4TrackId trackId = track.trackId;
+
+    int32_t *offsets = (int32_t *)malloc(samplesWritten * sizeof(int32_t));
+    uint32_t delay = hevc_composition_offsets(pictures, samplesWritten, offsets);
+
+    if (delay > 0) {
+        for (uint32_t ix = 0; ix < samplesWritten; ix++) {
+            MP4SetSampleRenderingOffset(fileHandle, trackId, 1 + ix,
+                                        offsets[ix] * mp4FrameDuration);
+        }
+        MP4Duration editDuration = MP4ConvertFromTrackDuration(fileHandle,
+                                                               trackId,
+                                                               MP4GetTrackDuration(fileHandle, trackId),
+                                                               MP4GetTimeScale(fileHandle));
+
+        MP4AddTrackEdit(fileHandle, trackId, MP4_INVALID_EDIT_ID, delay * mp4FrameDuration,
+                        editDuration, 0);
+    }
+
+    free(offsets);
+    free(pictures);
+    pictures = NULL;
+    picturesCountMax = 0;
+}
+
+- (NSString *)description
+{
+    return @"HEVC demuxer";
+}
+
+- (void)dealloc
+{
+    free(pictures);
+    if (inFile) {
+        fclose(inFile);
+    }
+}
+
+@end
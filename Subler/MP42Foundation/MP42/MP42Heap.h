@@ -22,6 +22,7 @@ MP42_OBJC_DIRECT_MEMBERS
 
 - (void)insert:(ObjectType)item;
 - (nullable ObjectType)extract NS_RETURNS_RETAINED;
+- (nullable ObjectType)peek;
 
 - (NSInteger)count;
 
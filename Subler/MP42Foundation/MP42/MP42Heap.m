@@ -74,6 +74,10 @@ MP42_OBJC_DIRECT_MEMBERS
     return temp;
 }
 
+- (nullable id)peek {
+    return _len ? _array[0] : nil;
+}
+
 - (void)heapify {
     uint64 i = 0;
 
@@ -0,0 +1,47 @@
+//
+//  MP42Interleaver.h
+//  MP42Foundation
+//
+//  Copyright (c) 2022 Damiano Galassi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "MP42SampleBuffer.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Merges the samples of several tracks in decode time order,
+ *  so the muxer writes them in the same order on every run,
+ *  whatever the timing of the importers threads.
+ *
+ *  A sample is returned only when every track that isn't ended
+ *  has a sample queued, or when the queued samples span more
+ *  than window seconds, to not wait forever on sparse tracks.
+ */
+MP42_OBJC_DIRECT_MEMBERS
+@interface MP42Interleaver : NSObject
+
+- (instancetype)initWithTrackCount:(NSUInteger)count window:(double)window;
+
+/**
+ *  Sets the timescale of a track, and the duration used
+ *  for its samples without a duration.
+ */
+- (void)setTimescale:(uint32_t)timescale sampleDuration:(uint64_t)duration forTrack:(NSUInteger)index;
+
+- (void)addSample:(MP42SampleBuffer *)sample toTrack:(NSUInteger)index;
+- (void)endTrack:(NSUInteger)index;
+- (BOOL)isTrackEnded:(NSUInteger)index;
+
+/**
+ *  Returns the next sample to write and the index of its track,
+ *  or nil if more samples are needed to know which one comes first.
+ */
+- (nullable MP42SampleBuffer *)copyNextSample:(NSUInteger *)index;
+
+@property (nonatomic, readonly, getter=isDone) BOOL done;
+
+@end
+
+NS_ASSUME_NONNULL_END
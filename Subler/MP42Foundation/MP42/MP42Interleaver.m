@@ -0,0 +1,165 @@
+//
+//  MP42Interleaver.m
+//  MP42Foundation
+//
+//  Copyright (c) 2022 Damiano Galassi. All rights reserved.
+//
+
+#import "MP42Interleaver.h"
+#import "MP42Heap.h"
+
+#import "mp4v2.h"
+
+MP42_OBJC_DIRECT_MEMBERS
+@interface MP42InterleaverTrack : NSObject {
+    @public
+    NSUInteger  index;
+    uint32_t    timescale;
+    uint64_t    sampleDuration;
+
+    // decode time of the first queued sample, and of the next added one
+    uint64_t    headTimestamp;
+    uint64_t    nextTimestamp;
+
+    NSMutableArray<MP42SampleBuffer *> *samples;
+    BOOL        ended;
+}
+@end
+
+@implementation MP42InterleaverTrack
+@end
+
+static inline uint64_t durationOfSample(MP42InterleaverTrack *track, MP42SampleBuffer *sample)
+{
+    return sample->duration != MP4_INVALID_DURATION ? sample->duration : track->sampleDuration;
+}
+
+static inline double headTime(MP42InterleaverTrack *track)
+{
+    return (double)track->headTimestamp / track->timescale;
+}
+
+MP42_OBJC_DIRECT_MEMBERS
+@implementation MP42Interleaver {
+@private
+    NSArray<MP42InterleaverTrack *> *_tracks;
+    MP42Heap<MP42InterleaverTrack *> *_heap;
+
+    // tracks not ended and without queued samples
+    NSUInteger _waiting;
+    NSUInteger _ended;
+
+    double _window;
+    double _lastTime;
+}
+
+- (instancetype)initWithTrackCount:(NSUInteger)count window:(double)window
+{
+    self = [super init];
+    if (self) {
+        NSMutableArray<MP42InterleaverTrack *> *tracks = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger index = 0; index < count; index++) {
+            MP42InterleaverTrack *track = [[MP42InterleaverTrack alloc] init];
+            track->index = index;
+            track->timescale = 1;
+            track->samples = [[NSMutableArray alloc] init];
+            [tracks addObject:track];
+        }
+        _tracks = tracks;
+        _waiting = count;
+        _window = window;
+
+        // the earliest head first, the first track on ties
+        _heap = [[MP42Heap alloc] initWithCapacity:MAX(count, 1) comparator:^NSComparisonResult(MP42InterleaverTrack *obj1, MP42InterleaverTrack *obj2) {
+            unsigned __int128 t1 = (unsigned __int128)obj1->headTimestamp * obj2->timescale;
+            unsigned __int128 t2 = (unsigned __int128)obj2->headTimestamp * obj1->timescale;
+
+            if (t1 != t2) {
+                return t1 < t2 ? NSOrderedDescending : NSOrderedAscending;
+            }
+            return obj1->index < obj2->index ? NSOrderedDescending : NSOrderedAscending;
+        }];
+    }
+    return self;
+}
+
+- (void)setTimescale:(uint32_t)timescale sampleDuration:(uint64_t)duration forTrack:(NSUInteger)index
+{
+    MP42InterleaverTrack *track = _tracks[index];
+    track->timescale = timescale ? timescale : 1;
+    track->sampleDuration = duration;
+}
+
+- (void)addSample:(MP42SampleBuffer *)sample toTrack:(NSUInteger)index
+{
+    MP42InterleaverTrack *track = _tracks[index];
+
+    if (track->samples.count == 0) {
+        track->headTimestamp = track->nextTimestamp;
+        [_heap insert:track];
+        if (!track->ended) {
+            _waiting--;
+        }
+    }
+
+    [track->samples addObject:sample];
+
+    _lastTime = MAX(_lastTime, (double)track->nextTimestamp / track->timescale);
+    track->nextTimestamp += durationOfSample(track, sample);
+}
+
+- (void)endTrack:(NSUInteger)index
+{
+    MP42InterleaverTrack *track = _tracks[index];
+
+    if (track->ended) {
+        return;
+    }
+    if (track->samples.count == 0) {
+        _waiting--;
+    }
+    track->ended = YES;
+    _ended++;
+}
+
+- (BOOL)isTrackEnded:(NSUInteger)index
+{
+    return _tracks[index]->ended;
+}
+
+- (nullable MP42SampleBuffer *)copyNextSample:(NSUInteger *)index
+{
+    MP42InterleaverTrack *track = [_heap peek];
+
+    if (track == nil) {
+        return nil;
+    }
+
+    // A track without queued samples could still have one that comes
+    // before the head, unless the queued samples span more than the window
+    if (_waiting && _lastTime - headTime(track) <= _window) {
+        return nil;
+    }
+
+    track = [_heap extract];
+
+    MP42SampleBuffer *sample = track->samples.firstObject;
+    [track->samples removeObjectAtIndex:0];
+    track->headTimestamp += durationOfSample(track, sample);
+
+    if (track->samples.count) {
+        [_heap insert:track];
+    } else if (!track->ended) {
+        _waiting++;
+    }
+
+    *index = track->index;
+    return sample;
+}
+
+- (BOOL)isDone
+{
+    return _ended == _tracks.count && _heap.isEmpty;
+}
+
+@end
@@ -0,0 +1,71 @@
+//
+//  MP42MemoryGovernor.h
+//  MP42Foundation
+//
+//  Copyright (c) 2022 Damiano Galassi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "MP42SampleBuffer.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Limits the bytes of the samples waiting in the tracks queues
+ *  of a write, whatever the number of tracks and importers.
+ */
+MP42_OBJC_DIRECT_MEMBERS
+@interface MP42MemoryGovernor : NSObject
+
+- (instancetype)initWithByteBudget:(uint64_t)bytes;
+
+/**
+ *  Stops limiting, the waiting producers return.
+ */
+- (void)cancel;
+
+/**
+ *  Charges bytes held outside of the tracks queues,
+ *  like the frames a demuxer reads ahead. Never waits.
+ *
+ *  @param required charges the bytes even if they don't fit.
+ *  @return whether the bytes were charged.
+ */
+- (BOOL)reserveBytes:(uint64_t)bytes required:(BOOL)required;
+- (void)releaseBytes:(uint64_t)bytes;
+
+@property (nonatomic, readonly) uint64_t byteBudget;
+@property (nonatomic, readonly) uint64_t usedBytes;
+@property (nonatomic, readonly) uint64_t peakBytes;
+
+@end
+
+/**
+ *  The byte and duration budget of a track queue,
+ *  charged to the governor too.
+ *
+ *  The producer reserves the samples before enqueuing them,
+ *  the consumer releases them once dequeued. A sample is always
+ *  accepted in an empty queue, so a sample bigger than
+ *  the budgets can't block a track forever.
+ */
+MP42_OBJC_DIRECT_MEMBERS
+@interface MP42SampleBudget : NSObject
+
+- (instancetype)initWithGovernor:(MP42MemoryGovernor *)governor
+                      byteBudget:(uint64_t)bytes
+                  durationBudget:(double)seconds
+                       timescale:(uint32_t)timescale
+                  sampleDuration:(uint64_t)duration;
+
+/**
+ *  Waits until at least the first sample fits.
+ *
+ *  @return the number of reserved samples, from the start of the array.
+ */
+- (NSUInteger)reserveSamples:(MP42SampleBuffer * const _Nonnull * _Nonnull)samples count:(NSUInteger)count;
+- (void)releaseSamples:(MP42SampleBuffer * const _Nonnull * _Nonnull)samples count:(NSUInteger)count;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,206 @@
+//
+//  MP42MemoryGovernor.m
+//  MP42Foundation
+//
+//  Copyright (c) 2022 Damiano Galassi. All rights reserved.
+//
+
+#import "MP42MemoryGovernor.h"
+#include <pthread.h>
+
+#import "mp4v2.h"
+
+@interface MP42MemoryGovernor () {
+    @package
+    // guards the governor and all its budgets
+    pthread_mutex_t _mutex;
+    pthread_cond_t  _released;
+    NSUInteger      _waiting;
+
+    uint64_t _byteBudget;
+    uint64_t _usedBytes;
+    uint64_t _peakBytes;
+    BOOL     _cancelled;
+}
+@end
+
+MP42_OBJC_DIRECT_MEMBERS
+@implementation MP42MemoryGovernor
+
+- (instancetype)initWithByteBudget:(uint64_t)bytes
+{
+    self = [super init];
+    if (self) {
+        _byteBudget = bytes;
+        pthread_mutex_init(&_mutex, NULL);
+        pthread_cond_init(&_released, NULL);
+    }
+    return self;
+}
+
+- (void)cancel
+{
+    pthread_mutex_lock(&_mutex);
+    _cancelled = YES;
+    pthread_cond_broadcast(&_released);
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (BOOL)reserveBytes:(uint64_t)bytes required:(BOOL)required
+{
+    pthread_mutex_lock(&_mutex);
+
+    BOOL fits = required || _cancelled || _usedBytes + bytes <= _byteBudget;
+    if (fits) {
+        _usedBytes += bytes;
+        _peakBytes = MAX(_peakBytes, _usedBytes);
+    }
+
+    pthread_mutex_unlock(&_mutex);
+
+    return fits;
+}
+
+- (void)releaseBytes:(uint64_t)bytes
+{
+    pthread_mutex_lock(&_mutex);
+
+    _usedBytes -= bytes;
+
+    if (_waiting) {
+        pthread_cond_broadcast(&_released);
+    }
+
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (uint64_t)usedBytes
+{
+    pthread_mutex_lock(&_mutex);
+    uint64_t bytes = _usedBytes;
+    pthread_mutex_unlock(&_mutex);
+    return bytes;
+}
+
+- (uint64_t)peakBytes
+{
+    pthread_mutex_lock(&_mutex);
+    uint64_t bytes = _peakBytes;
+    pthread_mutex_unlock(&_mutex);
+    return bytes;
+}
+
+- (void)dealloc
+{
+    pthread_cond_destroy(&_released);
+    pthread_mutex_destroy(&_mutex);
+}
+
+@end
+
+MP42_OBJC_DIRECT_MEMBERS
+@implementation MP42SampleBudget {
+@private
+    MP42MemoryGovernor *_governor;
+
+    uint64_t _byteBudget;
+    uint64_t _durationBudget;
+    uint64_t _sampleDuration;
+
+    // the samples in the queue, guarded by the governor mutex
+    NSUInteger _count;
+    uint64_t   _bytes;
+    uint64_t   _duration;
+}
+
+- (instancetype)initWithGovernor:(MP42MemoryGovernor *)governor
+                      byteBudget:(uint64_t)bytes
+                  durationBudget:(double)seconds
+                       timescale:(uint32_t)timescale
+                  sampleDuration:(uint64_t)duration
+{
+    self = [super init];
+    if (self) {
+        _governor = governor;
+        _byteBudget = bytes;
+        _durationBudget = (uint64_t)(seconds * (timescale ? timescale : 1));
+        _sampleDuration = duration;
+    }
+    return self;
+}
+
+static inline uint64_t durationOfSample(MP42SampleBudget *budget, MP42SampleBuffer *sample)
+{
+    return sample->duration != MP4_INVALID_DURATION ? sample->duration : budget->_sampleDuration;
+}
+
+- (NSUInteger)reserveSamples:(MP42SampleBuffer * const *)samples count:(NSUInteger)count
+{
+    MP42MemoryGovernor *governor = _governor;
+    NSUInteger reserved = 0;
+
+    pthread_mutex_lock(&governor->_mutex);
+
+    for (;;) {
+        for (; reserved < count; reserved++) {
+            uint64_t bytes = samples[reserved]->size;
+            uint64_t duration = durationOfSample(self, samples[reserved]);
+
+            if (_count && !governor->_cancelled &&
+                (_bytes + bytes > _byteBudget ||
+                 _duration + duration > _durationBudget ||
+                 governor->_usedBytes + bytes > governor->_byteBudget)) {
+                break;
+            }
+
+            _count += 1;
+            _bytes += bytes;
+            _duration += duration;
+            governor->_usedBytes += bytes;
+        }
+
+        if (reserved) {
+            break;
+        }
+
+        governor->_waiting++;
+        pthread_cond_wait(&governor->_released, &governor->_mutex);
+        governor->_waiting--;
+    }
+
+    governor->_peakBytes = MAX(governor->_peakBytes, governor->_usedBytes);
+
+    pthread_mutex_unlock(&governor->_mutex);
+
+    return reserved;
+}
+
+- (void)releaseSamples:(MP42SampleBuffer * const *)samples count:(NSUInteger)count
+{
+    if (!count) {
+        return;
+    }
+
+    MP42MemoryGovernor *governor = _governor;
+    uint64_t bytes = 0, duration = 0;
+
+    for (NSUInteger i = 0; i < count; i++) {
+        bytes += samples[i]->size;
+        duration += durationOfSample(self, samples[i]);
+    }
+
+    pthread_mutex_lock(&governor->_mutex);
+
+    _count -= count;
+    _bytes -= bytes;
+    _duration -= duration;
+    governor->_usedBytes -= bytes;
+
+    if (governor->_waiting) {
+        pthread_cond_broadcast(&governor->_released);
+    }
+
+    pthread_mutex_unlock(&governor->_mutex);
+}
+
+@end
@@ -9,6 +9,7 @@
 #import "MP42MkvImporter.h"
 #import "MP42FileImporter+Private.h"
 #import "MP42SampleBuffer.h"
+#import "MP42MemoryGovernor.h"
 
 #import "MP42File.h"
 #import "MP42Languages.h"
@@ -56,6 +57,84 @@ MP42_OBJC_DIRECT_MEMBERS
 
 @end
 
+// clusters are split in ranges of about this size,
+// each one parsed on its own by one of the workers
+#define DEMUX_RANGE_SIZE (16 * 1024 * 1024)
+#define DEMUX_MAX_WORKERS 8
+
+typedef struct MatroskaRangeFrame {
+    void        *sample;    // a retained MP42SampleBuffer
+    uint32_t    track;
+    uint32_t    flags;
+    uint64_t    startTime;
+    uint64_t    endTime;
+} MatroskaRangeFrame;
+
+MP42_OBJC_DIRECT_MEMBERS
+@interface MatroskaDemuxRange : NSObject {
+@public
+    uint64_t    start, end;
+    uint64_t    bytes;      // the size in the file, charged to the memory governor while read ahead
+
+    MatroskaRangeFrame *frames;
+    NSUInteger  count, capacity;
+
+    dispatch_semaphore_t done;
+}
+- (void)releaseFrames;
+@end
+
+@implementation MatroskaDemuxRange
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        done = dispatch_semaphore_create(0);
+    }
+    return self;
+}
+
+- (void)releaseFrames
+{
+    for (NSUInteger index = 0; index < count; index += 1) {
+        if (frames[index].sample) {
+            CFRelease(frames[index].sample);
+        }
+    }
+    free(frames);
+    frames = NULL;
+    count = capacity = 0;
+}
+
+- (void)dealloc
+{
+    [self releaseFrames];
+}
+
+@end
+
+// seek indexes built for files without cues are kept in the user caches,
+// so the files are scanned for clusters only once
+static const char *matroskaIndexCacheDirectory(void)
+{
+    static NSString *path;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSFileManager *fileManager = NSFileManager.defaultManager;
+        NSURL *cachesURL = [fileManager URLForDirectory:NSCachesDirectory inDomain:NSUserDomainMask
+                                      appropriateForURL:nil create:YES error:NULL];
+        NSString *identifier = [NSBundle bundleForClass:[MP42MkvImporter class]].bundleIdentifier ?: @"MP42Foundation";
+        NSURL *url = [[cachesURL URLByAppendingPathComponent:identifier isDirectory:YES]
+                      URLByAppendingPathComponent:@"MatroskaIndex" isDirectory:YES];
+
+        if (url && [fileManager createDirectoryAtURL:url withIntermediateDirectories:YES attributes:nil error:NULL]) {
+            path = url.path;
+        }
+    });
+    return path.fileSystemRepresentation;
+}
+
 MP42_OBJC_DIRECT_MEMBERS
 @implementation MP42MkvImporter
 {
@@ -75,7 +154,7 @@ MP42_OBJC_DIRECT_MEMBERS
 {
     if ((self = [super initWithURL:fileURL])) {
         _ioStream = calloc(1, sizeof(StdIoStream));
-        _matroskaFile = openMatroskaFile(self.fileURL.fileSystemRepresentation, _ioStream);
+        _matroskaFile = openMatroskaFileMapped(self.fileURL.fileSystemRepresentation, _ioStream);
         _helpers = [NSMutableArray array];
 
         if (!_matroskaFile) {
@@ -86,6 +165,14 @@ MP42_OBJC_DIRECT_MEMBERS
             return nil;
         }
 
+        // reuse the seek index built on an earlier open
+        Cue *cues = NULL;
+        unsigned int cuesCount = 0;
+        mkv_GetCues(_matroskaFile, &cues, &cuesCount);
+        if (cuesCount == 0) {
+            loadMatroskaFileIndex(_matroskaFile, _ioStream, matroskaIndexCacheDirectory());
+        }
+
         MP42TrackId trackCount = mkv_GetNumTracks(_matroskaFile);
         NSArray<NSNumber *> *trackSizes = [self approximatedTrackDataLength];
 
@@ -553,10 +640,8 @@ MP42_OBJC_DIRECT_MEMBERS
 
     uint64_t    trackSizes[trackCount];
     uint64_t    trackTimestamp[trackCount];
-    uint64_t    StartTime, EndTime, FilePos;
-    uint32_t    Track, FrameSize, FrameFlags;
-    int64_t     FrameDiscard;
-    char        *frame;
+    uint64_t    StartTime;
+    MatroskaFrame frame;
 
     if (trackCount) {
         for (unsigned int i = 0; i < trackCount; i++) {
@@ -567,11 +652,12 @@ MP42_OBJC_DIRECT_MEMBERS
         StartTime = 0;
         int i = 0;
         while (StartTime < (segInfo->Duration / 64)) {
-            if (!mkv_ReadFrame(_matroskaFile, 0, &Track, &StartTime, &EndTime, &FilePos, &FrameSize, &frame, &FrameFlags, &FrameDiscard, NULL, NULL, NULL)) {
-                trackSizes[Track] += FrameSize;
-                trackTimestamp[Track] = StartTime;
+            if (!mkv_ReadFrameRef(_matroskaFile, 0, &frame)) {
+                StartTime = frame.StartTime;
+                trackSizes[frame.Track] += frame.Size;
+                trackTimestamp[frame.Track] = StartTime;
                 i++;
-                free(frame);
+                mkv_ReleaseFrame(_matroskaFile, &frame);
             } else {
                 break;
             }
@@ -681,20 +767,29 @@ static NSString * TrackNameToString(TrackInfo *track)
     return nil;
 }
 
+// mask every track but trackId
+static void setSingleTrackMask(MatroskaFile *matroskaFile, MP4TrackId trackId)
+{
+    unsigned int words = MKV_TRACKMASK_WORDS(mkv_GetNumTracks(matroskaFile));
+    ulonglong TrackMask[words ? words : 1];
+
+    memset(TrackMask, 0xff, sizeof(TrackMask));
+    TrackMask[trackId / 64] &= ~(1ull << (trackId % 64));
+
+    mkv_SetTrackMaskEx(matroskaFile, TrackMask);
+}
+
 - (double)matroskaTrackStartTime:(TrackInfo *)track Id:(MP4TrackId)Id
 {
-    uint64_t StartTime, EndTime, FilePos;
-    uint32_t Track, FrameSize, FrameFlags;
-    int64_t FrameDiscard;
-    char    *frame;
+    uint64_t StartTime = 0;
+    MatroskaFrame frame;
 
     // mask other tracks because we don't need them
-    unsigned long TrackMask = ~0;
-    TrackMask &= ~(1l << Id);
-
-    mkv_SetTrackMask(_matroskaFile, TrackMask);
-    mkv_ReadFrame(_matroskaFile, 0, &Track, &StartTime, &EndTime, &FilePos, &FrameSize, &frame, &FrameFlags, &FrameDiscard, NULL, NULL, NULL);
-    free(frame);
+    setSingleTrackMask(_matroskaFile, Id);
+    if (!mkv_ReadFrameRef(_matroskaFile, 0, &frame)) {
+        StartTime = frame.StartTime;
+        mkv_ReleaseFrame(_matroskaFile, &frame);
+    }
     mkv_Seek(_matroskaFile, 0, 0);
 
     TrackInfo *trackInfo = mkv_GetTrackInfo(_matroskaFile, Id);
@@ -744,25 +839,26 @@ static uint32_t timescale(TrackInfo *trackInfo)
         return magicCookie;
     }
     else if (!strcmp(trackInfo->CodecID, "A_AC3") || !strcmp(trackInfo->CodecID, "A_EAC3")) {
-        mkv_SetTrackMask(_matroskaFile, ~(1l << track.sourceId));
+        setSingleTrackMask(_matroskaFile, track.sourceId);
 
-        uint64_t    StartTime, EndTime, FilePos;
-        uint32_t    rt, FrameSize, FrameFlags;
-        int64_t     FrameDiscard;
+        MatroskaFrame frame;
+        uint32_t    FrameSize;
         char       *Frame = NULL;
         NSData     *magicCookie = nil;
 
         if (!strcmp(trackInfo->CodecID, "A_AC3")) {
             // read first header to create track
-            int firstFrame = mkv_ReadFrame(_matroskaFile, 0, &rt, &StartTime, &EndTime, &FilePos, &FrameSize, &Frame, &FrameFlags, &FrameDiscard, NULL, NULL, NULL);
+            int firstFrame = mkv_ReadFrameRef(_matroskaFile, 0, &frame);
 
             if (firstFrame != 0) {
                 mkv_Seek(_matroskaFile, 0, 0);
-                free(Frame);
                 return nil;
             }
 
-            if (copyMkvPacket(trackInfo, &Frame, &FrameSize)) {
+            Frame = (char *)copyMkvFrame(trackInfo, &frame, &FrameSize);
+            mkv_ReleaseFrame(_matroskaFile, &frame);
+
+            if (Frame) {
 
                 // parse AC3 header
                 // collect all the necessary meta information
@@ -809,17 +905,19 @@ static uint32_t timescale(TrackInfo *trackInfo)
 			struct eac3_info *context = NULL;
             SegmentInfo *segInfo = mkv_GetFileInfo(_matroskaFile);
 
-			while (!mkv_ReadFrame(_matroskaFile, 0, &rt, &StartTime, &EndTime, &FilePos, &FrameSize, &Frame, &FrameFlags, &FrameDiscard, NULL, NULL, NULL)) {
-                if (StartTime > (segInfo->Duration / 64)) {
-                    free(Frame);
+			while (!mkv_ReadFrameRef(_matroskaFile, 0, &frame)) {
+                if (frame.StartTime > (segInfo->Duration / 64)) {
+                    mkv_ReleaseFrame(_matroskaFile, &frame);
                     break;
                 }
-                if (copyMkvPacket(trackInfo, &Frame, &FrameSize)) {
+                Frame = (char *)copyMkvFrame(trackInfo, &frame, &FrameSize);
+                if (Frame) {
 #ifdef DEBUG_PARSER
-					printf("\n\nMP42MkvImporter.magicCookieForTrack Analyzing MKV EAC3 packet number %d at filepos 0x%llX (%llu) with size 0x%X (%u) bits\n", mkvpktnum++, FilePos, FilePos, FrameSize * 8, FrameSize * 8);
+					printf("\n\nMP42MkvImporter.magicCookieForTrack Analyzing MKV EAC3 packet number %d at filepos 0x%llX (%llu) with size 0x%X (%u) bits\n", mkvpktnum++, frame.FilePos, frame.FilePos, FrameSize * 8, FrameSize * 8);
 #endif
 					analyze_EAC3((void *)&context, (uint8_t *)Frame, FrameSize);
                 }
+                mkv_ReleaseFrame(_matroskaFile, &frame);
                 free(Frame);
             }
 
@@ -861,23 +959,20 @@ static uint32_t timescale(TrackInfo *trackInfo)
 	uint8_t mkvpktnum = 0;
 
 	if (!strcmp(trackInfo->CodecID, "A_EAC3")) {
-		mkv_SetTrackMask(_matroskaFile, ~(1l << track.sourceId));
+		setSingleTrackMask(_matroskaFile, track.sourceId);
 		
-		uint64_t    StartTime, EndTime, FilePos;
-		uint32_t    rt, FrameSize, FrameFlags;
-        int64_t     FrameDiscard;
-        char       *Frame = NULL;
+		MatroskaFrame frame;
 		
-		while (!mkv_ReadFrame(_matroskaFile, 0, &rt, &StartTime, &EndTime, &FilePos, &FrameSize, &Frame, &FrameFlags, &FrameDiscard, NULL, NULL, NULL)) {
+		while (!mkv_ReadFrameRef(_matroskaFile, 0, &frame)) {
             if (mkvpktnum++ > 5) {
-                free(Frame);
+                mkv_ReleaseFrame(_matroskaFile, &frame);
                 break;
             }
 #ifdef DEBUG_PARSER
-            printf("\nMP42MkvImporter.streamExtensionTypeForAudioTrack analyzing MKV EAC3 packet number %d at filepos 0x%llX (%llu) with size 0x%X (%u) bits\n", mkvpktnum++, FilePos,   FilePos, FrameSize * 8, FrameSize * 8);
+            printf("\nMP42MkvImporter.streamExtensionTypeForAudioTrack analyzing MKV EAC3 packet number %d at filepos 0x%llX (%llu) with size 0x%X (%u) bits\n", mkvpktnum++, frame.FilePos, frame.FilePos, frame.Size * 8, frame.Size * 8);
 #endif
-            analyze_EAC3((void *)&context, (uint8_t *)Frame, FrameSize); // This routine allocates buffer for context, because we're passing NULL as input!
-            free(Frame);
+            analyze_EAC3((void *)&context, (uint8_t *)frame.Data, frame.Size); // This routine allocates buffer for context, because we're passing NULL as input!
+            mkv_ReleaseFrame(_matroskaFile, &frame);
 		}
 	}
 
@@ -961,12 +1056,15 @@ static uint32_t timescale(TrackInfo *trackInfo)
 {
     @autoreleasepool {
 
-        unsigned long TrackMask = ~0;
+        unsigned int mkvTracksNumber = mkv_GetNumTracks(_matroskaFile);
+        unsigned int maskWords = MKV_TRACKMASK_WORDS(mkvTracksNumber);
+        ulonglong TrackMask[maskWords ? maskWords : 1];
+        memset(TrackMask, 0xff, sizeof(TrackMask));
 
         NSArray<MP42Track *> *inputTracks = self.inputTracks;
 
         NSUInteger tracksNumber = inputTracks.count;
-        MatroskaDemuxHelper *helpers[self.tracks.count];
+        MatroskaDemuxHelper *helpers[mkvTracksNumber ? mkvTracksNumber : 1];
 
         for (NSUInteger index = 0; index < tracksNumber; index += 1) {
             MP42Track *track = inputTracks[index];
@@ -979,229 +1077,47 @@ static uint32_t timescale(TrackInfo *trackInfo)
             helpers[track.sourceId] = demuxHelper;
             [_helpers addObject:demuxHelper];
 
-            TrackMask &= ~(1l << track.sourceId);
+            TrackMask[track.sourceId / 64] &= ~(1ull << (track.sourceId % 64));
         }
 
         // mask other tracks because we don't need them
-        mkv_SetTrackMask(_matroskaFile, TrackMask);
+        mkv_SetTrackMaskEx(_matroskaFile, TrackMask);
 
-        uint64_t    StartTime, EndTime, FilePos;
-        uint32_t    Track, FrameSize, FrameFlags;
-        int64_t     FrameDiscard;
-        char       *Frame = NULL;
+        NSArray<MatroskaDemuxRange *> *ranges = [self clusterRanges];
 
-        MP42SampleBuffer *frameSample = nil, *currentSample = nil;
-        int64_t     duration, next_duration;
+        if (!ranges || ![self demuxRanges:ranges trackMask:TrackMask helpers:helpers]) {
+            // from here on clusters are read in file order,
+            // fetch the next ones while the current one is parsed
+            setMatroskaFileAccessPattern(_ioStream, MatroskaAccessSequential);
+            startMatroskaFilePrefetch(_matroskaFile, _ioStream);
 
-        while (!mkv_ReadFrame(_matroskaFile, 0, &Track, &StartTime, &EndTime, &FilePos, &FrameSize, &Frame, &FrameFlags, &FrameDiscard, NULL, NULL, NULL)) {
+            MatroskaFrame frame;
 
-            if (self.cancelled) {
-                free(Frame);
-                break;
-            }
-
-            self.progress = (StartTime / _fileDuration / 10000);
-
-            MatroskaDemuxHelper *demuxHelper = helpers[Track];
-            TrackInfo *trackInfo = demuxHelper->trackInfo;
-
-            if (StartTime < demuxHelper->startTime) {
-                demuxHelper->startTime = StartTime;
-            }
-
-            if (trackInfo->Type == TT_AUDIO) {
-
-                if (copyMkvPacket(trackInfo, &Frame, &FrameSize)) {
-
-                    MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
-                    sample->data = Frame;
-                    sample->size = FrameSize;
-                    sample->timescale = demuxHelper->timescale;
-                    sample->duration = MP4_INVALID_DURATION;
-                    sample->decodeTimestamp = StartTime;
-                    sample->flags = MP42SampleBufferFlagIsSync;
-                    sample->trackId = demuxHelper->sourceID;
-
-#define VARIABLE_AUDIO_RATE 1
+            while (!mkv_ReadFrameRef(_matroskaFile, 0, &frame)) {
 
-#ifdef VARIABLE_AUDIO_RATE
-                    double scaledStartTime = sample->decodeTimestamp * (double)mkv_TruncFloat(trackInfo->AV.Audio.SamplingFreq) / 1000000000.f;
-
-                    if (demuxHelper->previousSample) {
-                        uint64_t sampleDuration = scaledStartTime - demuxHelper->currentTime;
-
-                        // MKV timestamps are a bit random, try to round them
-                        // to make the sample table in the mp4 smaller.
-
-                        // Round ac3
-                        if (sampleDuration < 550 && sampleDuration > 480) {
-                            sampleDuration = 512;
-                        }
-
-                        // Round aac
-                        if (sampleDuration < 1060 && sampleDuration > 990) {
-                            sampleDuration = 1024;
-                        }
-
-                        // Round ac3
-                        if (sampleDuration < 1576 && sampleDuration > 1500) {
-                            sampleDuration = 1536;
-                        }
-
-                        demuxHelper->previousSample->duration = sampleDuration;
-                        [self enqueue:demuxHelper->previousSample];
-
-                        demuxHelper->currentTime += sampleDuration;
-                    } else {
-                        demuxHelper->currentTime = scaledStartTime;
-                    }
-
-                    demuxHelper->previousSample = sample;
-#else
-                    [self enqueue:sample];
-#endif
-                    demuxHelper->samplesWritten++;
+                if (self.cancelled) {
+                    mkv_ReleaseFrame(_matroskaFile, &frame);
+                    break;
                 }
-            }
 
-            if (trackInfo->Type == TT_SUB) {
-                if (copyMkvPacket(trackInfo, &Frame, &FrameSize)) {
-                    if (strcmp(trackInfo->CodecID, "S_VOBSUB") && strcmp(trackInfo->CodecID, "S_HDMV/PGS")) {
+                self.progress = (frame.StartTime / _fileDuration / 10000);
 
-                        MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
-                        sample->data = Frame;
-                        sample->size = FrameSize;
-                        sample->timescale = demuxHelper->timescale;
-                        sample->duration = EndTime / SCALE_FACTOR - StartTime / SCALE_FACTOR;
-                        sample->decodeTimestamp = StartTime / SCALE_FACTOR;
-                        sample->flags = MP42SampleBufferFlagIsSync;
-                        sample->trackId = demuxHelper->sourceID;
+                MatroskaDemuxHelper *demuxHelper = helpers[frame.Track];
 
-                        demuxHelper->samplesWritten++;
-                        [self enqueue:sample];
+                // the only copy of the payload, straight from the parser view
+                MP42SampleBuffer *sample = [self newSampleWithFrame:&frame trackInfo:demuxHelper->trackInfo];
+                mkv_ReleaseFrame(_matroskaFile, &frame);
 
-                    } else {
-                        MP42SampleBuffer *nextSample = [[MP42SampleBuffer alloc] init];
-                        nextSample->data = Frame;
-                        nextSample->size = FrameSize;
-                        nextSample->timescale = demuxHelper->timescale;
-                        nextSample->decodeTimestamp = StartTime;
-                        nextSample->flags = MP42SampleBufferFlagIsSync;
-                        nextSample->trackId = demuxHelper->sourceID;
-
-                        // PGS are usually stored with just the start time, and blank samples to fill the gaps
-                        if (!strcmp(trackInfo->CodecID, "S_HDMV/PGS")) {
-                            if (!demuxHelper->previousSample) {
-                                demuxHelper->previousSample = [[MP42SampleBuffer alloc] init];
-                                demuxHelper->previousSample->timescale = demuxHelper->timescale;
-                                demuxHelper->previousSample->duration = StartTime / SCALE_FACTOR;
-                                demuxHelper->previousSample->offset = 0;
-                                demuxHelper->previousSample->decodeTimestamp = StartTime;
-                                demuxHelper->previousSample->flags = MP42SampleBufferFlagIsSync;
-                                demuxHelper->previousSample->trackId = demuxHelper->sourceID;
-                            } else {
-                                if (nextSample->decodeTimestamp < demuxHelper->previousSample->decodeTimestamp) {
-                                    // Out of order samples? swap the next with the previous
-                                    MP42SampleBuffer *temp = nextSample;
-                                    nextSample = demuxHelper->previousSample;
-                                    demuxHelper->previousSample = temp;
-                                }
-
-                                demuxHelper->previousSample->duration = (nextSample->decodeTimestamp - demuxHelper->previousSample->decodeTimestamp) / SCALE_FACTOR;
-                            }
-
-                            demuxHelper->samplesWritten++;
-                            [self enqueue:demuxHelper->previousSample];
-
-                            demuxHelper->previousSample = nextSample;
-
-                        } else if (!strcmp(trackInfo->CodecID, "S_VOBSUB")) {
-                            // VobSub seems to have an end duration, and no blank samples, so create a new one each time to fill the gaps
-                            if (StartTime > demuxHelper->currentTime) {
-                                MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
-                                sample->data = calloc(1, 2);
-                                sample->size = 2;
-                                sample->timescale = demuxHelper->timescale;
-                                sample->duration = (StartTime - demuxHelper->currentTime) / SCALE_FACTOR;
-                                sample->flags = MP42SampleBufferFlagIsSync;
-                                sample->trackId = demuxHelper->sourceID;
-
-                                [self enqueue:sample];
-                            }
-
-                            nextSample->duration = (EndTime - StartTime) / SCALE_FACTOR;
-
-                            [self enqueue:nextSample];
-
-                            demuxHelper->currentTime = EndTime;
-                        }
-                    }
-                }
+                [self demuxSample:sample startTime:frame.StartTime endTime:frame.EndTime
+                            flags:frame.Flags helper:demuxHelper];
             }
 
-            else if (trackInfo->Type == TT_VIDEO) {
-
-                copyMkvPacket(trackInfo, &Frame, &FrameSize);
-
-                // read frames from file
-                frameSample = [[MP42SampleBuffer alloc] init];
-                frameSample->data = Frame;
-                frameSample->size = FrameSize;
-                frameSample->timescale = demuxHelper->timescale;
-                frameSample->decodeTimestamp = StartTime;
-                frameSample->presentationOutputTimestamp = EndTime;
-                frameSample->flags = (FrameFlags & FRAME_KF) ? MP42SampleBufferFlagIsSync : 0;
-                frameSample->trackId = demuxHelper->sourceID;
-                [demuxHelper->queue addObject:frameSample];
-
-                if (demuxHelper->queue.count < BUFFER_SIZE) {
-                    continue;
-                } else {
-                    currentSample = [demuxHelper->queue objectAtIndex:demuxHelper->buffer];
-
-                    // Matroska stores only the start and end time in decode order, so we need to recreate
-                    // the frame duration and the offset from the start time, the end time is useless
-                    // duration calculation
-                    duration = demuxHelper->queue.lastObject->decodeTimestamp - currentSample->decodeTimestamp;
-
-                    for (MP42SampleBuffer *sample in demuxHelper->queue) {
-                        if (sample != currentSample && (sample->decodeTimestamp >= currentSample->decodeTimestamp)) {
-                            if ((next_duration = (sample->decodeTimestamp - currentSample->decodeTimestamp)) < duration) {
-                                duration = next_duration;
-                            }
-                        }
-                    }
-
-                    if (duration == 0) {
-                        duration = 10000;
-                    }
-
-                    // offset calculation
-                    int64_t offset = currentSample->decodeTimestamp / 10000.0f - demuxHelper->currentTime / 10000.0f;
-
-                    demuxHelper->currentTime += duration;
-
-                    currentSample->duration = duration / 10000.0f;
-                    currentSample->offset = offset;
-
-                    // save the minimum offset, used later to keep all the offset values positive
-                    if (currentSample->offset < demuxHelper->minDisplayOffset) {
-                        demuxHelper->minDisplayOffset = currentSample->offset;
-                    }
-
-                    if (demuxHelper->buffer >= BUFFER_SIZE) {
-                        [demuxHelper->queue removeObjectAtIndex:0];
-                    }
-                    if (demuxHelper->buffer < BUFFER_SIZE) {
-                        demuxHelper->buffer++;
-                    }
-
-                    demuxHelper->samplesWritten++;
-                    [self enqueue:currentSample];
-                }
-            }
+            stopMatroskaFilePrefetch(_ioStream);
         }
 
+        MP42SampleBuffer *frameSample = nil, *currentSample = nil;
+        int64_t     duration, next_duration;
+
         for (MatroskaDemuxHelper *demuxHelper in _helpers) {
             TrackInfo *trackInfo = demuxHelper->trackInfo;
 
@@ -1248,12 +1164,14 @@ static uint32_t timescale(TrackInfo *trackInfo)
                         demuxHelper->minDisplayOffset = currentSample->offset;
                     }
 
+                    [demuxHelper->queue replaceObjectAtIndex:demuxHelper->buffer withObject:timestampsOfSample(currentSample)];
+
                     if (demuxHelper->buffer >= BUFFER_SIZE) {
                         [demuxHelper->queue removeObjectAtIndex:0];
                     }
 
                     demuxHelper->samplesWritten++;
-                    [self enqueue:currentSample];
+                    [self batchSample:currentSample];
 
                     demuxHelper->bufferFlush++;
                     if (demuxHelper->bufferFlush >= BUFFER_SIZE - 1) {
@@ -1267,7 +1185,7 @@ static uint32_t timescale(TrackInfo *trackInfo)
                     demuxHelper->previousSample->duration = 100;
                 }
 
-                [self enqueue:demuxHelper->previousSample];
+                [self batchSample:demuxHelper->previousSample];
                 demuxHelper->previousSample = nil;
             }
         }
@@ -1276,6 +1194,459 @@ static uint32_t timescale(TrackInfo *trackInfo)
     }
 }
 
+/**
+ *  Copies the frame payload into a sample from the muxer pool,
+ *  restoring the header stripped bytes and decompressing it if needed.
+ */
+- (nullable MP42SampleBuffer *)newSampleWithFrame:(const MatroskaFrame *)frame trackInfo:(TrackInfo *)trackInfo
+{
+    if (trackInfo->CompEnabled && (trackInfo->CompMethod == COMP_ZLIB || trackInfo->CompMethod == COMP_BZIP)) {
+        // the decompressed size isn't known in advance
+        uint32_t size = 0;
+        void *data = copyMkvFrame(trackInfo, frame, &size);
+
+        if (data == NULL) {
+            return nil;
+        }
+
+        MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
+        sample->data = data;
+        sample->size = size;
+        return sample;
+    }
+
+    uint32_t prefixSize = trackInfo->CompMethodPrivateSize;
+    MP42SampleBuffer *sample = [self newSampleWithSize:frame->Size + prefixSize];
+
+    if (prefixSize) {
+        memcpy(sample->data, trackInfo->CompMethodPrivate, prefixSize);
+    }
+    memcpy((uint8_t *)sample->data + prefixSize, frame->Data, frame->Size);
+
+    return sample;
+}
+
+/**
+ *  A pooled sample could be recycled once enqueued, the video reorder
+ *  queue keeps only its timestamps from then on.
+ */
+static MP42SampleBuffer *timestampsOfSample(MP42SampleBuffer *sample)
+{
+    if (sample->capacity == 0) {
+        return sample;
+    }
+
+    MP42SampleBuffer *timestamps = [[MP42SampleBuffer alloc] init];
+    timestamps->decodeTimestamp = sample->decodeTimestamp;
+    timestamps->presentationOutputTimestamp = sample->presentationOutputTimestamp;
+    return timestamps;
+}
+
+- (void)demuxSample:(nullable MP42SampleBuffer *)sample startTime:(uint64_t)StartTime endTime:(uint64_t)EndTime
+              flags:(unsigned int)FrameFlags helper:(MatroskaDemuxHelper *)demuxHelper
+{
+    TrackInfo *trackInfo = demuxHelper->trackInfo;
+
+    if (StartTime < demuxHelper->startTime) {
+        demuxHelper->startTime = StartTime;
+    }
+
+    if (trackInfo->Type == TT_AUDIO) {
+
+        if (sample) {
+
+            sample->timescale = demuxHelper->timescale;
+            sample->duration = MP4_INVALID_DURATION;
+            sample->decodeTimestamp = StartTime;
+            sample->flags = MP42SampleBufferFlagIsSync;
+            sample->trackId = demuxHelper->sourceID;
+
+#define VARIABLE_AUDIO_RATE 1
+
+#ifdef VARIABLE_AUDIO_RATE
+            double scaledStartTime = sample->decodeTimestamp * (double)mkv_TruncFloat(trackInfo->AV.Audio.SamplingFreq) / 1000000000.f;
+
+            if (demuxHelper->previousSample) {
+                uint64_t sampleDuration = scaledStartTime - demuxHelper->currentTime;
+
+                // MKV timestamps are a bit random, try to round them
+                // to make the sample table in the mp4 smaller.
+
+                // Round ac3
+                if (sampleDuration < 550 && sampleDuration > 480) {
+                    sampleDuration = 512;
+                }
+
+                // Round aac
+                if (sampleDuration < 1060 && sampleDuration > 990) {
+                    sampleDuration = 1024;
+                }
+
+                // Round ac3
+                if (sampleDuration < 1576 && sampleDuration > 1500) {
+                    sampleDuration = 1536;
+                }
+
+                demuxHelper->previousSample->duration = sampleDuration;
+                [self batchSample:demuxHelper->previousSample];
+
+                demuxHelper->currentTime += sampleDuration;
+            } else {
+                demuxHelper->currentTime = scaledStartTime;
+            }
+
+            demuxHelper->previousSample = sample;
+#else
+            [self batchSample:sample];
+#endif
+            demuxHelper->samplesWritten++;
+        }
+    }
+
+    if (trackInfo->Type == TT_SUB) {
+        if (sample) {
+            if (strcmp(trackInfo->CodecID, "S_VOBSUB") && strcmp(trackInfo->CodecID, "S_HDMV/PGS")) {
+
+                sample->timescale = demuxHelper->timescale;
+                sample->duration = EndTime / SCALE_FACTOR - StartTime / SCALE_FACTOR;
+                sample->decodeTimestamp = StartTime / SCALE_FACTOR;
+                sample->flags = MP42SampleBufferFlagIsSync;
+                sample->trackId = demuxHelper->sourceID;
+
+                demuxHelper->samplesWritten++;
+                [self batchSample:sample];
+
+            } else {
+                MP42SampleBuffer *nextSample = sample;
+                nextSample->timescale = demuxHelper->timescale;
+                nextSample->decodeTimestamp = StartTime;
+                nextSample->flags = MP42SampleBufferFlagIsSync;
+                nextSample->trackId = demuxHelper->sourceID;
+
+                // PGS are usually stored with just the start time, and blank samples to fill the gaps
+                if (!strcmp(trackInfo->CodecID, "S_HDMV/PGS")) {
+                    if (!demuxHelper->previousSample) {
+                        demuxHelper->previousSample = [[MP42SampleBuffer alloc] init];
+                        demuxHelper->previousSample->timescale = demuxHelper->timescale;
+                        demuxHelper->previousSample->duration = StartTime / SCALE_FACTOR;
+                        demuxHelper->previousSample->offset = 0;
+                        demuxHelper->previousSample->decodeTimestamp = StartTime;
+                        demuxHelper->previousSample->flags = MP42SampleBufferFlagIsSync;
+                        demuxHelper->previousSample->trackId = demuxHelper->sourceID;
+                    } else {
+                        if (nextSample->decodeTimestamp < demuxHelper->previousSample->decodeTimestamp) {
+                            // Out of order samples? swap the next with the previous
+                            MP42SampleBuffer *temp = nextSample;
+                            nextSample = demuxHelper->previousSample;
+                            demuxHelper->previousSample = temp;
+                        }
+
+                        demuxHelper->previousSample->duration = (nextSample->decodeTimestamp - demuxHelper->previousSample->decodeTimestamp) / SCALE_FACTOR;
+                    }
+
+                    demuxHelper->samplesWritten++;
+                    [self batchSample:demuxHelper->previousSample];
+
+                    demuxHelper->previousSample = nextSample;
+
+                } else if (!strcmp(trackInfo->CodecID, "S_VOBSUB")) {
+                    // VobSub seems to have an end duration, and no blank samples, so create a new one each time to fill the gaps
+                    if (StartTime > demuxHelper->currentTime) {
+                        MP42SampleBuffer *blankSample = [[MP42SampleBuffer alloc] init];
+                        blankSample->data = calloc(1, 2);
+                        blankSample->size = 2;
+                        blankSample->timescale = demuxHelper->timescale;
+                        blankSample->duration = (StartTime - demuxHelper->currentTime) / SCALE_FACTOR;
+                        blankSample->flags = MP42SampleBufferFlagIsSync;
+                        blankSample->trackId = demuxHelper->sourceID;
+
+                        [self batchSample:blankSample];
+                    }
+
+                    nextSample->duration = (EndTime - StartTime) / SCALE_FACTOR;
+
+                    [self batchSample:nextSample];
+
+                    demuxHelper->currentTime = EndTime;
+                }
+            }
+        }
+    }
+
+    else if (trackInfo->Type == TT_VIDEO) {
+
+        // read frames from file
+        MP42SampleBuffer *frameSample = sample ?: [[MP42SampleBuffer alloc] init];
+        frameSample->timescale = demuxHelper->timescale;
+        frameSample->decodeTimestamp = StartTime;
+        frameSample->presentationOutputTimestamp = EndTime;
+        frameSample->flags = (FrameFlags & FRAME_KF) ? MP42SampleBufferFlagIsSync : 0;
+        frameSample->trackId = demuxHelper->sourceID;
+        [demuxHelper->queue addObject:frameSample];
+
+        if (demuxHelper->queue.count < BUFFER_SIZE) {
+            return;
+        } else {
+            MP42SampleBuffer *currentSample = [demuxHelper->queue objectAtIndex:demuxHelper->buffer];
+            int64_t duration, next_duration;
+
+            // Matroska stores only the start and end time in decode order, so we need to recreate
+            // the frame duration and the offset from the start time, the end time is useless
+            // duration calculation
+            duration = demuxHelper->queue.lastObject->decodeTimestamp - currentSample->decodeTimestamp;
+
+            for (MP42SampleBuffer *sample in demuxHelper->queue) {
+                if (sample != currentSample && (sample->decodeTimestamp >= currentSample->decodeTimestamp)) {
+                    if ((next_duration = (sample->decodeTimestamp - currentSample->decodeTimestamp)) < duration) {
+                        duration = next_duration;
+                    }
+                }
+            }
+
+            if (duration == 0) {
+                duration = 10000;
+            }
+
+            // offset calculation
+            int64_t offset = currentSample->decodeTimestamp / 10000.0f - demuxHelper->currentTime / 10000.0f;
+
+            demuxHelper->currentTime += duration;
+
+            currentSample->duration = duration / 10000.0f;
+            currentSample->offset = offset;
+
+            // save the minimum offset, used later to keep all the offset values positive
+            if (currentSample->offset < demuxHelper->minDisplayOffset) {
+                demuxHelper->minDisplayOffset = currentSample->offset;
+            }
+
+            [demuxHelper->queue replaceObjectAtIndex:demuxHelper->buffer withObject:timestampsOfSample(currentSample)];
+
+            if (demuxHelper->buffer >= BUFFER_SIZE) {
+                [demuxHelper->queue removeObjectAtIndex:0];
+            }
+            if (demuxHelper->buffer < BUFFER_SIZE) {
+                demuxHelper->buffer++;
+            }
+
+            demuxHelper->samplesWritten++;
+            [self batchSample:currentSample];
+        }
+    }
+}
+
+#pragma mark - Parallel demux
+
+static int compareClusterPositions(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static BOOL isClusterAt(struct StdIoStream *ioStream, uint64_t position)
+{
+    uint8_t clusterID[4], *data = clusterID;
+
+    return readData(ioStream, position, &data, sizeof(clusterID)) &&
+           clusterID[0] == 0x1F && clusterID[1] == 0x43 && clusterID[2] == 0xB6 && clusterID[3] == 0x75;
+}
+
+- (nullable NSArray<MatroskaDemuxRange *> *)clusterRanges
+{
+    if (NSProcessInfo.processInfo.activeProcessorCount < 2) {
+        return nil;
+    }
+
+    // cues are the only cheap way to find cluster starts,
+    // files without them are indexed once and the index is cached
+    Cue *cues = NULL;
+    unsigned int cuesCount = 0;
+    mkv_GetCues(_matroskaFile, &cues, &cuesCount);
+
+    if (cuesCount == 0 && mkv_BuildCues(_matroskaFile)) {
+        saveMatroskaFileIndex(_matroskaFile, _ioStream, matroskaIndexCacheDirectory());
+        mkv_GetCues(_matroskaFile, &cues, &cuesCount);
+    }
+
+    if (cuesCount < 2) {
+        return nil;
+    }
+
+    uint64_t segmentBase = mkv_GetSegmentBase(_matroskaFile);
+    uint64_t segmentTop = mkv_GetSegmentTop(_matroskaFile);
+    uint64_t *positions = malloc(sizeof(uint64_t) * cuesCount);
+    unsigned int positionsCount = 0;
+
+    for (unsigned int index = 0; index < cuesCount; index += 1) {
+        uint64_t position = segmentBase + cues[index].Position;
+        if (position < segmentTop) {
+            positions[positionsCount++] = position;
+        }
+    }
+
+    qsort(positions, positionsCount, sizeof(uint64_t), compareClusterPositions);
+
+    NSMutableArray<MatroskaDemuxRange *> *ranges = [NSMutableArray array];
+
+    // the first range starts wherever a newly opened parser does,
+    // so blocks before the first cue point are not lost
+    MatroskaDemuxRange *range = [[MatroskaDemuxRange alloc] init];
+    uint64_t rangeStart = positionsCount ? positions[0] : 0;
+    [ranges addObject:range];
+
+    for (unsigned int index = 1; index < positionsCount; index += 1) {
+        if (positions[index] - rangeStart >= DEMUX_RANGE_SIZE) {
+            rangeStart = positions[index];
+            range->end = rangeStart;
+
+            range = [[MatroskaDemuxRange alloc] init];
+            range->start = rangeStart;
+            [ranges addObject:range];
+        }
+    }
+
+    free(positions);
+
+    if (ranges.count < 2) {
+        return nil;
+    }
+
+    // a cue that doesn't point to a cluster, from a broken file or a stale index,
+    // would make a worker parse garbage, the file is then read sequentially
+    for (MatroskaDemuxRange *clusterRange in ranges) {
+        if (clusterRange->start && !isClusterAt(_ioStream, clusterRange->start)) {
+            return nil;
+        }
+
+        uint64_t rangeEnd = clusterRange->end ? clusterRange->end : segmentTop;
+        uint64_t rangeBegin = clusterRange->start ? clusterRange->start : segmentBase;
+        clusterRange->bytes = rangeEnd > rangeBegin ? rangeEnd - rangeBegin : 0;
+    }
+
+    return ranges;
+}
+
+- (void)readRange:(MatroskaDemuxRange *)range matroskaFile:(MatroskaFile *)matroskaFile
+{
+    MatroskaFrame frame;
+
+    mkv_SetReadRange(matroskaFile, range->start, range->end);
+
+    while (!mkv_ReadFrameRef(matroskaFile, 0, &frame)) {
+        if (range->count == range->capacity) {
+            range->capacity = range->capacity ? range->capacity * 2 : 1024;
+            range->frames = realloc(range->frames, range->capacity * sizeof(MatroskaRangeFrame));
+        }
+
+        MatroskaRangeFrame *rangeFrame = &range->frames[range->count++];
+        rangeFrame->sample = (void *)CFBridgingRetain([self newSampleWithFrame:&frame trackInfo:mkv_GetTrackInfo(matroskaFile, frame.Track)]);
+        rangeFrame->track = frame.Track;
+        rangeFrame->flags = frame.Flags;
+        rangeFrame->startTime = frame.StartTime;
+        rangeFrame->endTime = frame.EndTime;
+
+        mkv_ReleaseFrame(matroskaFile, &frame);
+    }
+}
+
+- (BOOL)demuxRanges:(NSArray<MatroskaDemuxRange *> *)ranges trackMask:(const ulonglong *)TrackMask
+            helpers:(MatroskaDemuxHelper * __strong *)helpers
+{
+    NSUInteger workersCount = MIN(NSProcessInfo.processInfo.activeProcessorCount, DEMUX_MAX_WORKERS);
+    NSUInteger rangesCount = ranges.count;
+    const char *path = self.fileURL.fileSystemRepresentation;
+
+    // each worker reads its ranges with its own parser and its own view of the file
+    StdIoStream **ioStreams = calloc(workersCount, sizeof(StdIoStream *));
+    MatroskaFile **matroskaFiles = calloc(workersCount, sizeof(MatroskaFile *));
+
+    dispatch_apply(workersCount, dispatch_get_global_queue(0, 0), ^(size_t index) {
+        ioStreams[index] = calloc(1, sizeof(StdIoStream));
+        matroskaFiles[index] = openMatroskaFileMapped(path, ioStreams[index]);
+        if (matroskaFiles[index]) {
+            mkv_SetTrackMaskEx(matroskaFiles[index], TrackMask);
+            setMatroskaFileAccessPattern(ioStreams[index], MatroskaAccessSequential);
+        }
+    });
+
+    BOOL opened = YES;
+    for (NSUInteger index = 0; index < workersCount; index += 1) {
+        opened &= matroskaFiles[index] != NULL;
+    }
+
+    if (opened) {
+        NSMutableArray<dispatch_queue_t> *queues = [NSMutableArray array];
+        for (NSUInteger index = 0; index < workersCount; index += 1) {
+            [queues addObject:dispatch_queue_create("org.subler.mkvdemux", DISPATCH_QUEUE_SERIAL)];
+        }
+
+        dispatch_group_t group = dispatch_group_create();
+        MP42MemoryGovernor *governor = self.memoryGovernor;
+        uint64_t reservedBytes = 0;
+        NSUInteger dispatched = 0;
+
+        for (NSUInteger index = 0; index < rangesCount && !self.cancelled; index += 1) {
+            // ranges are handed out round robin, so every worker reads its ranges in file order,
+            // and only a few are parsed ahead of the one being demuxed to bound the memory use,
+            // as long as they fit in the memory budget of the write with the queued samples
+            for (; dispatched < rangesCount && dispatched < index + workersCount * 2; dispatched += 1) {
+                MatroskaDemuxRange *range = ranges[dispatched];
+
+                // the next range to demux is read anyway
+                if (governor && ![governor reserveBytes:range->bytes required:dispatched == index]) {
+                    break;
+                }
+                reservedBytes += range->bytes;
+
+                MatroskaFile *matroskaFile = matroskaFiles[dispatched % workersCount];
+
+                dispatch_group_async(group, queues[dispatched % workersCount], ^{
+                    if (!self.cancelled) {
+                        [self readRange:range matroskaFile:matroskaFile];
+                    }
+                    dispatch_semaphore_signal(range->done);
+                });
+            }
+
+            MatroskaDemuxRange *range = ranges[index];
+            dispatch_semaphore_wait(range->done, DISPATCH_TIME_FOREVER);
+
+            // from here on its frames are charged by the tracks queues
+            [governor releaseBytes:range->bytes];
+            reservedBytes -= range->bytes;
+
+            // frames are handed over in the same order a single parser would return them
+            for (NSUInteger frameIndex = 0; frameIndex < range->count && !self.cancelled; frameIndex += 1) {
+                MatroskaRangeFrame *frame = &range->frames[frameIndex];
+
+                self.progress = (frame->startTime / _fileDuration / 10000);
+
+                MP42SampleBuffer *sample = CFBridgingRelease(frame->sample);
+                frame->sample = NULL;
+
+                [self demuxSample:sample startTime:frame->startTime endTime:frame->endTime
+                            flags:frame->flags helper:helpers[frame->track]];
+            }
+
+            [range releaseFrames];
+        }
+
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+        // the ranges read ahead of a cancelled demux
+        [governor releaseBytes:reservedBytes];
+    }
+
+    for (NSUInteger index = 0; index < workersCount; index += 1) {
+        closeMatroskaFile(matroskaFiles[index], ioStreams[index]);
+    }
+
+    free(matroskaFiles);
+    free(ioStreams);
+
+    return opened;
+}
+
 - (MatroskaDemuxHelper *)helperWithTrackID:(MP4TrackId)trackID
 {
     for (MatroskaDemuxHelper *helper in _helpers) {
@@ -1378,61 +1749,50 @@ static int readData(struct StdIoStream  *ioStream, uint64_t pos, uint8_t **data,
     return 1;
 }
 
-static int copyMkvPacket(TrackInfo *trackInfo, char **Frame, uint32_t *FrameSize)
+// Copies the frame payload into a new malloc'd buffer,
+// restoring the header stripped bytes and decompressing it if needed.
+static uint8_t *copyMkvFrame(TrackInfo *trackInfo, const MatroskaFrame *frame, uint32_t *FrameSize)
 {
-    uint8_t *packet = NULL;
-    uint32_t iSize = *FrameSize;
+    uint32_t iSize = frame->Size + trackInfo->CompMethodPrivateSize;
+    uint8_t *packet = malloc(iSize ? iSize : 1);
 
-    if (trackInfo->CompMethodPrivateSize || trackInfo->CompEnabled) {
-        if (trackInfo->CompMethodPrivateSize != 0) {
-            packet = malloc(iSize + trackInfo->CompMethodPrivateSize);
-            memcpy(packet, trackInfo->CompMethodPrivate, trackInfo->CompMethodPrivateSize);
-        } else {
-            packet = malloc(iSize);
-        }
-
-        if (packet == NULL) {
-            fprintf(stderr,"Out of memory\n");
-            free(*Frame);
-            return 0;
-        }
-
-        memcpy(packet + trackInfo->CompMethodPrivateSize, *Frame, iSize);
-        iSize += trackInfo->CompMethodPrivateSize;
-
-        free(*Frame);
+    if (packet == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        return NULL;
+    }
 
-        if (trackInfo->CompEnabled) {
-            switch (trackInfo->CompMethod) {
-                case COMP_ZLIB:
-                    if (!DecompressZlib(&packet, &iSize)) {
-                        free(packet);
-                        return 0;
-                    }
-                    break;
+    if (trackInfo->CompMethodPrivateSize != 0) {
+        memcpy(packet, trackInfo->CompMethodPrivate, trackInfo->CompMethodPrivateSize);
+    }
+    memcpy(packet + trackInfo->CompMethodPrivateSize, frame->Data, frame->Size);
+
+    if (trackInfo->CompEnabled) {
+        switch (trackInfo->CompMethod) {
+            case COMP_ZLIB:
+                if (!DecompressZlib(&packet, &iSize)) {
+                    free(packet);
+                    return NULL;
+                }
+                break;
 
-                case COMP_BZIP:
-                    if (!DecompressBzlib(&packet, &iSize)) {
-                        free(packet);
-                        return 0;
-                    }
-                    break;
+            case COMP_BZIP:
+                if (!DecompressBzlib(&packet, &iSize)) {
+                    free(packet);
+                    return NULL;
+                }
+                break;
 
-                    // Not Implemented yet
-                case COMP_LZO1X:
-                    break;
+                // Not Implemented yet
+            case COMP_LZO1X:
+                break;
 
-                default:
-                    break;
-            }
+            default:
+                break;
         }
-
-        *Frame = (char *)packet;
-        *FrameSize = iSize;
-        return 1;
-    } else {
-        return 1;
     }
+
+    *FrameSize = iSize;
+    return packet;
 }
 
 
@@ -346,6 +346,9 @@ typedef struct MP4DemuxHelper {
             helpers[index] = demuxHelper;
         }
 
+        MP42SampleBuffer *samples[64];
+        NSUInteger count = 0;
+
         MP4Timestamp currentTime = 1;
         MP4Duration totalDuration = MP4GetDuration(_fileHandle);
         MP4Duration timescale = MP4GetTimeScale(_fileHandle);
@@ -363,8 +366,6 @@ typedef struct MP4DemuxHelper {
                 }
 
                 while (demuxHelper->currentTime < demuxHelper->timeScale * currentTime && !demuxHelper->done) {
-                    uint8_t *pBytes = NULL;
-                    uint32_t numBytes = 0;
                     MP4Duration duration;
                     MP4Duration renderingOffset;
                     MP4Timestamp pStartTime;
@@ -379,6 +380,11 @@ typedef struct MP4DemuxHelper {
                         break;
                     }
 
+                    // Read straight into the sample buffer
+                    uint32_t numBytes = MP4GetSampleSize(_fileHandle, demuxHelper->sourceID, demuxHelper->currentSampleId);
+                    MP42SampleBuffer *sample = [self newSampleWithSize:numBytes];
+                    uint8_t *pBytes = sample->data;
+
                     if (!MP4ReadSampleSampleDependency(_fileHandle,
                                        demuxHelper->sourceID,
                                        demuxHelper->currentSampleId,
@@ -390,8 +396,6 @@ typedef struct MP4DemuxHelper {
                         break;
                     }
 
-                    MP42SampleBuffer *sample = [[MP42SampleBuffer alloc] init];
-                    sample->data = pBytes;
                     sample->size = numBytes;
                     sample->timescale = demuxHelper->timeScale;
                     sample->duration = duration;
@@ -402,8 +406,16 @@ typedef struct MP4DemuxHelper {
                     if (hasDependencyFlags) {
                         sample->dependecyFlags = dependencyFlags;
                     }
-                    
-                    [self enqueue:sample];
+
+                    samples[count++] = sample;
+                    if (count == 64) {
+                        [self enqueueSamples:samples count:count];
+                        // the muxer could recycle them, don't keep them alive
+                        for (NSUInteger i = 0; i < count; i++) {
+                            samples[i] = nil;
+                        }
+                        count = 0;
+                    }
 
                     demuxHelper->currentTime = pStartTime;
                 }
@@ -413,6 +425,11 @@ typedef struct MP4DemuxHelper {
             currentTime += 3;
         }
 
+        [self enqueueSamples:samples count:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            samples[i] = nil;
+        }
+
         [self setDone];
 
         for (NSUInteger index = 0; index < tracksNumber; index += 1) {
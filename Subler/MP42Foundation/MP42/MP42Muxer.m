@@ -21,9 +21,24 @@
 #import "MP42FormatUtilites.h"
 #import "MP42PrivateUtilities.h"
 #import "MP42Track+Private.h"
+#import "MP42Interleaver.h"
+#import "MP42MemoryGovernor.h"
+#import "MP42SampleBufferPool.h"
 
 #include <stdatomic.h>
 
+// How long the samples of the other tracks can span while a track
+// has none queued, before they are written anyway
+static const double MP42InterleavingWindow = 5;
+
+// Default limits of the samples waiting in the tracks queues
+static const uint64_t MP42DefaultMemoryBudget = 256 * 1024 * 1024;
+static const uint64_t MP42DefaultTrackByteBudget = 64 * 1024 * 1024;
+static const double   MP42DefaultTrackDurationBudget = 4;
+
+// Written samples kept for reuse by the importers
+static const uint64_t MP42SamplePoolCacheLimit = 64 * 1024 * 1024;
+
 MP42_OBJC_DIRECT_MEMBERS
 @implementation MP42Muxer
 {
@@ -34,6 +49,13 @@ MP42_OBJC_DIRECT_MEMBERS
 
     NSMutableArray<MP42Track *> *_activeTracks;
     NSDictionary<NSString *, id> *_options;
+    double                        _chunkDuration;
+
+    MP42MemoryGovernor *_memoryGovernor;
+    uint64_t            _trackByteBudget;
+    double              _trackDurationBudget;
+
+    MP42SampleBufferPool *_samplePool;
 
     dispatch_semaphore_t _setupDone;
     int32_t              _cancelled;
@@ -56,6 +78,22 @@ MP42_OBJC_DIRECT_MEMBERS
         _delegate = del;
         _logger = logger;
         _options = [options copy];
+        _chunkDuration = [_options[MP42ChunkDuration] doubleValue];
+        if (_chunkDuration <= 0) {
+            _chunkDuration = 0.125;
+        }
+
+        uint64_t memoryBudget = [_options[MP42MemoryBudget] unsignedLongLongValue];
+        _memoryGovernor = [[MP42MemoryGovernor alloc] initWithByteBudget:memoryBudget ? memoryBudget : MP42DefaultMemoryBudget];
+        _trackByteBudget = [_options[MP42TrackByteBudget] unsignedLongLongValue];
+        if (!_trackByteBudget) {
+            _trackByteBudget = MP42DefaultTrackByteBudget;
+        }
+        _trackDurationBudget = [_options[MP42TrackDurationBudget] doubleValue];
+        if (_trackDurationBudget <= 0) {
+            _trackDurationBudget = MP42DefaultTrackDurationBudget;
+        }
+        _samplePool = [[MP42SampleBufferPool alloc] initWithCacheLimit:MP42SamplePoolCacheLimit];
         _setupDone = dispatch_semaphore_create(0);
     }
 
@@ -538,7 +576,7 @@ MP42_OBJC_DIRECT_MEMBERS
             const uint8_t textColor[4] = { 255,255,255,255 };
             dstTrackId = MP4AddSubtitleTrack(_fileHandle, timeScale, videoSize.width, subSize.height);
 
-            MP4SetTrackDurationPerChunk(_fileHandle, dstTrackId, timeScale / 8);
+            MP4SetTrackDurationPerChunk(_fileHandle, dstTrackId, MAX(timeScale * _chunkDuration, 1));
             MP4SetTrackIntegerProperty(_fileHandle, dstTrackId, "tkhd.layer", -1);
 
             MP4SetTrackIntegerProperty(_fileHandle, dstTrackId, "mdia.minf.stbl.stsd.tx3g.horizontalJustification", 1);
@@ -656,7 +694,7 @@ MP42_OBJC_DIRECT_MEMBERS
         }
 
         if (dstTrackId) {
-            MP4SetTrackDurationPerChunk(_fileHandle, dstTrackId, timeScale / 8);
+            MP4SetTrackDurationPerChunk(_fileHandle, dstTrackId, MAX(timeScale * _chunkDuration, 1));
             track.trackId = dstTrackId;
         }
     }
@@ -675,60 +713,104 @@ MP42_OBJC_DIRECT_MEMBERS
     }
 
     NSArray<MP42FileImporter *> *trackImportersArray = self.fileImporters;
-    NSUInteger done = 0, update = 0;
+    NSUInteger update = 0, read = 0;
     CGFloat progress = 0;
+    BOOL polling = NO;
+
+    NSUInteger tracksImportersCount = trackImportersArray.count;
+    NSArray<MP42Track *> *tracks = [_activeTracks copy];
+    NSUInteger tracksCount = tracks.count;
+
+    // Samples are written in decode time order across the tracks
+    MP42Interleaver *interleaver = [[MP42Interleaver alloc] initWithTrackCount:tracksCount window:MP42InterleavingWindow];
+
+    // The tracks fifos signal samplesReady when new samples arrive,
+    // converters have their own queues and must be polled
+    dispatch_semaphore_t samplesReady = dispatch_semaphore_create(0);
+
+    for (NSUInteger index = 0; index < tracksCount; index++) {
+        MP42Track *track = tracks[index];
+        MP4TrackId trackId = track.trackId;
+        uint32_t timescale = MP4GetTrackTimeScale(_fileHandle, trackId);
+        MP4Duration sampleDuration = MP4GetTrackFixedSampleDuration(_fileHandle, trackId);
+
+        [interleaver setTimescale:timescale sampleDuration:sampleDuration forTrack:index];
+
+        track.readySignal = samplesReady;
+        polling |= track.converter != nil;
+
+        // Limit the samples waiting in the fifo by size and duration,
+        // the samples in the interleaver are already limited by its window
+        if (!track.converter) {
+            track.sampleBudget = [[MP42SampleBudget alloc] initWithGovernor:_memoryGovernor
+                                                                 byteBudget:_trackByteBudget
+                                                             durationBudget:_trackDurationBudget
+                                                                  timescale:timescale
+                                                             sampleDuration:sampleDuration];
+        }
+    }
 
     for (MP42FileImporter *importerHelper in trackImportersArray) {
+        importerHelper.samplePool = _samplePool;
+        importerHelper.memoryGovernor = _memoryGovernor;
         [importerHelper startReading];
     }
 
-    NSUInteger tracksImportersCount = trackImportersArray.count;
-    NSUInteger tracksCount = _activeTracks.count;
-    NSMutableArray<MP42Track *> *tracks = [_activeTracks copy];
-    NSMutableArray<MP42Track *> *nextTracks = nil;
-
     for (;;) {
         @autoreleasepool {
+            BOOL timedOut = NO;
 
-            usleep(1000);
-
-            if (nextTracks) {
-                tracks = nextTracks;
-                nextTracks = nil;
+            // Sleep only when the last pass found nothing to read,
+            // wake up now and then anyway to update the progress
+            if (!read) {
+                dispatch_time_t timeout = dispatch_time(DISPATCH_TIME_NOW, polling ? NSEC_PER_MSEC : 100 * NSEC_PER_MSEC);
+                timedOut = dispatch_semaphore_wait(samplesReady, timeout) != 0;
             }
+            read = 0;
 
-            // Iterate the tracks array and mux the samples
-            for (MP42Track *track in tracks) {
-                MP42SampleBuffer *sampleBuffer = nil;
-                MP42TrackId trackId = track.trackId;
+            // Move the samples of every track to the interleaver
+            for (NSUInteger index = 0; index < tracksCount; index++) {
+                if ([interleaver isTrackEnded:index]) {
+                    continue;
+                }
 
-                for (int i = 0; i < 100 && (sampleBuffer = [track copyNextSample]) != nil; i++) {
+                MP42SampleBuffer *samples[100];
+                NSUInteger count = [tracks[index] copyNextSamples:samples count:100];
+                read += count;
 
-                    if (sampleBuffer->flags & MP42SampleBufferFlagEndOfFile) {
-                        // Tracks done, remove it from the loop
-                        nextTracks = nextTracks != nil ? nextTracks : [tracks mutableCopy];
-                        [nextTracks removeObject:track];
-                        done += 1;
+                for (NSUInteger i = 0; i < count; i++) {
+                    if (samples[i]->flags & MP42SampleBufferFlagEndOfFile) {
+                        [interleaver endTrack:index];
                         break;
                     }
-                    else {
-                        bool err = false;
-                        if (sampleBuffer->dependecyFlags) {
-                            err = MP4WriteSampleDependency(_fileHandle, trackId, sampleBuffer->data, sampleBuffer->size,
-                                                           sampleBuffer->duration, sampleBuffer->offset,
-                                                           (sampleBuffer->flags & MP42SampleBufferFlagIsSync) != 0,
-                                                           sampleBuffer->dependecyFlags);
-                        } else {
-                            err = MP4WriteSample(_fileHandle, trackId,
-                                                 sampleBuffer->data, sampleBuffer->size,
-                                                 sampleBuffer->duration, sampleBuffer->offset,
-                                                 (sampleBuffer->flags & MP42SampleBufferFlagIsSync) != 0);
-                        }
-                        if (!err) {
-                            _cancelled = YES;
-                        }
-                    }
+                    [interleaver addSample:samples[i] toTrack:index];
+                }
+            }
+
+            // And mux them
+            MP42SampleBuffer *sampleBuffer;
+            NSUInteger index;
+
+            while (!_cancelled && (sampleBuffer = [interleaver copyNextSample:&index])) {
+                MP42TrackId trackId = tracks[index].trackId;
+                bool err = false;
+
+                if (sampleBuffer->dependecyFlags) {
+                    err = MP4WriteSampleDependency(_fileHandle, trackId, sampleBuffer->data, sampleBuffer->size,
+                                                   sampleBuffer->duration, sampleBuffer->offset,
+                                                   (sampleBuffer->flags & MP42SampleBufferFlagIsSync) != 0,
+                                                   sampleBuffer->dependecyFlags);
+                } else {
+                    err = MP4WriteSample(_fileHandle, trackId,
+                                         sampleBuffer->data, sampleBuffer->size,
+                                         sampleBuffer->duration, sampleBuffer->offset,
+                                         (sampleBuffer->flags & MP42SampleBufferFlagIsSync) != 0);
+                }
+                if (!err) {
+                    _cancelled = YES;
                 }
+
+                [_samplePool recycleSample:sampleBuffer];
             }
 
             if (_cancelled) {
@@ -736,12 +818,12 @@ MP42_OBJC_DIRECT_MEMBERS
             }
 
             // If all tracks are done, exit the loop
-            if (done == tracksCount) {
+            if (interleaver.isDone) {
                 break;
             }
 
             // Update progress
-            if (!(update % 200)) {
+            if (!(update % 200) || (timedOut && !polling)) {
                 progress = 0;
                 for (MP42FileImporter *importerHelper in trackImportersArray) {
                     progress += importerHelper.progress;
@@ -755,6 +837,14 @@ MP42_OBJC_DIRECT_MEMBERS
         }
     }
 
+    // Don't leave an importer waiting for space if the loop stopped early
+    [_memoryGovernor cancel];
+
+    // The importers keep the pool, but not the samples in it
+    [_samplePool drain];
+    [_logger writeToLog:[NSString stringWithFormat:@"Samples: %llu requested, %llu allocated, %.1f%% recycled",
+                         _samplePool.requests, _samplePool.allocations, _samplePool.hitRate * 100]];
+
     // Write the converted audio track magic cookie
     for (MP42Track *track in _activeTracks) {
         if (track.converter && track.conversionSettings && [track isMemberOfClass:[MP42AudioTrack class]]) {
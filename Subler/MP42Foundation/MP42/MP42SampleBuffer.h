@@ -48,6 +48,11 @@ MP42_OBJC_DIRECT_MEMBERS
     MP42SampleDepType       dependecyFlags;
 
     void        *attachments;
+
+    // the allocated size of data, when the sample comes from a pool,
+    // and the number of tracks it was sent to
+    uint32_t    capacity;
+    uint32_t    owners;
 }
 
 @end
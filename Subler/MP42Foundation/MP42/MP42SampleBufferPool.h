@@ -0,0 +1,58 @@
+//
+//  MP42SampleBufferPool.h
+//  MP42Foundation
+//
+//  Copyright (c) 2022 Damiano Galassi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "MP42SampleBuffer.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Recycles the samples of a write, with their data buffers,
+ *  so the importers don't allocate a new sample and buffer
+ *  for every frame. The buffers are grouped in size classes,
+ *  four for each power of two, from 256 bytes to 16 MB.
+ *
+ *  Thread safe, the importers take the samples
+ *  and the muxer gives them back once written.
+ */
+MP42_OBJC_DIRECT_MEMBERS
+@interface MP42SampleBufferPool : NSObject
+
+/**
+ *  @param bytes the maximum size of the buffers kept in the pool.
+ */
+- (instancetype)initWithCacheLimit:(uint64_t)bytes;
+
+/**
+ *  Returns a cleared sample, with size set and
+ *  a data buffer of at least size bytes.
+ */
+- (MP42SampleBuffer *)newSampleWithSize:(uint32_t)size;
+
+/**
+ *  Gives back a sample taken from the pool once written.
+ *  A sample sent to several tracks is kept until each
+ *  of them gave it back, so a sample that went to a converter
+ *  is never reused. Other samples are ignored.
+ */
+- (void)recycleSample:(MP42SampleBuffer *)sample;
+
+/**
+ *  Releases the samples kept in the pool.
+ */
+- (void)drain;
+
+/// The samples requested from the pool.
+@property (nonatomic, readonly) uint64_t requests;
+/// The samples and buffers allocated because the pool had none.
+@property (nonatomic, readonly) uint64_t allocations;
+/// The ratio of requests served by a recycled sample.
+@property (nonatomic, readonly) double hitRate;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,193 @@
+//
+//  MP42SampleBufferPool.m
+//  MP42Foundation
+//
+//  Copyright (c) 2022 Damiano Galassi. All rights reserved.
+//
+
+#import "MP42SampleBufferPool.h"
+#include <os/lock.h>
+
+#define POOL_MIN_SHIFT 8
+#define POOL_MAX_SHIFT 24
+#define POOL_STEPS 4
+#define POOL_CLASSES ((POOL_MAX_SHIFT - POOL_MIN_SHIFT) * POOL_STEPS + 1)
+
+/**
+ *  The smallest class that fits size: 256 bytes,
+ *  then four steps between each power of two.
+ */
+static inline unsigned class_for_size(uint32_t size)
+{
+    if (size <= (1u << POOL_MIN_SHIFT)) {
+        return 0;
+    }
+
+    // 2^shift < size <= 2^(shift + 1)
+    unsigned shift = 31 - __builtin_clz(size - 1);
+    uint32_t step = 1u << (shift - 2);
+    unsigned q = (size - (1u << shift) + step - 1) / step;
+
+    return (shift - POOL_MIN_SHIFT) * POOL_STEPS + q;
+}
+
+static inline uint32_t size_of_class(unsigned sizeClass)
+{
+    if (sizeClass == 0) {
+        return 1u << POOL_MIN_SHIFT;
+    }
+
+    unsigned shift = POOL_MIN_SHIFT + (sizeClass - 1) / POOL_STEPS;
+    unsigned q = (sizeClass - 1) % POOL_STEPS + 1;
+
+    return (1u << shift) + q * (1u << (shift - 2));
+}
+
+MP42_OBJC_DIRECT_MEMBERS
+@implementation MP42SampleBufferPool {
+@private
+    os_unfair_lock _lock;
+    NSMutableArray<MP42SampleBuffer *> *_samples[POOL_CLASSES];
+
+    uint64_t _cacheLimit;
+    uint64_t _cachedBytes;
+
+    uint64_t _requests;
+    uint64_t _hits;
+    uint64_t _allocations;
+}
+
+- (instancetype)initWithCacheLimit:(uint64_t)bytes
+{
+    self = [super init];
+    if (self) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _cacheLimit = bytes;
+        for (unsigned sizeClass = 0; sizeClass < POOL_CLASSES; sizeClass++) {
+            _samples[sizeClass] = [[NSMutableArray alloc] init];
+        }
+    }
+    return self;
+}
+
+- (MP42SampleBuffer *)newSampleWithSize:(uint32_t)size
+{
+    MP42SampleBuffer *sample = nil;
+
+    // Too big to keep around
+    if (size > (1u << POOL_MAX_SHIFT)) {
+        os_unfair_lock_lock(&_lock);
+        _requests++;
+        _allocations++;
+        os_unfair_lock_unlock(&_lock);
+
+        sample = [[MP42SampleBuffer alloc] init];
+        sample->data = malloc(size);
+        sample->size = size;
+        return sample;
+    }
+
+    unsigned sizeClass = class_for_size(size);
+    NSMutableArray<MP42SampleBuffer *> *samples = _samples[sizeClass];
+
+    os_unfair_lock_lock(&_lock);
+    _requests++;
+    sample = samples.lastObject;
+    if (sample) {
+        [samples removeLastObject];
+        _cachedBytes -= sample->capacity;
+        _hits++;
+    } else {
+        _allocations++;
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    if (sample == nil) {
+        sample = [[MP42SampleBuffer alloc] init];
+        sample->capacity = size_of_class(sizeClass);
+        sample->data = malloc(sample->capacity);
+    }
+
+    sample->size = size;
+    return sample;
+}
+
+- (void)recycleSample:(MP42SampleBuffer *)sample
+{
+    if (sample->capacity == 0) {
+        return;
+    }
+
+    // Another track still has to write it,
+    // or a converter reads it and won't give it back
+    if (sample->owners > 1 && __atomic_sub_fetch(&sample->owners, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    // Clear it now, the next user only sets what it needs
+    sample->size = 0;
+    sample->timescale = 0;
+    sample->duration = 0;
+    sample->offset = 0;
+    sample->presentationTimestamp = 0;
+    sample->presentationOutputTimestamp = 0;
+    sample->decodeTimestamp = 0;
+    sample->trackId = 0;
+    sample->flags = 0;
+    sample->dependecyFlags = 0;
+    sample->owners = 0;
+    if (sample->attachments) {
+        CFRelease(sample->attachments);
+        sample->attachments = NULL;
+    }
+
+    NSMutableArray<MP42SampleBuffer *> *samples = _samples[class_for_size(sample->capacity)];
+
+    os_unfair_lock_lock(&_lock);
+    if (_cachedBytes + sample->capacity <= _cacheLimit) {
+        [samples addObject:sample];
+        _cachedBytes += sample->capacity;
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)drain
+{
+    NSMutableArray<MP42SampleBuffer *> *drained = [[NSMutableArray alloc] init];
+
+    os_unfair_lock_lock(&_lock);
+    for (unsigned sizeClass = 0; sizeClass < POOL_CLASSES; sizeClass++) {
+        [drained addObjectsFromArray:_samples[sizeClass]];
+        [_samples[sizeClass] removeAllObjects];
+    }
+    _cachedBytes = 0;
+    os_unfair_lock_unlock(&_lock);
+
+    // drained is released outside of the lock
+}
+
+- (uint64_t)requests
+{
+    os_unfair_lock_lock(&_lock);
+    uint64_t requests = _requests;
+    os_unfair_lock_unlock(&_lock);
+    return requests;
+}
+
+- (uint64_t)allocations
+{
+    os_unfair_lock_lock(&_lock);
+    uint64_t allocations = _allocations;
+    os_unfair_lock_unlock(&_lock);
+    return allocations;
+}
+
+- (double)hitRate
+{
+    os_unfair_lock_lock(&_lock);
+    double rate = _requests ? (double)_hits / _requests : 0;
+    os_unfair_lock_unlock(&_lock);
+    return rate;
+}
+
+@end
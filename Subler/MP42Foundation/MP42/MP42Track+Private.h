@@ -10,6 +10,7 @@ NS_ASSUME_NONNULL_BEGIN
 
 @class MP42FileImporter;
 @class MP42SampleBuffer;
+@class MP42SampleBudget;
 @protocol MP42ConverterProtocol;
 
 @interface MP42Track (Private)
@@ -40,6 +41,8 @@ NS_ASSUME_NONNULL_BEGIN
 
 @property (nonatomic, readwrite, nullable) MP42FileImporter *importer;
 @property (nonatomic, readwrite, nullable) id <MP42ConverterProtocol> converter;
+@property (nonatomic, readwrite, nullable) dispatch_semaphore_t readySignal;
+@property (nonatomic, readwrite, nullable) MP42SampleBudget *sampleBudget;
 
 - (void)startReading;
 
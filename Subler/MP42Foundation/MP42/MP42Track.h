@@ -58,7 +58,9 @@ NS_ASSUME_NONNULL_BEGIN
 #pragma mark - Private
 
 - (void)enqueue:(MP42SampleBuffer *)sample MP42_OBJC_DIRECT;
+- (void)enqueueSamples:(MP42SampleBuffer * const _Nonnull * _Nonnull)samples count:(NSUInteger)count MP42_OBJC_DIRECT;
 - (nullable MP42SampleBuffer *)copyNextSample MP42_OBJC_DIRECT;
+- (NSUInteger)copyNextSamples:(MP42SampleBuffer * _Nullable __strong * _Nonnull)samples count:(NSUInteger)count MP42_OBJC_DIRECT;
 
 @end
 
@@ -13,6 +13,7 @@
 #import "MP42Languages.h"
 
 #import "MP42Fifo.h"
+#import "MP42MemoryGovernor.h"
 #import "MP42FileImporter.h"
 #import "MP42ConverterProtocol.h"
 
@@ -23,6 +24,8 @@ typedef struct muxer_helper {
     // Output helpers
     id <MP42ConverterProtocol> converter;
     MP42Fifo<MP42SampleBuffer *> *fifo;
+    dispatch_semaphore_t readySignal;
+    MP42SampleBudget *sampleBudget;
 } muxer_helper;
 
 
@@ -490,6 +493,26 @@ typedef struct muxer_helper {
     self.helper->converter = converter;
 }
 
+- (nullable dispatch_semaphore_t)readySignal
+{
+    return _helper ? _helper->readySignal : nil;
+}
+
+- (void)setReadySignal:(dispatch_semaphore_t)readySignal
+{
+    self.helper->readySignal = readySignal;
+}
+
+- (nullable MP42SampleBudget *)sampleBudget
+{
+    return _helper ? _helper->sampleBudget : nil;
+}
+
+- (void)setSampleBudget:(MP42SampleBudget *)sampleBudget
+{
+    self.helper->sampleBudget = sampleBudget;
+}
+
 - (void *)copy_muxer_helper
 {
     muxer_helper *copy = calloc(1, sizeof(muxer_helper));
@@ -509,6 +532,8 @@ typedef struct muxer_helper {
     if (_helper) {
         _helper->fifo = nil;
         _helper->converter = nil;
+        _helper->readySignal = nil;
+        _helper->sampleBudget = nil;
         free(_helper);
         _helper = NULL;
     }
@@ -516,7 +541,10 @@ typedef struct muxer_helper {
 
 - (void)startReading
 {
-    self.helper->fifo = [[MP42Fifo alloc] init];
+    // The sample budget limits the queue,
+    // the capacity is there only for tiny samples
+    self.helper->fifo = [[MP42Fifo alloc] initWithCapacity:self.helper->sampleBudget ? 1024 : 300];
+    [self.helper->fifo setReadySignal:self.helper->readySignal];
 }
 
 - (void)enqueue:(MP42SampleBuffer *)sample
@@ -524,7 +552,24 @@ typedef struct muxer_helper {
     if (_helper->converter) {
         [_helper->converter addSample:sample];
     } else {
-        [_helper->fifo enqueue:sample];
+        [self enqueueSamples:&sample count:1];
+    }
+}
+
+- (void)enqueueSamples:(MP42SampleBuffer * const *)samples count:(NSUInteger)count
+{
+    if (_helper->converter) {
+        for (NSUInteger i = 0; i < count; i++) {
+            [_helper->converter addSample:samples[i]];
+        }
+    } else {
+        MP42SampleBudget *budget = _helper->sampleBudget;
+        while (count) {
+            NSUInteger reserved = budget ? [budget reserveSamples:samples count:count] : count;
+            [_helper->fifo enqueueObjects:samples count:reserved];
+            samples += reserved;
+            count -= reserved;
+        }
     }
 }
 
@@ -533,7 +578,24 @@ typedef struct muxer_helper {
         return [_helper->converter copyEncodedSample];
     }
     else {
-        return [_helper->fifo dequeue];
+        MP42SampleBuffer *sample;
+        [self copyNextSamples:&sample count:1];
+        return sample;
+    }
+}
+
+- (NSUInteger)copyNextSamples:(MP42SampleBuffer * __strong *)samples count:(NSUInteger)count {
+    if (_helper->converter) {
+        NSUInteger done = 0;
+        while (done < count && (samples[done] = [_helper->converter copyEncodedSample])) {
+            done++;
+        }
+        return done;
+    }
+    else {
+        NSUInteger done = [_helper->fifo dequeueObjects:samples count:count];
+        [_helper->sampleBudget releaseSamples:samples count:done];
+        return done;
     }
 }
 
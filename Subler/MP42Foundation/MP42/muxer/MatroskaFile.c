@@ -12,14 +12,358 @@
 #include <errno.h>
 #include <stdint.h>
 #include <string.h>
+#include <stddef.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "MatroskaParser.h"
 #include "MatroskaFile.h"
 
-#pragma mark Parser callbacks
-
 #define CACHESIZE 0xFFFFFFF
+#define SCANBLOCK (256*1024)
+
+#pragma mark Signature scanner
+
+static inline int SignatureAt(const unsigned char *p, uint32_t signature) { 
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]) == signature; 
+} 
+
+/* all the scanners below store base plus the offsets of up to maxoffsets
+ * occurrences of signature that lie entirely inside buf[0,len),
+ * and return how many were found. 
+ * The vector versions compare the first two bytes of the signature
+ * against a whole block at a time and only verify the candidates.
+ */ 
+static int ScanSignatureScalar(const unsigned char *buf, size_t i, size_t len, uint32_t signature, 
+                               longlong base, longlong *offsets, int maxoffsets) { 
+	int     n = 0; 
+
+	for (; i + 4 <= len && n < maxoffsets; ++i) 
+		if (buf[i] == (signature >> 24) && SignatureAt(buf + i, signature)) 
+			offsets[n++] = base + i; 
+
+	return n; 
+} 
+
+#if defined(__SSE2__)
+static int ScanSignatureSSE2(const unsigned char *buf, size_t len, uint32_t signature, 
+                             longlong base, longlong *offsets, int maxoffsets) { 
+	const __m128i   b0 = _mm_set1_epi8((char)(signature >> 24)); 
+	const __m128i   b1 = _mm_set1_epi8((char)(signature >> 16)); 
+	size_t          i; 
+	int             n = 0; 
+
+	for (i = 0; i + 20 <= len; i += 16) { 
+		__m128i     v0 = _mm_loadu_si128((const __m128i *)(buf + i)); 
+		__m128i     v1 = _mm_loadu_si128((const __m128i *)(buf + i + 1)); 
+		unsigned    m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v0, b0), _mm_cmpeq_epi8(v1, b1))); 
+
+		while (m) { 
+			size_t  k = i + __builtin_ctz(m); 
+			m &= m - 1; 
+			if (SignatureAt(buf + k, signature)) { 
+				offsets[n++] = base + k; 
+				if (n == maxoffsets) 
+					return n; 
+			} 
+		} 
+	} 
+
+	return n + ScanSignatureScalar(buf, i, len, signature, base, offsets + n, maxoffsets - n); 
+} 
+
+__attribute__((target("avx2"))) 
+static int ScanSignatureAVX2(const unsigned char *buf, size_t len, uint32_t signature, 
+                             longlong base, longlong *offsets, int maxoffsets) { 
+	const __m256i   b0 = _mm256_set1_epi8((char)(signature >> 24)); 
+	const __m256i   b1 = _mm256_set1_epi8((char)(signature >> 16)); 
+	size_t          i; 
+	int             n = 0; 
+
+	for (i = 0; i + 36 <= len; i += 32) { 
+		__m256i     v0 = _mm256_loadu_si256((const __m256i *)(buf + i)); 
+		__m256i     v1 = _mm256_loadu_si256((const __m256i *)(buf + i + 1)); 
+		unsigned    m = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v0, b0), 
+		                                                               _mm256_cmpeq_epi8(v1, b1))); 
+
+		while (m) { 
+			size_t  k = i + __builtin_ctz(m); 
+			m &= m - 1; 
+			if (SignatureAt(buf + k, signature)) { 
+				offsets[n++] = base + k; 
+				if (n == maxoffsets) 
+					return n; 
+			} 
+		} 
+	} 
+
+	return n + ScanSignatureScalar(buf, i, len, signature, base, offsets + n, maxoffsets - n); 
+} 
+#elif defined(__ARM_NEON)
+static int ScanSignatureNEON(const unsigned char *buf, size_t len, uint32_t signature, 
+                             longlong base, longlong *offsets, int maxoffsets) { 
+	const uint8x16_t    b0 = vdupq_n_u8((uint8_t)(signature >> 24)); 
+	const uint8x16_t    b1 = vdupq_n_u8((uint8_t)(signature >> 16)); 
+	size_t              i; 
+	int                 n = 0; 
+
+	for (i = 0; i + 20 <= len; i += 16) { 
+		uint8x16_t  eq = vandq_u8(vceqq_u8(vld1q_u8(buf + i), b0), vceqq_u8(vld1q_u8(buf + i + 1), b1)); 
+		/* narrow to a 64 bit mask, four bits per byte */ 
+		uint64_t    m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0); 
+
+		while (m) { 
+			unsigned    bit = __builtin_ctzll(m); 
+			size_t      k = i + (bit >> 2); 
+			m &= ~(0xfULL << (bit & ~3u)); 
+			if (SignatureAt(buf + k, signature)) { 
+				offsets[n++] = base + k; 
+				if (n == maxoffsets) 
+					return n; 
+			} 
+		} 
+	} 
+
+	return n + ScanSignatureScalar(buf, i, len, signature, base, offsets + n, maxoffsets - n); 
+} 
+#endif
+
+static int ScanSignature(const unsigned char *buf, size_t len, uint32_t signature, 
+                         longlong base, longlong *offsets, int maxoffsets) { 
+#if defined(__SSE2__)
+	static int  hasAVX2 = -1; 
+
+	if (hasAVX2 < 0) 
+		hasAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0; 
+
+	if (hasAVX2) 
+		return ScanSignatureAVX2(buf, len, signature, base, offsets, maxoffsets); 
+	return ScanSignatureSSE2(buf, len, signature, base, offsets, maxoffsets); 
+#elif defined(__ARM_NEON)
+	return ScanSignatureNEON(buf, len, signature, base, offsets, maxoffsets); 
+#else
+	return ScanSignatureScalar(buf, 0, len, signature, base, offsets, maxoffsets); 
+#endif
+} 
+
+#pragma mark Prefetcher
+
+/* The prefetcher reads ahead of the parser on a background thread. 
+ * It keeps a ring of slots, oldest first, each one ending on a cluster 
+ * start taken from the cues when the file has them. With the mapped 
+ * backend the slots carry no data, the thread only faults the pages in. 
+ */ 
+
+#define PREFETCH_SLOTS      8 
+#define PREFETCH_SLOTSIZE   (1024*1024) 
+
+typedef struct PrefetchSlot { 
+	uint64_t    pos; 
+	int         len; 
+	int         ready; 
+	char        *data; 
+} PrefetchSlot; 
+
+struct MatroskaPrefetch { 
+	pthread_t       thread; 
+	pthread_mutex_t lock; 
+	pthread_cond_t  cond; 
+	int             stop; 
+	int             eof; 
+	unsigned        generation;     /* bumped every time the ring starts over */ 
+
+	uint64_t        *clusters;      /* cluster offsets from the cues, sorted */ 
+	unsigned        nclusters; 
+	uint64_t        fileSize; 
+
+	uint64_t        next;           /* first byte past the ring */ 
+	unsigned        head, count; 
+	PrefetchSlot    slots[PREFETCH_SLOTS]; 
+}; 
+
+/* a slot ends on the last cluster start that fits in it, 
+ * clusters larger than a slot are cut at the slot size */ 
+static int PrefetchLength(MatroskaPrefetch *pf, uint64_t pos) { 
+	uint64_t    end = pos + PREFETCH_SLOTSIZE; 
+	unsigned    lo = 0, hi = pf->nclusters; 
+
+	while (lo < hi) { 
+		unsigned mid = (lo + hi) / 2; 
+		if (pf->clusters[mid] <= end) 
+			lo = mid + 1; 
+		else 
+			hi = mid; 
+	} 
+	if (lo > 0 && pf->clusters[lo - 1] > pos) 
+		end = pf->clusters[lo - 1]; 
+
+	if (end > pf->fileSize) 
+		end = pf->fileSize; 
+
+	return (int)(end - pos); 
+} 
+
+static int PrefetchFill(StdIoStream *st, PrefetchSlot *slot) { 
+	int     done = 0; 
+
+	if (st->map) { 
+		volatile const char *p = st->map + slot->pos; 
+		int                 pagesize = getpagesize(); 
+
+		for (done = 0; done < slot->len; done += pagesize) 
+			(void)p[done]; 
+		(void)p[slot->len - 1]; 
+
+		return slot->len; 
+	} 
+
+	while (done < slot->len) { 
+		ssize_t rd = pread(fileno(st->fp), slot->data + done, slot->len - done, (off_t)(slot->pos + done)); 
+		if (rd <= 0) 
+			break; 
+		done += (int)rd; 
+	} 
+
+	return done; 
+} 
+
+static void *PrefetchThread(void *arg) { 
+	StdIoStream         *st = arg; 
+	MatroskaPrefetch    *pf = st->prefetch; 
+
+	pthread_mutex_lock(&pf->lock); 
+	while (!pf->stop) { 
+		PrefetchSlot    *slot; 
+		unsigned        generation; 
+		int             rd; 
+
+		if (pf->count == PREFETCH_SLOTS || pf->eof || pf->next >= pf->fileSize) { 
+			pthread_cond_wait(&pf->cond, &pf->lock); 
+			continue; 
+		} 
+
+		slot = &pf->slots[(pf->head + pf->count) % PREFETCH_SLOTS]; 
+		slot->pos = pf->next; 
+		slot->len = PrefetchLength(pf, pf->next); 
+		slot->ready = 0; 
+		pf->next += slot->len; 
+		pf->count++; 
+		generation = pf->generation; 
+
+		pthread_mutex_unlock(&pf->lock); 
+		rd = PrefetchFill(st, slot); 
+		pthread_mutex_lock(&pf->lock); 
+
+		/* the parser went elsewhere in the meantime */ 
+		if (generation != pf->generation) 
+			continue; 
+
+		if (rd < slot->len) { 
+			slot->len = rd > 0 ? rd : 0; 
+			pf->next = slot->pos + slot->len; 
+			pf->eof = 1; 
+		} 
+		slot->ready = 1; 
+		pthread_cond_broadcast(&pf->cond); 
+	} 
+	pthread_mutex_unlock(&pf->lock); 
+
+	return NULL; 
+} 
+
+/* return the slot holding pos, after dropping the ones the parser is done 
+ * with. When pos is outside of the ring it starts over at restart, the 
+ * caller reads up to there by itself. Called with the lock held. 
+ */ 
+static PrefetchSlot *PrefetchLookup(MatroskaPrefetch *pf, uint64_t pos, uint64_t restart) { 
+	unsigned    i; 
+
+	while (pf->count) { 
+		PrefetchSlot *slot = &pf->slots[pf->head]; 
+
+		if (!slot->ready || slot->pos + slot->len > pos) 
+			break; 
+
+		pf->head = (pf->head + 1) % PREFETCH_SLOTS; 
+		pf->count--; 
+		pthread_cond_broadcast(&pf->cond); 
+	} 
+
+	for (i = 0; i < pf->count; ++i) { 
+		PrefetchSlot *slot = &pf->slots[(pf->head + i) % PREFETCH_SLOTS]; 
+
+		if (pos >= slot->pos && pos < slot->pos + slot->len) 
+			return slot; 
+	} 
+
+	pf->generation++; 
+	pf->head = pf->count = 0; 
+	pf->next = restart; 
+	pf->eof = 0; 
+	pthread_cond_broadcast(&pf->cond); 
+
+	return NULL; 
+} 
+
+/* copy what the ring holds for [pos,pos+count), waiting for slots that are 
+ * being read. Returns the number of bytes copied from the start */ 
+static int PrefetchRead(StdIoStream *st, uint64_t pos, char *buffer, int count) { 
+	MatroskaPrefetch    *pf = st->prefetch; 
+	int                 done = 0; 
+
+	pthread_mutex_lock(&pf->lock); 
+	while (done < count) { 
+		PrefetchSlot    *slot = PrefetchLookup(pf, pos + done, pos + count); 
+		int             n; 
+
+		if (slot == NULL) 
+			break; 
+
+		if (!slot->ready) { 
+			pthread_cond_wait(&pf->cond, &pf->lock); 
+			continue; 
+		} 
+
+		n = (int)(slot->pos + slot->len - (pos + done)); 
+		if (n > count - done) 
+			n = count - done; 
+
+		memcpy(buffer + done, slot->data + (pos + done - slot->pos), n); 
+		done += n; 
+	} 
+	pthread_mutex_unlock(&pf->lock); 
+
+	return done; 
+} 
+
+/* the mapped backend only reports where the parser is */ 
+static void PrefetchAdvance(StdIoStream *st, uint64_t pos, int count) { 
+	MatroskaPrefetch    *pf = st->prefetch; 
+
+	pthread_mutex_lock(&pf->lock); 
+	PrefetchLookup(pf, pos, pos + count); 
+	pthread_mutex_unlock(&pf->lock); 
+} 
+
+static int CompareOffsets(const void *a, const void *b) { 
+	uint64_t    x = *(const uint64_t *)a, y = *(const uint64_t *)b; 
+
+	return x < y ? -1 : x > y; 
+} 
+
+#pragma mark Parser callbacks
 
 /* StdIoStream methods */ 
 
@@ -28,6 +372,21 @@
  */ 
 int StdIoRead(StdIoStream *st, uint64_t pos, void *buffer, int count) { 
 	size_t  rd; 
+	int     done = 0; 
+
+	/* page touches from the parser, stdio has no cache to warm */ 
+	if (buffer == NULL || count == 0) 
+		return 0; 
+
+	if (st->prefetch) { 
+		done = PrefetchRead(st, pos, buffer, count); 
+		if (done == count) 
+			return done; 
+		pos += done; 
+		buffer = (char *)buffer + done; 
+		count -= done; 
+	} 
+
 	if (fseeko(st->fp, pos, SEEK_SET) == -1) { 
 		st->error = errno; 
 		return -1; 
@@ -35,30 +394,62 @@ int StdIoRead(StdIoStream *st, uint64_t pos, void *buffer, int count) {
 	rd = fread(buffer, 1, count, st->fp); 
 	if (rd == 0) { 
 		if (feof(st->fp)) 
-			return 0; 
+			return done; 
 		st->error = errno; 
 		return -1; 
 	} 
-	return (int)rd;
+	return done + (int)rd;
 } 
 
-/* scan for a signature sig(big-endian) starting at file position pos 
- * return position of the first byte of signature or -1 if error/not found 
+/* scan for every occurrence of signature (big-endian) starting in [start,end) 
+ * the file is read in large blocks, each block overlaps the previous one by 
+ * three bytes so that signatures straddling a block boundary are found 
+ * return the number of offsets stored or -1 on error 
  */ 
-longlong StdIoScan(StdIoStream *st, uint64_t start, uint32_t signature) { 
-	uint32_t         c; 
-	uint32_t    cmp = 0; 
-	FILE              *fp = st->fp; 
+int StdIoScanAll(StdIoStream *st, uint64_t start, uint64_t end, uint32_t signature, 
+                 longlong *offsets, int maxoffsets) { 
+	int     n = 0; 
 
-	if (fseeko(fp, start, SEEK_SET)) 
+	if (st->scanbuf == NULL && (st->scanbuf = malloc(SCANBLOCK)) == NULL) { 
+		st->error = ENOMEM; 
 		return -1; 
+	} 
+
+	while (start < end && n < maxoffsets) { 
+		size_t  want = SCANBLOCK; 
+		ssize_t rd; 
+
+		/* only signatures starting before end are reported */ 
+		if (want > end - start + 3) 
+			want = (size_t)(end - start + 3); 
 
-	while ((c = getc(fp)) != EOF) { 
-		cmp = ((cmp << 8) | c) & 0xffffffff; 
-		if (cmp == signature) 
-			return ftell(fp) - 4; 
+		rd = pread(fileno(st->fp), st->scanbuf, want, (off_t)start); 
+		if (rd < 0) { 
+			st->error = errno; 
+			return n ? n : -1; 
+		} 
+
+		n += ScanSignature((const unsigned char *)st->scanbuf, rd, signature, 
+		                   start, offsets + n, maxoffsets - n); 
+
+		if ((size_t)rd < want) /* EOF */ 
+			break; 
+
+		start += rd - 3; 
 	} 
 
+	return n; 
+} 
+
+/* scan for a signature sig(big-endian) starting at file position pos 
+ * return position of the first byte of signature or -1 if error/not found 
+ */ 
+longlong StdIoScan(StdIoStream *st, uint64_t start, uint32_t signature) { 
+	longlong    offset; 
+
+	if (StdIoScanAll(st, start, UINT64_MAX - 3, signature, &offset, 1) == 1) 
+		return offset; 
+
 	return -1; 
 } 
 
@@ -72,17 +463,253 @@ const char *StdIoGetLastError(StdIoStream *st) {
 	return strerror(st->error); 
 } 
 
-/* memory allocation, this is done via stdlib */ 
+/* memory allocation, served from a per-stream arena. 
+ * Small blocks are carved from pages in power of two size classes and 
+ * recycled through per class free lists, large blocks go to malloc. 
+ * Every block starts with a header that records its class and size. 
+ */ 
+
+#define ARENA_MINSHIFT  4 
+#define ARENA_CLASSES   9                   /* 16 bytes to 4 KB */ 
+#define ARENA_LARGE     ARENA_CLASSES 
+#define ARENA_PAGE      (64*1024) 
+
+typedef struct ArenaHeader { 
+	uint32_t    cls; 
+	uint32_t    pad; 
+	uint64_t    size;                       /* requested size */ 
+} ArenaHeader; 
+
+typedef struct ArenaLarge { 
+	struct ArenaLarge   *prev, *next; 
+	ArenaHeader         hdr; 
+} ArenaLarge; 
+
+typedef struct ArenaPage { 
+	struct ArenaPage    *next; 
+	uint64_t            pad; 
+} ArenaPage; 
+
+struct MatroskaArena { 
+	void                *freeList[ARENA_CLASSES]; 
+	ArenaPage           *pages; 
+	char                *bump; 
+	char                *bumpEnd; 
+	ArenaLarge          *large; 
+	MatroskaArenaStats  stats; 
+}; 
+
+static inline unsigned ArenaClass(size_t size) { 
+	unsigned cls = 0; 
+
+	while (cls < ARENA_CLASSES && ((size_t)1 << (cls + ARENA_MINSHIFT)) < size) 
+		++cls; 
+
+	return cls; 
+} 
+
+static void ArenaAccount(MatroskaArena *a, int64_t live, int64_t reserved) { 
+	a->stats.liveBytes += live; 
+	a->stats.reservedBytes += reserved; 
+
+	if (a->stats.liveBytes > a->stats.peakLiveBytes) 
+		a->stats.peakLiveBytes = a->stats.liveBytes; 
+	if (a->stats.reservedBytes > a->stats.peakReservedBytes) 
+		a->stats.peakReservedBytes = a->stats.reservedBytes; 
+} 
+
+static void *ArenaAlloc(MatroskaArena *a, size_t size) { 
+	unsigned    cls = ArenaClass(size); 
+	ArenaHeader *h; 
+
+	if (cls == ARENA_LARGE) { 
+		ArenaLarge *l = malloc(sizeof(*l) + size); 
+		if (l == NULL) 
+			return NULL; 
+
+		l->prev = NULL; 
+		l->next = a->large; 
+		if (a->large) 
+			a->large->prev = l; 
+		a->large = l; 
+
+		h = &l->hdr; 
+		ArenaAccount(a, size, sizeof(*l) + size); 
+	} else if (a->freeList[cls]) { 
+		h = a->freeList[cls]; 
+		a->freeList[cls] = *(void **)(h + 1); 
+		ArenaAccount(a, size, 0); 
+	} else { 
+		size_t  block = sizeof(*h) + ((size_t)1 << (cls + ARENA_MINSHIFT)); 
+
+		if (a->bump == NULL || (size_t)(a->bumpEnd - a->bump) < block) { 
+			ArenaPage *page = malloc(ARENA_PAGE); 
+			if (page == NULL) 
+				return NULL; 
+
+			page->next = a->pages; 
+			a->pages = page; 
+			a->bump = (char *)(page + 1); 
+			a->bumpEnd = (char *)page + ARENA_PAGE; 
+			ArenaAccount(a, 0, ARENA_PAGE); 
+		} 
+
+		h = (ArenaHeader *)a->bump; 
+		a->bump += block; 
+		ArenaAccount(a, size, 0); 
+	} 
+
+	h->cls = cls; 
+	h->size = size; 
+	++a->stats.allocations; 
+
+	return h + 1; 
+} 
+
+static void ArenaFree(MatroskaArena *a, void *mem) { 
+	ArenaHeader *h; 
+
+	if (mem == NULL) 
+		return; 
+
+	h = (ArenaHeader *)mem - 1; 
+	ArenaAccount(a, -(int64_t)h->size, 0); 
+
+	if (h->cls == ARENA_LARGE) { 
+		ArenaLarge *l = (ArenaLarge *)((char *)h - offsetof(ArenaLarge, hdr)); 
+
+		if (l->prev) 
+			l->prev->next = l->next; 
+		else 
+			a->large = l->next; 
+		if (l->next) 
+			l->next->prev = l->prev; 
+
+		ArenaAccount(a, 0, -(int64_t)(sizeof(*l) + h->size)); 
+		free(l); 
+	} else { 
+		*(void **)mem = a->freeList[h->cls]; 
+		a->freeList[h->cls] = h; 
+	} 
+} 
+
+static void *ArenaRealloc(MatroskaArena *a, void *mem, size_t size) { 
+	ArenaHeader *h; 
+	void        *nm; 
+
+	if (mem == NULL) 
+		return ArenaAlloc(a, size); 
+
+	h = (ArenaHeader *)mem - 1; 
+
+	/* still fits in the same class */ 
+	if (h->cls != ARENA_LARGE && ArenaClass(size) == h->cls) { 
+		ArenaAccount(a, (int64_t)size - (int64_t)h->size, 0); 
+		h->size = size; 
+		return mem; 
+	} 
+
+	nm = ArenaAlloc(a, size); 
+	if (nm == NULL) 
+		return NULL; 
+
+	memcpy(nm, mem, h->size < size ? h->size : size); 
+	ArenaFree(a, mem); 
+
+	return nm; 
+} 
+
+static void ArenaDestroy(MatroskaArena *a) { 
+	ArenaPage   *page, *pn; 
+	ArenaLarge  *l, *ln; 
+
+	if (a == NULL) 
+		return; 
+
+	/* whatever the parser didn't free goes away with the pages */ 
+	for (page = a->pages; page; page = pn) { 
+		pn = page->next; 
+		free(page); 
+	} 
+	for (l = a->large; l; l = ln) { 
+		ln = l->next; 
+		free(l); 
+	} 
+
+	free(a); 
+} 
+
 void  *StdIoMalloc(StdIoStream *st, size_t size) { 
-	return malloc(size); 
+	return ArenaAlloc(st->arena, size); 
 } 
 
 void  *StdIoRealloc(StdIoStream *st, void *mem, size_t size) { 
-	return realloc(mem,size); 
+	return ArenaRealloc(st->arena, mem, size); 
 } 
 
 void  StdIoFree(StdIoStream *st, void *mem) { 
-	free(mem); 
+	ArenaFree(st->arena, mem); 
+} 
+
+/* MmapStream methods, the mapping covers the whole file */ 
+
+int MmapRead(StdIoStream *st, uint64_t pos, void *buffer, int count) { 
+	if (pos >= st->mapSize || count <= 0) 
+		return 0; 
+	if ((uint64_t)count > st->mapSize - pos) 
+		count = (int)(st->mapSize - pos); 
+
+	if (st->prefetch && buffer) 
+		PrefetchAdvance(st, pos, count); 
+
+	/* the parser touches pages it will need soon with a NULL buffer, 
+	 * sequential access is already covered by the kernel readahead */ 
+	if (buffer == NULL) { 
+		if (st->access == MatroskaAccessRandom) { 
+			uint64_t page = pos & ~(uint64_t)(getpagesize() - 1); 
+			madvise((void *)(st->map + page), 0x4000, MADV_WILLNEED); 
+		} 
+		return 0; 
+	} 
+
+	memcpy(buffer, st->map + pos, count); 
+	return count; 
+} 
+
+int MmapScanAll(StdIoStream *st, uint64_t start, uint64_t end, uint32_t signature, 
+                longlong *offsets, int maxoffsets) { 
+	if (st->mapSize < 4 || start >= st->mapSize || start >= end) 
+		return 0; 
+
+	/* only signatures starting before end are reported */ 
+	if (end > st->mapSize - 3) 
+		end = st->mapSize - 3; 
+
+	return ScanSignature((const unsigned char *)st->map + start, end + 3 - start, signature, 
+	                     start, offsets, maxoffsets); 
+} 
+
+longlong MmapScan(StdIoStream *st, uint64_t start, uint32_t signature) { 
+	longlong    offset; 
+
+	if (MmapScanAll(st, start, st->mapSize, signature, &offset, 1) == 1) 
+		return offset; 
+
+	return -1; 
+} 
+
+const void *MmapGetData(StdIoStream *st, uint64_t pos, int count) { 
+	if (pos > st->mapSize || count < 0 || (uint64_t)count > st->mapSize - pos) 
+		return NULL; 
+
+	if (st->prefetch) 
+		PrefetchAdvance(st, pos, count); 
+
+	return st->map + pos; 
+} 
+
+longlong MmapGetFileSize(StdIoStream *st) { 
+	return st->mapSize; 
 } 
 
 /* progress report handler for lengthy operations 
@@ -92,13 +719,16 @@ int StdIoProgress(StdIoStream *st, uint64_t cur, uint64_t max) {
 	return 1; 
 } 
 
-MatroskaFile *openMatroskaFile(const char *filePath, StdIoStream *ioStream)
+static int fillStdIoStream(StdIoStream *ioStream)
 {
-	char err_msg[256];
+	ioStream->arena = calloc(1, sizeof(MatroskaArena));
+	if (ioStream->arena == NULL)
+		return 0;
 
 	/* fill in I/O object */ 
 	ioStream->base.read = (int(*)(struct InputStream *, ulonglong, void *, int))StdIoRead;
 	ioStream->base.scan = (longlong(*)(struct InputStream *, ulonglong, unsigned int))StdIoScan;
+	ioStream->base.scanall = (int(*)(struct InputStream *, ulonglong, ulonglong, unsigned int, longlong *, int))StdIoScanAll;
 	ioStream->base.getcachesize = (unsigned int (*)(struct InputStream *))StdIoGetCacheSize; 
 	ioStream->base.geterror = (const char *(*)(struct InputStream *))StdIoGetLastError;
 	ioStream->base.memalloc = (void *(*)(struct InputStream *, size_t))StdIoMalloc;
@@ -106,10 +736,59 @@ MatroskaFile *openMatroskaFile(const char *filePath, StdIoStream *ioStream)
 	ioStream->base.memfree = (void(*)(struct InputStream *, void *))StdIoFree;
 	ioStream->base.progress = (int (*)(struct InputStream *, uint64_t, uint64_t))StdIoProgress;
 
+	return 1;
+}
+
+/* frees what fillStdIoStream and the open functions allocated,
+ * the stream itself belongs to the caller */
+static void releaseStdIoStream(StdIoStream *ioStream)
+{
+	stopMatroskaFilePrefetch(ioStream);
+	if (ioStream->map) {
+		munmap((void *)ioStream->map, ioStream->mapSize);
+		ioStream->map = NULL;
+	}
+	if (ioStream->fp) {
+		fclose(ioStream->fp);
+		ioStream->fp = NULL;
+	}
+	free(ioStream->scanbuf);
+	ioStream->scanbuf = NULL;
+	ArenaDestroy(ioStream->arena);
+	ioStream->arena = NULL;
+}
+
+static MatroskaFile *openMatroskaParser(StdIoStream *ioStream)
+{
+	char err_msg[256];
+
+	/* the mapping is read in place, so a larger buffer costs nothing there */ 
+	unsigned flags = MKVF_BUFFER_SIZE(ioStream->map ? 22 : 20); 
+
+	/* initialize matroska parser */ 
+	MatroskaFile *mf = mkv_OpenEx(&ioStream->base, /* pointer to I/O object */ 
+                                  0, flags, 
+                                  err_msg, sizeof(err_msg)); /* error message is returned here */ 
+
+	if (mf == NULL) {
+		releaseStdIoStream(ioStream);
+		fprintf(stderr, "Can't parse Matroska file: %s\n", err_msg); 
+		return NULL; 
+	} 
+
+	return mf;	
+}
+
+MatroskaFile *openMatroskaFile(const char *filePath, StdIoStream *ioStream)
+{
+	if (!fillStdIoStream(ioStream))
+		return NULL;
+
 	/* open source file */ 
 	ioStream->fp = fopen(filePath,"r");
 	if (ioStream->fp == NULL) { 
 		fprintf(stderr, "Can't open '%s': %s\n", filePath, strerror(errno)); 
+		releaseStdIoStream(ioStream);
 		return NULL; 
 	}
 
@@ -117,17 +796,450 @@ MatroskaFile *openMatroskaFile(const char *filePath, StdIoStream *ioStream)
     //fcntl (ioStream->fp->_file, F_RDAHEAD, 1);
     //fcntl (ioStream->fp->_file, F_NOCACHE, 1);
 
-	/* initialize matroska parser */ 
-	MatroskaFile *mf = mkv_Open(&ioStream->base, /* pointer to I/O object */ 
-                                err_msg, sizeof(err_msg)); /* error message is returned here */ 
+	return openMatroskaParser(ioStream);
+}
 
-	if (mf == NULL) {
-		fclose(ioStream->fp); 
-		fprintf(stderr, "Can't parse Matroska file: %s\n", err_msg); 
+MatroskaFile *openMatroskaFileMapped(const char *filePath, StdIoStream *ioStream)
+{
+	struct stat st;
+	void        *map;
+
+	if (!fillStdIoStream(ioStream))
+		return NULL;
+
+	/* open source file, the stream is kept around for attachments */ 
+	ioStream->fp = fopen(filePath,"r");
+	if (ioStream->fp == NULL) { 
+		fprintf(stderr, "Can't open '%s': %s\n", filePath, strerror(errno)); 
+		releaseStdIoStream(ioStream);
 		return NULL; 
-	} 
+	}
 
-	return mf;	
+	if (fstat(fileno(ioStream->fp), &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX) {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(ioStream->fp), 0);
+		if (map != MAP_FAILED) {
+			ioStream->map = map;
+			ioStream->mapSize = st.st_size;
+
+			ioStream->base.read = (int(*)(struct InputStream *, ulonglong, void *, int))MmapRead;
+			ioStream->base.scan = (longlong(*)(struct InputStream *, ulonglong, unsigned int))MmapScan;
+			ioStream->base.scanall = (int(*)(struct InputStream *, ulonglong, ulonglong, unsigned int, longlong *, int))MmapScanAll;
+			ioStream->base.getdata = (const void *(*)(struct InputStream *, ulonglong, int))MmapGetData;
+			ioStream->base.getfilesize = (longlong(*)(struct InputStream *))MmapGetFileSize;
+
+			setMatroskaFileAccessPattern(ioStream, MatroskaAccessNormal);
+		}
+	}
+
+	return openMatroskaParser(ioStream);
+}
+
+void setMatroskaFileAccessPattern(StdIoStream *ioStream, MatroskaAccessPattern pattern)
+{
+	int advice;
+
+	ioStream->access = pattern;
+
+	if (ioStream->map == NULL)
+		return;
+
+	switch (pattern) {
+		case MatroskaAccessSequential:
+			advice = MADV_SEQUENTIAL;
+			break;
+		case MatroskaAccessRandom:
+			advice = MADV_RANDOM;
+			break;
+		default:
+			advice = MADV_NORMAL;
+			break;
+	}
+
+	madvise((void *)ioStream->map, ioStream->mapSize, advice);
+}
+
+void startMatroskaFilePrefetch(MatroskaFile *matroskaFile, StdIoStream *ioStream)
+{
+	MatroskaPrefetch    *pf;
+	Cue                 *cues;
+	unsigned            nCues, i;
+	struct stat         st;
+
+	if (ioStream->prefetch || ioStream->fp == NULL)
+		return;
+
+	pf = calloc(1, sizeof(*pf));
+	if (pf == NULL)
+		return;
+
+	if (ioStream->map)
+		pf->fileSize = ioStream->mapSize;
+	else if (fstat(fileno(ioStream->fp), &st) == 0)
+		pf->fileSize = st.st_size;
+
+	/* cluster starts, in file order */
+	mkv_GetCues(matroskaFile, &cues, &nCues);
+	if (nCues && (pf->clusters = malloc(nCues * sizeof(*pf->clusters)))) {
+		ulonglong base = mkv_GetSegmentBase(matroskaFile);
+
+		for (i = 0; i < nCues; ++i)
+			pf->clusters[i] = base + cues[i].Position;
+		qsort(pf->clusters, nCues, sizeof(*pf->clusters), CompareOffsets);
+
+		for (i = 0; i < nCues; ++i)
+			if (pf->nclusters == 0 || pf->clusters[pf->nclusters - 1] != pf->clusters[i])
+				pf->clusters[pf->nclusters++] = pf->clusters[i];
+	}
+
+	for (i = 0; i < PREFETCH_SLOTS && ioStream->map == NULL; ++i) {
+		if ((pf->slots[i].data = malloc(PREFETCH_SLOTSIZE)) == NULL)
+			goto fail;
+	}
+
+	/* idle until the parser reads something */
+	pf->next = pf->fileSize;
+
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+
+	ioStream->prefetch = pf;
+	if (pthread_create(&pf->thread, NULL, PrefetchThread, ioStream) == 0)
+		return;
+
+	ioStream->prefetch = NULL;
+	pthread_mutex_destroy(&pf->lock);
+	pthread_cond_destroy(&pf->cond);
+
+fail:
+	for (i = 0; i < PREFETCH_SLOTS; ++i)
+		free(pf->slots[i].data);
+	free(pf->clusters);
+	free(pf);
+}
+
+void stopMatroskaFilePrefetch(StdIoStream *ioStream)
+{
+	MatroskaPrefetch    *pf = ioStream->prefetch;
+	unsigned            i;
+
+	if (pf == NULL)
+		return;
+
+	pthread_mutex_lock(&pf->lock);
+	pf->stop = 1;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->lock);
+
+	pthread_join(pf->thread, NULL);
+	ioStream->prefetch = NULL;
+
+	pthread_mutex_destroy(&pf->lock);
+	pthread_cond_destroy(&pf->cond);
+	for (i = 0; i < PREFETCH_SLOTS; ++i)
+		free(pf->slots[i].data);
+	free(pf->clusters);
+	free(pf);
+}
+
+/* The index cache stores the seek index built for files without Cues,
+ * one file per source keyed by its segment UID, device, inode, size and
+ * modification time, so that reopening the same file doesn't scan it for
+ * clusters again. Saving an index removes the ones of a previous version
+ * of the same file, and the least recently used ones once the directory
+ * is over its limits.
+ */
+
+#define INDEX_MAGIC     "MKVIDX01"
+#define INDEX_FIELDS    6
+#define INDEX_SUFFIX    ".mkvindex"
+#define INDEX_MAX_FILES 256
+#define INDEX_MAX_BYTES (64 * 1024 * 1024)
+
+typedef struct MatroskaIndexHeader {
+	char            magic[8];
+	uint64_t        fileSize;
+	int64_t         mtime;          /* nanoseconds */
+	unsigned char   segmentUID[16];
+	uint64_t        segmentBase;
+	uint64_t        count;
+} MatroskaIndexHeader;
+
+/* where the file is, part of the index name but not of its header */
+typedef struct MatroskaIndexFile {
+	uint64_t        device;
+	uint64_t        inode;
+} MatroskaIndexFile;
+
+static int IndexIdentity(MatroskaFile *matroskaFile, StdIoStream *ioStream, MatroskaIndexHeader *header, MatroskaIndexFile *file)
+{
+	struct stat st;
+
+	if (ioStream->fp == NULL || fstat(fileno(ioStream->fp), &st) != 0)
+		return 0;
+
+	file->device = (uint64_t)st.st_dev;
+	file->inode = (uint64_t)st.st_ino;
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, INDEX_MAGIC, sizeof(header->magic));
+	header->fileSize = st.st_size;
+#if defined(__APPLE__)
+	header->mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	header->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	memcpy(header->segmentUID, mkv_GetFileInfo(matroskaFile)->UID, sizeof(header->segmentUID));
+	header->segmentBase = mkv_GetSegmentBase(matroskaFile);
+
+	return 1;
+}
+
+static void IndexUID(const MatroskaIndexHeader *header, char uid[33])
+{
+	unsigned    i;
+
+	for (i = 0; i < sizeof(header->segmentUID); ++i)
+		snprintf(uid + i * 2, 3, "%02x", header->segmentUID[i]);
+}
+
+static void IndexPath(const MatroskaIndexHeader *header, const MatroskaIndexFile *file, const char *cacheDirectory, char *path, size_t size)
+{
+	char        uid[33];
+
+	IndexUID(header, uid);
+	snprintf(path, size, "%s/%s-%llx-%llx-%llx-%llx" INDEX_SUFFIX, cacheDirectory, uid,
+	         (unsigned long long)file->device, (unsigned long long)file->inode,
+	         (unsigned long long)header->fileSize, (unsigned long long)header->mtime);
+}
+
+/* Files without a SegmentUID all share the zero UID, so the UID alone
+ * doesn't tell that an index is of a previous version of the file.
+ * The same inode does, the same size only along with a real UID.
+ */
+static int IndexIsPrevious(const char *name, const char *uid, int hasUID, const MatroskaIndexHeader *header, const MatroskaIndexFile *file)
+{
+	unsigned long long  device, inode, fileSize, mtime;
+
+	if (strncmp(name, uid, 32) || name[32] != '-')
+		return 0;
+	if (sscanf(name + 32, "-%llx-%llx-%llx-%llx" INDEX_SUFFIX, &device, &inode, &fileSize, &mtime) != 4)
+		return 0;
+
+	if (device == file->device && inode == file->inode)
+		return 1;
+	return hasUID && fileSize == header->fileSize;
+}
+
+typedef struct MatroskaIndexEntry {
+	char            *path;
+	int64_t         used;
+	uint64_t        size;
+} MatroskaIndexEntry;
+
+static int IndexEntryCompare(const void *a, const void *b)
+{
+	const MatroskaIndexEntry *x = a, *y = b;
+
+	return (x->used > y->used) - (x->used < y->used);
+}
+
+/* removes the indexes of a previous version of the same file,
+ * then the least recently used ones over the limits */
+static void PruneIndexCache(const MatroskaIndexHeader *header, const MatroskaIndexFile *file, const char *cacheDirectory, const char *keep)
+{
+	MatroskaIndexEntry  *entries = NULL, *grown;
+	unsigned            count = 0, capacity = 0, i;
+	uint64_t            bytes = 0;
+	size_t              length, suffix = strlen(INDEX_SUFFIX);
+	struct dirent       *entry;
+	struct stat         st;
+	char                uid[33], path[1024];
+	int                 hasUID = 0;
+	DIR                 *dir;
+
+	if ((dir = opendir(cacheDirectory)) == NULL)
+		return;
+
+	IndexUID(header, uid);
+	for (i = 0; i < sizeof(header->segmentUID); ++i)
+		hasUID |= header->segmentUID[i];
+
+	while ((entry = readdir(dir)) != NULL) {
+		length = strlen(entry->d_name);
+		if (length <= suffix || strcmp(entry->d_name + length - suffix, INDEX_SUFFIX))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", cacheDirectory, entry->d_name);
+		if (strcmp(path, keep) == 0)
+			continue;
+
+		if (IndexIsPrevious(entry->d_name, uid, hasUID, header, file)) {
+			unlink(path);
+			continue;
+		}
+
+		if (stat(path, &st) != 0)
+			continue;
+
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 32;
+			if ((grown = realloc(entries, capacity * sizeof(*entries))) == NULL)
+				break;
+			entries = grown;
+		}
+
+		if ((entries[count].path = strdup(path)) == NULL)
+			break;
+#if defined(__APPLE__)
+		entries[count].used = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+		entries[count].used = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+		entries[count].size = st.st_size;
+		bytes += st.st_size;
+		count++;
+	}
+
+	closedir(dir);
+
+	/* the index just saved counts too */
+	if (stat(keep, &st) == 0)
+		bytes += st.st_size;
+
+	qsort(entries, count, sizeof(*entries), IndexEntryCompare);
+
+	for (i = 0; i < count; ++i) {
+		if (count - i + 1 > INDEX_MAX_FILES || bytes > INDEX_MAX_BYTES) {
+			unlink(entries[i].path);
+			bytes -= entries[i].size;
+		}
+		free(entries[i].path);
+	}
+
+	free(entries);
+}
+
+int loadMatroskaFileIndex(MatroskaFile *matroskaFile, StdIoStream *ioStream, const char *cacheDirectory)
+{
+	MatroskaIndexHeader header, stored;
+	MatroskaIndexFile   file;
+	char                path[1024];
+	FILE                *fp;
+	uint64_t            fields[INDEX_FIELDS];
+	Cue                 *cues = NULL;
+	unsigned            i;
+	int                 loaded = 0;
+
+	if (cacheDirectory == NULL || !IndexIdentity(matroskaFile, ioStream, &header, &file))
+		return 0;
+
+	IndexPath(&header, &file, cacheDirectory, path, sizeof(path));
+	if ((fp = fopen(path, "rb")) == NULL)
+		return 0;
+
+	/* the count is the only field allowed to differ */
+	if (fread(&stored, sizeof(stored), 1, fp) != 1)
+		goto out;
+	header.count = stored.count;
+	if (memcmp(&header, &stored, sizeof(header)) || stored.count == 0 || stored.count > UINT32_MAX / sizeof(Cue))
+		goto out;
+
+	if ((cues = malloc(stored.count * sizeof(Cue))) == NULL)
+		goto out;
+
+	for (i = 0; i < stored.count; ++i) {
+		if (fread(fields, sizeof(fields), 1, fp) != 1)
+			goto out;
+
+		/* a cue past the end of the file means the cache is stale */
+		if (header.segmentBase + fields[2] >= header.fileSize)
+			goto out;
+
+		cues[i].Time = fields[0];
+		cues[i].Duration = fields[1];
+		cues[i].Position = fields[2];
+		cues[i].RelativePosition = fields[3];
+		cues[i].Block = fields[4];
+		cues[i].Track = (unsigned)fields[5];
+	}
+
+	loaded = mkv_SetCues(matroskaFile, cues, (unsigned)stored.count) == 0;
+
+	/* the modification time orders the cache for eviction */
+	if (loaded)
+		utimes(path, NULL);
+
+out:
+	free(cues);
+	fclose(fp);
+	return loaded;
+}
+
+int saveMatroskaFileIndex(MatroskaFile *matroskaFile, StdIoStream *ioStream, const char *cacheDirectory)
+{
+	MatroskaIndexHeader header;
+	MatroskaIndexFile   file;
+	char                path[1024], temp[1024 + 8];
+	uint64_t            fields[INDEX_FIELDS];
+	Cue                 *cues;
+	unsigned            count, i;
+	FILE                *fp;
+	int                 fd;
+
+	mkv_GetCues(matroskaFile, &cues, &count);
+
+	if (cacheDirectory == NULL || count == 0 || !IndexIdentity(matroskaFile, ioStream, &header, &file))
+		return 0;
+
+	header.count = count;
+
+	/* written aside and renamed, so that concurrent readers
+	 * never see a partial index */
+	IndexPath(&header, &file, cacheDirectory, path, sizeof(path));
+	snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+	if ((fd = mkstemp(temp)) < 0)
+		return 0;
+	if ((fp = fdopen(fd, "wb")) == NULL) {
+		close(fd);
+		unlink(temp);
+		return 0;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		goto fail;
+
+	for (i = 0; i < count; ++i) {
+		fields[0] = cues[i].Time;
+		fields[1] = cues[i].Duration;
+		fields[2] = cues[i].Position;
+		fields[3] = cues[i].RelativePosition;
+		fields[4] = cues[i].Block;
+		fields[5] = cues[i].Track;
+		if (fwrite(fields, sizeof(fields), 1, fp) != 1)
+			goto fail;
+	}
+
+	if (fclose(fp) != 0 || rename(temp, path) != 0) {
+		unlink(temp);
+		return 0;
+	}
+
+	PruneIndexCache(&header, &file, cacheDirectory, path);
+
+	return 1;
+
+fail:
+	fclose(fp);
+	unlink(temp);
+	return 0;
+}
+
+void getMatroskaFileArenaStats(StdIoStream *ioStream, MatroskaArenaStats *stats)
+{
+	if (ioStream->arena)
+		*stats = ioStream->arena->stats;
+	else
+		memset(stats, 0, sizeof(*stats));
 }
 
 void closeMatroskaFile(MatroskaFile *matroskaFile, StdIoStream *ioStream)
@@ -137,7 +1249,7 @@ void closeMatroskaFile(MatroskaFile *matroskaFile, StdIoStream *ioStream)
     
 	/* close file */
     if (ioStream) {
-        fclose(ioStream->fp);
+        releaseStdIoStream(ioStream);
         free(ioStream);
     }
 }
@@ -11,13 +11,68 @@
  * source file 
  */
 
+typedef struct MatroskaArena MatroskaArena;
+typedef struct MatroskaPrefetch MatroskaPrefetch;
+
+/* allocation statistics of the arena backing the parser memory hooks */
+typedef struct MatroskaArenaStats {
+	ulonglong           liveBytes;          /* bytes currently handed to the parser */
+	ulonglong           peakLiveBytes;
+	ulonglong           reservedBytes;      /* pages and large blocks held from the system */
+	ulonglong           peakReservedBytes;
+	ulonglong           allocations;
+} MatroskaArenaStats;
+
 struct StdIoStream { 
 	struct InputStream  base; 
 	FILE                *fp; 
 	int                 error; 
+	char                *scanbuf; 
+	MatroskaArena       *arena;
+	MatroskaPrefetch    *prefetch;
+
+	/* memory-mapped backend, NULL when reading through stdio */
+	const char          *map;
+	ulonglong           mapSize;
+	int                 access;
 };
 
 typedef struct StdIoStream StdIoStream; 
 
+/* access pattern hints for the memory-mapped backend */
+typedef enum MatroskaAccessPattern {
+	MatroskaAccessNormal,       /* header parsing and probing */
+	MatroskaAccessSequential,   /* demux, clusters are read in file order */
+	MatroskaAccessRandom        /* cue seeks */
+} MatroskaAccessPattern;
+
 MatroskaFile *openMatroskaFile(const char *filePath, StdIoStream *ioStream);
+
+/* same as openMatroskaFile, but reads and scans are served straight from
+ * a read-only mapping of the file. Falls back to stdio if the file can't
+ * be mapped.
+ */
+MatroskaFile *openMatroskaFileMapped(const char *filePath, StdIoStream *ioStream);
+
+void setMatroskaFileAccessPattern(StdIoStream *ioStream, MatroskaAccessPattern pattern);
+
+/* read the clusters ahead of the parser on a background thread, following
+ * the cues when the file has them. Meant for sequential demuxing, start it
+ * once the track mask is set. closeMatroskaFile stops it too.
+ */
+void startMatroskaFilePrefetch(MatroskaFile *matroskaFile, StdIoStream *ioStream);
+void stopMatroskaFilePrefetch(StdIoStream *ioStream);
+
+/* seek index cache for files without Cues, kept in cacheDirectory and keyed
+ * by the segment UID, inode, file size and modification time. load installs
+ * a cached index in the parser, save stores the one built by mkv_BuildCues,
+ * replacing the stale ones of the same file and evicting the least
+ * recently used ones when the directory grows too large.
+ * Both return 1 on success.
+ */
+int loadMatroskaFileIndex(MatroskaFile *matroskaFile, StdIoStream *ioStream, const char *cacheDirectory);
+int saveMatroskaFileIndex(MatroskaFile *matroskaFile, StdIoStream *ioStream, const char *cacheDirectory);
+
+void getMatroskaFileArenaStats(StdIoStream *ioStream, MatroskaArenaStats *stats);
+
 void closeMatroskaFile(MatroskaFile *matroskaFile, StdIoStream *ioStream);
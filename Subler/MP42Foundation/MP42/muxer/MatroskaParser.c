@@ -68,8 +68,9 @@
 #define WEBM_DOCTYPE          "webm"
 
 #define        MAX_STRING_LEN              1023
-#define        QSEGSIZE              512
-#define        MAX_TRACKS              64
+#define        QMINSIZE              16
+#define        SLABCHUNK              (1024*1024)
+#define        MAX_TRACKNUMBER         65535
 #define        MAX_READAHEAD              (256*1024)
 
 #define        MAXCLUSTER              (256*1048576)
@@ -116,10 +117,28 @@ static void  mystrlcpy(char *dst,const char *src,unsigned size) {
     dst[i] = 0;
 }
 
+// frame payloads that can't be referenced in place are carved from large
+// chunks, each chunk counts the frames still pointing into it. Frames
+// sitting in the queues and frames handed out to the caller are counted
+// apart, so that emptying the queues can drop the former all at once.
+struct SlabChunk {
+  struct SlabChunk    *next;     // next free chunk
+  struct SlabChunk    *prevAll;  // list of all chunks owned by the file
+  struct SlabChunk    *nextAll;
+  unsigned int         queued;
+  unsigned int         refs;
+  unsigned int         used;
+  unsigned int         size;
+  unsigned int         dedicated;
+  unsigned int         pad;      // keep data 16 bytes aligned
+  char                 data[];
+};
+
 struct QueueEntry {
-  struct QueueEntry   *next;
   unsigned int         Length;
   char                *Data;
+  struct SlabChunk    *Chunk;    // NULL when Data points into the stream
+  unsigned int         Detached; // held outside the track queues
 
   ulonglong            Start;
   ulonglong            End;
@@ -134,16 +153,28 @@ struct QueueEntry {
   char                *DataAdditional;
 };
 
+// ring of entries, size is a power of two
 struct Queue {
-  struct QueueEntry *head;
-  struct QueueEntry *tail;
+  struct QueueEntry *ring;
+  unsigned int       head;
+  unsigned int       count;
+  unsigned int       size;
 };
 
 #define        MPF_ERROR 0x10000
-#define        IBSZ          1024
+#define        IBSZ_MIN      (4*1024)
+#define        IBSZ_LOW      16          // 64 KB
+#define        IBSZ_HIGH     22          // 4 MB
 
 #define        RBRESYNC  1
 
+// track sets, one bit per index in mf->Tracks
+#define        MASKWORDS(n)   (((n) + 63) >> 6)
+#define        MASKBIT(i)     (ULL(1) << ((i) & 63))
+#define        MASKTEST(m,i)  ((m)[(i) >> 6] & MASKBIT(i))
+#define        MASKSET(m,i)   ((m)[(i) >> 6] |= MASKBIT(i))
+#define        MASKCLR(m,i)   ((m)[(i) >> 6] &= ~MASKBIT(i))
+
 struct MatroskaFile {
   // parser config
   unsigned    flags;
@@ -152,7 +183,13 @@ struct MatroskaFile {
   InputStream *cache;
 
   // internal buffering
-  char              inbuf[IBSZ];
+  const char  *inbuf;  // points to ownbuf, or into the stream memory
+  char             *ownbuf;
+  int              ownsize;
+  int              bufwant; // size of the next fill, grows while reading is sequential
+  int              bufmin;
+  int              bufmax;
+  int              bufseek; // set by seeks outside the buffer
   ulonglong   bufbase; // file offset of the first byte in buffer
   int              bufpos; // current read position in buffer
   int              buflen; // valid bytes in buffer
@@ -194,13 +231,25 @@ struct MatroskaFile {
   unsigned int            nTracks,nTracksSize;
   struct TrackInfo  **Tracks;
 
+  // Frame slab
+  struct SlabChunk  *SlabCur;
+  struct SlabChunk  *SlabFree;
+  struct SlabChunk  *SlabAll;
+
   // Queues
-  struct QueueEntry *QFreeList;
-  unsigned int            nQBlocks,nQBlocksSize;
-  struct QueueEntry **QBlocks;
+  unsigned int            nQAdditional; // entries owning block additions
   struct Queue            *Queues;
+  ulonglong            *QActive;     // tracks with frames queued
   ulonglong            readPosition;
-  ulonglong            trackMask;
+  ulonglong            readLimit;    // 0 to read up to the segment end
+  ulonglong            *trackMask;
+  unsigned int            nMaskWords;   // size of the track sets
+  unsigned int            *TrackIndex;  // track number -> index + 1, 0 if unused
+  unsigned int            nTrackIndex;
+  ulonglong            *seekTime;    // mkv_Seek scratch, one per track
+  unsigned char            *seekSeen;
+  ulonglong            *seekMask;
+  ulonglong            *readMask;    // mkv_ReadFrame mask
   ulonglong            pSegmentTop;  // offset of next byte after the segment
   ulonglong            tcCluster;    // current cluster timecode
 
@@ -461,26 +510,208 @@ static void ArrayReleaseMemory(MatroskaFile *mf,void **base,
 #define        AGET(f,name)          ArrayAlloc((f),(void**)&(f)->name,&(f)->n##name,&(f)->n##name##Size,sizeof(*((f)->name)))
 #define        ARELEASE(f,s,name)  ArrayReleaseMemory((f),(void**)&(s)->name,(s)->n##name,&(s)->n##name##Size,sizeof(*((s)->name)))
 
+///////////////////////////////////////////////////////////////////////////
+// frame slab
+static void SlabLink(MatroskaFile *mf,struct SlabChunk *sc) {
+  sc->prevAll = NULL;
+  sc->nextAll = mf->SlabAll;
+  if (mf->SlabAll)
+    mf->SlabAll->prevAll = sc;
+  mf->SlabAll = sc;
+}
+
+static void SlabDrop(MatroskaFile *mf,struct SlabChunk *sc) {
+  if (sc->prevAll)
+    sc->prevAll->nextAll = sc->nextAll;
+  else
+    mf->SlabAll = sc->nextAll;
+  if (sc->nextAll)
+    sc->nextAll->prevAll = sc->prevAll;
+  mf->cache->memfree(mf->cache,sc);
+}
+
+static inline int SlabIdle(struct SlabChunk *sc) {
+  return sc->queued == 0 && sc->refs == 0;
+}
+
+static char *SlabAlloc(MatroskaFile *mf,unsigned size,struct SlabChunk **chunk) {
+  struct SlabChunk  *sc = mf->SlabCur;
+  char              *p;
+
+  size = (size + 15) & ~15;
+
+  // large frames get a chunk of their own
+  if (size > SLABCHUNK / 4) {
+    sc = mf->cache->memalloc(mf->cache,sizeof(*sc) + size);
+    if (sc == NULL)
+      errorjmp(mf,"Out of memory");
+    SlabLink(mf,sc);
+    sc->next = NULL;
+    sc->queued = 1;
+    sc->refs = 0;
+    sc->used = sc->size = size;
+    sc->dedicated = 1;
+    *chunk = sc;
+    return sc->data;
+  }
+
+  if (sc && SlabIdle(sc))
+    sc->used = 0;
+
+  if (sc == NULL || sc->used + size > sc->size) {
+    if (mf->SlabFree) {
+      sc = mf->SlabFree;
+      mf->SlabFree = sc->next;
+    } else {
+      sc = mf->cache->memalloc(mf->cache,sizeof(*sc) + SLABCHUNK);
+      if (sc == NULL)
+        errorjmp(mf,"Out of memory");
+      sc->size = SLABCHUNK;
+      sc->dedicated = 0;
+      SlabLink(mf,sc);
+    }
+    sc->next = NULL;
+    sc->queued = 0;
+    sc->refs = 0;
+    sc->used = 0;
+    mf->SlabCur = sc;
+  }
+
+  p = sc->data + sc->used;
+  sc->used += size;
+  ++sc->queued;
+
+  *chunk = sc;
+  return p;
+}
+
+// give an idle chunk back, the current one is kept for the next frames
+static void SlabRecycle(MatroskaFile *mf,struct SlabChunk *sc) {
+  if (!SlabIdle(sc) || sc == mf->SlabCur)
+    return;
+
+  if (sc->dedicated)
+    SlabDrop(mf,sc);
+  else {
+    sc->next = mf->SlabFree;
+    mf->SlabFree = sc;
+  }
+}
+
+// all queued frames were dropped, only borrowed frames keep chunks busy
+static void SlabDropQueued(MatroskaFile *mf) {
+  struct SlabChunk  *sc,*sn;
+
+  mf->SlabFree = NULL;
+  for (sc = mf->SlabAll; sc; sc = sn) {
+    sn = sc->nextAll;
+    sc->queued = 0;
+    SlabRecycle(mf,sc);
+  }
+}
+
+static void SlabFreeAll(MatroskaFile *mf) {
+  struct SlabChunk  *sc,*sn;
+
+  for (sc = mf->SlabAll; sc; sc = sn) {
+    sn = sc->nextAll;
+    mf->cache->memfree(mf->cache,sc);
+  }
+
+  mf->SlabAll = mf->SlabFree = mf->SlabCur = NULL;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // queues
-static struct QueueEntry *QPut(struct Queue *q,struct QueueEntry *qe) {
-  if (q->tail)
-    q->tail->next = qe;
-  qe->next = NULL;
-  q->tail = qe;
-  if (q->head==NULL)
-    q->head = qe;
+//
+// every track queues its frames in a ring of entries that doubles when full,
+// QHead and QGet return pointers into the ring, valid until the next QPut
+static inline struct QueueEntry *QHead(struct Queue *q) {
+  return q->count ? &q->ring[q->head] : NULL;
+}
 
-  return qe;
+// the entry queued after qe, NULL at the tail
+static inline struct QueueEntry *QNext(struct Queue *q,struct QueueEntry *qe) {
+  unsigned  i = (unsigned)(qe - q->ring + 1) & (q->size - 1);
+
+  return i == ((q->head + q->count) & (q->size - 1)) ? NULL : &q->ring[i];
+}
+
+// make room for n more entries
+static void QReserve(MatroskaFile *mf,struct Queue *q,unsigned n) {
+  struct QueueEntry *ring;
+  unsigned          size = q->size ? q->size : QMINSIZE;
+
+  if (q->count + n <= q->size)
+    return;
+
+  while (size < q->count + n)
+    size <<= 1;
+
+  ring = mf->cache->memrealloc(mf->cache,q->ring,size * sizeof(*ring));
+  if (ring == NULL)
+    errorjmp(mf,"Ouf of memory");
+
+  // entries that wrapped around move right after the old end
+  if (q->head + q->count > q->size)
+    memcpy(ring + q->size,ring,(q->head + q->count - q->size) * sizeof(*ring));
+
+  q->ring = ring;
+  q->size = size;
+}
+
+static struct QueueEntry *QPut(MatroskaFile *mf,struct Queue *q,const struct QueueEntry *qe) {
+  struct QueueEntry *tail;
+
+  QReserve(mf,q,1);
+
+  tail = &q->ring[(q->head + q->count) & (q->size - 1)];
+  *tail = *qe;
+  ++q->count;
+
+  return tail;
 }
 
 static struct QueueEntry  *QGet(struct Queue *q) {
-  struct QueueEntry   *qe = q->head;
+  struct QueueEntry   *qe = QHead(q);
   if (qe == NULL)
     return NULL;
-  q->head = qe->next;
-  if (q->tail == qe)
-    q->tail = NULL;
+  q->head = (q->head + 1) & (q->size - 1);
+  --q->count;
+  return qe;
+}
+
+// index of the lowest set bit, bits must not be 0
+static inline unsigned QLowest(ulonglong bits) {
+#if defined(__GNUC__)
+  return (unsigned)__builtin_ctzll(bits);
+#else
+  unsigned  n = 0;
+
+  while (!(bits & 1)) {
+    bits >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+// the track queues keep QActive up to date, so lookups
+// only visit the tracks that have frames
+static struct QueueEntry *QTrackPut(MatroskaFile *mf,unsigned n,const struct QueueEntry *qe) {
+  struct QueueEntry *tail = QPut(mf,&mf->Queues[n],qe);
+
+  MASKSET(mf->QActive,n);
+
+  return tail;
+}
+
+static struct QueueEntry *QTrackGet(MatroskaFile *mf,unsigned n) {
+  struct QueueEntry *qe = QGet(&mf->Queues[n]);
+
+  if (mf->Queues[n].count == 0)
+    MASKCLR(mf->QActive,n);
+
   return qe;
 }
 
@@ -494,83 +725,138 @@ static struct Queue* QsStructAlloc(MatroskaFile *mf) {
   return q;
 }
 
-// dump the contents of src into the head of each dest queue such that the
-// old tail of src[i] points to the old head of dest[i], the new head of dest[i]
-// is the old head of src[i], and the src queues are now empty.
-static void QsDumpHead(struct Queue *destination, struct Queue *source, int n) {
-  for (int i = 0; i < n; ++i) {
-    struct Queue *dest = &destination[i];
-    struct Queue *src = &source[i];
-    if (!src->tail) // do nothing if src queue empty
-        continue;
-    src->tail->next = dest->head; // link up queues
-    dest->head = src->head; // set heads and tails properly
-    src->head = NULL;
-    src->tail = NULL;
+static inline void QFree(MatroskaFile *mf,struct QueueEntry *qe) {
+  if (qe->Chunk) {
+    if (qe->Detached)
+      --qe->Chunk->refs;
+    else
+      --qe->Chunk->queued;
+    SlabRecycle(mf, qe->Chunk);
   }
+  qe->Chunk = NULL;
+  qe->Detached = 0;
+  qe->Data = NULL;
+  if (qe->DataAdditional) {
+    mf->cache->memfree(mf->cache, qe->DataAdditional);
+    --mf->nQAdditional;
+  }
+  qe->DataAdditional = NULL;
 }
 
-static struct QueueEntry  *QAlloc(MatroskaFile *mf) {
-  struct QueueEntry   *qe,**qep;
-  if (mf->QFreeList == NULL) {
-    unsigned              i;
-
-    qep = AGET(mf,QBlocks);
-
-    *qep = mf->cache->memalloc(mf->cache,QSEGSIZE * sizeof(*qe));
-    if (*qep == NULL)
-      errorjmp(mf,"Ouf of memory");
-
-    qe = *qep;
-    for (i=0;i<QSEGSIZE-1;++i) {
-      qe[i].next = qe+i+1;
-      qe[i].Data = NULL;
-      qe[i].DataAdditional = NULL;
+// put the contents of each source queue in front of the matching track queue,
+// in order, the source queues are left empty.
+static void QsDumpHead(MatroskaFile *mf, struct Queue *source) {
+  for (unsigned i = 0; i < mf->nTracks; ++i) {
+    struct Queue *dest = &mf->Queues[i];
+    struct Queue *src = &source[i];
+    if (!src->count) // do nothing if src queue empty
+        continue;
+    QReserve(mf, dest, src->count);
+    while (src->count) { // last source entry first
+      --src->count;
+      dest->head = (dest->head - 1) & (dest->size - 1);
+      dest->ring[dest->head] = src->ring[(src->head + src->count) & (src->size - 1)];
+      ++dest->count;
     }
-    qe[QSEGSIZE-1].next = NULL;
-    qe[QSEGSIZE-1].Data = NULL;
-    qe[QSEGSIZE-1].DataAdditional = NULL;
-
-    mf->QFreeList = qe;
+    MASKSET(mf->QActive, i);
   }
+}
 
-  qe = mf->QFreeList;
-  mf->QFreeList = qe->next;
-
-  return qe;
+// an entry kept outside the track queues must survive EmptyQueues,
+// so its payload is accounted as borrowed until it is put back
+static void QDetach(struct QueueEntry *qe) {
+  if (qe->Chunk && !qe->Detached) {
+    --qe->Chunk->queued;
+    ++qe->Chunk->refs;
+  }
+  qe->Detached = 1;
 }
 
-static inline void QFree(MatroskaFile *mf,struct QueueEntry *qe) {
-  mf->cache->memfree(mf->cache, qe->Data);
-  qe->Data = NULL;
-  mf->cache->memfree(mf->cache, qe->DataAdditional);
-  qe->DataAdditional = NULL;
-  qe->next = mf->QFreeList;
-  mf->QFreeList = qe;
+static void QAttach(struct QueueEntry *qe) {
+  if (qe->Chunk && qe->Detached) {
+    --qe->Chunk->refs;
+    ++qe->Chunk->queued;
+  }
+  qe->Detached = 0;
 }
 
 // deallocatee an array of Queues, one for each track
 static void QsStructFree(MatroskaFile *mf, struct Queue *q) {
   for (int i = 0; i < mf->nTracks; ++i) {
-    while (q[i].head)
+    while (q[i].count)
       QFree(mf, QGet(&q[i]));
+    mf->cache->memfree(mf->cache, q[i].ring);
   }
   mf->cache->memfree(mf->cache, q);
 }
 
+// get index in mf->Tracks corresponding to trackNum
+// returns -1 if track number is invalid
+static inline int TrackNumToIndex(MatroskaFile *mf, ulonglong trackNum) {
+  return trackNum < mf->nTrackIndex ? (int)mf->TrackIndex[trackNum] - 1 : -1;
+}
+
+// pick the buffer bounds from the open flags, readahead is capped
+// to half of the stream cache like in readMoreBlocks
+static void initbuf(MatroskaFile *mf) {
+  unsigned  shift = (mf->flags >> MKVF_BUFFER_SHIFT) & 0x1f;
+  unsigned  cache = mf->cache->getcachesize(mf->cache) >> 1;
+
+  if (shift < IBSZ_LOW)
+    shift = IBSZ_LOW;
+  if (shift > IBSZ_HIGH)
+    shift = IBSZ_HIGH;
+
+  mf->bufmax = 1 << shift;
+  if ((unsigned)mf->bufmax > cache)
+    mf->bufmax = cache < IBSZ_MIN ? IBSZ_MIN : cache;
+
+  mf->bufmin = 1 << IBSZ_LOW;
+  if (mf->bufmin > mf->bufmax)
+    mf->bufmin = mf->bufmax;
+
+  mf->bufwant = mf->bufmin;
+  mf->bufseek = 1;
+}
+
 // fill the buffer at current position
 static void fillbuf(MatroskaFile *mf) {
   int            rd;
+  const void    *p = NULL;
+
+  // no seek since the last refill means sequential reading
+  if (!mf->bufseek && mf->bufwant < mf->bufmax)
+    mf->bufwant <<= 1;
+  mf->bufseek = 0;
 
   // advance buffer pointers
   mf->bufbase += mf->buflen;
   mf->buflen = mf->bufpos = 0;
 
+  // use the stream memory when it is available
+  if (mf->cache->getdata)
+    p = mf->cache->getdata(mf->cache, mf->bufbase, mf->bufwant);
+
+  if (p) {
+    mf->inbuf = p;
+    mf->buflen = mf->bufwant;
+    return;
+  }
+
+  if (mf->ownsize < mf->bufwant) {
+    char  *np = mf->cache->memrealloc(mf->cache, mf->ownbuf, mf->bufwant);
+    if (np == NULL)
+      errorjmp(mf,"Out of memory");
+    mf->ownbuf = np;
+    mf->ownsize = mf->bufwant;
+  }
+
   // get the relevant page
-  rd = mf->cache->read(mf->cache, mf->bufbase, mf->inbuf, IBSZ);
+  rd = mf->cache->read(mf->cache, mf->bufbase, mf->ownbuf, mf->bufwant);
   if (rd<0)
     errorjmp(mf,"I/O Error: %s",mf->cache->geterror(mf->cache));
 
+  mf->inbuf = mf->ownbuf;
   mf->buflen = rd;
 }
 
@@ -604,7 +890,14 @@ static void   readbytes(MatroskaFile *mf,void *buffer,int len) {
   len -= nb;
   cp += nb;
 
-  if (len>0) {
+  // small reads go through the buffer, large ones straight to the stream
+  if (len>0 && len <= mf->bufwant >> 2) {
+    fillbuf(mf);
+    if (mf->buflen < len)
+      errorjmp(mf,"Short read: got %d bytes of %d",mf->buflen,len);
+    memcpy(cp, mf->inbuf, len);
+    mf->bufpos = len;
+  } else if (len>0) {
     mf->bufbase += mf->buflen;
     mf->bufpos = mf->buflen = 0;
 
@@ -617,6 +910,26 @@ static void   readbytes(MatroskaFile *mf,void *buffer,int len) {
   }
 }
 
+static void   skipbytes(MatroskaFile *mf,ulonglong len);
+
+// point qe at the frame payload at the current position, in place
+// if the stream can hand out its memory, copied into the slab otherwise
+static void   readframe(MatroskaFile *mf,struct QueueEntry *qe) {
+  const void  *p = NULL;
+
+  if (mf->cache->getdata)
+    p = mf->cache->getdata(mf->cache,filepos(mf),qe->Length);
+
+  if (p) {
+    qe->Data = (char *)p;
+    qe->Chunk = NULL;
+    skipbytes(mf,qe->Length);
+  } else {
+    qe->Data = SlabAlloc(mf,qe->Length + 16,&qe->Chunk);
+    readbytes(mf,qe->Data,qe->Length);
+  }
+}
+
 static void   skipbytes(MatroskaFile *mf,ulonglong len) {
   int            nb = mf->buflen - mf->bufpos;
 
@@ -635,13 +948,15 @@ static void   skipbytes(MatroskaFile *mf,ulonglong len) {
 }
 
 static void seek(MatroskaFile *mf,ulonglong pos) {
-  // see if pos is inside buffer
-  if (pos>=mf->bufbase && pos<mf->bufbase+mf->buflen)
+  // see if pos is inside buffer, or right where reading continues
+  if (pos>=mf->bufbase && pos<=mf->bufbase+mf->buflen)
     mf->bufpos = (unsigned)(pos - mf->bufbase);
   else {
-    // invalidate buffer and set pointer
+    // invalidate buffer and set pointer, readahead starts over
     mf->bufbase = pos;
     mf->buflen = mf->bufpos = 0;
+    mf->bufwant = mf->bufmin;
+    mf->bufseek = 1;
   }
 }
 
@@ -1491,12 +1806,6 @@ static void parseTrackEntry(MatroskaFile *mf,ulonglong toplen) {
   size_t            cplen = 0, cslen = 0, cpadd = 0;
   unsigned            CompScope, num_comp = 0;
 
-  if (mf->nTracks >= MAX_TRACKS) {
-    //errorjmp(mf,"Too many tracks.");
-    skipbytes(mf, toplen);
-    return;
-  }
-
   // clear track info
   memset(&t,0,sizeof(t));
 
@@ -1511,9 +1820,9 @@ static void parseTrackEntry(MatroskaFile *mf,ulonglong toplen) {
   FOREACH(mf,toplen)
     case 0xd7: // TrackNumber
       v = readUInt(mf,(unsigned)len);
-      if (v>255)
-        errorjmp(mf,"Track number is >255 (%d)",(int)v);
-      t.Number = (unsigned char)v;
+      if (v>MAX_TRACKNUMBER)
+        errorjmp(mf,"Track number is >%d (%llu)",MAX_TRACKNUMBER,v);
+      t.Number = (unsigned)v;
       break;
     case 0x73c5: // TrackUID
       t.UID = readUInt(mf,(unsigned)len);
@@ -1796,6 +2105,31 @@ static void parseTrackEntry(MatroskaFile *mf,ulonglong toplen) {
   *tpp = tp;
 }
 
+// rebuild the track number lookup table
+static void indexTracks(MatroskaFile *mf) {
+  unsigned  i, top = 0;
+  unsigned  *index;
+
+  for (i=0;i<mf->nTracks;++i)
+    if (mf->Tracks[i]->Number >= top)
+      top = mf->Tracks[i]->Number + 1;
+
+  if (top == 0)
+    return;
+
+  index = mf->cache->memrealloc(mf->cache,mf->TrackIndex,top * sizeof(*index));
+  if (index == NULL)
+    errorjmp(mf,"Out of memory");
+  memset(index,0,top * sizeof(*index));
+
+  // on duplicate numbers the first track wins
+  for (i=mf->nTracks;i>0;--i)
+    index[mf->Tracks[i-1]->Number] = i;
+
+  mf->TrackIndex = index;
+  mf->nTrackIndex = top;
+}
+
 static void parseTracks(MatroskaFile *mf,ulonglong toplen) {
   mf->seen.Tracks = 1;
   FOREACH(mf,toplen)
@@ -1803,6 +2137,8 @@ static void parseTracks(MatroskaFile *mf,ulonglong toplen) {
       parseTrackEntry(mf,len);
       break;
   ENDFOR(mf);
+
+  indexTracks(mf);
 }
 
 static void addCue(MatroskaFile *mf,ulonglong pos,ulonglong timecode) {
@@ -1815,26 +2151,31 @@ static void addCue(MatroskaFile *mf,ulonglong pos,ulonglong timecode) {
   cc->Block = 0;
 }
 
+static void setCueBestType(MatroskaFile *mf) {
+  unsigned  i;
+  unsigned char nBestType = -1;
+
+  for (i=0;i<mf->nCues;++i) {
+    int n = TrackNumToIndex(mf, mf->Cues[i].Track);
+    if (n >= 0)
+        nBestType = mf->Tracks[n]->Type;
+  }
+
+  mf->CueBestType = nBestType;
+}
+
 static void fixupCues(MatroskaFile *mf) {
   // adjust cues, shift cues if file does not start at 0
   unsigned  i;
   longlong  adjust = mf->firstTimecode * mf->Seg.TimecodeScale;
-  unsigned char nBestType = -1;
-
 
   for (i=0;i<mf->nCues;++i) {
     mf->Cues[i].Time *= mf->Seg.TimecodeScale;
     mf->Cues[i].Time -= adjust;
     mf->Cues[i].Duration *= mf->Seg.TimecodeScale;
-
-
-    for (int n = 0; n < mf->nTracks; ++n) {
-        if (mf->Tracks[n]->Number == mf->Cues[i].Track)
-            nBestType = mf->Tracks[n]->Type;
-    }
   }
 
-  mf->CueBestType = nBestType;
+  setCueBestType(mf);
 }
 
 static void parseCues(MatroskaFile *mf,ulonglong toplen) {
@@ -1878,9 +2219,9 @@ static void parseCues(MatroskaFile *mf,ulonglong toplen) {
           FOREACH(mf,len)
             case 0xf7: // CueTrack
               v = readUInt(mf,(unsigned)len);
-              if (v>255)
-                errorjmp(mf,"CueTrack points to an invalid track: %d",(int)v);
-              cc.Track = (unsigned char)v;
+              if (v>MAX_TRACKNUMBER)
+                errorjmp(mf,"CueTrack points to an invalid track: %llu",v);
+              cc.Track = (unsigned)v;
               break;
             case 0xb2: // CueDuration
               cc.Duration = readUInt(mf,(unsigned)len);
@@ -2420,6 +2761,7 @@ static void parseBlockAdditions(MatroskaFile *mf, ulonglong toplen, struct Queue
         qe->AdditionalID = add_id;
         qe->DataAdditional = add_data;
         qe->DataAdditionalLength = add_len;
+        ++mf->nQAdditional;
       } else if(add_data) {
         mf->cache->memfree(mf->cache,add_data);
       }
@@ -2432,12 +2774,12 @@ static void parseBlockGroup(MatroskaFile *mf,ulonglong toplen,ulonglong timecode
   ulonglong        duration = 0;
   ulonglong        dpos;
   longlong         discard = 0;
-  struct QueueEntry *qe,*qf = NULL;
+  struct QueueEntry *qe,*qf = NULL,frame;
+  struct Queue      *q = NULL;
   unsigned char        have_duration = 0, have_block = 0;
   unsigned char        gap = 0;
   unsigned char        lacing = 0;
   unsigned char        ref = 0;
-  unsigned char        trackid;
   unsigned        tracknum = 0;
   int                c;
   unsigned        nframes = 0,i;
@@ -2461,21 +2803,14 @@ blockex:
       dpos = filepos(mf);
 
       v = readVLUInt(mf);
-      if (v>255)
-        errorjmp(mf,"Invalid track number in Block: %d",(int)v);
-      trackid = (unsigned char)v;
+      c = TrackNumToIndex(mf,v);
 
-      for (tracknum=0;tracknum<mf->nTracks;++tracknum)
-        if (mf->Tracks[tracknum]->Number == trackid) {
-          if (mf->trackMask & (ULL(1)<<tracknum)) // ignore this block
-            break;
-          goto found;
-        }
-
-      // bad trackid/unsupported track
-      skipbytes(mf,start + tmplen - filepos(mf)); // shortcut
-      return;
-found:
+      // bad trackid/unsupported track, or ignore this block
+      if (c < 0 || MASKTEST(mf->trackMask,c)) {
+        skipbytes(mf,start + tmplen - filepos(mf)); // shortcut
+        return;
+      }
+      tracknum = c;
 
       block_timecode = (signed short)readSInt(mf,2);
 
@@ -2538,26 +2873,26 @@ found:
       }
 
       v = filepos(mf);
+      q = &mf->Queues[tracknum];
+      // room for the whole lace, qf must stay put until the group is parsed
+      QReserve(mf,q,nframes);
       qf = NULL;
       for (i=0;i<nframes;++i) {
-        qe = QAlloc(mf);
-        if (!qf)
-          qf = qe;
-
-        qe->Start = timecode;
-        qe->End = timecode;
-        qe->Position = v;
-        qe->Length = sizes[i];
-        qe->Data = (char *)mf->cache->memalloc(mf->cache,qe->Length + 16);
-        readbytes(mf, qe->Data, qe->Length);
-        qe->flags = FRAME_UNKNOWN_END | FRAME_KF;
+        memset(&frame,0,sizeof(frame));
+        frame.Start = timecode;
+        frame.End = timecode;
+        frame.Position = v;
+        frame.Length = sizes[i];
+        readframe(mf,&frame);
+        frame.flags = FRAME_UNKNOWN_END | FRAME_KF;
         if (i == nframes-1 && gap)
-          qe->flags |= FRAME_GAP;
+          frame.flags |= FRAME_GAP;
         if (i > 0)
-          qe->flags |= FRAME_UNKNOWN_START;
-        qe->DiscardPadding = 0;
+          frame.flags |= FRAME_UNKNOWN_START;
 
-        QPut(&mf->Queues[tracknum],qe);
+        qe = QTrackPut(mf,tracknum,&frame);
+        if (!qf)
+          qf = qe;
 
         v += sizes[i];
       }
@@ -2598,7 +2933,7 @@ out:
       duration = mul3(mf->Tracks[tracknum]->TimecodeScale,
         duration * mf->Seg.TimecodeScale);
 
-      for (qe = qf; nframes > 1; --nframes, qe = qe->next) {
+      for (qe = qf; nframes > 1; --nframes, qe = QNext(q,qe)) {
         qe->Start = v;
         v += defd;
         duration -= defd;
@@ -2611,7 +2946,7 @@ out:
       qe->End = v + duration;
       qe->flags &= ~FRAME_UNKNOWN_END;
     } else if (mf->Tracks[tracknum]->DefaultDuration) {
-      for (qe = qf; nframes > 0; --nframes, qe = qe->next) {
+      for (qe = qf; nframes > 0; --nframes, qe = QNext(q,qe)) {
         qe->Start = v;
         v += defd;
         qe->End = v;
@@ -2637,32 +2972,58 @@ out:
   if (ref)
     while (qf) {
       qf->flags &= ~FRAME_KF;
-      qf = qf->next;
+      qf = QNext(q,qf);
     }
 }
 
-static void ClearQueue(MatroskaFile *mf,struct Queue *q) {
-  struct QueueEntry *qe,*qn;
+static void ClearQueue(MatroskaFile *mf,unsigned n) {
+  struct Queue      *q = &mf->Queues[n];
 
-  for (qe=q->head;qe;qe=qn) {
-    qn = qe->next;
-    mf->cache->memfree(mf->cache, qe->Data);
-    qe->Data = NULL;
-    mf->cache->memfree(mf->cache, qe->DataAdditional);
-    qe->DataAdditional = NULL;
-    qe->next = mf->QFreeList;
-    mf->QFreeList = qe;
-  }
+  while (q->count)
+    QFree(mf,QGet(q));
 
-  q->head = NULL;
-  q->tail = NULL;
+  q->head = 0;
+  MASKCLR(mf->QActive,n);
+}
+
+// drop whatever is queued for the ignored tracks
+static void applyTrackMask(MatroskaFile *mf) {
+  unsigned int          w;
+  ulonglong             masked;
+
+  for (w=0;w<mf->nMaskWords;++w)
+    for (masked = mf->QActive[w] & mf->trackMask[w]; masked; masked &= masked - 1)
+      ClearQueue(mf,(w << 6) + QLowest(masked));
 }
 
 static void EmptyQueues(MatroskaFile *mf) {
-  unsigned            i;
+  unsigned            w;
+  ulonglong           active;
+  struct Queue        *q;
+  struct QueueEntry   *qe;
+
+  for (w=0;w<mf->nMaskWords;++w) {
+    for (active = mf->QActive[w]; active; active &= active - 1) {
+      q = &mf->Queues[(w << 6) + QLowest(active)];
+
+      // block additions are owned by their entries and freed one by one
+      if (mf->nQAdditional)
+        for (qe = QHead(q); qe; qe = QNext(q,qe))
+          if (qe->DataAdditional) {
+            mf->cache->memfree(mf->cache,qe->DataAdditional);
+            qe->DataAdditional = NULL;
+            --mf->nQAdditional;
+          }
 
-  for (i=0;i<mf->nTracks;++i)
-    ClearQueue(mf,&mf->Queues[i]);
+      // the ring is reset in place
+      q->head = 0;
+      q->count = 0;
+    }
+    mf->QActive[w] = 0;
+  }
+
+  // and the slab forgets every queued frame at once
+  SlabDropQueued(mf);
 }
 
 static int  readMoreBlocks(MatroskaFile *mf) {
@@ -2671,8 +3032,11 @@ static int  readMoreBlocks(MatroskaFile *mf) {
   int                        cid, ret = 0;
   jmp_buf                jb;
   volatile unsigned        retries = 0;
+  // set once, before the setjmp below
+  const ulonglong        top = mf->readLimit && mf->readLimit < mf->pSegmentTop ?
+                                mf->readLimit : mf->pSegmentTop;
 
-  if (mf->readPosition >= mf->pSegmentTop)
+  if (mf->readPosition >= top)
     return EOF;
 
   memcpy(&jb,&mf->jb,sizeof(jb));
@@ -2688,12 +3052,12 @@ static int  readMoreBlocks(MatroskaFile *mf) {
       goto ex;
 
     for (;;) {
-      if (filepos(mf) >= mf->pSegmentTop)
+      if (filepos(mf) >= top)
         goto ex;
 
       cp = mf->cache->scan(mf->cache,filepos(mf),0x1f43b675); // cluster
 
-      if (cp < 0 || (ulonglong)cp >= mf->pSegmentTop)
+      if (cp < 0 || (ulonglong)cp >= top)
         goto ex;
 
       seek(mf,cp);
@@ -2722,7 +3086,7 @@ static int  readMoreBlocks(MatroskaFile *mf) {
 
   seek(mf,mf->readPosition);
 
-  while (filepos(mf) < mf->pSegmentTop) {
+  while (filepos(mf) < top) {
     cid = readID(mf);
     if (cid == EOF) {
       ret = EOF;
@@ -2747,21 +3111,7 @@ static int  readMoreBlocks(MatroskaFile *mf) {
         case 0xab: // PrevSize
           readUInt(mf,(unsigned)len);
           break;
-        case 0x5854: { // SilentTracks
-          ulonglong stmask = 0;
-          unsigned  i, trk;
-          FOREACH(mf, len)
-            case 0x58d7: // SilentTrackNumber
-              trk = (unsigned)readUInt(mf, (unsigned)len);
-              for (i = 0; i < mf->nTracks; ++i)
-                if (mf->Tracks[i]->Number == trk) {
-                  stmask |= ULL(1) << i;
-                  break;
-                }
-              break;
-          ENDFOR(mf);
-          // TODO pass stmask to reading app
-          break; }
+        // SilentTracks is skipped, the reading app has no use for it
         case 0xa0: // BlockGroup
           if (!have_timecode)
             errorjmp(mf,"Found BlockGroup before cluster TimeCode");
@@ -2795,42 +3145,83 @@ ex:
   return ret;
 }
 
+// any frames queued for the tracks not in mask, NULL masks nothing
+static int  haveFrames(MatroskaFile *mf,const ulonglong *mask) {
+  unsigned    w;
+
+  for (w=0;w<mf->nMaskWords;++w)
+    if (mf->QActive[w] & ~(mask ? mask[w] : 0))
+      return 1;
+
+  return 0;
+}
+
 // this is almost the same as readMoreBlocks, except it ensures
 // there are no partial frames queued, however empty queues are ok
-static int  fillQueues(MatroskaFile *mf,ulonglong mask) {
-  unsigned    i,j;
+static int  fillQueues(MatroskaFile *mf,const ulonglong *mask) {
   int              ret = 0;
 
   for (;;) {
-    j = 0;
-
-    for (i=0;i<mf->nTracks;++i)
-      if (mf->Queues[i].head && !(mask & (ULL(1)<<i)))
-        ++j;
-
-    if (j>0) // have at least some frames
+    if (haveFrames(mf,mask)) // have at least some frames
       return ret;
 
     if ((ret = readMoreBlocks(mf)) < 0) {
-      j = 0;
-      for (i=0;i<mf->nTracks;++i)
-        if (mf->Queues[i].head && !(mask & (ULL(1)<<i)))
-          ++j;
-      if (j) // we adjusted some blocks
+      if (haveFrames(mf,mask)) // we adjusted some blocks
         return 0;
       return EOF;
     }
   }
 }
 
+// cluster signature candidates, fetched in batches from streams
+// that can return many offsets per scan
+#define        SCANBATCH  64
+
+struct ScanBatch {
+  longlong    offsets[SCANBATCH];
+  int         n, cur;
+  ulonglong   next;   // where the next batch starts
+};
+
+static longlong nextClusterCandidate(MatroskaFile *mf,struct ScanBatch *sb,
+                                     ulonglong pos,ulonglong window)
+{
+  if (!mf->cache->scanall)
+    return mf->cache->scan(mf->cache,pos,0x1f43b675);
+
+  for (;;) {
+    ulonglong start, end;
+
+    while (sb->cur < sb->n) {
+      longlong  cp = sb->offsets[sb->cur++];
+      if ((ulonglong)cp >= pos)
+        return cp;
+    }
+
+    start = pos > sb->next ? pos : sb->next;
+    if (start >= mf->pSegmentTop)
+      return -1;
+
+    end = mf->pSegmentTop - start > window ? start + window : mf->pSegmentTop;
+
+    sb->cur = 0;
+    sb->n = mf->cache->scanall(mf->cache,start,end,0x1f43b675,sb->offsets,SCANBATCH);
+    if (sb->n < 0)
+      return -1;
+
+    sb->next = sb->n == SCANBATCH ? sb->offsets[SCANBATCH-1] + 1 : end;
+  }
+}
+
 static void reindex(MatroskaFile *mf) {
   jmp_buf     jb;
   ulonglong   pos = mf->pCluster;
   ulonglong   step = 10*1024*1024;
   ulonglong   size, tc, isize;
-  longlong    next_cluster;
+  volatile longlong next_cluster;
   int              id, have_tc, bad;
   struct Cue  *cue;
+  struct ScanBatch sb;
 
   if (pos >= mf->pSegmentTop)
     return;
@@ -2846,6 +3237,8 @@ static void reindex(MatroskaFile *mf) {
   mf->nCues = 0;
 
   bad = 0;
+  sb.n = sb.cur = 0;
+  sb.next = 0;
 
   while (pos < mf->pSegmentTop) {
     if (!mf->cache->progress(mf->cache,pos,mf->pSegmentTop))
@@ -2858,7 +3251,7 @@ static void reindex(MatroskaFile *mf) {
     }
 
     // find next cluster header
-    next_cluster = mf->cache->scan(mf->cache,pos,0x1f43b675); // cluster
+    next_cluster = nextClusterCandidate(mf,&sb,pos,step); // cluster
     if (next_cluster < 0 || (ulonglong)next_cluster >= mf->pSegmentTop)
       break;
 
@@ -2916,7 +3309,9 @@ static void reindex(MatroskaFile *mf) {
     // good cluster, remember it
     cue = AGET(mf,Cues);
     cue->Time = tc;
+    cue->Duration = 0;
     cue->Position = next_cluster - mf->pSegment;
+    cue->RelativePosition = 0;
     cue->Block = 0;
     cue->Track = 0;
 
@@ -2933,7 +3328,9 @@ static void reindex(MatroskaFile *mf) {
   if (mf->nCues == 0) {
     cue = AGET(mf,Cues);
     cue->Time = mf->firstTimecode;
+    cue->Duration = 0;
     cue->Position = mf->pCluster - mf->pSegment;
+    cue->RelativePosition = 0;
     cue->Block = 0;
     cue->Track = 0;
   }
@@ -2955,6 +3352,27 @@ static void fixupChapter(ulonglong adj, struct Chapter *ch) {
     fixupChapter(adj,&ch->Children[i]);
 }
 
+// allocate the queues, the track sets and the seek scratch,
+// everything is sized to the number of tracks in the file
+static void initReader(MatroskaFile *mf) {
+  unsigned  n = mf->nTracks ? mf->nTracks : 1;
+  unsigned  words = MASKWORDS(n);
+
+  mf->Queues = mf->cache->memalloc(mf->cache,n * sizeof(*mf->Queues));
+  mf->trackMask = mf->cache->memalloc(mf->cache,4 * words * sizeof(*mf->trackMask));
+  mf->seekTime = mf->cache->memalloc(mf->cache,n * sizeof(*mf->seekTime));
+  mf->seekSeen = mf->cache->memalloc(mf->cache,n);
+  if (mf->Queues == NULL || mf->trackMask == NULL || mf->seekTime == NULL || mf->seekSeen == NULL)
+    errorjmp(mf, "Ouf of memory");
+
+  memset(mf->Queues, 0, n * sizeof(*mf->Queues));
+  memset(mf->trackMask, 0, 4 * words * sizeof(*mf->trackMask));
+  mf->QActive = mf->trackMask + words;
+  mf->seekMask = mf->QActive + words;
+  mf->readMask = mf->seekMask + words;
+  mf->nMaskWords = words;
+}
+
 static longlong        findLastTimecode(MatroskaFile *mf) {
   ulonglong   nd = 0;
   unsigned    n,vtrack,vtrackid,retry=0,cueoffset=0;
@@ -2974,7 +3392,8 @@ ok:
 
   EmptyQueues(mf);
 
-  mf->trackMask = ~(ULL(1) << vtrack);
+  memset(mf->trackMask,0xff,mf->nMaskWords * sizeof(*mf->trackMask));
+  MASKCLR(mf->trackMask,vtrack);
 
   while (nd == 0 && retry < MAXDURATIONRETRY) {
     if (mf->nCues == 0) {
@@ -2998,20 +3417,20 @@ ok:
     }
 
     do
-      while (mf->Queues[vtrack].head)
+      while (QHead(&mf->Queues[vtrack]))
       {
-        ulonglong   tc = mf->Queues[vtrack].head->flags & FRAME_UNKNOWN_END ?
-          mf->Queues[vtrack].head->Start : mf->Queues[vtrack].head->End;
+        ulonglong   tc = QHead(&mf->Queues[vtrack])->flags & FRAME_UNKNOWN_END ?
+          QHead(&mf->Queues[vtrack])->Start : QHead(&mf->Queues[vtrack])->End;
         if (nd < tc)
           nd = tc;
-        QFree(mf, QGet(&mf->Queues[vtrack]));
+        QFree(mf,QTrackGet(mf,vtrack));
       }
-    while (fillQueues(mf, 0) != EOF);
+    while (fillQueues(mf, NULL) != EOF);
 
     retry++;
   }
 
-  mf->trackMask = 0;
+  memset(mf->trackMask,0,mf->nMaskWords * sizeof(*mf->trackMask));
 
   EmptyQueues(mf);
 
@@ -3086,11 +3505,7 @@ segment:
   // release extra memory
   ARELEASE(mf,mf,Tracks);
 
-  // initialize reader
-  mf->Queues = mf->cache->memalloc(mf->cache,mf->nTracks * sizeof(*mf->Queues));
-  if (mf->Queues == NULL)
-    errorjmp(mf, "Ouf of memory");
-  memset(mf->Queues, 0, mf->nTracks * sizeof(*mf->Queues));
+  initReader(mf);
 
   // try to detect real duration
   if (!(mf->flags & MKVF_AVOID_SEEKS)) {
@@ -3184,21 +3599,22 @@ static void DeleteChapter(MatroskaFile *mf,struct Chapter *ch) {
 // or SimpleBlock or BlockGroup element and the Queues are all empty.
 //
 // Parse the block at relative position cueRelativePosition within the
-// cluster at absolute offset clusterOffset and return a pointer to a QueueEntry
-// storing its data. (This only parses the block and not sibling
+// cluster at absolute offset clusterOffset and copy it into the QueueEntry
+// ret. (This only parses the block and not sibling
 // elements so the start timecode will equal the end timecode.)
 // If we are not right at the start of something resembling a block,
-// returns NULL. The caller is responsible for ensuring eventual disposal
+// returns 0. The caller is responsible for ensuring eventual disposal
 // of the QueueEntry via the QFree function. This function gurantees mf queues
 // are empty after completing.
 //
 // The returned QueueEntry may have garbage Start and End values
-static struct QueueEntry* seekAndReadLoneBlock(MatroskaFile *mf, ulonglong clusterOffset, ulonglong cueRelativePosition) {
+static int seekAndReadLoneBlock(MatroskaFile *mf, ulonglong clusterOffset, ulonglong cueRelativePosition, struct QueueEntry *ret) {
   jmp_buf jb;
   int ebmlID;
   ulonglong toplen;
   int nTracks = mf->nTracks;
-  struct QueueEntry *ret = NULL;
+  struct QueueEntry *qe;
+  volatile int found = 0;
   ulonglong clusterRelZero;
 
   memcpy(&jb, &mf->jb, sizeof(jb));
@@ -3224,9 +3640,13 @@ static struct QueueEntry* seekAndReadLoneBlock(MatroskaFile *mf, ulonglong clust
 
     // find the block and return it
     for (int i = 0; i < nTracks; ++i) {
-      ret = QGet(&mf->Queues[i]);
-      if (ret)
+      qe = QTrackGet(mf, i);
+      if (qe) {
+        *ret = *qe;
+        QDetach(ret);
+        found = 1;
         break;
+      }
     }
   }
 
@@ -3235,18 +3655,7 @@ out:
   // for subtitle blocks, we might have a nonempty queue.
   EmptyQueues(mf);
   memcpy(&mf->jb, &jb, sizeof(jb));
-  return ret;
-}
-
-// get index in mf->Tracks corresponding to trackNum
-// returns -1 if track number is invalid
-static int TrackNumToIndex(MatroskaFile *mf, unsigned char trackNum) {
-  int nTracks = mf->nTracks;
-  for (int i = 0; i < nTracks; ++i)
-      if (mf->Tracks[i]->Number == trackNum)
-          return i;
-
-  return -1;
+  return found;
 }
 
 // returns the index of the next cue at index >= startIdx that corresponds
@@ -3266,7 +3675,7 @@ static int NextPESubtitleIdx(MatroskaFile *mf, ulonglong timecode, int startIdx)
       } else {
           int trackIndex = TrackNumToIndex(mf, cue.Track);
 
-          if (trackIndex >= 0 && mf->Tracks[trackIndex]->Type == TT_SUB && !(mf->trackMask & (ULL(1) << trackIndex))
+          if (trackIndex >= 0 && mf->Tracks[trackIndex]->Type == TT_SUB && !MASKTEST(mf->trackMask, trackIndex)
               && cue.Duration && cue.RelativePosition && cue.Time + cue.Duration >= timecode) {
 
               return i;
@@ -3278,7 +3687,7 @@ static int NextPESubtitleIdx(MatroskaFile *mf, ulonglong timecode, int startIdx)
 }
 
 static void GetSubtitlePreroll(MatroskaFile *mf, ulonglong timecode, struct Queue *subPreQueues) {
-  struct QueueEntry *qe;
+  struct QueueEntry qe;
   Cue cue;
   ulonglong prevPosition = 0, prevRelativePosition = 0;
 
@@ -3294,13 +3703,11 @@ static void GetSubtitlePreroll(MatroskaFile *mf, ulonglong timecode, struct Queu
       continue;
 
     // read the block contents into a QueueEntry and insert it
-    qe = seekAndReadLoneBlock(mf, mf->pSegment + cue.Position, cue.RelativePosition);
-
-    if (qe) {
+    if (seekAndReadLoneBlock(mf, mf->pSegment + cue.Position, cue.RelativePosition, &qe)) {
       int trackIndex = TrackNumToIndex(mf, cue.Track);
-      qe->Start = mul3(mf->Tracks[trackIndex]->TimecodeScale, cue.Time);
-      qe->End = qe->Start + cue.Duration;
-      QPut(&subPreQueues[trackIndex], qe);
+      qe.Start = mul3(mf->Tracks[trackIndex]->TimecodeScale, cue.Time);
+      qe.End = qe.Start + cue.Duration;
+      QPut(mf, &subPreQueues[trackIndex], &qe);
     }
 
     // save present Position and RelativePosition for future comparisons
@@ -3326,6 +3733,7 @@ MatroskaFile  *mkv_OpenEx(InputStream *io,
 
   mf->cache = io;
   mf->flags = flags;
+  initbuf(mf);
   io->progress(io,0,0);
 
   if (setjmp(mf->jb)==0) {
@@ -3353,6 +3761,7 @@ MatroskaFile  *mkv_OpenSparse(InputStream *io,
 
   mf->cache = io;
   mf->flags = MKVF_AVOID_SEEKS;
+  initbuf(mf);
   io->progress(io,0,0);
 
   if (setjmp(mf->jb)==0) {
@@ -3375,6 +3784,7 @@ MatroskaFile  *mkv_Open(InputStream *io,
 
 void              mkv_Close(MatroskaFile *mf) {
   unsigned  i,j;
+  struct QueueEntry *qe;
 
   if (mf==NULL)
     return;
@@ -3387,14 +3797,20 @@ void              mkv_Close(MatroskaFile *mf) {
   }
   mf->cache->memfree(mf->cache,mf->Tracks);
 
-  for (i=0;i<mf->nQBlocks;++i) {
-    for (j=0;j<QSEGSIZE;j++)
-      mf->cache->memfree(mf->cache, mf->QBlocks[i][j].Data);
-    mf->cache->memfree(mf->cache,mf->QBlocks[i]);
-  }
-  mf->cache->memfree(mf->cache,mf->QBlocks);
+  if (mf->Queues)
+    for (i=0;i<mf->nTracks;++i) {
+      for (qe = QHead(&mf->Queues[i]); qe; qe = QNext(&mf->Queues[i],qe))
+        mf->cache->memfree(mf->cache, qe->DataAdditional);
+      mf->cache->memfree(mf->cache,mf->Queues[i].ring);
+    }
+
+  SlabFreeAll(mf);
 
   mf->cache->memfree(mf->cache,mf->Queues);
+  mf->cache->memfree(mf->cache,mf->trackMask);
+  mf->cache->memfree(mf->cache,mf->seekTime);
+  mf->cache->memfree(mf->cache,mf->seekSeen);
+  mf->cache->memfree(mf->cache,mf->TrackIndex);
 
   mf->cache->memfree(mf->cache,mf->Seg.Title);
   mf->cache->memfree(mf->cache,mf->Seg.MuxingApp);
@@ -3427,6 +3843,7 @@ void              mkv_Close(MatroskaFile *mf) {
   mf->cache->memfree(mf->cache,mf->Tags);
 
   mf->cache->memfree(mf->cache, mf->cpbuf);
+  mf->cache->memfree(mf->cache, mf->ownbuf);
   mf->cache->memfree(mf->cache,mf);
 }
 
@@ -3464,6 +3881,37 @@ void              mkv_GetCues(MatroskaFile *mf,Cue **cue,unsigned *count) {
   *count = mf->nCues;
 }
 
+unsigned          mkv_BuildCues(MatroskaFile *mf) {
+  if (mf->nCues || (mf->flags & MKVF_AVOID_SEEKS))
+    return mf->nCues;
+
+  if (setjmp(mf->jb)!=0)
+    return mf->nCues;
+
+  reindex(mf);
+
+  return mf->nCues;
+}
+
+int               mkv_SetCues(MatroskaFile *mf,const Cue *cues,unsigned count) {
+  struct Cue  *copy = NULL;
+
+  if (count) {
+    copy = mf->cache->memalloc(mf->cache,count * sizeof(*copy));
+    if (copy == NULL)
+      return -1;
+    memcpy(copy,cues,count * sizeof(*copy));
+  }
+
+  mf->cache->memfree(mf->cache,mf->Cues);
+  mf->Cues = copy;
+  mf->nCues = mf->nCuesSize = count;
+
+  setCueBestType(mf);
+
+  return 0;
+}
+
 void              mkv_GetTags(MatroskaFile *mf,Tag **tag,unsigned *count) {
   *tag = mf->Tags;
   *count = mf->nTags;
@@ -3473,6 +3921,19 @@ ulonglong     mkv_GetSegmentTop(MatroskaFile *mf) {
   return mf->pSegmentTop;
 }
 
+ulonglong     mkv_GetSegmentBase(MatroskaFile *mf) {
+  return mf->pSegment;
+}
+
+void          mkv_SetReadRange(MatroskaFile *mf,ulonglong start,ulonglong end) {
+  EmptyQueues(mf);
+
+  if (start)
+    mf->readPosition = start;
+  mf->readLimit = end;
+  mf->flags &= ~MPF_ERROR;
+}
+
 #define        IS_DELTA(f) (!((f)->flags & FRAME_KF) || ((f)->flags & FRAME_UNKNOWN_START))
 
 static inline ulonglong mkv_time_diff(ulonglong one, ulonglong two)
@@ -3487,12 +3948,12 @@ void mkv_Seek_CueAware(MatroskaFile *mf, ulonglong timecode, unsigned flags, uns
 {
   if (timecode > 0 && (flags & (MKVF_SEEK_TO_PREV_KEYFRAME|MKVF_SEEK_TO_PREV_KEYFRAME_STRICT))) {
     unsigned int count, i;
-    unsigned char track = 0;
+    unsigned int track = 0;
     ulonglong default_duration = 10000000;
     Cue *cue;
 
     for (i=0;i<mf->nTracks;++i) {
-      if (mf->Tracks[i]->Type == TT_VIDEO && !(mf->trackMask & (ULL(1)<<i))) {
+      if (mf->Tracks[i]->Type == TT_VIDEO && !MASKTEST(mf->trackMask,i)) {
         track = mf->Tracks[i]->Number;
         if (mf->Tracks[i]->DefaultDuration)
           default_duration = mf->Tracks[i]->DefaultDuration;
@@ -3521,21 +3982,19 @@ void mkv_Seek_CueAware(MatroskaFile *mf, ulonglong timecode, unsigned flags, uns
 }
 
 static inline int CueSuitableForSeeking(MatroskaFile *mf, int nCue) {
-  int nTrack = -1, n;
+  int nTrack, n;
   unsigned char nBestTrackType = TT_SUB;
 
   if (nCue < 0 || nCue >= mf->nCues)
     return 0;
 
-  for (n = 0; n < mf->nTracks; ++n) {
-    if (!(mf->trackMask & (ULL(1)<<n)) && mf->Tracks[n]->Type < nBestTrackType)
+  for (n = 0; n < mf->nTracks; ++n)
+    if (!MASKTEST(mf->trackMask,n) && mf->Tracks[n]->Type < nBestTrackType)
       nBestTrackType = mf->Tracks[n]->Type;
 
-    if (mf->Tracks[n]->Number == mf->Cues[nCue].Track)
-      nTrack = n;
-  }
+  nTrack = TrackNumToIndex(mf, mf->Cues[nCue].Track);
 
-  if (nTrack >= 0 && nTrack < mf->nTracks && mf->Tracks[nTrack]->Type > FFMAX(mf->CueBestType, nBestTrackType))
+  if (nTrack >= 0 && mf->Tracks[nTrack]->Type > FFMAX(mf->CueBestType, nBestTrackType))
     return 0;
 
   return 1;
@@ -3544,8 +4003,8 @@ static inline int CueSuitableForSeeking(MatroskaFile *mf, int nCue) {
 void  mkv_Seek(MatroskaFile *mf,ulonglong timecode,unsigned flags) {
   int                i,j,m,ret;
   unsigned        n,z;
-  ulonglong        mask,m_kftime[MAX_TRACKS];
-  unsigned char        m_seendf[MAX_TRACKS];
+  ulonglong        *mask = mf->seekMask,*m_kftime = mf->seekTime;
+  unsigned char        *m_seendf = mf->seekSeen;
   struct Queue      *subPreQueues = NULL;
 
   if (mf->flags & MKVF_AVOID_SEEKS)
@@ -3582,7 +4041,7 @@ void  mkv_Seek(MatroskaFile *mf,ulonglong timecode,unsigned flags) {
       if (setjmp(mf->jb) != 0)
         goto dealloc;
 
-      mkv_SetTrackMask(mf,mf->trackMask);
+      applyTrackMask(mf);
 
       if (flags & (MKVF_SEEK_TO_PREV_KEYFRAME | MKVF_SEEK_TO_PREV_KEYFRAME_STRICT)) {
         // we do this in two stages
@@ -3608,25 +4067,25 @@ void  mkv_Seek(MatroskaFile *mf,ulonglong timecode,unsigned flags) {
           mf->tcCluster = mf->Cues[j].Time;
 
           for (;;) {
-            if ((ret = fillQueues(mf,0)) < 0 || ret == RBRESYNC)
+            if ((ret = fillQueues(mf,NULL)) < 0 || ret == RBRESYNC)
               goto dealloc;
 
             // drain queues until we get to the required timecode
             for (n = 0; n < mf->nTracks; ++n) {
-              if (mf->Queues[n].head && (mf->Queues[n].head->Start<timecode || (m_seendf[n] == 0 && m_kftime[n] == MAXU64))) {
-                if (IS_DELTA(mf->Queues[n].head))
+              if (QHead(&mf->Queues[n]) && (QHead(&mf->Queues[n])->Start<timecode || (m_seendf[n] == 0 && m_kftime[n] == MAXU64))) {
+                if (IS_DELTA(QHead(&mf->Queues[n])))
                   m_seendf[n] = 1;
                 else
-                  m_kftime[n] = mf->Queues[n].head->Start;
+                  m_kftime[n] = QHead(&mf->Queues[n])->Start;
               }
 
-              while (mf->Queues[n].head && mf->Queues[n].head->Start < timecode)
+              while (QHead(&mf->Queues[n]) && QHead(&mf->Queues[n])->Start < timecode)
               {
-                if (IS_DELTA(mf->Queues[n].head))
+                if (IS_DELTA(QHead(&mf->Queues[n])))
                   m_seendf[n] = 1;
                 else
-                  m_kftime[n] = mf->Queues[n].head->Start;
-                QFree(mf,QGet(&mf->Queues[n]));
+                  m_kftime[n] = QHead(&mf->Queues[n])->Start;
+                QFree(mf,QTrackGet(mf,n));
               }
 
               // We've drained the queue, so the frame at head is the next one past the requered point.
@@ -3634,19 +4093,19 @@ void  mkv_Seek(MatroskaFile *mf,ulonglong timecode,unsigned flags) {
               // if it's not an audio track (we accept preroll within a frame for audio), and the head frame
               // is a keyframe
               if (!(flags & MKVF_SEEK_TO_PREV_KEYFRAME_STRICT))
-                if (mf->Queues[n].head && (mf->Tracks[n]->Type != TT_AUDIO || mf->Queues[n].head->Start <= timecode))
-                  if (!IS_DELTA(mf->Queues[n].head))
-                    m_kftime[n] = mf->Queues[n].head->Start;
+                if (QHead(&mf->Queues[n]) && (mf->Tracks[n]->Type != TT_AUDIO || QHead(&mf->Queues[n])->Start <= timecode))
+                  if (!IS_DELTA(QHead(&mf->Queues[n])))
+                    m_kftime[n] = QHead(&mf->Queues[n])->Start;
             }
 
             for (n = 0; n < mf->nTracks; ++n)
-              if (mf->Queues[n].head && mf->Queues[n].head->Start >= timecode)
+              if (QHead(&mf->Queues[n]) && QHead(&mf->Queues[n])->Start >= timecode)
                 goto found;
           }
 found:
 
           for (n = 0; n < mf->nTracks; ++n)
-            if (!(mf->trackMask & (ULL(1) << n)) && m_kftime[n] == MAXU64 &&
+            if (!MASKTEST(mf->trackMask,n) && m_kftime[n] == MAXU64 &&
                 m_seendf[n] && j > 0 && (mf->Tracks[n]->Type == TT_VIDEO || mf->Tracks[n]->Type == TT_AUDIO))
             {
               // we need to restart the search from prev cue
@@ -3669,51 +4128,56 @@ again:;
 
       // no timecodes for ignored streams
       for (n = 0; n < mf->nTracks; ++n)
-        if (mf->trackMask & (ULL(1) << n))
+        if (MASKTEST(mf->trackMask,n))
             m_kftime[n] = MAXU64;
 
-      for (mask = mf->trackMask;;) {
+      memcpy(mask,mf->trackMask,mf->nMaskWords * sizeof(*mask));
+
+      for (;;) {
         if ((ret = fillQueues(mf,mask)) < 0 || ret == RBRESYNC)
           goto dealloc;
 
         // drain queues until we get to the required timecode
         for (n = 0; n < mf->nTracks; ++n) {
           struct QueueEntry *qe;
-          for (qe = mf->Queues[n].head; qe && qe->Start<m_kftime[n]; qe = mf->Queues[n].head)
-            QFree(mf,QGet(&mf->Queues[n]));
+          for (qe = QHead(&mf->Queues[n]); qe && qe->Start<m_kftime[n]; qe = QHead(&mf->Queues[n]))
+            QFree(mf,QTrackGet(mf,n));
         }
 
         for (n = z = 0; n < mf->nTracks; ++n)
-          if (m_kftime[n] == MAXU64 || (mf->Queues[n].head && mf->Queues[n].head->Start >= m_kftime[n])) {
+          if (m_kftime[n] == MAXU64 || (QHead(&mf->Queues[n]) && QHead(&mf->Queues[n])->Start >= m_kftime[n])) {
             ++z;
-            mask |= ULL(1) << n;
+            MASKSET(mask,n);
           } else if (!(mf->Tracks[n]->Type == TT_VIDEO || mf->Tracks[n]->Type == TT_AUDIO)) {
             ++z;
           }
 
         if (z == mf->nTracks) {
           for (int i = 0; i < mf->nTracks; ++i) {
-            if (subPreQueues[i].head) { // if the subPreQueues are not empty
+            if (subPreQueues[i].count) { // if the subPreQueues are not empty
               ulonglong fp = filepos(mf);
-              struct QueueEntry *qe;
-              struct Queue tmpQ = { .head = NULL, .tail = NULL };
+              struct QueueEntry *qe, kept;
+              unsigned k;
 
               // remove any subtitles from queues that are duplicates of stuff in subPreQueues
               if (mf->Tracks[i]->Type == TT_SUB)
-                while (mf->Queues[i].head && mf->Queues[i].head->Start <= timecode)
-                  QFree(mf, QGet(&mf->Queues[i]));
+                while ((qe = QHead(&mf->Queues[i])) && qe->Start <= timecode)
+                  QFree(mf, QTrackGet(mf, i));
 
               // from subPreQueues, filter out any subtitle blocks that we'll see later on in the file
-              // (prevents the occasional case of having a subtitle displayed twice)
-              while (qe = subPreQueues[i].head)
-                  if (qe->Position < fp)
-                      QPut(&tmpQ, QGet(&subPreQueues[i]));
-                  else
-                      QFree(mf, QGet(&subPreQueues[i]));
-              subPreQueues[i] = tmpQ;
+              // (prevents the occasional case of having a subtitle displayed twice),
+              // the kept ones go around to the tail of the same ring
+              for (k = subPreQueues[i].count; k > 0; --k) {
+                  kept = *QGet(&subPreQueues[i]);
+                  if (kept.Position < fp) {
+                      QAttach(&kept);
+                      QPut(mf, &subPreQueues[i], &kept);
+                  } else
+                      QFree(mf, &kept);
+              }
             }
           }
-          QsDumpHead(mf->Queues, subPreQueues, mf->nTracks); // add pre-existing subtitles to the queues
+          QsDumpHead(mf, subPreQueues); // add pre-existing subtitles to the queues
           goto dealloc;
         }
       }
@@ -3735,6 +4199,7 @@ dealloc:
 void  mkv_SkipToKeyframe(MatroskaFile *mf) {
   unsigned  n,wait;
   ulonglong ht;
+  struct QueueEntry *qe,*qn;
 
   if (setjmp(mf->jb)!=0)
     return;
@@ -3743,48 +4208,52 @@ void  mkv_SkipToKeyframe(MatroskaFile *mf) {
   do {
     wait = 0;
 
-    if (fillQueues(mf,0)<0)
+    if (fillQueues(mf,NULL)<0)
       return;
 
     for (n=0;n<mf->nTracks;++n)
-      if (mf->Queues[n].head && !(mf->Queues[n].head->flags & FRAME_KF)) {
+      if (QHead(&mf->Queues[n]) && !(QHead(&mf->Queues[n])->flags & FRAME_KF)) {
         ++wait;
-        QFree(mf,QGet(&mf->Queues[n]));
+        QFree(mf,QTrackGet(mf,n));
       }
   } while (wait);
 
   // find highest queued time
   for (n=0,ht=0;n<mf->nTracks;++n)
-    if (mf->Queues[n].head && ht<mf->Queues[n].head->Start)
-      ht = mf->Queues[n].head->Start;
+    if (QHead(&mf->Queues[n]) && ht<QHead(&mf->Queues[n])->Start)
+      ht = QHead(&mf->Queues[n])->Start;
 
   // ensure the time difference is less than 100ms
   do {
     wait = 0;
 
-    if (fillQueues(mf,0)<0)
+    if (fillQueues(mf,NULL)<0)
       return;
 
     for (n=0;n<mf->nTracks;++n)
-      while (mf->Queues[n].head && mf->Queues[n].head->next &&
-          (mf->Queues[n].head->next->flags & FRAME_KF) &&
-          ht - mf->Queues[n].head->Start > 100000000)
+      while ((qe = QHead(&mf->Queues[n])) && (qn = QNext(&mf->Queues[n],qe)) &&
+          (qn->flags & FRAME_KF) &&
+          ht - qe->Start > 100000000)
       {
         ++wait;
-        QFree(mf,QGet(&mf->Queues[n]));
+        QFree(mf,QTrackGet(mf,n));
       }
 
   } while (wait);
 }
 
 ulonglong mkv_GetLowestQTimecode(MatroskaFile *mf) {
-  unsigned  n,seen;
-  ulonglong t;
+  unsigned  w,seen;
+  ulonglong t,active;
+  struct QueueEntry *qe;
 
   // find the lowest queued timecode
-  for (n=seen=0,t=0;n<mf->nTracks;++n)
-    if (mf->Queues[n].head && (!seen || t > mf->Queues[n].head->Start))
-      t = mf->Queues[n].head->Start, seen=1;
+  for (w=seen=0,t=0;w<mf->nMaskWords;++w)
+    for (active=mf->QActive[w];active;active &= active - 1) {
+      qe = QHead(&mf->Queues[(w << 6) + QLowest(active)]);
+      if (!seen || t > qe->Start)
+        t = qe->Start, seen=1;
+    }
 
   return seen ? t : (ulonglong)LL(-1);
 }
@@ -3800,16 +4269,63 @@ int              mkv_TruncFloat(MKFLOAT f) {
 #define        FTRACK        0xffffffff
 
 void              mkv_SetTrackMask(MatroskaFile *mf,ulonglong mask) {
-  unsigned int          i;
+  if ((mf->flags & MPF_ERROR) || mf->trackMask == NULL)
+    return;
 
-  if (mf->flags & MPF_ERROR)
+  // only the first 64 tracks can be masked this way
+  memset(mf->trackMask,0,mf->nMaskWords * sizeof(*mf->trackMask));
+  mf->trackMask[0] = mask;
+
+  applyTrackMask(mf);
+}
+
+void              mkv_SetTrackMaskEx(MatroskaFile *mf,const ulonglong *mask) {
+  unsigned int          w;
+
+  if ((mf->flags & MPF_ERROR) || mf->trackMask == NULL)
     return;
 
-  mf->trackMask = mask;
+  for (w=0;w<mf->nMaskWords;++w)
+    mf->trackMask[w] = mask[w];
 
-  for (i=0;i<mf->nTracks;++i)
-    if (mask & (ULL(1)<<i))
-      ClearQueue(mf,&mf->Queues[i]);
+  applyTrackMask(mf);
+}
+
+// dequeue the frame with the lowest timecode among the tracks not in mask,
+// the mask only covers the first 64 tracks
+static struct QueueEntry *nextFrame(MatroskaFile *mf,ulonglong bits,unsigned int *track) {
+  unsigned int            i,j,w;
+  ulonglong               active,*mask = NULL;
+
+  if (setjmp(mf->jb)!=0)
+    return NULL;
+
+  if (bits) {
+    mask = mf->readMask;
+    memset(mask,0,mf->nMaskWords * sizeof(*mask));
+    mask[0] = bits;
+  }
+
+  do {
+    // extract required frame, use block with the lowest timecode
+    for (j=FTRACK,w=0;w<mf->nMaskWords;++w)
+      for (active=mf->QActive[w] & ~(mask ? mask[w] : 0);active;active &= active - 1) {
+        i = (w << 6) + QLowest(active);
+        if (j == FTRACK || QHead(&mf->Queues[j])->Start > QHead(&mf->Queues[i])->Start)
+          j = i;
+      }
+
+    if (j != FTRACK) {
+      *track = j;
+      return QTrackGet(mf,j);
+    }
+
+    if (mf->flags & MPF_ERROR)
+      return NULL;
+
+  } while (fillQueues(mf,mask)>=0);
+
+  return NULL;
 }
 
 int              mkv_ReadFrame(MatroskaFile *mf,
@@ -3819,58 +4335,88 @@ int              mkv_ReadFrame(MatroskaFile *mf,
                             char **FrameData,unsigned int *FrameFlags, longlong *FrameDiscard,
                             unsigned int *FrameAdditionalSize, char **FrameAdditionalData, unsigned int *FrameAdditionalID)
 {
-  unsigned int            i,j;
-  struct QueueEntry *qe;
+  struct QueueEntry *qe = nextFrame(mf,mask,track);
 
-  if (setjmp(mf->jb)!=0)
+  if (qe == NULL)
     return -1;
 
-  do {
-    // extract required frame, use block with the lowest timecode
-    for (j=FTRACK,i=0;i<mf->nTracks;++i)
-      if (!(mask & (ULL(1)<<i)) && mf->Queues[i].head) {
-        j = i;
-        ++i;
-        break;
-      }
+  // the payload belongs to the slab or to the stream, hand out a copy
+  *FrameData = mf->cache->memalloc(mf->cache,qe->Length + 16);
+  if (*FrameData == NULL) {
+    QFree(mf,qe);
+    return -1;
+  }
+  memcpy(*FrameData,qe->Data,qe->Length);
+
+  *StartTime = qe->Start;
+  *EndTime = qe->End;
+  *FilePos = qe->Position;
+  *FrameSize = qe->Length;
+  *FrameFlags = qe->flags;
+  *FrameDiscard = qe->DiscardPadding;
+
+  if (FrameAdditionalSize && FrameAdditionalData && FrameAdditionalID) {
+    *FrameAdditionalSize = qe->DataAdditionalLength;
+    *FrameAdditionalData = qe->DataAdditional;
+    *FrameAdditionalID = qe->AdditionalID;
+
+    if (qe->DataAdditional)
+      --mf->nQAdditional;
+    qe->DataAdditional = NULL;
+  }
 
-    for (;i<mf->nTracks;++i)
-      if (!(mask & (ULL(1)<<i)) && mf->Queues[i].head &&
-          mf->Queues[j].head->Start > mf->Queues[i].head->Start)
-        j = i;
+  QFree(mf,qe);
 
-    if (j != FTRACK) {
-      qe = QGet(&mf->Queues[j]);
+  return 0;
+}
 
-      *track = j;
-      *StartTime = qe->Start;
-      *EndTime = qe->End;
-      *FilePos = qe->Position;
-      *FrameSize = qe->Length;
-      *FrameData = qe->Data;
-      *FrameFlags = qe->flags;
-      *FrameDiscard = qe->DiscardPadding;
-
-      if (FrameAdditionalSize && FrameAdditionalData && FrameAdditionalID) {
-        *FrameAdditionalSize = qe->DataAdditionalLength;
-        *FrameAdditionalData = qe->DataAdditional;
-        *FrameAdditionalID = qe->AdditionalID;
-
-        qe->DataAdditional = NULL;
-      }
+int              mkv_ReadFrameRef(MatroskaFile *mf,ulonglong mask,MatroskaFrame *frame)
+{
+  struct QueueEntry *qe = nextFrame(mf,mask,&frame->Track);
 
-      qe->Data = NULL;
-      QFree(mf,qe);
+  if (qe == NULL)
+    return -1;
 
-      return 0;
-    }
+  frame->StartTime = qe->Start;
+  frame->EndTime = qe->End;
+  frame->FilePos = qe->Position;
+  frame->Size = qe->Length;
+  frame->Data = qe->Data;
+  frame->Flags = qe->flags;
+  frame->Discard = qe->DiscardPadding;
+  frame->AdditionalSize = qe->DataAdditional ? qe->DataAdditionalLength : 0;
+  frame->AdditionalData = qe->DataAdditional;
+  frame->AdditionalID = qe->AdditionalID;
+
+  // the slab reference moves to the frame
+  frame->Ref = qe->Chunk;
+  if (qe->Chunk && !qe->Detached) {
+    --qe->Chunk->queued;
+    ++qe->Chunk->refs;
+  }
 
-    if (mf->flags & MPF_ERROR)
-      return -1;
+  if (qe->DataAdditional)
+    --mf->nQAdditional;
+  qe->Chunk = NULL;
+  qe->DataAdditional = NULL;
+  QFree(mf,qe);
 
-  } while (fillQueues(mf,mask)>=0);
+  return 0;
+}
 
-  return EOF;
+void              mkv_ReleaseFrame(MatroskaFile *mf,MatroskaFrame *frame)
+{
+  struct SlabChunk  *sc = frame->Ref;
+
+  if (sc) {
+    --sc->refs;
+    SlabRecycle(mf,sc);
+  }
+  mf->cache->memfree(mf->cache,frame->AdditionalData);
+
+  frame->Ref = NULL;
+  frame->Data = NULL;
+  frame->AdditionalData = NULL;
 }
 
 #ifdef MATROSKA_COMPRESSION_SUPPORT
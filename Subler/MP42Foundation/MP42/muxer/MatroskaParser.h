@@ -95,6 +95,13 @@ struct InputStream {
   int          (*progress)(struct InputStream *cc,ulonglong cur,ulonglong max);
   /* get file size, optional, can be NULL or return -1 if filesize is unknown */
   longlong    (*getfilesize)(struct InputStream *cc);
+  /* scan for every occurrence of a four byte signature starting in [start,end),
+   * optional, can be NULL. Returns the number of offsets stored */
+  int          (*scanall)(struct InputStream *cc,ulonglong start,ulonglong end,unsigned signature,
+                          longlong *offsets,int maxoffsets);
+  /* get a pointer to count bytes at pos that stays valid until the stream is closed,
+   * optional, can be NULL or return NULL if the data can't be referenced in place */
+  const void *(*getdata)(struct InputStream *cc,ulonglong pos,int count);
 };
 
 typedef struct InputStream InputStream;
@@ -121,7 +128,7 @@ struct BlockAdditionMapping {
 };
 
 struct TrackInfo {
-  unsigned char      Number;
+  unsigned int      Number;
   unsigned char      Type;
   unsigned char      TrackOverlay;
   ulonglong      UID;
@@ -300,7 +307,7 @@ struct Cue {
   ulonglong        Position;
   ulonglong        RelativePosition;
   ulonglong        Block;
-  unsigned char        Track;
+  unsigned int        Track;
 };
 
 typedef struct Cue Cue;
@@ -342,6 +349,14 @@ X MatroskaFile  *mkv_Open(/* in */ InputStream *io,
 
 #define    MKVF_AVOID_SEEKS    1 /* use sequential reading only */
 
+/* upper bound of the parser read buffer, as log2 of its size in bytes,
+ * clamped to 64 KB - 4 MB. The buffer starts at 64 KB after every seek
+ * and doubles while reading stays sequential, never beyond half of the
+ * stream cache size. Streams with getdata are read in place.
+ */
+#define    MKVF_BUFFER_SHIFT   8
+#define    MKVF_BUFFER_SIZE(log2)  (((log2) & 0x1f) << MKVF_BUFFER_SHIFT)
+
 X MatroskaFile  *mkv_OpenEx(/* in */  InputStream *io,
               /* in */  ulonglong base,
               /* in */  unsigned flags,
@@ -381,8 +396,28 @@ X void          mkv_GetTags(/* in */  MatroskaFile *mf,
 
 X void  mkv_GetCues(MatroskaFile *mf, Cue **cue, unsigned *count);
 
+/* Build the seek index for a file without Cues by scanning for clusters,
+ * the same index mkv_Seek builds on demand. Returns the number of cues.
+ */
+X unsigned  mkv_BuildCues(MatroskaFile *mf);
+
+/* Replace the seek index with one returned by mkv_GetCues on an earlier
+ * open of the same file. Returns -1 if out of memory, 0 otherwise.
+ */
+X int   mkv_SetCues(MatroskaFile *mf, const Cue *cues, unsigned count);
+
 X ulonglong   mkv_GetSegmentTop(MatroskaFile *mf);
 
+/* file offset of the segment data, cue positions are relative to it */
+X ulonglong   mkv_GetSegmentBase(MatroskaFile *mf);
+
+/* Only read the clusters in [start,end), given as file offsets of cluster
+ * starts, so that several parsers can split a file between them.
+ * start 0 keeps the current read position, end 0 reads up to the end of
+ * the segment. Queued frames are dropped.
+ */
+X void        mkv_SetReadRange(MatroskaFile *mf, ulonglong start, ulonglong end);
+
 /* Seek to specified timecode,
  * if timecode is past end of file,
  * all tracks are set to return EOF
@@ -419,13 +454,27 @@ X int          mkv_TruncFloat(MKFLOAT f);
  *  masked tracks [with 1s in their bit positions]
  *  will be ignored when reading file data.
  * This call discards all parsed and queued frames
+ * Only the first 64 tracks can be masked, use
+ * mkv_SetTrackMaskEx for files with more tracks.
  */
 X void          mkv_SetTrackMask(/* in */ MatroskaFile *mf,/* in */ ulonglong mask);
 
+/* Number of 64 bit words in a mask for ntracks tracks */
+#define    MKV_TRACKMASK_WORDS(ntracks)  (((ntracks) + 63) / 64)
+
+/* Same as mkv_SetTrackMask, mask holds one bit per track,
+ *  MKV_TRACKMASK_WORDS(mkv_GetNumTracks(mf)) words, track i
+ *  is bit i % 64 of word i / 64.
+ */
+X void          mkv_SetTrackMaskEx(/* in */ MatroskaFile *mf,/* in */ const ulonglong *mask);
+
 /* Read one frame from the queue.
  * mask specifies what tracks to ignore.
  * Returns -1 if there are no more frames in the specified
  * set of tracks, 0 on success
+ * FrameData and FrameAdditionalData are allocated with the
+ * InputStream memalloc and owned by the caller, release them
+ * with memfree.
  */
 X int          mkv_ReadFrame(/* in */  MatroskaFile *mf,
                 /* in */  ulonglong mask,
@@ -441,6 +490,40 @@ X int          mkv_ReadFrame(/* in */  MatroskaFile *mf,
                 /* out */ char **FrameAdditionalData,
                 /* out */ unsigned int *FrameAdditionalID);
 
+/* A frame read with mkv_ReadFrameRef.
+ * Data is a borrowed view, either straight into the input stream memory or
+ * into a refcounted slab owned by the parser, and stays valid until the frame
+ * is passed to mkv_ReleaseFrame. AdditionalData is owned by the frame too.
+ */
+struct MatroskaFrame {
+  unsigned int  Track;
+  ulonglong     StartTime;      /* in ns */
+  ulonglong     EndTime;        /* in ns */
+  ulonglong     FilePos;        /* in bytes from start of file */
+  unsigned int  Size;           /* in bytes */
+  const char    *Data;
+  unsigned int  Flags;
+  longlong      Discard;
+  unsigned int  AdditionalSize; /* in bytes */
+  char          *AdditionalData;
+  unsigned int  AdditionalID;
+
+  void          *Ref;           /* private */
+};
+
+typedef struct MatroskaFrame MatroskaFrame;
+
+/* Same as mkv_ReadFrame, but the frame data is not copied.
+ * Every frame returned must be released with mkv_ReleaseFrame
+ * before the file is closed.
+ */
+X int          mkv_ReadFrameRef(/* in */  MatroskaFile *mf,
+                   /* in */  ulonglong mask,
+                   /* out */ MatroskaFrame *frame);
+
+X void          mkv_ReleaseFrame(/* in */ MatroskaFile *mf,
+                   /* in */ MatroskaFrame *frame);
+
 #ifdef MATROSKA_COMPRESSION_SUPPORT
 /* Compressed streams support */
 struct CompressedStream;
@@ -0,0 +1,323 @@
+/*
+ *  annexb.c
+ *  Subler
+ *
+ *  Start code scanner for Annex B elementary streams.
+ *
+ */
+
+#include "annexb.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* The scalar scanner looks at the third byte of each candidate first,
+ * anything above 1 rules out three positions at once. The vector
+ * versions compare three shifted loads against 00 00 01 and only walk
+ * the bits of the resulting mask, each set bit is a start code.
+ */
+static size_t ScanScalar(const uint8_t *buf, size_t i, size_t len,
+                         size_t *offsets, size_t maxoffsets) {
+	size_t  n = 0;
+
+	while (i + 3 <= len && n < maxoffsets) {
+		if (buf[i + 2] > 1)
+			i += 3;
+		else if (buf[i + 1])
+			i += 2;
+		else if (buf[i] || buf[i + 2] != 1)
+			i += 1;
+		else {
+			offsets[n++] = i;
+			i += 3;
+		}
+	}
+
+	return n;
+}
+
+#if defined(__SSE2__)
+static size_t ScanSSE2(const uint8_t *buf, size_t len, size_t *offsets, size_t maxoffsets) {
+	const __m128i   zero = _mm_setzero_si128();
+	const __m128i   one = _mm_set1_epi8(1);
+	size_t          i, n = 0;
+
+	for (i = 0; i + 18 <= len; i += 16) {
+		__m128i     v0 = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i     v1 = _mm_loadu_si128((const __m128i *)(buf + i + 1));
+		__m128i     v2 = _mm_loadu_si128((const __m128i *)(buf + i + 2));
+		unsigned    m = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(v0, zero),
+		                                                              _mm_cmpeq_epi8(v1, zero)),
+		                                                _mm_cmpeq_epi8(v2, one)));
+
+		for (; m; m &= m - 1) {
+			offsets[n++] = i + __builtin_ctz(m);
+			if (n == maxoffsets)
+				return n;
+		}
+	}
+
+	return n + ScanScalar(buf, i, len, offsets + n, maxoffsets - n);
+}
+
+__attribute__((target("avx2")))
+static size_t ScanAVX2(const uint8_t *buf, size_t len, size_t *offsets, size_t maxoffsets) {
+	const __m256i   zero = _mm256_setzero_si256();
+	const __m256i   one = _mm256_set1_epi8(1);
+	size_t          i, n = 0;
+
+	for (i = 0; i + 34 <= len; i += 32) {
+		__m256i     v0 = _mm256_loadu_si256((const __m256i *)(buf + i));
+		__m256i     v1 = _mm256_loadu_si256((const __m256i *)(buf + i + 1));
+		__m256i     v2 = _mm256_loadu_si256((const __m256i *)(buf + i + 2));
+		unsigned    m = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(v0, zero),
+		                                                                                 _mm256_cmpeq_epi8(v1, zero)),
+		                                                                _mm256_cmpeq_epi8(v2, one)));
+
+		for (; m; m &= m - 1) {
+			offsets[n++] = i + __builtin_ctz(m);
+			if (n == maxoffsets)
+				return n;
+		}
+	}
+
+	return n + ScanScalar(buf, i, len, offsets + n, maxoffsets - n);
+}
+#elif defined(__ARM_NEON)
+static size_t ScanNEON(const uint8_t *buf, size_t len, size_t *offsets, size_t maxoffsets) {
+	const uint8x16_t    one = vdupq_n_u8(1);
+	size_t              i, n = 0;
+
+	for (i = 0; i + 18 <= len; i += 16) {
+		uint8x16_t  eq = vandq_u8(vandq_u8(vceqzq_u8(vld1q_u8(buf + i)), vceqzq_u8(vld1q_u8(buf + i + 1))),
+		                          vceqq_u8(vld1q_u8(buf + i + 2), one));
+		/* narrow to a 64 bit mask, four bits per byte */
+		uint64_t    m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+
+		while (m) {
+			unsigned    bit = __builtin_ctzll(m);
+			m &= ~(0xfULL << (bit & ~3u));
+			offsets[n++] = i + (bit >> 2);
+			if (n == maxoffsets)
+				return n;
+		}
+	}
+
+	return n + ScanScalar(buf, i, len, offsets + n, maxoffsets - n);
+}
+#endif
+
+size_t annexb_find_start_codes(const uint8_t *buf, size_t len, size_t *offsets, size_t maxoffsets) {
+	if (maxoffsets == 0)
+		return 0;
+
+#if defined(__SSE2__)
+	static int  hasAVX2 = -1;
+
+	if (hasAVX2 < 0)
+		hasAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+
+	if (hasAVX2)
+		return ScanAVX2(buf, len, offsets, maxoffsets);
+	return ScanSSE2(buf, len, offsets, maxoffsets);
+#elif defined(__ARM_NEON)
+	return ScanNEON(buf, len, offsets, maxoffsets);
+#else
+	return ScanScalar(buf, 0, len, offsets, maxoffsets);
+#endif
+}
+
+size_t annexb_find_start_code(const uint8_t *buf, size_t len) {
+	size_t  offset;
+
+	return annexb_find_start_codes(buf, len, &offset, 1) ? offset : len;
+}
+
+#pragma mark Reader
+
+#define WINDOW_SIZE     (4 * 1024 * 1024)
+
+static int IsStartCode(const uint8_t *p) {
+	return p[0] == 0 && p[1] == 0 && (p[2] == 1 || (p[2] == 0 && p[3] == 1));
+}
+
+static inline const uint8_t *ReaderAt(const annexb_reader_t *reader, uint64_t offset) {
+	return reader->data + (offset - reader->data_pos);
+}
+
+int annexb_reader_open(annexb_reader_t *reader, FILE *file) {
+	struct stat st;
+
+	memset(reader, 0, sizeof(*reader));
+	reader->file = file;
+	reader->hold = ANNEXB_NO_HOLD;
+
+	if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void    *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			reader->data = (uint8_t *)map;
+			reader->data_size = st.st_size;
+			reader->mapped = 1;
+			return 1;
+		}
+	}
+
+	rewind(file);
+	reader->data_size_max = WINDOW_SIZE;
+	reader->data = (uint8_t *)malloc(reader->data_size_max);
+	return reader->data != NULL;
+}
+
+void annexb_reader_close(annexb_reader_t *reader) {
+	if (reader->mapped)
+		munmap(reader->data, reader->data_size);
+	else
+		free(reader->data);
+	reader->data = NULL;
+	reader->nal = NULL;
+}
+
+/* reads more of the file into the window, dropping what comes before keep.
+ * The window grows only when a single NAL doesn't fit in it.
+ */
+static int Refill(annexb_reader_t *reader, uint64_t keep) {
+	uint64_t    skip;
+	size_t      bytes_read;
+
+	if (reader->mapped)
+		return 0;
+
+	skip = keep - reader->data_pos;
+	if (skip > reader->data_size)
+		skip = reader->data_size;
+	if (skip) {
+		memmove(reader->data, reader->data + skip, reader->data_size - skip);
+		reader->data_pos += skip;
+		reader->data_size -= skip;
+	}
+	if (reader->data_size == reader->data_size_max) {
+		uint8_t *data = (uint8_t *)realloc(reader->data, reader->data_size_max * 2);
+
+		if (data == NULL)
+			return 0;
+		reader->data = data;
+		reader->data_size_max *= 2;
+	}
+
+	bytes_read = fread(reader->data + reader->data_size, 1,
+	                   reader->data_size_max - reader->data_size, reader->file);
+	reader->data_size += bytes_read;
+	return bytes_read != 0;
+}
+
+int annexb_reader_next(annexb_reader_t *reader) {
+	uint64_t        start = reader->nal_offset + reader->nal_size;
+	uint64_t        keep = start < reader->hold ? start : reader->hold;
+	uint64_t        end = reader->data_pos + reader->data_size;
+	uint64_t        len, first, from, code;
+	const uint8_t   *p;
+
+	while (start + 8 > end && Refill(reader, keep))
+		end = reader->data_pos + reader->data_size;
+	if (start + 4 > end)
+		return 0;
+
+	p = ReaderAt(reader, start);
+	len = end - start;
+
+	/* skip anything before the first start code */
+	if (!IsStartCode(p)) {
+		from = 0;
+		for (;;) {
+			code = from + annexb_find_start_code(p + from, len - from);
+			if (code < len) {
+				start += code;
+				keep = start < reader->hold ? start : reader->hold;
+				break;
+			}
+			from = len > 2 ? len - 2 : 0;
+			if (!Refill(reader, keep))
+				return 0;
+			p = ReaderAt(reader, start);
+			len = reader->data_pos + reader->data_size - start;
+		}
+		end = reader->data_pos + reader->data_size;
+		while (start + 8 > end && Refill(reader, keep))
+			end = reader->data_pos + reader->data_size;
+		if (start + 4 > end)
+			return 0;
+		p = ReaderAt(reader, start);
+		len = end - start;
+	}
+
+	/* look for the next start code past the current one, when more data
+	 * has to be read the search resumes where it stopped
+	 */
+	first = len >= 8 && IsStartCode(p + 4) ? 7 : 4;
+	from = first;
+	for (;;) {
+		int refilled;
+
+		if (len >= from + 3) {
+			code = from + annexb_find_start_code(p + from, len - 3 - from);
+			if (code != len - 3)
+				break;
+			/* a start code may straddle the end of the searched bytes */
+			from = len - 5 > first ? len - 5 : first;
+		}
+		refilled = Refill(reader, keep);
+		p = ReaderAt(reader, start);
+		len = reader->data_pos + reader->data_size - start;
+		if (!refilled) {
+			/* end of file, the last NAL runs to its end */
+			code = len;
+			break;
+		}
+	}
+	if (code < len && code > first && p[code - 1] == 0)
+		code--;
+
+	reader->nal = p;
+	reader->nal_size = (uint32_t)code;
+	reader->nal_offset = start;
+	return 1;
+}
+
+void annexb_reader_write_spans(const annexb_reader_t *reader, const annexb_span_t *spans,
+                               size_t count, uint8_t *dst) {
+	size_t  i;
+
+	for (i = 0; i < count; i++) {
+		uint32_t    length = spans[i].length;
+
+		dst[0] = (length >> 24) & 0xff;
+		dst[1] = (length >> 16) & 0xff;
+		dst[2] = (length >> 8) & 0xff;
+		dst[3] = length & 0xff;
+		memcpy(dst + 4, ReaderAt(reader, spans[i].offset), length);
+		dst += length + 4;
+	}
+}
+
+uint8_t *annexb_reader_copy_spans(const annexb_reader_t *reader, const annexb_span_t *spans,
+                                  size_t count, size_t size) {
+	uint8_t *sample = (uint8_t *)malloc(size);
+
+	if (sample == NULL)
+		return NULL;
+
+	annexb_reader_write_spans(reader, spans, count, sample);
+
+	return sample;
+}
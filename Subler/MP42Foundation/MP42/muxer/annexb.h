@@ -0,0 +1,81 @@
+/*
+ *  annexb.h
+ *  Subler
+ *
+ *  Start code scanner for Annex B elementary streams.
+ *
+ */
+
+#ifndef ANNEXB_H
+#define ANNEXB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* stores the offsets of up to maxoffsets 00 00 01 start code prefixes
+ * that lie entirely inside buf[0,len), in a single pass over the buffer,
+ * and returns how many were found.
+ */
+size_t annexb_find_start_codes(const uint8_t *buf, size_t len, size_t *offsets, size_t maxoffsets);
+
+/* offset of the first 00 00 01 prefix inside buf[0,len), len if there is none */
+size_t annexb_find_start_code(const uint8_t *buf, size_t len);
+
+/* NAL reader over a whole mapped file, or over a window of it for pipes
+ * and files that can't be mapped. The window slides only when a NAL runs
+ * past its end, and keeps everything from hold onward readable so that
+ * earlier NALs can still be copied out.
+ */
+typedef struct annexb_reader_t {
+	FILE            *file;
+	uint8_t         *data;
+	uint64_t        data_pos;
+	uint64_t        data_size;
+	uint64_t        data_size_max;
+	int             mapped;
+
+	uint64_t        hold;
+
+	/* the current NAL, start code included */
+	const uint8_t   *nal;
+	uint32_t        nal_size;
+	uint64_t        nal_offset;
+} annexb_reader_t;
+
+/* a NAL payload in the file, without its start code */
+typedef struct annexb_span_t {
+	uint64_t        offset;
+	uint32_t        length;
+} annexb_span_t;
+
+#define ANNEXB_NO_HOLD  UINT64_MAX
+
+int annexb_reader_open(annexb_reader_t *reader, FILE *file);
+void annexb_reader_close(annexb_reader_t *reader);
+
+/* loads the next NAL, returns 0 at the end of the file */
+int annexb_reader_next(annexb_reader_t *reader);
+
+/* builds a sample out of the spans, each prefixed by its 32 bit big endian
+ * length, with a single copy out of the reader. size is the sum of the span
+ * lengths plus 4 bytes for each span.
+ */
+uint8_t *annexb_reader_copy_spans(const annexb_reader_t *reader, const annexb_span_t *spans,
+                                  size_t count, size_t size);
+
+/* the same, into a buffer of at least size bytes, like the ones of the
+ * sample pool.
+ */
+void annexb_reader_write_spans(const annexb_reader_t *reader, const annexb_span_t *spans,
+                               size_t count, uint8_t *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
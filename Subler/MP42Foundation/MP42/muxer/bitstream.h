@@ -0,0 +1,292 @@
+/*
+ *  bitstream.h
+ *  Subler
+ *
+ *  Bit reader and writer for codec headers.
+ *
+ */
+
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#pragma mark Reader
+
+/* The reader keeps the next bits of the buffer left aligned in a 64 bit
+ * cache, refilled with a single unaligned load. Reading past the end
+ * returns zeros and sets the error state instead of stopping the parser,
+ * so parsers check bs_error() once they are done with a header, and in
+ * the loops whose count comes from the stream.
+ *
+ * A reader set up with bs_reader_init_nal() reads the payload of a NAL
+ * unit, the emulation prevention byte of each 00 00 03 sequence is
+ * dropped as the bytes are loaded. Its bs_left() counts the bits of the
+ * payload, bs_tell() and bs_seek() positions in the buffer are only
+ * meaningful when there were no emulation prevention bytes before them.
+ */
+typedef struct bs_reader_t {
+	const uint8_t   *start;
+	const uint8_t   *ptr;       /* first byte that isn't in the cache yet */
+	const uint8_t   *end;
+	uint64_t        cache;
+	unsigned        count;      /* valid bits at the top of the cache */
+	int64_t         left;       /* bits left in the buffer, negative after an overread */
+	int             error;      /* set on invalid Exp-Golomb codes */
+	int             nal;        /* skips emulation prevention bytes */
+} bs_reader_t;
+
+static inline uint64_t bs_load64(const uint8_t *p) {
+	uint64_t    v;
+
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline void bs_reader_init(bs_reader_t *b, const uint8_t *buf, size_t size) {
+	b->start = b->ptr = buf;
+	b->end = buf + size;
+	b->cache = 0;
+	b->count = 0;
+	b->left = (int64_t)size * 8;
+	b->error = 0;
+	b->nal = 0;
+}
+
+static inline void bs_reader_init_nal(bs_reader_t *b, const uint8_t *buf, size_t size) {
+	bs_reader_init(b, buf, size);
+	b->nal = 1;
+}
+
+/* nonzero if any byte of v is 03 */
+static inline uint64_t bs_has_03(uint64_t v) {
+	v ^= 0x0303030303030303ULL;
+	return (v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL;
+}
+
+/* an emulation prevention byte follows two zero bytes, the 03 that
+ * was dropped ends the run of zeros like any other byte
+ */
+static inline int bs_is_emulation(const bs_reader_t *b, const uint8_t *p) {
+	return *p == 3 && p - b->start >= 2 && p[-1] == 0 && p[-2] == 0;
+}
+
+/* the last bytes are loaded one by one, past the end the cache
+ * holds only zeros
+ */
+static inline void bs_refill_tail(bs_reader_t *b) {
+	while (b->count <= 56 && b->ptr < b->end) {
+		if (b->nal && bs_is_emulation(b, b->ptr)) {
+			b->ptr++;
+			b->left -= 8;
+			continue;
+		}
+		b->cache |= (uint64_t)*b->ptr++ << (56 - b->count);
+		b->count += 8;
+	}
+	if (b->ptr == b->end)
+		b->count = 64;
+}
+
+/* leaves at least 56 bits in the cache, the bits loaded below them
+ * are loaded again in the same place by the next refill. NAL readers
+ * load byte by byte when a 03 byte could be an emulation prevention one.
+ */
+static inline void bs_refill(bs_reader_t *b) {
+	if (b->count > 56)
+		return;
+	if (b->end - b->ptr >= 8) {
+		uint64_t    v = bs_load64(b->ptr);
+
+		if (!b->nal || !bs_has_03(v)) {
+			b->cache |= v >> b->count;
+			b->ptr += (63 - b->count) >> 3;
+			b->count |= 56;
+			return;
+		}
+	}
+	bs_refill_tail(b);
+}
+
+static inline int bs_error(const bs_reader_t *b) {
+	return b->left < 0 || b->error;
+}
+
+static inline int64_t bs_left(const bs_reader_t *b) {
+	return b->left;
+}
+
+/* bit position from the start of the buffer */
+static inline uint64_t bs_tell(const bs_reader_t *b) {
+	return (uint64_t)((int64_t)(b->end - b->start) * 8 - b->left);
+}
+
+static inline void bs_seek(bs_reader_t *b, uint64_t pos) {
+	uint64_t    size = (uint64_t)(b->end - b->start) * 8;
+
+	b->cache = 0;
+	b->left = (int64_t)(size - pos);
+	if (pos > size) {
+		b->ptr = b->end;
+		b->count = 64;
+		return;
+	}
+	b->ptr = b->start + (pos >> 3);
+	b->count = 0;
+	bs_refill(b);
+	b->cache <<= pos & 7;
+	b->count -= pos & 7;
+}
+
+/* up to 32 bits, peeking past the end sets the error like a read would */
+static inline uint32_t bs_peek(bs_reader_t *b, unsigned n) {
+	if (n > 32) {
+		b->error = 1;
+		return 0;
+	}
+	if (b->count < n)
+		bs_refill(b);
+	if ((int64_t)n > b->left)
+		b->error = 1;
+	return (uint32_t)((b->cache >> 1) >> (63 - n));
+}
+
+/* up to 32 bits, wider reads come from a broken header and set the error */
+static inline uint32_t bs_read(bs_reader_t *b, unsigned n) {
+	uint32_t    v;
+
+	if (n > 32) {
+		b->error = 1;
+		return 0;
+	}
+	if (b->count < n)
+		bs_refill(b);
+	v = (uint32_t)((b->cache >> 1) >> (63 - n));
+	b->cache <<= n;
+	b->count -= n;
+	b->left -= n;
+	return v;
+}
+
+static inline void bs_skip(bs_reader_t *b, uint64_t n) {
+	if (n < b->count) {
+		b->cache <<= n;
+		b->count -= (unsigned)n;
+		b->left -= (int64_t)n;
+	} else if (b->nal) {
+		for (; n > 32 && b->left >= 0; n -= 32)
+			bs_read(b, 32);
+		bs_read(b, (unsigned)(n > 32 ? 32 : n));
+	} else
+		bs_seek(b, bs_tell(b) + n);
+}
+
+static inline uint32_t bs_read_ue_long(bs_reader_t *b) {
+	unsigned    zeros = 0;
+
+	while (bs_read(b, 1) == 0) {
+		if (++zeros > 31 || b->left < 0) {
+			b->error = 1;
+			return 0;
+		}
+	}
+	return (uint32_t)((1ULL << zeros) - 1 + bs_read(b, zeros));
+}
+
+/* Exp-Golomb codes up to 55 bits long are read at once */
+static inline uint32_t bs_read_ue(bs_reader_t *b) {
+	unsigned    zeros = (unsigned)__builtin_clzll(b->cache | 1);
+	unsigned    len;
+	uint32_t    v;
+
+	if (2 * zeros + 1 > b->count) {
+		bs_refill(b);
+		zeros = (unsigned)__builtin_clzll(b->cache | 1);
+	}
+	if (zeros >= 28)
+		return bs_read_ue_long(b);
+
+	len = 2 * zeros + 1;
+	v = (uint32_t)(b->cache >> (64 - len)) - 1;
+	b->cache <<= len;
+	b->count -= len;
+	b->left -= len;
+	return v;
+}
+
+static inline int32_t bs_read_se(bs_reader_t *b) {
+	uint32_t    v = bs_read_ue(b);
+
+	return v & 1 ? (int32_t)((v >> 1) + 1) : -(int32_t)(v >> 1);
+}
+
+#pragma mark Writer
+
+typedef struct bs_writer_t {
+	uint8_t     *start;
+	uint8_t     *ptr;
+	uint8_t     *end;
+	uint64_t    cache;
+	unsigned    count;      /* bits in the cache, less than 8 between calls */
+	int         error;      /* set when the buffer is too small */
+} bs_writer_t;
+
+static inline void bs_writer_init(bs_writer_t *w, uint8_t *buf, size_t size) {
+	w->start = w->ptr = buf;
+	w->end = buf + size;
+	w->cache = 0;
+	w->count = 0;
+	w->error = 0;
+}
+
+/* up to 32 bits, the value is masked to n bits */
+static inline void bs_write(bs_writer_t *w, uint32_t value, unsigned n) {
+	if (n > 32) {
+		w->error = 1;
+		return;
+	}
+	w->cache = (w->cache << n) | (value & (uint32_t)((1ULL << n) - 1));
+	w->count += n;
+	while (w->count >= 8) {
+		w->count -= 8;
+		if (w->ptr < w->end)
+			*w->ptr++ = (uint8_t)(w->cache >> w->count);
+		else
+			w->error = 1;
+	}
+}
+
+static inline void bs_write_bytes(bs_writer_t *w, const uint8_t *bytes, size_t size) {
+	if (w->count == 0) {
+		if ((size_t)(w->end - w->ptr) < size) {
+			w->error = 1;
+			return;
+		}
+		memcpy(w->ptr, bytes, size);
+		w->ptr += size;
+	} else {
+		for (size_t i = 0; i < size; i++)
+			bs_write(w, bytes[i], 8);
+	}
+}
+
+/* pads the last byte with zeros */
+static inline void bs_writer_flush(bs_writer_t *w) {
+	if (w->count)
+		bs_write(w, 0, 8 - w->count);
+}
+
+static inline uint64_t bs_writer_tell(const bs_writer_t *w) {
+	return (uint64_t)(w->ptr - w->start) * 8 + w->count;
+}
+
+static inline int bs_writer_error(const bs_writer_t *w) {
+	return w->error;
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ *  syncframe.c
+ *  Subler
+ *
+ *  Buffered reader for audio elementary streams made of frames
+ *  that start with a sync word, like ADTS AAC and AC-3.
+ *
+ */
+
+#include "syncframe.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE      (1024 * 1024)
+
+static inline const uint8_t *ReaderAt(const syncframe_reader_t *reader, uint64_t offset) {
+	return reader->data + (offset - reader->data_pos);
+}
+
+int syncframe_reader_open(syncframe_reader_t *reader, FILE *file) {
+	struct stat st;
+
+	memset(reader, 0, sizeof(*reader));
+	reader->file = file;
+
+	if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void    *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			reader->data = (uint8_t *)map;
+			reader->data_size = st.st_size;
+			reader->mapped = 1;
+			return 1;
+		}
+	}
+
+	rewind(file);
+	reader->data_size_max = BLOCK_SIZE;
+	reader->data = (uint8_t *)malloc(reader->data_size_max);
+	return reader->data != NULL;
+}
+
+void syncframe_reader_close(syncframe_reader_t *reader) {
+	if (reader->mapped)
+		munmap(reader->data, reader->data_size);
+	else
+		free(reader->data);
+	reader->data = NULL;
+}
+
+/* drops what comes before the read position, and reads until at least
+ * size bytes from it are in the block or the file ends.
+ */
+static int Refill(syncframe_reader_t *reader, size_t size) {
+	uint64_t    skip;
+	size_t      bytes_read;
+
+	if (reader->mapped)
+		return 0;
+
+	skip = reader->pos - reader->data_pos;
+	if (skip > reader->data_size)
+		skip = reader->data_size;
+	if (skip) {
+		memmove(reader->data, reader->data + skip, reader->data_size - skip);
+		reader->data_pos += skip;
+		reader->data_size -= skip;
+	}
+	while (reader->data_size_max < size) {
+		uint8_t *data = (uint8_t *)realloc(reader->data, reader->data_size_max * 2);
+
+		if (data == NULL)
+			return 0;
+		reader->data = data;
+		reader->data_size_max *= 2;
+	}
+
+	bytes_read = fread(reader->data + reader->data_size, 1,
+	                   reader->data_size_max - reader->data_size, reader->file);
+	reader->data_size += bytes_read;
+	return bytes_read != 0;
+}
+
+const uint8_t *syncframe_reader_peek(syncframe_reader_t *reader, size_t size) {
+	while (reader->pos + size > reader->data_pos + reader->data_size) {
+		if (!Refill(reader, size))
+			return NULL;
+	}
+	return ReaderAt(reader, reader->pos);
+}
+
+int syncframe_reader_sync(syncframe_reader_t *reader, uint8_t sync0, uint8_t mask1, uint8_t sync1) {
+	for (;;) {
+		uint64_t    end = reader->data_pos + reader->data_size;
+
+		/* the second byte of the sync word has to be in the block too */
+		if (reader->pos + 1 < end) {
+			const uint8_t   *p = ReaderAt(reader, reader->pos);
+			const uint8_t   *last = ReaderAt(reader, end - 1);
+
+			while ((p = (const uint8_t *)memchr(p, sync0, last - p)) != NULL) {
+				if ((p[1] & mask1) == sync1) {
+					reader->pos = reader->data_pos + (p - reader->data);
+					return 1;
+				}
+				if (++p == last)
+					break;
+			}
+			/* keep the last byte, it could start a sync word */
+			reader->pos = end - 1;
+		}
+		if (!Refill(reader, 2))
+			return 0;
+	}
+}
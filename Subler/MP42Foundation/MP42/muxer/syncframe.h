@@ -0,0 +1,59 @@
+/*
+ *  syncframe.h
+ *  Subler
+ *
+ *  Buffered reader for audio elementary streams made of frames
+ *  that start with a sync word, like ADTS AAC and AC-3.
+ *
+ */
+
+#ifndef SYNCFRAME_H
+#define SYNCFRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Reader over a whole mapped file, or over a block of it for pipes and
+ * files that can't be mapped. The block slides forward as the stream is
+ * read, and grows only when a single frame doesn't fit in it.
+ */
+typedef struct syncframe_reader_t {
+	FILE            *file;
+	uint8_t         *data;
+	uint64_t        data_pos;
+	uint64_t        data_size;
+	uint64_t        data_size_max;
+	int             mapped;
+
+	/* offset of the next byte to read */
+	uint64_t        pos;
+} syncframe_reader_t;
+
+int syncframe_reader_open(syncframe_reader_t *reader, FILE *file);
+void syncframe_reader_close(syncframe_reader_t *reader);
+
+/* moves to the next sync word, the first byte equal to sync0 that is
+ * followed by a byte whose bits in mask1 equal sync1. Returns 0 when
+ * there is none before the end of the file.
+ */
+int syncframe_reader_sync(syncframe_reader_t *reader, uint8_t sync0, uint8_t mask1, uint8_t sync1);
+
+/* the next size bytes, NULL when the file ends before them. They stay
+ * readable until the reader moves past them.
+ */
+const uint8_t *syncframe_reader_peek(syncframe_reader_t *reader, size_t size);
+
+static inline void syncframe_reader_skip(syncframe_reader_t *reader, size_t size) {
+	reader->pos += size;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
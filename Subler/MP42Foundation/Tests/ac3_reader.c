@@ -0,0 +1,30 @@
+//
+//  ac3_reader.c
+//  MP42Foundation Tests
+//
+//  The AC-3 importer parsing code, built as C like in the importer.
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "ac3.inc"
+#include "ac3_reader.h"
+
+u_int8_t *ac3_load_frame(syncframe_reader_t *reader, size_t *size)
+{
+	return LoadNextAc3Frame(reader, size, false);
+}
+
+bool ac3_first_header(FILE *file, u_int8_t *header)
+{
+	return GetFirstHeader(file, header);
+}
+
+u_int32_t ac3_frame_size(unsigned fscod, unsigned frmsizecod)
+{
+	return Ac3FrameSize[frmsizecod][3 - fscod] * 2;
+}
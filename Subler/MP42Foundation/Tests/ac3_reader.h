@@ -0,0 +1,29 @@
+//
+//  ac3_reader.h
+//  MP42Foundation Tests
+//
+
+#ifndef AC3_READER_H
+#define AC3_READER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "syncframe.h"
+
+#define AC3_HEADER_SIZE 10
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+u_int8_t *ac3_load_frame(syncframe_reader_t *reader, size_t *size);
+bool ac3_first_header(FILE *file, u_int8_t *header);
+u_int32_t ac3_frame_size(unsigned fscod, unsigned frmsizecod);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
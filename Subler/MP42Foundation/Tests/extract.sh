@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+# Prints the plain C part of an importer source file: the parsing functions
+# without the Objective-C imports, interfaces, instance variables and
+# methods, wherever they are in the file, so that a test can build them
+# on their own. With -f, prints only the definition of the
+# named functions. With -r "a b", prints the part that follows the
+# definition of a, or the start of the file if a is -, through the
+# definition of b, with the types and tables the functions in it use.
+# -f and -r can be repeated and combined.
+#
+# The functions a test needs are listed with -e, or are the ones named
+# with -f and -r. If one of them isn't defined in the output, because it
+# was renamed or moved into a method, the script fails instead of letting
+# the test build against a partial file.
+#
+# usage: extract.sh [-e "GetFirstHeader LoadNextAacFrame"] MP42AACImporter.mm > aac.inc
+#        extract.sh -f "h264_is_start_code h264_find_next_start_code" MP42H264Importer.mm
+#        extract.sh -r "readEAC3Config analyze_EAC3" -f free_EAC3_context MP42FormatUtilites.mm
+
+mode=file
+expected=
+functions=
+ranges=
+
+while [ $# -gt 1 ]; do
+	case "$1" in
+		-f) mode=select; functions="$functions $2"; expected="$expected $2"; shift 2 ;;
+		-r) mode=select; ranges="$ranges $2"; expected="$expected $(echo "$2" | sed 's/^- //')"; shift 2 ;;
+		-e) expected="$expected $2"; shift 2 ;;
+		*) break ;;
+	esac
+done
+
+if [ $# -ne 1 ] || [ ! -r "$1" ]; then
+	echo "usage: $0 [-e \"names\"] [-f \"names\"] [-r \"from through\"] file" >&2
+	exit 2
+fi
+
+awk -v mode="$mode" -v names="$expected" -v functions="$functions" -v ranges="$ranges" -v file="$1" '
+	function definition(line, i) {
+		if (line !~ /^[^ \t#\/]/ || line ~ /;[ \t]*$/)
+			return 0
+		for (i in list)
+			if (match(line, "[ *]" list[i] " *[(\\[]"))
+				return i
+		return 0
+	}
+
+	function keep(from, to, line) {
+		for (line = from; line <= to; line++)
+			kept[line] = 1
+	}
+
+	BEGIN { count = split(names, list, " ") }
+
+	/^#import/ || /^MP42_OBJC_DIRECT_MEMBERS/ { next }
+	/^@(interface|protocol)/ { declarations = 1; next }
+	declarations { if ($0 ~ /^@end/) declarations = 0; next }
+	/^@implementation.*\{/ { ivars = 1; next }
+	ivars { if ($0 ~ /^}/) ivars = 0; next }
+	/^[+-] *\(/ { method = $0 !~ /}[ \t]*$/; next }
+	method { if ($0 ~ /^}/) method = 0; next }
+	/^@/ { next }
+	{
+		out[++n] = $0
+		if (!open && (i = definition($0)) && !(list[i] in first)) {
+			open = list[i]
+			first[open] = n
+		}
+		if (open && ($0 ~ /^}/ || (first[open] == n && $0 ~ /}[ \t]*$/))) {
+			last[open] = n
+			open = ""
+		}
+	}
+
+	END {
+		for (i = 1; i <= count; i++) {
+			if (!(list[i] in last)) {
+				printf("%s: %s is not defined outside of the methods\n", file, list[i]) > "/dev/stderr"
+				missing = 1
+			}
+		}
+		if (missing)
+			exit 1
+
+		if (mode == "file") {
+			keep(1, n)
+		} else {
+			split(functions, selected, " ")
+			for (i in selected)
+				keep(first[selected[i]], last[selected[i]])
+			pairs = split(ranges, bounds, " ")
+			for (i = 1; i < pairs; i += 2)
+				keep(bounds[i] == "-" ? 1 : last[bounds[i]] + 1, last[bounds[i + 1]])
+		}
+
+		for (line = 1; line <= n; line++) {
+			if (line in kept) {
+				print out[line]
+				gap = mode != "file"
+			} else if (gap) {
+				print ""
+				gap = 0
+			}
+		}
+		if (gap)
+			print ""
+	}
+' "$1"
@@ -0,0 +1,233 @@
+//
+//  h264_annexb_diff.cpp
+//  MP42Foundation Tests
+//
+//  Differential test of the batched Annex B start code scanner and NAL
+//  reader against the per-NAL code the raw H.264 importer used before,
+//  kept in h264_reference.h. Random buffers check the start code
+//  search, generated streams check the NALs the reader splits.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "annexb.h"
+
+#include "h264_find.inc"
+
+#include "h264_reference.h"
+
+struct Random {
+    uint64_t state;
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (uint32_t)(state >> 16);
+    }
+
+    uint32_t below(uint32_t n) { return next() % n; }
+};
+
+typedef std::vector<std::vector<uint8_t>> NalList;
+
+/* random bytes, with more and more zeros and ones so that
+ * start codes and near misses show up often */
+static void fillRandom(Random &rnd, uint8_t *buf, size_t len)
+{
+    uint32_t density = rnd.below(4);
+
+    for (size_t i = 0; i < len; i++) {
+        uint32_t r = rnd.next();
+        if (density == 0) {
+            buf[i] = (uint8_t)r;
+        }
+        else {
+            buf[i] = (r % (density + 2)) == 0 ? 0 : (r % 7 == 0 ? 1 : (uint8_t)(r >> 8));
+        }
+    }
+}
+
+static size_t checkBuffers(Random &rnd, size_t iterations)
+{
+    static uint8_t buf[1024];
+    size_t errors = 0;
+
+    for (size_t it = 0; it < iterations; it++) {
+        size_t len = 4 + rnd.below(600);
+        fillRandom(rnd, buf, len + 8);
+
+        // the importer entry point against the byte by byte search
+        if (h264_find_next_start_code(buf, (uint32_t)len) !=
+            reference::h264_find_next_start_code(buf, (uint32_t)len)) {
+            if (errors < 4) {
+                fprintf(stderr, "h264_find_next_start_code differs, length %zu\n", len);
+            }
+            errors++;
+        }
+
+        // every offset, fetched in small batches like the reader does
+        std::vector<size_t> expected;
+        for (size_t i = 0; i + 3 <= len; i++) {
+            if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1) {
+                expected.push_back(i);
+            }
+        }
+
+        std::vector<size_t> found;
+        size_t from = 0, offsets[8];
+        for (;;) {
+            size_t max = 1 + rnd.below(8);
+            size_t n = annexb_find_start_codes(buf + from, len - from, offsets, max);
+            for (size_t k = 0; k < n; k++) {
+                found.push_back(from + offsets[k]);
+            }
+            if (n < max) {
+                break;
+            }
+            from += offsets[n - 1] + 1;
+        }
+
+        size_t first = annexb_find_start_code(buf, len);
+        if (found != expected || first != (expected.empty() ? len : expected[0])) {
+            if (errors < 4) {
+                fprintf(stderr, "annexb_find_start_codes differs, length %zu\n", len);
+            }
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+/* a stream of NALs with 3 and 4 byte start codes, the payload never
+ * contains 00 00 01, like an encoder output after emulation prevention */
+static std::vector<uint8_t> makeStream(Random &rnd, int kind)
+{
+    std::vector<uint8_t> data;
+
+    if (kind % 2) {
+        for (uint32_t i = rnd.below(64); i; i--) {
+            data.push_back((uint8_t)(2 + rnd.below(254)));
+        }
+    }
+
+    for (int nal = 0; nal < 300; nal++) {
+        if (rnd.below(2)) {
+            data.push_back(0);
+        }
+        data.push_back(0);
+        data.push_back(0);
+        data.push_back(1);
+
+        uint32_t size;
+        switch (kind) {
+            case 0:  size = 2 + rnd.below(64); break;
+            case 1:  size = 2 + rnd.below(4096); break;
+            case 2:  size = 2 + rnd.below(65536); break;
+            case 3:  size = rnd.below(5) ? 2 + rnd.below(50) : 100000 + rnd.below(200000); break;
+            default: size = rnd.below(40) ? 2 + rnd.below(3000) : (5 << 20) + rnd.below(1 << 20); break;
+        }
+
+        data.push_back((uint8_t)(0x01 + rnd.below(0x7f)));
+        for (uint32_t i = 1; i < size; i++) {
+            uint8_t c = (uint8_t)rnd.next();
+            if (kind == 2 && i % 3 == 0) {
+                c = 0;
+            }
+            data.push_back(c == 1 ? 2 : c);
+        }
+    }
+
+    return data;
+}
+
+static FILE *openStream(const std::vector<uint8_t> &data, bool mapped)
+{
+    if (mapped) {
+        FILE *file = tmpfile();
+        if (file) {
+            fwrite(data.data(), 1, data.size(), file);
+            fflush(file);
+            rewind(file);
+        }
+        return file;
+    }
+
+    // no file descriptor, so the reader falls back to a window
+    return fmemopen((void *)data.data(), data.size(), "rb");
+}
+
+static NalList referenceNals(const std::vector<uint8_t> &data)
+{
+    NalList nals;
+    reference::nal_reader_t nal;
+    memset(&nal, 0, sizeof(nal));
+    nal.ifile = openStream(data, true);
+
+    while (reference::LoadNal(&nal)) {
+        nals.push_back(std::vector<uint8_t>(nal.buffer, nal.buffer + nal.buffer_on));
+        if (nal.buffer_on == 0 || nals.size() > data.size()) {
+            break;
+        }
+    }
+
+    fclose(nal.ifile);
+    free(nal.buffer);
+    return nals;
+}
+
+static NalList readerNals(const std::vector<uint8_t> &data, bool mapped)
+{
+    NalList nals;
+    annexb_reader_t reader;
+    FILE *file = openStream(data, mapped);
+
+    if (file && annexb_reader_open(&reader, file)) {
+        while (annexb_reader_next(&reader)) {
+            nals.push_back(std::vector<uint8_t>(reader.nal, reader.nal + reader.nal_size));
+        }
+        annexb_reader_close(&reader);
+    }
+
+    if (file) {
+        fclose(file);
+    }
+    return nals;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 500000;
+    Random rnd = { 88172645463325252ULL };
+    size_t errors = checkBuffers(rnd, iterations);
+
+    printf("%zu random buffers: %zu errors\n", iterations, errors);
+
+    for (int kind = 0; kind < 5; kind++) {
+        std::vector<uint8_t> data = makeStream(rnd, kind);
+        NalList expected = referenceNals(data);
+
+        for (int mapped = 0; mapped < 2; mapped++) {
+            NalList nals = readerNals(data, mapped);
+            size_t count = nals.size() < expected.size() ? nals.size() : expected.size();
+            size_t differ = nals.size() != expected.size();
+
+            for (size_t i = 0; i < count; i++) {
+                differ += nals[i] != expected[i];
+            }
+
+            printf("stream %d, %zu bytes, %s reader: %zu NALs, %zu expected, %zu errors\n",
+                   kind, data.size(), mapped ? "mapped" : "window",
+                   nals.size(), expected.size(), differ);
+            errors += differ;
+        }
+    }
+
+    return errors ? 1 : 0;
+}
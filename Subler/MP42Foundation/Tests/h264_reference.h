@@ -0,0 +1,138 @@
+//
+//  h264_reference.h
+//  MP42Foundation Tests
+//
+//  The Annex B start code search and NAL reader of the raw H.264 importer
+//  before the batched scanner, unchanged, for the differential test and
+//  the benchmark.
+//
+
+#ifndef H264_REFERENCE_H
+#define H264_REFERENCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define H264_START_CODE 0x000001
+
+namespace reference {
+
+typedef struct nal_reader_t {
+    FILE *ifile;
+	int pipeFD;
+	int usePipe;
+    uint8_t *buffer;
+    uint32_t buffer_on;
+    uint32_t buffer_size;
+    uint32_t buffer_size_max;
+} nal_reader_t;
+
+static bool h264_is_start_code (const uint8_t *pBuf)
+{
+    if (pBuf[0] == 0 &&
+        pBuf[1] == 0 &&
+        ((pBuf[2] == 1) ||
+         ((pBuf[2] == 0) && pBuf[3] == 1))) {
+            return true;
+        }
+    return false;
+}
+
+static uint32_t h264_find_next_start_code (const uint8_t *pBuf,
+                                           uint32_t bufLen)
+{
+    uint32_t val, temp;
+    uint32_t offset;
+
+    offset = 0;
+    if (pBuf[0] == 0 &&
+        pBuf[1] == 0 &&
+        ((pBuf[2] == 1) ||
+         ((pBuf[2] == 0) && pBuf[3] == 1))) {
+            pBuf += 3;
+            offset = 3;
+        }
+    val = 0xffffffff;
+    while (offset < bufLen - 3) {
+        val <<= 8;
+        temp = val & 0xff000000;
+        val &= 0x00ffffff;
+        val |= *pBuf++;
+        offset++;
+        if (val == H264_START_CODE) {
+            if (temp == 0) return offset - 4;
+            return offset - 3;
+        }
+    }
+    return 0;
+}
+
+static bool RefreshReader (nal_reader_t *nal,
+                           uint32_t nal_start)
+{
+    uint32_t bytes_left;
+    uint32_t bytes_read;
+
+    if (nal_start != 0) {
+        if (nal_start > nal->buffer_size) {
+            nal->buffer_on = 0;
+        } else {
+            bytes_left = nal->buffer_size - nal_start;
+            if (bytes_left > 0) {
+                memmove(nal->buffer,
+                        nal->buffer + nal_start,
+                        bytes_left);
+                nal->buffer_on -= nal_start;
+            } else {
+                nal->buffer_on = 0;
+            }
+            nal->buffer_size = bytes_left;
+        }
+    } else {
+        if (feof(nal->ifile)) {
+            return false;
+        }
+        nal->buffer_size_max += 4096 * 4;
+        nal->buffer = (uint8_t *)realloc(nal->buffer, nal->buffer_size_max);
+    }
+    bytes_read = (uint32_t)fread(nal->buffer + nal->buffer_size,
+                                 1,
+                                 nal->buffer_size_max - nal->buffer_size,
+                                 nal->ifile);
+    if (bytes_read == 0) return false;
+    nal->buffer_size += bytes_read;
+    return true;
+}
+
+static bool LoadNal (nal_reader_t *nal)
+{
+    if (nal->buffer_on != 0 || nal->buffer_size == 0) {
+        if (RefreshReader(nal, nal->buffer_on) == false) {
+            if (nal->buffer_on >= nal->buffer_size) return false;
+            // continue
+        }
+    }
+    // find start code
+    uint32_t start;
+    if (h264_is_start_code(nal->buffer) == false) {
+        start = h264_find_next_start_code(nal->buffer,
+                                          nal->buffer_size);
+        RefreshReader(nal, start);
+    }
+    while ((start = h264_find_next_start_code(nal->buffer + 4,
+                                              nal->buffer_size - 4)) == 0) {
+        if (RefreshReader(nal, 0) == false) {
+            // end of file - use the last NAL
+            nal->buffer_on = nal->buffer_size;
+            return true;
+        }
+    }
+    nal->buffer_on = start + 4;
+    return true;
+}
+
+}
+
+#endif
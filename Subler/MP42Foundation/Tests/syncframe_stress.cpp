@@ -0,0 +1,318 @@
+//
+//  syncframe_stress.cpp
+//  MP42Foundation Tests
+//
+//  Stress test of the ADTS AAC and AC-3 frame readers: synthetic streams
+//  with junk between the frames and false sync words right before real
+//  frames, read by several importers at once, through the mapped and the
+//  block reader. Every frame must come out once and intact.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include "syncframe.h"
+#include "bitstream.h"
+#include "ac3_reader.h"
+
+namespace aac {
+#include "aac.inc"
+}
+
+enum StreamKind { StreamAAC, StreamAC3 };
+
+struct Random {
+    uint64_t state;
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (uint32_t)(state >> 16);
+    }
+
+    uint32_t below(uint32_t n) { return next() % n; }
+    bool chance(uint32_t percent) { return below(100) < percent; }
+};
+
+struct Stream {
+    StreamKind kind;
+    std::vector<uint8_t> data;
+    std::vector<std::pair<size_t, size_t>> frames;  // offset, size
+    size_t falseSyncs;
+};
+
+/* a byte that can't start a sync word of the stream */
+static uint8_t filler(Random &rnd, StreamKind kind)
+{
+    uint8_t sync = kind == StreamAAC ? 0xFF : 0x0B;
+    uint8_t byte;
+    do {
+        byte = (uint8_t)rnd.next();
+    } while (byte == sync);
+    return byte;
+}
+
+static void appendFiller(Stream &s, Random &rnd, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        s.data.push_back(filler(rnd, s.kind));
+    }
+}
+
+/* a sync word whose header is invalid, ending before the header would,
+ * so that the next frame starts inside it */
+static void appendFalseSync(Stream &s, Random &rnd)
+{
+    size_t start = s.data.size();
+
+    if (s.kind == StreamAAC) {
+        // frame length 0, shorter than any header
+        bool crc = rnd.chance(50);
+        size_t length = crc ? 6 + rnd.below(3) : 6;
+        s.data.push_back(0xFF);
+        s.data.push_back(crc ? 0xF0 : 0xF1);
+        s.data.push_back(filler(rnd, s.kind));
+        s.data.push_back(filler(rnd, s.kind) & 0xFC);
+        s.data.push_back(0x00);
+        s.data.push_back(filler(rnd, s.kind) & 0x1F);
+        appendFiller(s, rnd, length - 6);
+    } else {
+        // reserved sampling rate, or a frame size code past the table
+        size_t length = 5 + rnd.below(5);
+        s.data.push_back(0x0B);
+        s.data.push_back(0x77);
+        appendFiller(s, rnd, 2);
+        s.data.push_back(rnd.chance(50) ? (uint8_t)(0xC0 | rnd.below(38)) :
+                                          (uint8_t)((rnd.below(3) << 6) | (38 + rnd.below(26))));
+        appendFiller(s, rnd, length - 5);
+    }
+
+    s.falseSyncs += s.data.size() > start;
+}
+
+static void appendFrame(Stream &s, Random &rnd)
+{
+    size_t start = s.data.size();
+    size_t size;
+
+    if (s.kind == StreamAAC) {
+        bool crc = rnd.chance(30);
+        size_t header = crc ? 9 : 7;
+        size = header + rnd.below(4096);
+        s.data.push_back(0xFF);
+        s.data.push_back(0xF0 | (crc ? 0 : 1) | (rnd.chance(50) ? 8 : 0));
+        s.data.push_back(0x50 | (rnd.below(4) << 2));
+        s.data.push_back((uint8_t)(0x80 | (size >> 11)));
+        s.data.push_back((uint8_t)(size >> 3));
+        s.data.push_back((uint8_t)(((size & 7) << 5) | 0x1F));
+        s.data.push_back(0xFC);
+        appendFiller(s, rnd, size - 7);
+    } else {
+        uint32_t fscod = rnd.below(3);
+        uint32_t code = rnd.below(38);
+        size = ac3_frame_size(fscod, code);
+        s.data.push_back(0x0B);
+        s.data.push_back(0x77);
+        appendFiller(s, rnd, 2);
+        s.data.push_back((uint8_t)((fscod << 6) | code));
+        s.data.push_back(0x40 | rnd.below(8));
+        appendFiller(s, rnd, size - 6);
+    }
+
+    s.frames.push_back(std::make_pair(start, size));
+}
+
+static Stream makeStream(StreamKind kind, uint64_t seed, size_t bytes)
+{
+    Random rnd = { seed * 2654435761u + 1 };
+    Stream s;
+    s.kind = kind;
+    s.falseSyncs = 0;
+
+    if (rnd.chance(50)) {
+        appendFiller(s, rnd, 1 + rnd.below(3000));
+    }
+
+    while (s.data.size() < bytes) {
+        if (rnd.chance(10)) {
+            appendFalseSync(s, rnd);
+        }
+        appendFrame(s, rnd);
+        if (rnd.chance(5)) {
+            appendFiller(s, rnd, 1 + rnd.below(40));
+        }
+    }
+
+    // a cut last frame is dropped
+    if (rnd.chance(50)) {
+        const std::pair<size_t, size_t> &last = s.frames.back();
+        s.data.resize(last.first + 1 + rnd.below((uint32_t)last.second - 1));
+        s.frames.pop_back();
+    }
+
+    return s;
+}
+
+static FILE *openStream(const Stream &s, bool mapped)
+{
+    if (mapped) {
+        FILE *file = tmpfile();
+        if (file) {
+            fwrite(s.data.data(), 1, s.data.size(), file);
+            fflush(file);
+            rewind(file);
+        }
+        return file;
+    }
+
+    // no file descriptor, so the reader falls back to blocks
+    return fmemopen((void *)s.data.data(), s.data.size(), "rb");
+}
+
+/* reads the stream like the importer does, returns the number of errors */
+static size_t readStream(const Stream &s, bool mapped)
+{
+    size_t errors = 0, count = 0;
+    syncframe_reader_t reader;
+    aac::adts_parser_t parser = {};
+    parser.profileLevel = 4;
+    FILE *file = openStream(s, mapped);
+
+    if (file == NULL) {
+        return 1;
+    }
+
+    const std::pair<size_t, size_t> &first = s.frames.front();
+
+    if (s.kind == StreamAAC) {
+        if (!aac::GetFirstHeader(&parser, file) ||
+            memcmp(parser.firstHeader, &s.data[first.first], 7)) {
+            fprintf(stderr, "aac: wrong first header\n");
+            errors++;
+        }
+    }
+    else {
+        u_int8_t firstHeader[AC3_HEADER_SIZE];
+        if (!ac3_first_header(file, firstHeader) ||
+            memcmp(firstHeader, &s.data[first.first], AC3_HEADER_SIZE)) {
+            fprintf(stderr, "ac3: wrong first header\n");
+            errors++;
+        }
+    }
+
+    if (!syncframe_reader_open(&reader, file)) {
+        fclose(file);
+        return errors + 1;
+    }
+
+    for (;;) {
+        u_int8_t *frame;
+        size_t size;
+
+        if (s.kind == StreamAAC) {
+            u_int32_t frameSize;
+            frame = aac::LoadNextAacFrame(&parser, &reader, &frameSize, false);
+            size = frameSize;
+        }
+        else {
+            frame = ac3_load_frame(&reader, &size);
+        }
+
+        if (frame == NULL) {
+            break;
+        }
+
+        if (count >= s.frames.size()) {
+            errors++;
+        }
+        else {
+            const std::pair<size_t, size_t> &expected = s.frames[count];
+            if (size != expected.second || memcmp(frame, &s.data[expected.first], size)) {
+                if (errors < 4) {
+                    fprintf(stderr, "%s: frame %zu at %zu differs\n",
+                            s.kind == StreamAAC ? "aac" : "ac3", count, expected.first);
+                }
+                errors++;
+            }
+        }
+
+        free(frame);
+        count++;
+    }
+
+    if (count != s.frames.size()) {
+        fprintf(stderr, "%s: read %zu frames of %zu\n",
+                s.kind == StreamAAC ? "aac" : "ac3", count, s.frames.size());
+        errors++;
+    }
+
+    syncframe_reader_close(&reader);
+    fclose(file);
+
+    return errors;
+}
+
+struct Job {
+    const Stream *stream;
+    bool mapped;
+    size_t errors;
+};
+
+static void *runJob(void *arg)
+{
+    Job *job = (Job *)arg;
+    job->errors = readStream(*job->stream, job->mapped);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int streams = argc > 1 ? atoi(argv[1]) : 16;
+    int threads = argc > 2 ? atoi(argv[2]) : 8;
+    size_t frames = 0, falseSyncs = 0, errors = 0;
+
+    std::vector<Stream> tests;
+    for (int i = 0; i < streams; i++) {
+        tests.push_back(makeStream(i % 2 ? StreamAC3 : StreamAAC, i + 1, 1536 * 1024 + i * 4099));
+        frames += tests.back().frames.size();
+        falseSyncs += tests.back().falseSyncs;
+    }
+
+    // every stream through both readers, threads importers at a time
+    std::vector<Job> jobs;
+    for (const Stream &s : tests) {
+        jobs.push_back(Job{&s, true, 0});
+        jobs.push_back(Job{&s, false, 0});
+    }
+
+    for (size_t i = 0; i < jobs.size(); i += threads) {
+        std::vector<pthread_t> running;
+        for (size_t j = i; j < jobs.size() && j < i + threads; j++) {
+            pthread_t thread;
+            pthread_create(&thread, NULL, runJob, &jobs[j]);
+            running.push_back(thread);
+        }
+        for (pthread_t thread : running) {
+            pthread_join(thread, NULL);
+        }
+    }
+
+    for (const Job &job : jobs) {
+        errors += job.errors;
+    }
+
+    printf("%d streams, %zu frames, %zu false syncs: %zu errors\n",
+           streams, frames, falseSyncs, errors);
+
+    return errors ? 1 : 0;
+}